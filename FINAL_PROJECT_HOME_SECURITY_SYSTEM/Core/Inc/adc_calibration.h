@@ -0,0 +1,185 @@
+/*
+ * This module corrects the conversions of an ADC for the drift of the supply and of the temperature.
+ * Every ADC_CALIBRATION_PERIOD milliseconds the injected group converts, in turn, the internal reference VREFINT
+ * and the internal temperature sensor: an injected conversion is started by software between two scans of the
+ * regular group, so the stream of the DMA goes on, only delayed by a conversion, and it is taken only if the scan
+ * leaves room for it in the sample period. The end of the conversion is marked by its interrupt, and the main loop
+ * folds it into a moving average, so the correction moves a little at every conversion and nothing ever waits.
+ * VREFINT and the temperature sensor have been measured in the factory with a supply of 3.3 V: the ratio of the
+ * factory VREFINT to the measured one gives the supply, and scales the conversions to a supply of 3.3 V; the
+ * temperature scales them by a drift in ppm per degree around ADC_CALIBRATION_REFERENCE_TEMPERATURE.
+ * The correction is a single factor in Q16, so correcting a sample costs a multiply.
+ */
+
+#ifndef INC_ADC_CALIBRATION_H_
+#define INC_ADC_CALIBRATION_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "adc_stream.h"
+#include "timer_wheel.h"
+#include "shell.h"
+
+/* Time between two injected conversions in milliseconds, each reading is refreshed every two periods */
+#define ADC_CALIBRATION_PERIOD				(500U)
+
+/* Sampling time of the injected conversions, both the sensors need at least 10 microseconds */
+#define ADC_CALIBRATION_SAMPLING_TIME		(ADC_SAMPLETIME_480CYCLES)
+#define ADC_CALIBRATION_CYCLES				(480U + ADC_STREAM_CONVERSION_CYCLES)
+
+/* Weight of a conversion in the moving averages, 1 / 2^ADC_CALIBRATION_AVERAGE_SHIFT */
+#define ADC_CALIBRATION_AVERAGE_SHIFT		(3U)
+
+/* Fractional bits of the correction factor */
+#define ADC_CALIBRATION_FACTOR_SHIFT		(16U)
+
+/* Factory measures, with a supply of 3.3 V: VREFINT, and the temperature sensor at 30 and at 110 degrees */
+#define ADC_CALIBRATION_VREFINT_CAL			(*(const uint16_t*) 0x1FFF7A2AUL)
+#define ADC_CALIBRATION_TS_CAL1				(*(const uint16_t*) 0x1FFF7A2CUL)
+#define ADC_CALIBRATION_TS_CAL2				(*(const uint16_t*) 0x1FFF7A2EUL)
+#define ADC_CALIBRATION_SUPPLY				(3300U)
+#define ADC_CALIBRATION_TS_CAL1_TEMPERATURE	(300)
+#define ADC_CALIBRATION_TS_CAL2_TEMPERATURE	(1100)
+
+/* Range of a sane factory VREFINT, from 1.05 V to 1.35 V, an erased value leaves the conversions uncorrected */
+#define ADC_CALIBRATION_VREFINT_MIN			(1303U)
+#define ADC_CALIBRATION_VREFINT_MAX			(1675U)
+
+/* Temperature in tenths of degree at which the drift gives no correction */
+#define ADC_CALIBRATION_REFERENCE_TEMPERATURE	(250)
+
+/* Drift of the conversions in ppm per degree, corrected with the opposite sign */
+#define ADC_CALIBRATION_DEFAULT_DRIFT		(0)
+
+/* Internal channels converted by the injected group, in turn */
+enum {
+	ADC_CALIBRATION_VREFINT,
+	ADC_CALIBRATION_TEMPERATURE,
+	ADC_CALIBRATION_CHANNELS_N
+};
+
+/*
+ * @brief	This struct represents the correction of the conversions of an ADC.
+ * @param	stream		the stream of the regular group, the injected conversions must fit in its sample period
+ * @param	hadc		the ADC of the stream
+ * @param	timer		the periodic timer of the injected conversions
+ * @param	valid		TRUE if the factory measures are sane, otherwise no conversion is corrected
+ * @param	channel		the internal channel of the next injected conversion
+ * @param	due			TRUE when the period expired, set by the timer
+ * @param	ready		TRUE when an injected conversion is completed, set by its interrupt
+ * @param	result		the last injected conversion
+ * @param	averages	the moving averages of the channels, multiplied by 2^ADC_CALIBRATION_AVERAGE_SHIFT
+ * @param	primed		mask of the channels with an average
+ * @param	supply		the supply of the ADC in millivolts
+ * @param	temperature	the temperature of the chip in tenths of degree
+ * @param	drift		the drift of the conversions in ppm per degree
+ * @param	factor		the correction of the conversions in Q16, 1 until both the channels have an average
+ * @param	updates		number of updates of the factor
+ * @param	skipped		number of conversions not taken because the scan left no room for them
+ */
+typedef struct {
+	TAdc_stream *stream;
+	ADC_HandleTypeDef *hadc;
+	TTimer timer;
+	bool valid;
+	uint8_t channel;
+	volatile bool due;
+	volatile bool ready;
+	volatile uint16_t result;
+	uint32_t averages[ADC_CALIBRATION_CHANNELS_N];
+	uint8_t primed;
+	uint16_t supply;
+	int16_t temperature;
+	int32_t drift;
+	uint32_t factor;
+	uint32_t updates;
+	uint32_t skipped;
+} TAdc_calibration;
+
+/*
+ * @fn		void adc_calibration_init(TAdc_calibration *calibration, TAdc_stream *stream)
+ * @brief	Checks the factory measures and starts the timer of the injected conversions.
+ * 			The timer wheel must be initialized
+ * @param	calibration		pointer to the TAdc_calibration structure to initialize
+ * @param	stream			the stream of the ADC, already initialized
+ */
+void adc_calibration_init(TAdc_calibration *calibration, TAdc_stream *stream);
+
+/*
+ * @fn		void adc_calibration_set_drift(TAdc_calibration *calibration, int32_t drift)
+ * @brief	Sets the drift of the conversions with the temperature, applied from the next update of the factor
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	drift			the drift in ppm per degree, positive if the conversions grow with the temperature
+ */
+void adc_calibration_set_drift(TAdc_calibration *calibration, int32_t drift);
+
+/*
+ * @fn		void adc_calibration_complete(TAdc_calibration *calibration, ADC_HandleTypeDef *hadc)
+ * @brief	Stores the injected conversion. It must be called by HAL_ADCEx_InjectedConvCpltCallback
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	hadc			the ADC of the callback
+ */
+void adc_calibration_complete(TAdc_calibration *calibration, ADC_HandleTypeDef *hadc);
+
+/*
+ * @fn		void adc_calibration_process(TAdc_calibration *calibration)
+ * @brief	Folds the completed conversion into the factor, and starts the next one when the period expired.
+ * 			It must be called by the main loop
+ * @param	calibration		pointer to the TAdc_calibration structure
+ */
+void adc_calibration_process(TAdc_calibration *calibration);
+
+/*
+ * @fn		bool adc_calibration_is_pending(TAdc_calibration *calibration)
+ * @brief	Tells if a conversion is waiting to be started or folded by adc_calibration_process
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @retval	TRUE if adc_calibration_process has something to do, FALSE otherwise
+ */
+bool adc_calibration_is_pending(TAdc_calibration *calibration);
+
+/*
+ * @fn		uint16_t adc_calibration_apply(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale)
+ * @brief	Corrects a conversion, or a value in the same unit
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	value			the value to correct
+ * @param	full_scale		the greatest value, the corrected one is limited to it
+ * @retval	the corrected value
+ */
+uint16_t adc_calibration_apply(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale);
+
+/*
+ * @fn		void adc_calibration_apply_block(TAdc_calibration *calibration, const uint16_t *values, uint16_t *corrected,
+ * 				uint16_t length, uint16_t full_scale)
+ * @brief	Corrects a block of conversions
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	values			the values to correct
+ * @param	corrected		the corrected values, it can be the same array as the values
+ * @param	length			number of values
+ * @param	full_scale		the greatest value, the corrected ones are limited to it
+ */
+void adc_calibration_apply_block(TAdc_calibration *calibration, const uint16_t *values, uint16_t *corrected,
+		uint16_t length, uint16_t full_scale);
+
+/*
+ * @fn		uint16_t adc_calibration_to_raw(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale)
+ * @brief	Returns the conversion that gives a corrected value, as the thresholds of the analog watchdog
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	value			the corrected value
+ * @param	full_scale		the greatest value, the conversion is limited to it
+ * @retval	the conversion
+ */
+uint16_t adc_calibration_to_raw(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale);
+
+/*
+ * @fn		void adc_calibration_register_commands(TAdc_calibration *calibration, TShell *shell)
+ * @brief	Adds to the shell the command cal [drift], that shows the supply, the temperature and the correction,
+ * 			and optionally changes the drift
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	shell			pointer to the TShell structure
+ */
+void adc_calibration_register_commands(TAdc_calibration *calibration, TShell *shell);
+
+#endif /* INC_ADC_CALIBRATION_H_ */
@@ -0,0 +1,263 @@
+/*
+ * This module streams the conversions of an ADC into a circular buffer, with the DMA.
+ * Every scan of the channels is started in hardware by the TRGO of a timer, at the sample rate, so a sample costs
+ * no code at all. The DMA fills the two halves of the buffer in turn, with the samples of the channels interleaved:
+ * when a half is full, the interrupt of the DMA marks its block as ready, and the main loop hands the samples of every
+ * started channel to the consumer of the channel, while the DMA fills the other half.
+ * A block still not consumed when the DMA completes the other half is counted as an overrun.
+ * The ADC runs while at least one channel is started.
+ * A channel can be oversampled by 4 or 16: its samples are summed in groups and decimated, giving 1 or 2 more bits
+ * of resolution and less noise, at a quarter or a sixteenth of the sample rate. The time spent decimating, and the one
+ * spent on every block by the consumers, are measured with the DWT cycle counter, enabled by latency_init():
+ * a block must be consumed before the DMA fills the other half, its budget is the period of a block.
+ * A tap can receive every block as the DMA wrote it, all the channels interleaved and before any decimation.
+ */
+
+#ifndef INC_ADC_STREAM_H_
+#define INC_ADC_STREAM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+#define ADC_STREAM_OK				(0)
+#define ADC_STREAM_ERR_INVALID		(-1)
+#define ADC_STREAM_ERR_HAL			(-2)
+
+/* Samples of a block for each channel, the buffer holds two blocks */
+#define ADC_STREAM_BLOCK_SIZE		(32U)
+
+/* Channels of a scan */
+#define ADC_STREAM_MAX_CHANNELS		(8U)
+
+/* Sampling time of a new channel */
+#define ADC_STREAM_SAMPLING_TIME	(ADC_SAMPLETIME_3CYCLES)
+
+/* The ADC counts at 21 MHz, PCLK2 divided by 2, and a conversion lasts the sampling time and 12 more cycles */
+#define ADC_STREAM_ADC_FREQUENCY	(21000000UL)
+#define ADC_STREAM_CONVERSION_CYCLES	(12U)
+
+/* Resolution of the conversions, and longest oversampling of a channel, that must divide ADC_STREAM_BLOCK_SIZE */
+#define ADC_STREAM_RESOLUTION		(12U)
+#define ADC_STREAM_MAX_OVERSAMPLING	(16U)
+
+/* The trigger timer counts at 1 MHz: MX_TIM2_Init divides by 42 the 42 MHz clock of the APB1 timers */
+#define ADC_STREAM_TIMER_FREQUENCY	(1000000UL)
+
+/* Sample rates of each channel in Hz. The default one gives a block every 50 milliseconds */
+#define ADC_STREAM_MIN_RATE			(20U)
+#define ADC_STREAM_MAX_RATE			(50000U)
+#define ADC_STREAM_DEFAULT_RATE		(640U)
+
+/*
+ * @brief	Function receiving the blocks of samples of a channel, from the main loop.
+ * 			The samples are a copy, valid only during the call.
+ */
+typedef void (*TAdc_stream_consumer)(void *context, const uint16_t *samples, uint16_t length);
+
+/*
+ * @brief	This struct represents a stream of conversions of an ADC.
+ * @param	hadc		the ADC, with its DMA stream linked to it
+ * @param	htim		the timer triggering the conversions with its TRGO
+ * @param	buffer		the two blocks written by the DMA, the samples of a scan are consecutive
+ * @param	rate		the sample rate of each channel in Hz
+ * @param	channels_n	number of channels of the scan
+ * @param	channels	the channels of the ADC, in the order of the scan
+ * @param	consumers	the functions receiving the blocks of every channel, NULL to drop them
+ * @param	contexts	the arguments of the consumers
+ * @param	sampling_times	the sampling times of the channels, as ADC_SAMPLETIME_3CYCLES
+ * @param	oversampling_shifts	the extra bits of the channels: 4^shift samples are decimated into one
+ * @param	started		mask of the started channels, the ADC runs while it is not empty
+ * @param	ready		mask of the halves of the buffer filled and not consumed yet, set by the DMA interrupt
+ * @param	next		half of the buffer the consumer expects next, the DMA fills them in turn
+ * @param	running		TRUE while the timer and the DMA are running
+ * @param	blocks		number of blocks filled by the DMA
+ * @param	overruns	number of blocks overwritten before being consumed
+ * @param	decimation_cycles	cycles spent decimating the oversampled channels
+ * @param	decimated	number of samples given by the decimation
+ * @param	block_cycles	cycles spent on the last block, decimation and consumers
+ * @param	block_cycles_max	most cycles spent on a block since the last change of the rate
+ * @param	late		number of blocks that took longer than the period of a block
+ * @param	tap			the function receiving the raw blocks, NULL if there is none
+ * @param	tap_context	the argument of the tap
+ */
+typedef struct {
+	ADC_HandleTypeDef *hadc;
+	TIM_HandleTypeDef *htim;
+	uint16_t buffer[2 * ADC_STREAM_BLOCK_SIZE * ADC_STREAM_MAX_CHANNELS];
+	uint32_t rate;
+	uint8_t channels_n;
+	uint32_t channels[ADC_STREAM_MAX_CHANNELS];
+	TAdc_stream_consumer consumers[ADC_STREAM_MAX_CHANNELS];
+	void *contexts[ADC_STREAM_MAX_CHANNELS];
+	uint32_t sampling_times[ADC_STREAM_MAX_CHANNELS];
+	uint8_t oversampling_shifts[ADC_STREAM_MAX_CHANNELS];
+	uint8_t started;
+	volatile uint8_t ready;
+	uint8_t next;
+	bool running;
+	uint32_t blocks;
+	uint32_t overruns;
+	uint32_t decimation_cycles;
+	uint32_t decimated;
+	uint32_t block_cycles;
+	uint32_t block_cycles_max;
+	uint32_t late;
+	TAdc_stream_consumer tap;
+	void *tap_context;
+} TAdc_stream;
+
+/*
+ * @fn		int adc_stream_init(TAdc_stream *stream, ADC_HandleTypeDef *hadc, TIM_HandleTypeDef *htim)
+ * @brief	Initializes the stream at ADC_STREAM_DEFAULT_RATE, without starting the ADC and the timer.
+ * 			The channels are added with adc_stream_add_channel
+ * @param	stream		pointer to the TAdc_stream structure to initialize
+ * @param	hadc		the ADC, as configured by MX_ADC1_Init: a scan on the rising edges of the TRGO of the timer,
+ * 						with its DMA stream in circular mode
+ * @param	htim		a timer on the APB1 bus, not used by anything else, as configured by MX_TIM2_Init:
+ * 						counting at ADC_STREAM_TIMER_FREQUENCY, with its auto-reload preloaded and its update on TRGO
+ * @retval	ADC_STREAM_ERR_INVALID if the ADC is not triggered in hardware or its DMA is not circular,
+ * 			ADC_STREAM_OK otherwise
+ */
+int adc_stream_init(TAdc_stream *stream, ADC_HandleTypeDef *hadc, TIM_HandleTypeDef *htim);
+
+/*
+ * @fn		int adc_stream_add_channel(TAdc_stream *stream, uint32_t channel, TAdc_stream_consumer consumer,
+ * 				void *context)
+ * @brief	Adds a channel at the end of the scan, with ADC_STREAM_SAMPLING_TIME and without oversampling.
+ * 			It must be called while no channel is started
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	channel		the channel of the ADC, as ADC_CHANNEL_0, with its pin already in analog mode
+ * @param	consumer	the function receiving the blocks of the channel, NULL to drop them
+ * @param	context		the argument of the function
+ * @retval	the index of the channel in the scan, ADC_STREAM_ERR_INVALID if the scan is full or running,
+ * 			ADC_STREAM_ERR_HAL if the HAL refused the configuration
+ */
+int adc_stream_add_channel(TAdc_stream *stream, uint32_t channel, TAdc_stream_consumer consumer, void *context);
+
+/*
+ * @fn		void adc_stream_set_tap(TAdc_stream *stream, TAdc_stream_consumer tap, void *context)
+ * @brief	Hands every block to a function before the consumers, as the DMA wrote it: ADC_STREAM_BLOCK_SIZE scans
+ * 			of channels_n samples, not decimated. The tap is called even for the channels not started
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	tap			the function receiving the blocks, NULL to remove it
+ * @param	context		the argument of the function
+ */
+void adc_stream_set_tap(TAdc_stream *stream, TAdc_stream_consumer tap, void *context);
+
+/*
+ * @fn		int adc_stream_set_channel(TAdc_stream *stream, uint8_t index, uint32_t sampling_time, uint8_t oversampling)
+ * @brief	Changes the sampling time and the oversampling of a channel, even while the stream is running.
+ * 			The consumer of an oversampled channel gets ADC_STREAM_BLOCK_SIZE / oversampling samples per block,
+ * 			see adc_stream_get_bits
+ * @param	stream			pointer to the TAdc_stream structure
+ * @param	index			the index of the channel in the scan
+ * @param	sampling_time	the sampling time, as ADC_SAMPLETIME_3CYCLES
+ * @param	oversampling	samples decimated into one, 1, 4 or 16
+ * @retval	ADC_STREAM_ERR_INVALID if a value is not allowed or the scan would last longer than the sample period,
+ * 			ADC_STREAM_ERR_HAL if the HAL refused the configuration, ADC_STREAM_OK otherwise
+ */
+int adc_stream_set_channel(TAdc_stream *stream, uint8_t index, uint32_t sampling_time, uint8_t oversampling);
+
+/*
+ * @fn		uint8_t adc_stream_get_bits(TAdc_stream *stream, uint8_t index)
+ * @brief	Returns the resolution of the samples of a channel: ADC_STREAM_RESOLUTION, one more bit with
+ * 			the oversampling by 4 and two more with the one by 16. The full scale is the one of the ADC shifted
+ * 			to the left by the extra bits
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ * @retval	the bits of the samples
+ */
+uint8_t adc_stream_get_bits(TAdc_stream *stream, uint8_t index);
+
+/*
+ * @fn		uint32_t adc_stream_get_spare_cycles(TAdc_stream *stream)
+ * @brief	Returns the cycles of the ADC left free in every sample period after the scan of all the channels,
+ * 			the room for a conversion of the injected group, that delays the scan
+ * @param	stream		pointer to the TAdc_stream structure
+ * @retval	the cycles of the ADC, 0 if the scan takes the whole period
+ */
+uint32_t adc_stream_get_spare_cycles(TAdc_stream *stream);
+
+/*
+ * @fn		int adc_stream_set_rate(TAdc_stream *stream, uint32_t rate)
+ * @brief	Changes the sample rate, even while the stream is running
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	rate		the sample rate in Hz, from ADC_STREAM_MIN_RATE to ADC_STREAM_MAX_RATE
+ * @retval	ADC_STREAM_ERR_INVALID if the rate is out of range or the scan would last longer than its period,
+ * 			ADC_STREAM_OK otherwise
+ */
+int adc_stream_set_rate(TAdc_stream *stream, uint32_t rate);
+
+/*
+ * @fn		void adc_stream_start(TAdc_stream *stream, uint8_t index)
+ * @brief	Starts handing the blocks of a channel to its consumer, and the DMA and the timer if they are not running
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ */
+void adc_stream_start(TAdc_stream *stream, uint8_t index);
+
+/*
+ * @fn		void adc_stream_stop(TAdc_stream *stream, uint8_t index)
+ * @brief	Stops handing the blocks of a channel to its consumer. After the last channel the timer and the DMA stop,
+ * 			and the blocks not consumed yet are dropped
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ */
+void adc_stream_stop(TAdc_stream *stream, uint8_t index);
+
+/*
+ * @fn		bool adc_stream_is_started(TAdc_stream *stream, uint8_t index)
+ * @brief	Tells if a channel is started
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ * @retval	TRUE if the channel is started, FALSE otherwise
+ */
+bool adc_stream_is_started(TAdc_stream *stream, uint8_t index);
+
+/*
+ * @fn		void adc_stream_half_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc)
+ * @brief	Marks the first block as ready. It must be called by HAL_ADC_ConvHalfCpltCallback
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	hadc		the ADC of the callback
+ */
+void adc_stream_half_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc);
+
+/*
+ * @fn		void adc_stream_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc)
+ * @brief	Marks the second block as ready. It must be called by HAL_ADC_ConvCpltCallback
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	hadc		the ADC of the callback
+ */
+void adc_stream_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc);
+
+/*
+ * @fn		void adc_stream_process(TAdc_stream *stream)
+ * @brief	Hands the ready blocks to the consumers of the started channels, the oldest first.
+ * 			It must be called by the main loop
+ * @param	stream		pointer to the TAdc_stream structure
+ */
+void adc_stream_process(TAdc_stream *stream);
+
+/*
+ * @fn		bool adc_stream_has_block(TAdc_stream *stream)
+ * @brief	Tells if a block is waiting for adc_stream_process
+ * @param	stream		pointer to the TAdc_stream structure
+ * @retval	TRUE if a block is ready, FALSE otherwise
+ */
+bool adc_stream_has_block(TAdc_stream *stream);
+
+/*
+ * @fn		void adc_stream_register_commands(TAdc_stream *stream, TShell *shell)
+ * @brief	Adds to the shell the command adc [rate], that shows the statistics of the stream
+ * 			and optionally changes its sample rate, and the command adcch <index> <cycles> <oversampling>,
+ * 			that changes the sampling time and the oversampling of a channel
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	shell		pointer to the TShell structure
+ */
+void adc_stream_register_commands(TAdc_stream *stream, TShell *shell);
+
+#endif /* INC_ADC_STREAM_H_ */
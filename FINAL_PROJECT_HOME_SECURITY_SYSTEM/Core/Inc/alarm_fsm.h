@@ -0,0 +1,88 @@
+/*
+ * This module executes the alarm state machine of the sensors from a table.
+ * Every sensor type describes its behavior with a constant table indexed by state and event: each cell holds
+ * the next state and the list of the actions to execute, as indices in the table of the actions of the sensor type.
+ * alarm_fsm_dispatch() is the only interpreter of the tables, so a new sensor type needs only its tables.
+ * Every transition is also reported to an optional observer, that sees the state changes of all the sensors.
+ */
+
+#ifndef INC_ALARM_FSM_H_
+#define INC_ALARM_FSM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bool.h"
+#include "sensors_state.h"
+
+#define ALARM_STATES_N			(4U)
+#define ALARM_EVENTS_N			(5U)
+
+/* Maximum number of actions of a transition */
+#define ALARM_FSM_MAX_ACTIONS	(4U)
+
+/* Next state of the events ignored in a state: the state doesn't change and no action is executed */
+#define ALARM_FSM_IGNORE		(0xFFU)
+
+/* Index terminating the list of the actions of a transition, so the index 0 of the table of the actions is never used */
+#define ALARM_ACTION_END		(0U)
+
+typedef enum {
+	ALARM_EVENT_ACTIVATE,		/* the user enables the sensor */
+	ALARM_EVENT_DEACTIVATE,		/* the user disables the sensor */
+	ALARM_EVENT_TRIGGER,		/* an intruder has been detected */
+	ALARM_EVENT_CLEAR,			/* the intruder is not detected anymore */
+	ALARM_EVENT_TIMEOUT			/* the delay or the duration of the alarm has passed */
+} TAlarmEvent;
+
+/* Action executed in a transition, on the sensor passed to alarm_fsm_dispatch() */
+typedef void (*TAlarm_action)(void *sensor);
+
+/*
+ * @brief	Function called after every transition, before its actions
+ * @param	sensor		the sensor passed to alarm_fsm_dispatch()
+ * @param	previous	the state before the event
+ * @param	state		the state after the event
+ */
+typedef void (*TAlarm_observer)(void *sensor, TAlarmState previous, TAlarmState state);
+
+/*
+ * @brief	This struct represents a cell of the table of the transitions.
+ * @param	next_state	the state after the event, ALARM_FSM_IGNORE if the event is ignored
+ * @param	actions		indices of the actions to execute in order, terminated by ALARM_ACTION_END if shorter
+ */
+typedef struct {
+	uint8_t next_state;
+	uint8_t actions[ALARM_FSM_MAX_ACTIONS];
+} TAlarm_transition;
+
+/*
+ * @brief	This struct represents the state machine of a sensor type.
+ * @param	transitions	the table of the transitions, indexed by state and event
+ * @param	actions		the table of the actions, indexed by the values in the transitions
+ */
+typedef struct {
+	const TAlarm_transition (*transitions)[ALARM_EVENTS_N];
+	const TAlarm_action *actions;
+} TAlarm_fsm;
+
+/*
+ * @fn		bool alarm_fsm_dispatch(const TAlarm_fsm *fsm, TAlarmState *state, TAlarmEvent event, void *sensor)
+ * @brief	Executes the transition of an event. The new state is stored before the actions are executed,
+ * 			so an action can dispatch another event on the same sensor.
+ * @param	fsm		the state machine of the sensor type
+ * @param	state	pointer to the state of the sensor
+ * @param	event	the event to execute
+ * @param	sensor	pointer passed to the actions as it is
+ * @retval	TRUE if the event caused a transition, FALSE if it has been ignored
+ */
+bool alarm_fsm_dispatch(const TAlarm_fsm *fsm, TAlarmState *state, TAlarmEvent event, void *sensor);
+
+/*
+ * @fn		void alarm_fsm_set_observer(TAlarm_observer observer)
+ * @brief	Sets the function called after every transition of every sensor
+ * @param	observer	the function, NULL to remove it
+ */
+void alarm_fsm_set_observer(TAlarm_observer observer);
+
+#endif /* INC_ALARM_FSM_H_ */
@@ -2,6 +2,7 @@
  * This module contains methods to handle with the console, representing it with a singleton.
  * To instantiate a console, just call console_init() with the UART interface you want to use to communicate.
  * To print messages, just call the proper methods, without specifying again the UART interface.
+ * While the UART carries something else, as a binary stream, the console can be muted: the messages are dropped.
  */
 
 #ifndef INC_CONSOLE_H_
@@ -24,10 +25,12 @@
  * @param	huart	pointer to the UART_HandleTypeDef structure
  * 					representing the UART interface used for communication
  * @param	ready	a boolean value set to TRUE if the console is ready for use, FALSE otherwise
+ * @param	muted	a boolean value set to TRUE if the messages must be dropped, FALSE otherwise
  */
 typedef struct {
 	UART_HandleTypeDef *huart;
 	bool ready;
+	bool muted;
 } TConsole;
 
 /*
@@ -65,6 +68,14 @@ void clear_console();
  */
 void free_console();
 
+/*
+ * @fn		void mute_console(bool muted)
+ * @brief	Drops the next messages, or prints them again.
+ * 			The console must be free before it is muted, so no message is left halfway
+ * @param	muted	TRUE to drop the messages, FALSE to print them
+ */
+void mute_console(bool muted);
+
 /*
  * @fn		static void print_message(const char *message)
  * @brief	Prints a string on the console.
@@ -72,6 +83,9 @@ void free_console();
  * @param	message		string to print
  */
 static void print_message(const char *message) {
+	if (get_console(NULL)->muted) {
+		return;
+	}
 	HAL_UART_Transmit_DMA(get_console(NULL)->huart, (uint8_t*) message, strlen(message));
 }
 
@@ -0,0 +1,139 @@
+/*
+ * This module correlates the detections of different sensors to compute a confidence-weighted alarm level.
+ * It observes the transitions of all the sensors: a sensor entering the delayed state is a detection, stamped with
+ * the SysTick time and with the zones of the sensor in the registry. Two kinds of rules are evaluated on the detections:
+ * 		a sequence, a detection in some zones followed by a detection in other zones within a window,
+ * 			e.g. "barrier break followed by area motion within 10 s"
+ * 		a count, detections of different sensors of some zones within a window, e.g. "two zones within 2 s"
+ * Every rule keeps its own sliding window, updated only by the detections of its zones: the rules are indexed by zone,
+ * so a detection touches only the rules that can match it. A matched rule adds its weight to the alarm level,
+ * that decays linearly with the time and is computed when it is read.
+ */
+
+#ifndef INC_CORRELATION_H_
+#define INC_CORRELATION_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "sensors_state.h"
+#include "alarm_fsm.h"
+#include "sensor_registry.h"
+#include "logger.h"
+#include "shell.h"
+
+#define CORRELATION_ERR_INVALID		(-1)
+#define CORRELATION_ERR_FULL		(-2)
+
+/* Maximum number of rules, up to 255, one bit of the masks of the zones for each rule */
+#ifndef CORRELATION_RULES_N
+#define CORRELATION_RULES_N			(32U)
+#endif
+
+/* Words of 32 bits of the masks of the rules */
+#define CORRELATION_RULE_WORDS		((CORRELATION_RULES_N + 31U) / 32U)
+
+/* Number of zone bits, the same bits as USER_ZONE_AREA, USER_ZONE_BARRIER ... */
+#define CORRELATION_ZONES_N			(16U)
+
+/* Maximum number of detections a count rule can require */
+#define CORRELATION_COUNT_MAX		(4U)
+
+/* The alarm level is in [0, CORRELATION_LEVEL_MAX] and loses CORRELATION_LEVEL_DECAY points every second */
+#define CORRELATION_LEVEL_MAX		(100U)
+#define CORRELATION_LEVEL_DECAY		(10U)
+
+/* When the alarm level reaches this value a correlated alarm is logged */
+#define CORRELATION_ALARM_LEVEL		(75U)
+
+typedef enum {
+	CORRELATION_RULE_SEQUENCE, CORRELATION_RULE_COUNT
+} TCorrelation_kind;
+
+/*
+ * @brief	This struct represents a detection remembered by a rule.
+ * @param	sensor	index of the sensor in the registry
+ * @param	time	SysTick time of the detection
+ */
+typedef struct {
+	uint8_t sensor;
+	uint32_t time;
+} TCorrelation_detection;
+
+/*
+ * @brief	This struct represents a rule and its sliding window.
+ * @param	name		name shown in the log and by the command correlation
+ * @param	kind		sequence or count
+ * @param	first		sequence: zones of the first detection. count: zones of the detections
+ * @param	then		sequence: zones of the second detection. count: unused
+ * @param	count		count: number of detections of different sensors required
+ * @param	window		milliseconds within the detections must happen
+ * @param	weight		points added to the alarm level when the rule matches
+ * @param	recent		the last detections of the window, the oldest first. A sequence keeps only the first detection
+ * @param	recent_n	number of detections in recent
+ * @param	matches		number of times the rule matched
+ */
+typedef struct {
+	const char *name;
+	TCorrelation_kind kind;
+	uint16_t first;
+	uint16_t then;
+	uint8_t count;
+	uint32_t window;
+	uint8_t weight;
+	TCorrelation_detection recent[CORRELATION_COUNT_MAX];
+	uint8_t recent_n;
+	uint32_t matches;
+} TCorrelation_rule;
+
+/*
+ * @fn		void correlation_init()
+ * @brief	Removes all the rules, clears the alarm level and starts observing the transitions of the sensors
+ */
+void correlation_init();
+
+/*
+ * @fn		int correlation_add_sequence(const char *name, uint16_t first, uint16_t then, uint32_t window, uint8_t weight)
+ * @brief	Adds a rule matching a detection in the zones first followed, within window milliseconds,
+ * 			by a detection of another sensor in the zones then
+ * @param	name	name of the rule, it must be a constant string
+ * @param	first	mask of the zones of the first detection
+ * @param	then	mask of the zones of the second detection
+ * @param	window	maximum milliseconds between the two detections
+ * @param	weight	points added to the alarm level when the rule matches
+ * @retval	CORRELATION_ERR_INVALID if a mask is empty, CORRELATION_ERR_FULL if there is no room for the rule,
+ * 			the index of the rule otherwise
+ */
+int correlation_add_sequence(const char *name, uint16_t first, uint16_t then, uint32_t window, uint8_t weight);
+
+/*
+ * @fn		int correlation_add_count(const char *name, uint16_t zones, uint8_t count, uint32_t window, uint8_t weight)
+ * @brief	Adds a rule matching detections of count different sensors of the given zones within window milliseconds
+ * @param	name	name of the rule, it must be a constant string
+ * @param	zones	mask of the zones of the detections
+ * @param	count	number of sensors, from 2 to CORRELATION_COUNT_MAX
+ * @param	window	maximum milliseconds between the first and the last detection
+ * @param	weight	points added to the alarm level when the rule matches
+ * @retval	CORRELATION_ERR_INVALID if the mask is empty or count is out of range,
+ * 			CORRELATION_ERR_FULL if there is no room for the rule, the index of the rule otherwise
+ */
+int correlation_add_count(const char *name, uint16_t zones, uint8_t count, uint32_t window, uint8_t weight);
+
+/*
+ * @fn		uint8_t correlation_get_level()
+ * @brief	Returns the current alarm level
+ * @retval	the level, from 0 to CORRELATION_LEVEL_MAX
+ */
+uint8_t correlation_get_level();
+
+/*
+ * @fn		void correlation_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command correlation, that shows the alarm level and the matches of every rule
+ * @param	shell	pointer to the TShell structure
+ */
+void correlation_register_commands(TShell *shell);
+
+#endif /* INC_CORRELATION_H_ */
@@ -0,0 +1,87 @@
+/*
+ * This module dispatches the external interrupts to the modules owning the lines.
+ * Every module registers a handler for its pins during the initialization, then the irq handlers of the EXTI
+ * vectors just call exti_dispatcher_dispatch() with the lines they serve: the pending register is read and
+ * cleared once, and the handlers of the pending lines are called through a table indexed by the line number.
+ * The time from the dispatch to each handler is measured with the DWT cycle counter, that is enabled by latency_init().
+ */
+
+#ifndef INC_EXTI_DISPATCHER_H_
+#define INC_EXTI_DISPATCHER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+#define EXTI_DISPATCHER_OK				(0)
+#define EXTI_DISPATCHER_ERR_INVALID		(-1)
+#define EXTI_DISPATCHER_ERR_BUSY		(-2)
+
+/* Number of EXTI lines connected to the GPIO pins */
+#define EXTI_DISPATCHER_LINES_N			(16U)
+
+/* Lines served by the shared vectors */
+#define EXTI_DISPATCHER_LINES_9_5		(0x03E0U)
+#define EXTI_DISPATCHER_LINES_15_10		(0xFC00U)
+
+/*
+ * @brief	Function executed when an EXTI line is pending. The pending bit is already cleared.
+ * @param	pin			the pin of the line, e.g. GPIO_PIN_12
+ * @param	context		the context given when the handler has been registered
+ */
+typedef void (*TEXTI_handler)(uint16_t pin, void *context);
+
+/*
+ * @brief	This struct represents an EXTI line.
+ * @param	handler			the function executed when the line is pending, NULL if the line is not used
+ * @param	context			pointer passed to handler as it is
+ * @param	count			number of times the handler has been executed
+ * @param	latency_sum		sum of the cycles from the dispatch to the handler, to compute the average
+ * @param	latency_max		maximum number of cycles from the dispatch to the handler
+ */
+typedef struct {
+	TEXTI_handler handler;
+	void *context;
+	uint32_t count;
+	uint64_t latency_sum;
+	uint32_t latency_max;
+} TEXTI_line;
+
+/*
+ * @fn		void exti_dispatcher_init()
+ * @brief	Removes all the handlers. It must be called before any module registers its handlers.
+ */
+void exti_dispatcher_init();
+
+/*
+ * @fn		int exti_dispatcher_register(uint16_t pin, TEXTI_handler handler, void *context)
+ * @brief	Registers the handler of the line of a pin
+ * @param	pin			the pin, one of GPIO_PIN_0 ... GPIO_PIN_15
+ * @param	handler		the function executed when the line is pending
+ * @param	context		pointer passed to handler as it is
+ * @retval	EXTI_DISPATCHER_ERR_INVALID if pin is not a single pin or handler is NULL,
+ * 			EXTI_DISPATCHER_ERR_BUSY if the line already has a handler,
+ * 			EXTI_DISPATCHER_OK otherwise
+ */
+int exti_dispatcher_register(uint16_t pin, TEXTI_handler handler, void *context);
+
+/*
+ * @fn		void exti_dispatcher_dispatch(uint32_t lines)
+ * @brief	Clears the pending lines among the given ones and executes their handlers, from the lowest line.
+ * 			Should be called only by the irq handlers of the EXTI vectors.
+ * @param	lines	mask of the lines served by the calling vector
+ */
+void exti_dispatcher_dispatch(uint32_t lines);
+
+/*
+ * @fn		void exti_dispatcher_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command exti, that shows how many times each line has been dispatched
+ * 			and the average and maximum cycles from the dispatch to its handler
+ * @param	shell	pointer to the TShell structure
+ */
+void exti_dispatcher_register_commands(TShell *shell);
+
+#endif /* INC_EXTI_DISPATCHER_H_ */
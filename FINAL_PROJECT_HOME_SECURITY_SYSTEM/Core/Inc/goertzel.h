@@ -0,0 +1,127 @@
+/*
+ * This module measures the amplitude of a few frequencies in a stream of samples, with a bank of Goertzel filters
+ * in fixed point. Each filter is a resonator, s = x + c * s1 - s2 with c = 2 cos(2 pi f / rate) in Q29, so a sample
+ * costs a multiply and two additions per frequency, and the amplitude is computed once per window.
+ * The window lasts rate / GOERTZEL_RESOLUTION samples, so every frequency multiple of GOERTZEL_RESOLUTION
+ * falls exactly on a bin: the constant level and the other bins do not leak into it.
+ * Above GOERTZEL_MAX_RATE the samples are averaged in groups before the resonators, that never run faster, and
+ * the mean of the previous window is subtracted from them: so the resonators stay far from overflowing.
+ * The groups split the window exactly, so it still lasts a whole number of periods of every bin.
+ */
+
+#ifndef INC_GOERTZEL_H_
+#define INC_GOERTZEL_H_
+
+#include <stdint.h>
+#include <math.h>
+
+#include "bool.h"
+
+#define GOERTZEL_OK					(0)
+#define GOERTZEL_ERR_INVALID		(-1)
+
+/* Frequencies of a bank */
+#define GOERTZEL_MAX_BINS			(4U)
+
+/* Spacing of the bins in Hz, the window lasts 1 / GOERTZEL_RESOLUTION seconds */
+#define GOERTZEL_RESOLUTION			(10U)
+
+/* Highest rate of the resonators in Hz, faster samples are averaged in groups */
+#define GOERTZEL_MAX_RATE			(3200U)
+
+/* Samples run through the resonators in one pass */
+#define GOERTZEL_CHUNK				(32U)
+
+/* Fractional bits of the coefficients */
+#define GOERTZEL_COEFFICIENT_SHIFT	(29U)
+
+/*
+ * @brief	This struct represents a bank of Goertzel filters.
+ * @param	bins_n			number of frequencies
+ * @param	frequencies		the frequencies in Hz, multiples of GOERTZEL_RESOLUTION
+ * @param	coefficients	2 cos(2 pi f / rate) in Q29, for each frequency, 0 for the ones not below half the rate
+ * @param	s1				last output of each resonator
+ * @param	s2				second last output of each resonator
+ * @param	rate			the sample rate in Hz, 0 until it is set
+ * @param	decimation		samples averaged into one input of the resonators
+ * @param	group_count		samples of the current group
+ * @param	group_sum		sum of the samples of the current group
+ * @param	length			inputs of a window
+ * @param	count			inputs of the current window
+ * @param	offset			value subtracted from the inputs of the current window, the mean of the previous one
+ * @param	sum				sum of the inputs of the current window
+ * @param	mean			mean of the inputs of the last window
+ * @param	amplitudes		amplitude of each frequency in the last window, in the unit of the samples
+ * @param	windows			number of windows completed
+ */
+typedef struct {
+	uint8_t bins_n;
+	uint16_t frequencies[GOERTZEL_MAX_BINS];
+	int32_t coefficients[GOERTZEL_MAX_BINS];
+	int32_t s1[GOERTZEL_MAX_BINS];
+	int32_t s2[GOERTZEL_MAX_BINS];
+	uint32_t rate;
+	uint16_t decimation;
+	uint16_t group_count;
+	uint32_t group_sum;
+	uint16_t length;
+	uint16_t count;
+	uint16_t offset;
+	uint32_t sum;
+	uint16_t mean;
+	uint16_t amplitudes[GOERTZEL_MAX_BINS];
+	uint32_t windows;
+} TGoertzel;
+
+/*
+ * @fn		void goertzel_init(TGoertzel *goertzel)
+ * @brief	Initializes an empty bank, without a sample rate
+ * @param	goertzel	pointer to the TGoertzel structure
+ */
+void goertzel_init(TGoertzel *goertzel);
+
+/*
+ * @fn		int goertzel_add_bin(TGoertzel *goertzel, uint16_t frequency)
+ * @brief	Adds a frequency to the bank. It is measured at the sample rates above twice the frequency
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @param	frequency	the frequency in Hz, a multiple of GOERTZEL_RESOLUTION
+ * @retval	GOERTZEL_ERR_INVALID if the bank is full or the frequency is not a multiple of GOERTZEL_RESOLUTION,
+ * 			GOERTZEL_OK otherwise
+ */
+int goertzel_add_bin(TGoertzel *goertzel, uint16_t frequency);
+
+/*
+ * @fn		void goertzel_set_rate(TGoertzel *goertzel, uint32_t rate)
+ * @brief	Sets the sample rate of the next samples. If it changed the coefficients are computed again
+ * 			and the current window starts over, otherwise nothing happens, so it can be called for every block
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @param	rate		the sample rate in Hz, at least GOERTZEL_RESOLUTION
+ */
+void goertzel_set_rate(TGoertzel *goertzel, uint32_t rate);
+
+/*
+ * @fn		void goertzel_reset(TGoertzel *goertzel)
+ * @brief	Starts the current window over, forgetting its samples
+ * @param	goertzel	pointer to the TGoertzel structure
+ */
+void goertzel_reset(TGoertzel *goertzel);
+
+/*
+ * @fn		bool goertzel_block(TGoertzel *goertzel, const uint16_t *samples, uint16_t length)
+ * @brief	Feeds a block of samples to the bank, computing the mean and the amplitudes of every window completed
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @param	samples		the samples, of 15 bits at most
+ * @param	length		number of samples
+ * @retval	TRUE if a window has been completed, FALSE otherwise
+ */
+bool goertzel_block(TGoertzel *goertzel, const uint16_t *samples, uint16_t length);
+
+/*
+ * @fn		uint16_t goertzel_get_peak(TGoertzel *goertzel)
+ * @brief	Returns the greatest amplitude of the last window
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @retval	the amplitude, in the unit of the samples
+ */
+uint16_t goertzel_get_peak(TGoertzel *goertzel);
+
+#endif /* INC_GOERTZEL_H_ */
@@ -0,0 +1,115 @@
+/*
+ * This module collects the faults of the sensors and of the peripherals, found by background checks
+ * that reuse the data the modules already read:
+ * 		a PIR output held high for more than PIR_STUCK_TIME, seen from its edges
+ * 		an ADC reading of the photoresistor pinned at 0 or 4095, seen from the samples of the photoresistor
+ * 		the RTC not answering a reading of the datetime, seen from the I2C callbacks
+ * 		a row of the keypad held high for more than KEYPAD_ROW_STUCK_TIME, seen from the release debouncing
+ * 		an ambient light so close to the top of the ADC that the barrier can't tell an intruder, seen from its baseline
+ * Every kind of fault keeps the mask of its faulty sources (the PIR lines, the keypad rows ...): a fault is logged
+ * once when it is raised and once when it is cleared, and the active ones are shown in the periodic log message.
+ * The events are written in a ring of messages while the interrupts are disabled, so the events of the interrupts
+ * and of the main loop never share a message.
+ */
+
+#ifndef INC_HEALTH_H_
+#define INC_HEALTH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+/* Milliseconds the RTC has to complete a reading of the datetime */
+#define HEALTH_RTC_TIMEOUT		(1000U)
+
+/* Maximum length of a fault event */
+#define HEALTH_MESSAGE_LENGTH	(48U)
+
+/* Number of fault events kept for the logger, which keeps a reference to them: at least twice its queue */
+#define HEALTH_MESSAGES_N		(16U)
+
+typedef enum {
+	HEALTH_FAULT_PIR_STUCK,			/* source: the EXTI line of the PIR */
+	HEALTH_FAULT_ADC_SATURATED,		/* source: always 0 */
+	HEALTH_FAULT_RTC_TIMEOUT,		/* source: always 0 */
+	HEALTH_FAULT_KEYPAD_ROW_STUCK,	/* source: the row of the keypad */
+	HEALTH_FAULT_BARRIER_WINDOW,	/* source: always 0 */
+	HEALTH_FAULTS_N
+} THealth_fault;
+
+/*
+ * @brief	This struct represents a kind of fault.
+ * @param	sources		mask of the faulty sources, a bit for each source
+ * @param	raised		number of times the fault has been raised
+ * @param	last_time	SysTick time of the last change of the fault
+ */
+typedef struct {
+	uint16_t sources;
+	uint32_t raised;
+	uint32_t last_time;
+} THealth_entry;
+
+/*
+ * @fn		void health_init()
+ * @brief	Clears all the faults
+ */
+void health_init();
+
+/*
+ * @fn		void health_raise(THealth_fault fault, uint8_t source)
+ * @brief	Raises a fault of a source, and logs it if it was not already raised
+ * @param	fault	the kind of fault
+ * @param	source	the faulty source, from 0 to 15
+ */
+void health_raise(THealth_fault fault, uint8_t source);
+
+/*
+ * @fn		void health_clear(THealth_fault fault, uint8_t source)
+ * @brief	Clears a fault of a source, and logs it if it was raised
+ * @param	fault	the kind of fault
+ * @param	source	the source, from 0 to 15
+ */
+void health_clear(THealth_fault fault, uint8_t source);
+
+/*
+ * @fn		bool health_is_raised(THealth_fault fault)
+ * @brief	Tells if a fault is raised for at least one source
+ * @param	fault	the kind of fault
+ * @retval	TRUE if the fault is raised, FALSE otherwise
+ */
+bool health_is_raised(THealth_fault fault);
+
+/*
+ * @fn		void health_rtc_request()
+ * @brief	Notifies that a reading of the datetime is starting. If the previous one is still waiting
+ * 			for more than HEALTH_RTC_TIMEOUT, the RTC fault is raised.
+ */
+void health_rtc_request();
+
+/*
+ * @fn		void health_rtc_response(bool ok)
+ * @brief	Notifies the end of a reading of the datetime, from the I2C callbacks
+ * @param	ok	TRUE if the reading completed, FALSE if the I2C reported an error
+ */
+void health_rtc_response(bool ok);
+
+/*
+ * @fn		void health_get_string(char *string, size_t length)
+ * @brief	Writes the names of the raised faults, separated by commas, or "none"
+ * @param	string	reference to the buffer where to write the names
+ * @param	length	size of the buffer
+ */
+void health_get_string(char *string, size_t length);
+
+/*
+ * @fn		void health_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command health, that shows the faulty sources and the counters of every fault
+ * @param	shell	pointer to the TShell structure
+ */
+void health_register_commands(TShell *shell);
+
+#endif /* INC_HEALTH_H_ */
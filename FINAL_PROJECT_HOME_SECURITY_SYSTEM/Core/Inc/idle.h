@@ -0,0 +1,74 @@
+/*
+ * This module puts the core to sleep when the main loop has nothing to do.
+ * While some module must be polled, the core sleeps until the next interrupt, at most until the next SysTick.
+ * Otherwise the sleep is tickless: the SysTick is suspended and a 16 bits timer, counting tenths of millisecond, wakes the core
+ * at the earliest deadline of the timing wheel. Any other interrupt ends the sleep before, and the milliseconds slept
+ * are given back to the HAL tick at once, and to the wheel by the next SysTick, so the timers expire at the right time
+ * and their callbacks run with the interrupts enabled, as usual: they may wait for the console.
+ */
+
+#ifndef INC_IDLE_H_
+#define INC_IDLE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "timer_wheel.h"
+#include "shell.h"
+
+/* The timer counts at 10 kHz in one pulse mode, as configured by MX_TIM11_Init */
+#define IDLE_TIMER_TICKS_PER_MS		(10U)
+
+/* Shortest deadline, in milliseconds, worth stopping the SysTick for */
+#define IDLE_MIN_SLEEP				(2U)
+
+/* Longest tickless sleep, in milliseconds, within the 16 bits of the counter */
+#define IDLE_MAX_SLEEP				(6000U)
+
+/*
+ * @brief	This struct holds the statistics of the sleeps.
+ * @param	sleeps		number of tickless sleeps
+ * @param	woken		number of tickless sleeps ended by an interrupt before the deadline
+ * @param	slept		milliseconds spent in the tickless sleeps
+ */
+typedef struct {
+	uint32_t sleeps;
+	uint32_t woken;
+	uint32_t slept;
+} TIdle_stats;
+
+/*
+ * @fn		void idle_init(TIM_HandleTypeDef *htim, IRQn_Type irq)
+ * @brief	Sets the timer waking the core from the tickless sleeps
+ * @param	htim	a timer already initialized at 10 kHz in one pulse mode, not used by anything else
+ * @param	irq		the interrupt of the timer
+ */
+void idle_init(TIM_HandleTypeDef *htim, IRQn_Type irq);
+
+/*
+ * @fn		void idle_sleep(bool tickless)
+ * @brief	Sleeps until the next interrupt. It must be called with the interrupts disabled, right after checking
+ * 			that the main loop has nothing to do: an interrupt raised in the meanwhile ends the sleep at once,
+ * 			and it is served when the interrupts are enabled again.
+ * @param	tickless	TRUE if no module needs to be polled, so the SysTick can be suspended
+ * 						until the earliest deadline of the timing wheel
+ */
+void idle_sleep(bool tickless);
+
+/*
+ * @fn		void idle_tick()
+ * @brief	Advances the timing wheel by one millisecond, and by the milliseconds of the last tickless sleep.
+ * 			Should be called only by the SysTick interrupt, in place of timer_wheel_tick().
+ */
+void idle_tick();
+
+/*
+ * @fn		void idle_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command idle, that shows the number and the length of the tickless sleeps
+ * @param	shell	pointer to the TShell structure
+ */
+void idle_register_commands(TShell *shell);
+
+#endif /* INC_IDLE_H_ */
@@ -1,6 +1,6 @@
 /*
  * This module allows to connect a keypad to the system. This module will also manage the activation and deactivation of
- * the sensors. The user pin is automatically retrieved by the configuration.
+ * the sensors. The user pins are looked up in the user directory, which always contains the PIN set during the configuration.
  * */
 
 #ifndef INC_KEYPAD_H_
@@ -9,15 +9,22 @@
 #include "main.h"
 #include "configuration.h"
 #include "keypad_configuration.h"
-#include "tim.h"
-#include "pir_sensor.h"
-#include "photoresistor.h"
+#include "keypad_gesture.h"
+#include "timer_wheel.h"
+#include "sensor_registry.h"
 #include "logger.h"
 #include "buzzer.h"
+#include "user_directory.h"
+#include "latency.h"
+#include "exti_dispatcher.h"
+#include "health.h"
 
 #define MESSAGE_WRONG_USER_PIN 		("Wrong user pin inserted")
 #define MESSAGE_COMMAND_REJECTED	("Command rejected")
 #define MESSAGE_COMMAND_ACCEPTED	("Command accepted")
+#define MESSAGE_COMMAND_NOT_ALLOWED	("Command not allowed for this user")
+#define MESSAGE_PANIC_ALARM			("Panic alarm")
+#define MESSAGE_QUICK_ARM			("Quick arm, zones activated")
 
 
 /**
@@ -48,19 +55,35 @@ typedef enum {
  * @param buffer			keeps the pressed button in a short period of time
  * @param last_pressed_key 	keeps the last pressed key, useful for one byte reading
  * @param index				keeps track of the pressed buttons
- * @param timer			timer used for debouncing
+ * @param timer			software timer used for debouncing
  * @param last_pressed_time	used to check the time between different pressions
  * @param rows_pins			used to scan through the rows
  * @param cols_pins			used to scan through the columns
+ * @param gestures			the engine recognizing long presses and chords
+ * @param pressed_keys		mask of the held keys, set by the irq when a key is decoded, see KEYPAD_KEY_BIT()
+ * @param key_press_time	time of the last press of every key, indexed as the bits of pressed_keys
+ * @param notified_keys		mask of the held keys already notified to the gesture engine
+ * @param row_low_since		time since each row reads low, 0 if it reads high. Used to debounce the releases
+ * @param row_high_since	time since each row reads high with its keys held, 0 if it doesn't. Used to find stuck rows
+ * @param accepted_commands	number of commands accepted since the initialization
+ * @param rejected_commands	number of commands rejected since the initialization
  */
 typedef struct Keypad {
 	TKEYPAD_Button buffer[KEYPAD_DEFAULT_BUFFER_SIZE];
 	TKEYPAD_Button last_pressed_key;
 	uint8_t index;
-	TIM_HandleTypeDef *timer;
+	TTimer timer;
 	uint32_t last_pressed_time;
 	uint16_t rows_pins[ROWS_N];
 	uint16_t cols_pins[COLUMNS_N];
+	TKeypad_gestures gestures;
+	volatile uint16_t pressed_keys;
+	volatile uint32_t key_press_time[ROWS_N * COLUMNS_N];
+	uint16_t notified_keys;
+	uint32_t row_low_since[ROWS_N];
+	uint32_t row_high_since[ROWS_N];
+	uint32_t accepted_commands;
+	uint32_t rejected_commands;
 } TKeypad;
 
 /* Maps buttons to rows and columns number */
@@ -101,7 +124,7 @@ void KEYPAD_key_pressed(TKeypad *keypad, uint16_t pin);
 
 /**
  * @fn 		void KEYPAD_time_elapsed(TKeypad *keypad)
- * @brief 	ISR of the timer used to prevent bouncing (keypad is really bouncy:) ). Should be called only by the irq.
+ * @brief 	Callback of the timer used to prevent bouncing (keypad is really bouncy:) ). Should be called only by the timer.
  * 			When the time is elapsed, the function will scan the columns and will read the last saved row. If it is valid,
  * 			the read button will be saved in a buffer. When the buffer is full, the function will restart the timer,
  * 			and the buffer will be checked later.
@@ -111,14 +134,39 @@ void KEYPAD_key_pressed(TKeypad *keypad, uint16_t pin);
 void KEYPAD_time_elapsed(TKeypad *keypad);
 
 /**
- * @fn 		void KEYPAD_check_buffer(uint8_t *buffer)
+ * @fn 		bool KEYPAD_check_buffer(uint8_t *buffer)
  * @brief 	ISR of the timer used to check the buffer. This is called only when the buffer size is full.
  * 			The buffer will be checked and, if the command is valid,it is executed. So it will enable and disable
  * 			the sensors and the system. This will also log on the console.
  * @param 	buffer a pointer to the buffer to be checked
- * @return none
+ * @return	TRUE if the command has been accepted, FALSE otherwise
  */
-void KEYPAD_check_buffer(uint8_t *buffer);
+bool KEYPAD_check_buffer(uint8_t *buffer);
+
+/**
+ * @fn 		void KEYPAD_poll(TKeypad *keypad)
+ * @brief 	Feeds the gesture engine with the presses decoded by the irq and with the releases, and recognizes
+ * 			the gestures. When a gesture is recognized, the keys typed so far are discarded.
+ * 			It must be called in the main loop: it is the only tick of the gesture engine.
+ * @param 	keypad a pointer to the structure of the keypad
+ * @retval	none
+ */
+void KEYPAD_poll(TKeypad *keypad);
+
+/**
+ * @fn 		bool KEYPAD_is_panic_alarm()
+ * @brief 	Tells if the panic alarm sounds
+ * @retval	TRUE from the long press of '*' to the command D*, FALSE otherwise
+ */
+bool KEYPAD_is_panic_alarm();
+
+/**
+ * @fn 		bool KEYPAD_is_idle(TKeypad *keypad)
+ * @brief 	Tells if no key is held: the releases and the gestures are polled by KEYPAD_poll() while a key is held
+ * @param 	keypad a pointer to the structure of the keypad
+ * @retval	TRUE if KEYPAD_poll() has nothing to do, FALSE otherwise
+ */
+bool KEYPAD_is_idle(TKeypad *keypad);
 
 
 #endif /* INC_KEYPAD_H_ */
@@ -31,14 +31,8 @@
 #define ROW_4_PORT  	GPIOB
 #define ROW_4_PIN  		GPIO_PIN_15
 
-/* For the timer clock, please refer to the configuration. */
-/* Used in the default initialization process. */
-#define KEYPAD_TIMER 					htim11
-
-/* The clock source  used by the timer, this is used in order to calculate timings for debouncing. */
-#define TIMER_CLOCK 					(42000000U)
-#define KEYPAD_PRESCALER 				((TIMER_CLOCK/1000U) - 1U)
-#define KEYPAD_DELAY_PERIOD   					(75U - 1U)
+/* Milliseconds waited after the edge of a row before the columns are scanned, to prevent bouncing. */
+#define KEYPAD_DEBOUNCE_TIME			(75U)
 
 /* Follow the command protocol from keypad. */
 #define KEYPAD_DEFAULT_BUFFER_SIZE		(7U)
@@ -49,5 +43,23 @@
  * everything is discarded. Default value is 5000ms*/
 #define MAX_DELAY_BETWEEN_PRESSIONS  	(5000U)
 
+/* Milliseconds a row must be read low before its keys are considered released. */
+#define KEYPAD_RELEASE_DEBOUNCE			(50U)
+
+/* Milliseconds the '*' key must be held to raise the panic alarm. */
+#define KEYPAD_PANIC_HOLD_TIME			(3000U)
+
+/* Milliseconds the 'A' and 'B' keys must be held together for the quick arm. */
+#define KEYPAD_QUICK_ARM_HOLD_TIME		(300U)
+
+/* Zones activated by the quick arm, as a mask of USER_ZONE_* bits. It is the only command sent without a PIN,
+ * so anyone at the keypad can use it: by default it only activates the area. Set it to 0 to disable the chord. */
+#ifndef KEYPAD_QUICK_ARM_ZONES
+#define KEYPAD_QUICK_ARM_ZONES			(USER_ZONE_AREA)
+#endif
+
+/* Milliseconds a row can be read high, with its keys held, before it is reported as stuck. */
+#define KEYPAD_ROW_STUCK_TIME			(60000U)
+
 
 #endif /* INC_KEYPAD_CONFIGURATION_H_ */
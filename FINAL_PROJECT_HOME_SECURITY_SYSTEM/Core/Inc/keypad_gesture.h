@@ -0,0 +1,133 @@
+/*
+ * This module recognizes gestures on the keypad: a gesture is a set of keys held down together for a minimum time,
+ * so both long presses (e.g. '*' held for 3 seconds) and chords (e.g. 'A' and 'B' pressed together) are handled.
+ * The engine does not need any timer: it is fed with the timestamps of the debounced presses and releases,
+ * and all the recognizers are evaluated by a single shared tick, KEYPAD_gesture_tick().
+ */
+
+#ifndef INC_KEYPAD_GESTURE_H_
+#define INC_KEYPAD_GESTURE_H_
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "keypad_configuration.h"
+
+#define KEYPAD_GESTURE_OK				(0)
+#define KEYPAD_GESTURE_ERR_FULL			(-1)
+
+/* Maximum number of gestures that can be recognized at the same time */
+#define KEYPAD_GESTURE_MAX_RECOGNIZERS	(8U)
+
+/* The keys of a chord must all be pressed within this amount of milliseconds */
+#define KEYPAD_GESTURE_CHORD_WINDOW		(500U)
+
+/* Returned by KEYPAD_gesture_next_deadline() when no gesture is waiting for its hold time */
+#define KEYPAD_GESTURE_NO_DEADLINE		(0xFFFFFFFFU)
+
+/* Converts a row and a column of the keypad in the bit of the key in a keys mask */
+#define KEYPAD_KEY_BIT(row, col)		((uint16_t) (1U << ((row) * COLUMNS_N + (col))))
+
+/*
+ * @brief	Function executed when a gesture is recognized.
+ * @param	context		the context given when the gesture has been added
+ */
+typedef void (*TKeypad_gesture_action)(void *context);
+
+/*
+ * @brief	This struct represents a gesture recognizer.
+ * @param	keys		mask of the keys that must be held, see KEYPAD_KEY_BIT()
+ * @param	hold_time	milliseconds the keys must be held before the gesture is recognized
+ * @param	action		function executed when the gesture is recognized
+ * @param	context		pointer passed to action as it is
+ * @param	deadline	time at which the gesture will be recognized if the keys are still held
+ * @param	armed		TRUE while all the keys are held and the gesture has not been recognized yet
+ */
+typedef struct {
+	uint16_t keys;
+	uint32_t hold_time;
+	TKeypad_gesture_action action;
+	void *context;
+	uint32_t deadline;
+	bool armed;
+} TKeypad_gesture;
+
+/*
+ * @brief	This struct represents the gesture engine.
+ * @param	gestures		the gesture recognizers
+ * @param	gestures_n		number of gesture recognizers
+ * @param	pressed			mask of the keys currently held
+ * @param	press_time		time of the press of every key, indexed as the bits of the masks
+ * @param	armed_n			number of armed gestures
+ * @param	next_deadline	earliest deadline among the armed gestures, so the tick is O(1) while nothing expires
+ * @param	recognized		number of recognized gestures, useful for statistics
+ */
+typedef struct {
+	TKeypad_gesture gestures[KEYPAD_GESTURE_MAX_RECOGNIZERS];
+	uint8_t gestures_n;
+	uint16_t pressed;
+	uint32_t press_time[ROWS_N * COLUMNS_N];
+	uint8_t armed_n;
+	uint32_t next_deadline;
+	uint32_t recognized;
+} TKeypad_gestures;
+
+/*
+ * @fn		void KEYPAD_gesture_init(TKeypad_gestures *engine)
+ * @brief	Initializes a gesture engine without gestures
+ * @param	engine	pointer to the TKeypad_gestures structure to initialize
+ */
+void KEYPAD_gesture_init(TKeypad_gestures *engine);
+
+/*
+ * @fn		int KEYPAD_gesture_add(TKeypad_gestures *engine, uint16_t keys, uint32_t hold_time,
+ * 								TKeypad_gesture_action action, void *context)
+ * @brief	Adds a gesture to recognize. A gesture with a single key is a long press, otherwise it is a chord.
+ * @param	engine		pointer to the TKeypad_gestures structure
+ * @param	keys		mask of the keys that must be held, see KEYPAD_KEY_BIT()
+ * @param	hold_time	milliseconds the keys must be held together
+ * @param	action		function executed when the gesture is recognized
+ * @param	context		pointer passed to action as it is
+ * @retval	KEYPAD_GESTURE_ERR_FULL if there are already KEYPAD_GESTURE_MAX_RECOGNIZERS gestures,
+ * 			KEYPAD_GESTURE_OK otherwise
+ */
+int KEYPAD_gesture_add(TKeypad_gestures *engine, uint16_t keys, uint32_t hold_time,
+		TKeypad_gesture_action action, void *context);
+
+/*
+ * @fn		void KEYPAD_gesture_key_down(TKeypad_gestures *engine, uint16_t key, uint32_t time)
+ * @brief	Notifies the debounced press of a key
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	key		the bit of the key, see KEYPAD_KEY_BIT()
+ * @param	time	time of the press in milliseconds
+ */
+void KEYPAD_gesture_key_down(TKeypad_gestures *engine, uint16_t key, uint32_t time);
+
+/*
+ * @fn		void KEYPAD_gesture_key_up(TKeypad_gestures *engine, uint16_t keys, uint32_t time)
+ * @brief	Notifies the debounced release of one or more keys
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	keys	mask of the released keys
+ * @param	time	time of the release in milliseconds
+ */
+void KEYPAD_gesture_key_up(TKeypad_gestures *engine, uint16_t keys, uint32_t time);
+
+/*
+ * @fn		bool KEYPAD_gesture_tick(TKeypad_gestures *engine, uint32_t now)
+ * @brief	Recognizes the gestures whose keys have been held long enough, executing their action.
+ * 			A gesture is recognized only once, until one of its keys is released.
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	now		current time in milliseconds
+ * @retval	TRUE if at least one gesture has been recognized, FALSE otherwise
+ */
+bool KEYPAD_gesture_tick(TKeypad_gestures *engine, uint32_t now);
+
+/*
+ * @fn		uint32_t KEYPAD_gesture_next_deadline(TKeypad_gestures *engine)
+ * @brief	Returns the time at which the next gesture will be recognized if its keys are still held
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @retval	the deadline in milliseconds, or KEYPAD_GESTURE_NO_DEADLINE if no gesture is armed
+ */
+uint32_t KEYPAD_gesture_next_deadline(TKeypad_gestures *engine);
+
+#endif /* INC_KEYPAD_GESTURE_H_ */
@@ -0,0 +1,131 @@
+/*
+ * This module measures the end-to-end latency of the keypad commands, from the edge of the row interrupt
+ * to the log line on the console and to the beep of the buzzer.
+ * The pipeline is marked in a few points with latency_mark(): the timestamps come from the DWT cycle counter,
+ * so marking costs a few cycles and can be done in interrupt context. Every stage of the pipeline is the time
+ * between two marks, and it is collected as min/avg/max and as a histogram with power-of-two buckets.
+ * The statistics are shown on the console by the latency command, see latency_register_commands().
+ */
+
+#ifndef INC_LATENCY_H_
+#define INC_LATENCY_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+/*
+ * Number of buckets of the histograms. The bucket i counts the samples lasting from 2^(i-1) to 2^i - 1
+ * microseconds, the bucket 0 the ones shorter than a microsecond, the last one everything longer.
+ */
+#define LATENCY_HISTOGRAM_BUCKETS	(24U)
+
+/*
+ * @brief	Points of the keypad pipeline in which a timestamp is taken, in the order they are met.
+ * 			EDGE:		the row interrupt starts a debounce, a new measure starts unless a command waits to be checked
+ * 			DECODE:		the debounce timer expired, the column scan starts
+ * 			DECODED:	the key has been stored in the buffer
+ * 			EXECUTE:	the full buffer is going to be checked
+ * 			LOG:		the command has been accepted and its log line requested
+ * 			BEEP:		the buzzer started beeping
+ * 			PRINTED:	the log line has been handed to the UART
+ * 			EMITTED:	the UART completed the transmission
+ */
+typedef enum {
+	LATENCY_MARK_EDGE,
+	LATENCY_MARK_DECODE,
+	LATENCY_MARK_DECODED,
+	LATENCY_MARK_EXECUTE,
+	LATENCY_MARK_LOG,
+	LATENCY_MARK_BEEP,
+	LATENCY_MARK_PRINTED,
+	LATENCY_MARK_EMITTED,
+	LATENCY_MARKS_N
+} TLatency_mark;
+
+/*
+ * @brief	Stages of the pipeline, each one measured between two marks.
+ * 			DEBOUNCE:	EDGE to DECODE, for every key
+ * 			DECODE:		DECODE to DECODED, for every key
+ * 			QUEUE:		DECODED to EXECUTE, the wait before the full buffer is checked
+ * 			EXECUTE:	EXECUTE to LOG, checking and executing the command
+ * 			EMIT:		LOG to EMITTED, reading the RTC and transmitting the log line
+ * 			BEEP:		EDGE to BEEP, from the last key to the feedback of the buzzer
+ * 			TOTAL:		EDGE to EMITTED, from the last key to the log line
+ */
+typedef enum {
+	LATENCY_STAGE_DEBOUNCE,
+	LATENCY_STAGE_DECODE,
+	LATENCY_STAGE_QUEUE,
+	LATENCY_STAGE_EXECUTE,
+	LATENCY_STAGE_EMIT,
+	LATENCY_STAGE_BEEP,
+	LATENCY_STAGE_TOTAL,
+	LATENCY_STAGES_N
+} TLatency_stage;
+
+/*
+ * @brief	This struct represents the statistics of a stage.
+ * @param	count		number of samples
+ * @param	min			shortest sample in cycles
+ * @param	max			longest sample in cycles
+ * @param	sum			sum of the samples in cycles, to compute the average
+ * @param	histogram	number of samples in each bucket, see LATENCY_HISTOGRAM_BUCKETS
+ */
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t histogram[LATENCY_HISTOGRAM_BUCKETS];
+} TLatency_stats;
+
+/*
+ * @fn		void latency_init()
+ * @brief	Enables the DWT cycle counter and clears the statistics
+ */
+void latency_init();
+
+/*
+ * @fn		void latency_mark(TLatency_mark mark)
+ * @brief	Takes the timestamp of a point of the pipeline and updates the stages ending there.
+ * 			Only the first timestamp of a mark is kept until a new measure is started by an edge,
+ * 			so the bounces of the keys and the unrelated transmissions are ignored. An edge does not restart
+ * 			a measure that reached DECODED and waits for EXECUTE: the release of the last key may bounce.
+ * @param	mark	the point of the pipeline that has been reached
+ */
+void latency_mark(TLatency_mark mark);
+
+/*
+ * @fn		void latency_end()
+ * @brief	Ends the measure in flight: its next marks are ignored until an edge starts a new one.
+ * 			The keypad calls it when a debounce ends without a key, and when a key does not complete a command
+ */
+void latency_end();
+
+/*
+ * @fn		void latency_reset()
+ * @brief	Clears the statistics of all the stages
+ */
+void latency_reset();
+
+/*
+ * @fn		void latency_get_stats(TLatency_stage stage, TLatency_stats *stats)
+ * @brief	Copies the statistics of a stage. It can be called while the pipeline is running.
+ * @param	stage	the stage
+ * @param	stats	pointer to the structure the statistics will be copied in
+ */
+void latency_get_stats(TLatency_stage stage, TLatency_stats *stats);
+
+/*
+ * @fn		void latency_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command latency, that shows min/avg/max of every stage in microseconds.
+ * 			latency <stage> shows the histogram of a stage, latency reset clears the statistics.
+ * @param	shell	pointer to the TShell structure
+ */
+void latency_register_commands(TShell *shell);
+
+#endif /* INC_LATENCY_H_ */
@@ -0,0 +1,221 @@
+/*
+ * This module keeps the history of a light level for days, in a few KB of RAM and in a sector of the flash.
+ * The values are folded as they come into the minimum, the maximum and the mean of the current interval, and every
+ * LIGHT_HISTORY_INTERVAL milliseconds the interval is closed into a record of a few bytes: the mean as the difference
+ * from the mean of the previous record, zig-zag encoded so that small changes of both signs stay small, and the
+ * minimum and the maximum as their distance from the mean, each one as a varint of 7 bits per byte. A steady level
+ * costs 3 bytes every interval. The intervals without values are not recorded: the next record counts them.
+ * The values are light levels, or the share of the emitter of a barrier lost in lock-in mode: every chunk holds
+ * records of one of them, written in its header, and an interval takes the unit of its last values.
+ * The records are appended to chunks of LIGHT_HISTORY_CHUNK_SIZE bytes, each one starting again from a mean of 0
+ * with the date of its first record, so a chunk is decoded on its own. The chunks are kept in a ring in RAM: when
+ * it is full the oldest one is programmed in the flash. Two sectors take turns: the chunks fill one of them while
+ * the other one keeps the older chunks, and only when the first one is nearly full the other one is erased, to be
+ * filled next, so the history never loses much more than its oldest sector. An erase stalls the core for a second
+ * or two, so it is left to the main loop, which runs it only while every zone is disarmed: if the sector fills up
+ * before, the oldest chunks in RAM are dropped. The chunks in RAM are lost at the reset, the ones
+ * in the flash are found again, and the flash is never erased at the start.
+ * The history is shown on the console, interval by interval or with a few intervals merged in each line.
+ */
+
+#ifndef INC_LIGHT_HISTORY_H_
+#define INC_LIGHT_HISTORY_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "datetime.h"
+#include "timer_wheel.h"
+#include "shell.h"
+
+/* Length of an interval in milliseconds */
+#define LIGHT_HISTORY_INTERVAL			(300000UL)
+
+/* Bytes of a chunk, with its header, and chunks kept in RAM: 16 chunks hold about 4 days of a steady level */
+#define LIGHT_HISTORY_CHUNK_SIZE		(256U)
+#define LIGHT_HISTORY_RAM_CHUNKS		(16U)
+
+/*
+ * The last two sectors of the flash, 128 KB each, left out of the program by the linker script: the sector
+ * LIGHT_HISTORY_FLASH_SECTOR at LIGHT_HISTORY_FLASH_ADDRESS and the next one. At the rate of a steady level
+ * a sector is filled in about 4 months
+ */
+#define LIGHT_HISTORY_FLASH_SECTOR		(FLASH_SECTOR_6)
+#define LIGHT_HISTORY_FLASH_ADDRESS		(0x08040000UL)
+#define LIGHT_HISTORY_FLASH_SIZE		(0x20000UL)
+#define LIGHT_HISTORY_FLASH_CHUNKS		(LIGHT_HISTORY_FLASH_SIZE / LIGHT_HISTORY_CHUNK_SIZE)
+
+/* Chunks left in the sector being filled when the other one may be erased: about 2 weeks of a steady level */
+#define LIGHT_HISTORY_ERASE_AHEAD		(64U)
+
+/* Marks a chunk written by this module, with the unit and the turn in its header, an erased chunk reads 0xFFFF */
+#define LIGHT_HISTORY_MAGIC				(0x4C4AU)
+
+/* Longest record: the mean with the flag of the gap, the gap, and the distances of the minimum and the maximum */
+#define LIGHT_HISTORY_MAX_RECORD		(14U)
+
+/* Lines shown by the history command without arguments */
+#define LIGHT_HISTORY_DEFAULT_LINES		(24U)
+
+/*
+ * @brief	What the values of a history measure.
+ */
+typedef enum {
+	LIGHT_HISTORY_LEVEL,	/* the light level, in steps of the ADC */
+	LIGHT_HISTORY_LOSS		/* the share of the emitter lost, scaled to the range of the ADC */
+} TLight_history_unit;
+
+/*
+ * @brief	Header of a chunk.
+ * @param	magic		LIGHT_HISTORY_MAGIC
+ * @param	records		number of records of the chunk
+ * @param	length		bytes of the records
+ * @param	interval	length of the intervals of the records, in seconds
+ * @param	unit		the TLight_history_unit of the records
+ * @param	turn		in the flash, the turn of its sector: the sector filled after the other one has the next turn
+ * @param	start		date and time of the end of the interval of the first record
+ */
+typedef struct {
+	uint16_t magic;
+	uint16_t records;
+	uint16_t length;
+	uint16_t interval;
+	uint16_t unit;
+	uint16_t turn;
+	TDatetime start;
+} TLight_history_header;
+
+/* Bytes of the records of a chunk */
+#define LIGHT_HISTORY_CHUNK_DATA		(LIGHT_HISTORY_CHUNK_SIZE - sizeof(TLight_history_header))
+
+/*
+ * @brief	A chunk of records, decoded on its own.
+ * @param	header		the header of the chunk
+ * @param	data		the records
+ */
+typedef struct {
+	TLight_history_header header;
+	uint8_t data[LIGHT_HISTORY_CHUNK_DATA];
+} TLight_history_chunk;
+
+/*
+ * @brief	A decoded record.
+ * @param	offset		intervals from the first record of its chunk
+ * @param	min			the minimum of the interval
+ * @param	mean		the mean of the interval
+ * @param	max			the maximum of the interval
+ */
+typedef struct {
+	uint32_t offset;
+	uint16_t min;
+	uint16_t mean;
+	uint16_t max;
+} TLight_history_record;
+
+/*
+ * @brief	This struct represents the history of a light level.
+ * @param	clock		the date and time kept by the RTC
+ * @param	timer		the periodic timer closing the intervals
+ * @param	due			TRUE when an interval is over, set by the timer
+ * @param	min			the minimum of the current interval
+ * @param	max			the maximum of the current interval
+ * @param	sum			the sum of the values of the current interval
+ * @param	count		number of values of the current interval
+ * @param	unit		the unit of the values of the current interval
+ * @param	gap			intervals without values since the last record
+ * @param	previous	the mean of the last record of the open chunk
+ * @param	chunks		the ring of the chunks in RAM, the last one is open
+ * @param	first		index in the ring of the oldest chunk
+ * @param	chunks_n	number of chunks in the ring, with the open one
+ * @param	sector		the flash sector being filled, 0 or 1 from LIGHT_HISTORY_FLASH_SECTOR
+ * @param	turn		the turn of the sector being filled
+ * @param	flash_n		number of chunks programmed in the sector being filled, from its start
+ * @param	flash_full	TRUE if no more chunks can be programmed in the sector being filled
+ * @param	older_n		number of chunks in the other sector, older than the ones of the sector being filled
+ * @param	next_erased	TRUE if the other sector has been erased, to be filled when the one being filled is full
+ * @param	flash_ok	FALSE if the flash failed, the oldest chunks are dropped then
+ * @param	records		number of records appended since the reset
+ * @param	dropped		number of chunks lost because the flash failed, or because the sector being filled was full
+ * 						and the other one not erased yet
+ */
+typedef struct {
+	const TDatetime *clock;
+	TTimer timer;
+	volatile bool due;
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+	uint32_t count;
+	TLight_history_unit unit;
+	uint32_t gap;
+	uint16_t previous;
+	TLight_history_chunk chunks[LIGHT_HISTORY_RAM_CHUNKS];
+	uint8_t first;
+	uint8_t chunks_n;
+	uint8_t sector;
+	uint16_t turn;
+	uint16_t flash_n;
+	bool flash_full;
+	uint16_t older_n;
+	bool next_erased;
+	bool flash_ok;
+	uint32_t records;
+	uint32_t dropped;
+} TLight_history;
+
+/*
+ * @fn		void light_history_init(TLight_history *history, const TDatetime *clock)
+ * @brief	Finds the chunks already in the flash sectors, without erasing them, and starts the timer
+ * 			of the intervals. The timer wheel must be initialized
+ * @param	history		pointer to the TLight_history structure to initialize
+ * @param	clock		the date and time kept by the RTC, written in the header of every chunk
+ */
+void light_history_init(TLight_history *history, const TDatetime *clock);
+
+/*
+ * @fn		void light_history_add(TLight_history *history, uint16_t value, TLight_history_unit unit)
+ * @brief	Folds a value into the current interval, dropping the values of the other unit already folded
+ * @param	history		pointer to the TLight_history structure
+ * @param	value		the light level or the loss
+ * @param	unit		what the value measures
+ */
+void light_history_add(TLight_history *history, uint16_t value, TLight_history_unit unit);
+
+/*
+ * @fn		void light_history_process(TLight_history *history)
+ * @brief	Closes the current interval when it is over, appending its record.
+ * 			It must be called by the main loop, since a chunk may be programmed in the flash
+ * @param	history		pointer to the TLight_history structure
+ */
+void light_history_process(TLight_history *history);
+
+/*
+ * @fn		void light_history_erase_ahead(TLight_history *history)
+ * @brief	Erases the other flash sector when the one being filled has LIGHT_HISTORY_ERASE_AHEAD chunks left,
+ * 			dropping its older chunks. The erase stalls the core and all the interrupts for 1 s, up to 2 s:
+ * 			it must be called by the main loop, only while every zone is disarmed
+ * @param	history		pointer to the TLight_history structure
+ */
+void light_history_erase_ahead(TLight_history *history);
+
+/*
+ * @fn		bool light_history_is_pending(TLight_history *history)
+ * @brief	Tells if an interval is waiting to be closed by light_history_process
+ * @param	history		pointer to the TLight_history structure
+ * @retval	TRUE if an interval is over, FALSE otherwise
+ */
+bool light_history_is_pending(TLight_history *history);
+
+/*
+ * @fn		void light_history_register_commands(TLight_history *history, TShell *shell)
+ * @brief	Adds to the shell the command history [lines] [intervals], that shows the last records,
+ * 			merging some intervals in each line
+ * @param	history		pointer to the TLight_history structure
+ * @param	shell		pointer to the TShell structure
+ */
+void light_history_register_commands(TLight_history *history, TShell *shell);
+
+#endif /* INC_LIGHT_HISTORY_H_ */
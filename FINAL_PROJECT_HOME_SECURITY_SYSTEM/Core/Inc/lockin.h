@@ -0,0 +1,116 @@
+/*
+ * This module drives the emitter of a barrier with a square wave and measures how much of it comes back,
+ * with a synchronous detection. The PWM timer is clocked by the TRGO of the timer triggering the ADC, so it counts
+ * the samples of the stream: the emitter switches every period / 2 samples, locked in phase with the conversions
+ * at any sample rate. The samples are correlated with a sine and a cosine at the frequency of the emitter over
+ * windows of whole periods: the ambient light, constant or changing at other frequencies, falls out of the sums,
+ * and the amplitude comes from both of them, so it does not depend on the delay of the receiver.
+ */
+
+#ifndef INC_LOCKIN_H_
+#define INC_LOCKIN_H_
+
+#include <stdint.h>
+#include <math.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+
+#define LOCKIN_OK					(0)
+#define LOCKIN_ERR_INVALID			(-1)
+#define LOCKIN_ERR_HAL				(-2)
+
+/* Samples of a window of the correlation, a multiple of every period */
+#define LOCKIN_WINDOW				(32U)
+
+/* Samples of a period of the emitter, it must divide LOCKIN_WINDOW. The default one gives 80 Hz at 640 Hz */
+#define LOCKIN_MAX_PERIOD			(32U)
+#define LOCKIN_DEFAULT_PERIOD		(8U)
+
+/*
+ * @brief	This struct represents a synchronous detector and the emitter it drives.
+ * @param	htim		the timer driving the emitter, clocked by the trigger of the ADC
+ * @param	channel		the channel of the timer wired to the emitter
+ * @param	period		samples of a period of the emitter
+ * @param	cosines		the cosine at the frequency of the emitter, in Q15, one value per sample of a period
+ * @param	sines		the sine at the frequency of the emitter, in Q15, one value per sample of a period
+ * @param	running		TRUE while the emitter is driven
+ * @param	phase		index in the period of the next sample
+ * @param	count		samples of the current window
+ * @param	in_phase	correlation of the current window with the cosine
+ * @param	quadrature	correlation of the current window with the sine
+ * @param	amplitude	amplitude of the emitter in the last window, in the unit of the samples
+ * @param	reference	amplitude of the first window after the reset, with the beam clear, 0 until then
+ * @param	windows		number of windows completed
+ */
+typedef struct {
+	TIM_HandleTypeDef *htim;
+	uint32_t channel;
+	uint8_t period;
+	int16_t cosines[LOCKIN_MAX_PERIOD];
+	int16_t sines[LOCKIN_MAX_PERIOD];
+	bool running;
+	uint8_t phase;
+	uint16_t count;
+	int64_t in_phase;
+	int64_t quadrature;
+	uint16_t amplitude;
+	uint16_t reference;
+	uint32_t windows;
+} TLockin;
+
+/*
+ * @fn		int lockin_init(TLockin *lockin, TIM_HandleTypeDef *htim, uint32_t channel, uint32_t trigger, uint8_t period)
+ * @brief	Makes the timer count the rising edges of the trigger, and sets its period and a duty cycle
+ * 			of 50%, without starting it
+ * @param	lockin		pointer to the TLockin structure to initialize
+ * @param	htim		a timer with a slave mode controller, with its channel configured as a PWM by MX_TIMx_Init
+ * @param	channel		the channel of the timer wired to the emitter, as TIM_CHANNEL_3
+ * @param	trigger		the internal trigger of the timer matching the timer of the ADC, as TIM_TS_ITR1
+ * @param	period		samples of a period of the emitter, from 2 to LOCKIN_MAX_PERIOD, dividing LOCKIN_WINDOW
+ * @retval	LOCKIN_ERR_INVALID if the period is not allowed, LOCKIN_ERR_HAL if the HAL refused the configuration,
+ * 			LOCKIN_OK otherwise
+ */
+int lockin_init(TLockin *lockin, TIM_HandleTypeDef *htim, uint32_t channel, uint32_t trigger, uint8_t period);
+
+/*
+ * @fn		void lockin_start(TLockin *lockin)
+ * @brief	Starts driving the emitter, that switches with the samples of the ADC
+ * @param	lockin		pointer to the TLockin structure
+ */
+void lockin_start(TLockin *lockin);
+
+/*
+ * @fn		void lockin_stop(TLockin *lockin)
+ * @brief	Stops driving the emitter
+ * @param	lockin		pointer to the TLockin structure
+ */
+void lockin_stop(TLockin *lockin);
+
+/*
+ * @fn		void lockin_reset(TLockin *lockin)
+ * @brief	Starts the current window over and forgets the reference, set again by the next window
+ * @param	lockin		pointer to the TLockin structure
+ */
+void lockin_reset(TLockin *lockin);
+
+/*
+ * @fn		bool lockin_block(TLockin *lockin, const uint16_t *samples, uint16_t length)
+ * @brief	Correlates a block of samples, computing the amplitude of every window completed
+ * @param	lockin		pointer to the TLockin structure
+ * @param	samples		the samples, one for each rising edge of the trigger
+ * @param	length		number of samples
+ * @retval	TRUE if a window has been completed, FALSE otherwise
+ */
+bool lockin_block(TLockin *lockin, const uint16_t *samples, uint16_t length);
+
+/*
+ * @fn		uint16_t lockin_get_loss(TLockin *lockin, uint16_t full_scale)
+ * @brief	Returns how much of the reference amplitude is missing in the last window
+ * @param	lockin		pointer to the TLockin structure
+ * @param	full_scale	the value returned when the emitter is not received at all
+ * @retval	0 with the whole reference amplitude, full_scale without any, proportional in the middle
+ */
+uint16_t lockin_get_loss(TLockin *lockin, uint16_t full_scale);
+
+#endif /* INC_LOCKIN_H_ */
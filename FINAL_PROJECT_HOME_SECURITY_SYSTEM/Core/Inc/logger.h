@@ -2,9 +2,12 @@
  * This module contains methods to handle with the logger, represented with a structure holding:
  * 		a pointer to the UART_HandleTypeDef structure representing the UART interface used to print
  * 			the log messages
- * 		a pointer to the PIR sensor to print the status of
- * 		a pointer to the photoresistor to print the status of
- * 		a message to print
+ * 		the messages to print
+ * The periodic message shows the state of the area and of the barrier zones, taken from the sensor registry,
+ * the occupancy of the area, the highest activity duty cycle among its sensors, the active health faults,
+ * and the peak rate of the inputs and the storms of every sensor of the area.
+ * The event messages wait in a queue for the datetime, so the ones of the same tick are all printed.
+ * While the RTC is not responding the messages are printed at once, with the last datetime read.
  */
 
 #ifndef INC_LOGGER_H_
@@ -12,38 +15,43 @@
 
 #include "configuration.h"
 #include "console.h"
-#include "pir_sensor.h"
-#include "photoresistor.h"
+#include "sensor_registry.h"
+#include "user_directory.h"
 #include "datetime.h"
 #include "rtc_ds1307.h"
 #include "bool.h"
+#include "latency.h"
+#include "health.h"
+
+/* Event messages waiting for the datetime, the ones coming when the queue is full are dropped */
+#define LOGGER_QUEUE_SIZE		(8U)
 
 /*
  * @brief	This struct represents the logger,
  * 			encapsulating the UART interface used to print the log messages.
  * @param	huart			pointer to the UART_HandleTypeDef structure
  *							representing the UART interface used to print the log messages
- * @param	pir				pointer to the PIR sensor to print the status of
- * @param	duty_cycle		pointer to the photoresistor to print the status of
- * @param	message			message to print
+ * @param	messages		the event messages to print, in the order they came
+ * @param	first			index of the oldest message
+ * @param	count			number of messages to print
+ * @param	dropped			number of messages dropped because the queue was full
  */
 typedef struct {
 	UART_HandleTypeDef *huart;
-	TPIR_sensor *pir;
-	TPhotoresistor *photoresistor;
-	char *message;
+	const char *messages[LOGGER_QUEUE_SIZE];
+	uint8_t first;
+	volatile uint8_t count;
+	uint32_t dropped;
 } TLogger;
 
 /*
- *	@fn		void logger_init(TLogger *logger, UART_HandleTypeDef *huart, TPIR_sensor *pir, TPhotoresistor *photoresistor)
+ *	@fn		void logger_init(TLogger *logger, UART_HandleTypeDef *huart)
  *	@brief	Instantiates the logger
  *	@param	logger			pointer to the TLogger structure to store the parameters in
  *	@param	huart			pointer to the UART_HandleTypeDef structure
  *							representing the UART interface used to print the log messages
- *	@param	pir				pointer to the PIR sensor to print the status of
- *	@param	photoresistor	pointer to the photoresistor to print the status of
  */
-void logger_init(TLogger *logger, UART_HandleTypeDef *huart, TPIR_sensor *pir, TPhotoresistor *photoresistor);
+void logger_init(TLogger *logger, UART_HandleTypeDef *huart);
 
 /**
  * @fn	static void logger_show_event_message(TDatetime *datetime, const char *event_message)
@@ -69,16 +77,22 @@ static void logger_show_event_message(TDatetime *datetime, const char *event_mes
  */
 static void logger_show_periodic_message(TLogger *logger, TDatetime *datetime) {
 	char msg[512] = { '\0' };
-	char area_state[10] = { '\0' };
-	char barrier_state[10] = { '\0' };
+	char area_state[SENSOR_STATE_STRING_LENGTH] = { '\0' };
+	char barrier_state[SENSOR_STATE_STRING_LENGTH] = { '\0' };
+	char faults[64] = { '\0' };
+	char rates[128] = { '\0' };
 
-	PIR_get_string_state(logger->pir, area_state);
-	photoresistor_get_string_state(logger->photoresistor, barrier_state);
+	sensor_registry_get_string_state(USER_ZONE_AREA, area_state);
+	sensor_registry_get_string_state(USER_ZONE_BARRIER, barrier_state);
+	uint16_t occupancy = sensor_registry_get_duty(USER_ZONE_AREA);
+	health_get_string(faults, sizeof(faults));
+	sensor_registry_get_string_rates(USER_ZONE_AREA, rates, sizeof(rates));
 
-	sprintf(msg, (char*) "[%02u-%02u-%u%02u %02u:%02u:%02u] Area %s - Barrier %s\r\n",
+	sprintf(msg, (char*) "[%02u-%02u-%u%02u %02u:%02u:%02u] Area %s - Barrier %s - Occupancy %u.%u%% - Faults %s"
+			" - Rates %s\r\n",
 			datetime->date, datetime->month, datetime->year_prefix, datetime->year,
 			datetime->hour, datetime->minute, datetime->second,
-			area_state, barrier_state);
+			area_state, barrier_state, occupancy / 10U, occupancy % 10U, faults, rates);
 
 	print_message(msg);
 }
@@ -86,14 +100,16 @@ static void logger_show_periodic_message(TLogger *logger, TDatetime *datetime) {
 /*
  * @fn	void logger_callback(TLogger *logger)
  * @brief	This function is called every time the RTC is asked to get the datetime.
- * 			Automatically shows either the periodic log message or an aperiodic event message
+ * 			Automatically shows either the periodic log message or the aperiodic event messages queued
  * @param logger	pointer to the TLogger structure
  */
 void logger_callback(TLogger *logger);
 
 /*
  * @fn	void logger_print(TLogger *logger, char *event_message)
- * @brief	Sets a message to print in a TLogger structure, and shows the specific message
+ * @brief	Queues a message to print in a TLogger structure, and shows the messages queued.
+ * 			The datetime is asked to the RTC; if the RTC is not responding the messages are shown at once.
+ * 			An empty message asks for the periodic message, shown if no event message is queued.
  * @param	logger			pointer to the TLogger structure
  * @param	event_message	the message to print
  */
@@ -1,5 +1,19 @@
 /*
  *	This module contains methods to handle with a photoresistor
+ *	Every photoresistor is a channel of the scan of the ADC stream, with its own filter, window and state machine.
+ *	One of them can be critical: the hardware watchdog of the ADC watches its raw conversions too,
+ *	so an intruder is detected at the conversion, without waiting for the block.
+ *	The flicker of the lamps powered by the mains, at twice its frequency, is measured by a bank of Goertzel filters:
+ *	while it is strong, the values leaving the window are taken for an intruder only if the mean of their block
+ *	leaves the window too, since the flicker swings around the mean while an intruder moves it, and the hardware
+ *	watchdog is masked.
+ *	In lock-in mode the photoresistor receives the light of its own emitter, switched in step with the samples:
+ *	the value of a block is the share of the emitter amplitude lost since the start of the sampling, scaled to
+ *	the range of the ADC, so the ambient light is left out and the same thresholds hold at any beam distance.
+ *	With a calibration attached, the samples are corrected for the drift of the supply and of the temperature
+ *	before the filter, and the thresholds of the hardware watchdog are turned back into raw conversions.
+ *	With a history attached, the filtered value of every block is folded into it, marked as a light level or,
+ *	in lock-in mode, as a loss of the emitter.
  */
 
 #ifndef INC_PHOTORESISTOR_H_
@@ -9,53 +23,179 @@
 
 #include "stm32f4xx_hal.h"
 #include "adc.h"
+#include "adc_stream.h"
+#include "q15_filter.h"
+#include "goertzel.h"
+#include "lockin.h"
+#include "adc_calibration.h"
+#include "light_history.h"
 #include "buzzer.h"
 #include "sensors_state.h"
+#include "timer_wheel.h"
+#include "alarm_fsm.h"
+#include "sensor_registry.h"
+#include "health.h"
 
-/* Factor needed to be multiplied with the alarm duration/delay of the photoresistor in order check if the photoresistor
- * has reached the max time in alarmed/delayed state and then change its current state.
- * It depends on the photoresistor timer period T. For example, if T is 1  second and the photoresistor
- * ADC completes a conversione every 10ms, then ALARM_COUNTER_FACTOR is 10*/
-#define ALARM_COUNTER_FACTOR		(20)
+#define PHOTORESISTOR_OK				(0)
+#define PHOTORESISTOR_ERR_NO_LOCKIN		(-1)
+
+/* Stages of the filter of the samples: median of 3, moving average of 8, IIR with alpha 0.25 */
+#define PHOTORESISTOR_MEDIAN_LENGTH		(3U)
+#define PHOTORESISTOR_AVERAGE_LENGTH	(8U)
+#define PHOTORESISTOR_IIR_ALPHA			(8192)
+
+/* Largest value of the 12 bits conversions */
+#define PHOTORESISTOR_ADC_MAX		(4095U)
+
+/*
+ * The thresholds follow the ambient light: the baseline is an exponential moving average of the filtered values,
+ * updated at every block while the photoresistor is active, with a weight of 1 / 2^PHOTORESISTOR_BASELINE_SHIFT,
+ * about 100 seconds at the default rate of the ADC stream. It is frozen while an intruder may be in front of it.
+ * An intruder is detected above the baseline plus PHOTORESISTOR_DARK_MARGIN, and the intruder has gone away
+ * below the baseline plus PHOTORESISTOR_LIGHT_MARGIN. The first baseline gives the old fixed thresholds, 2500 and 1500.
+ * Above the first baseline the margins shrink with the room left up to PHOTORESISTOR_ADC_MAX, so the detection
+ * threshold stays reachable; when the dark margin falls below PHOTORESISTOR_MIN_DARK_MARGIN, the noise
+ * of the values can cross it, and the barrier window fault is raised until the ambient light goes down.
+ */
+#define PHOTORESISTOR_BASELINE_SHIFT	(11U)
+#define PHOTORESISTOR_INITIAL_BASELINE	(1200U)
+#define PHOTORESISTOR_DARK_MARGIN		(1300U)
+#define PHOTORESISTOR_LIGHT_MARGIN		(300U)
+#define PHOTORESISTOR_MIN_DARK_MARGIN	(200U)
+
+/* Smallest change of the detection threshold written to the window and to the watchdog registers */
+#define PHOTORESISTOR_THRESHOLD_STEP	(32U)
+
+/* Frequencies of the flicker of the lamps, at twice the frequency of the mains of 50 and 60 Hz, and their harmonics */
+#define PHOTORESISTOR_FLICKER_BINS		{ 100U, 120U, 200U, 240U }
+
+/* Smallest amplitude of the flicker, in steps of the ADC, that can move the filtered values out of the window */
+#define PHOTORESISTOR_FLICKER_MIN		(24U)
+
+/* Consecutive blocks of samples all at 0 or all at PHOTORESISTOR_ADC_MAX that raise the saturated fault,
+ * 5 seconds at the default rate of the ADC stream */
+#define PHOTORESISTOR_SATURATION_BLOCKS	(100U)
 
 /*
  * @brief	This struct represents the phoresistor's attributes.
- * 			It stores value read, alarm_delay, alarm_duration, counter, state, htim, hadc and buzzer.
- * @param	value 				value read from the photoresistor
- * @param	alarm_delay			the delay of the photoresistor
- * @param	alarm_duration		the alarm duration of photoresistor
- * @param	counter				value that count the time passed in alarmed/delayed state and
- * 								when reach the the max alarm duration/delay the photoresistor change the state respectively in active/alarmed state
+ * 			It stores value read, alarm_delay, alarm_duration, state, timers, hadc and buzzer.
+ * @param	value 				last filtered value read from the photoresistor
+ * @param	alarm_delay			the delay of the photoresistor, in milliseconds
+ * @param	alarm_duration		the alarm duration of photoresistor, in milliseconds
  * @param	state				current state of the sensor
- * @param	htim				the timer used by the photoresistor sensor
+ * @param	alarm_timer			the software timer counting the delay and the duration of the alarm
+ * @param	stream				the stream of conversions of the ADC, running while the photoresistor watches
  * @param	hadc				the adc used by the photoresistor sensor
+ * @param	channel				the channel of the ADC
+ * @param	index				the index of the channel in the scan of the stream
+ * @param	critical			TRUE if the hardware watchdog of the ADC watches the channel
+ * @param	filter				the filter of the samples, the state changes when a filtered value leaves the window
+ * @param	window_low			lowest value inside the window watched by the photoresistor
+ * @param	window_high			highest value inside the window watched by the photoresistor
+ * @param	baseline			the ambient light level, multiplied by 2^PHOTORESISTOR_BASELINE_SHIFT
+ * @param	baseline_primed		FALSE until the first block after the start of the sampling, that sets the baseline
+ * @param	flicker_bank		the Goertzel filters measuring the flicker on the samples
+ * @param	flicker				the amplitude of the strongest flicker in the last window of the bank, in steps of the ADC
+ * @param	flicker_rejects		number of blocks leaving the window only because of the flicker
+ * @param	lockin				the detector of the emitter of the barrier, NULL if there is none
+ * @param	lockin_on			TRUE in lock-in mode
+ * @param	calibration			the correction of the conversions of the ADC, NULL if there is none
+ * @param	calibration_updates	the updates of the correction already written to the watchdog thresholds
+ * @param	history				the history of the filtered values, NULL if there is none
  * @param	buzzer				the buzzer associated to the photoresistor
+ * @param	events				number of times the ADC watchdog has fired while the photoresistor was watching
+ * @param	alarms				number of times the photoresistor went in alarm
+ * @param	saturated_blocks	number of consecutive blocks at the limits of the ADC
  */
 typedef struct {
 	uint16_t value;
-	uint8_t alarm_delay;
-	uint8_t alarm_duration;
-	uint16_t counter;
+	uint32_t alarm_delay;
+	uint32_t alarm_duration;
 	TAlarmState state;
-	TIM_HandleTypeDef *htim;
+	TTimer alarm_timer;
+	TAdc_stream *stream;
 	ADC_HandleTypeDef *hadc;
+	uint32_t channel;
+	uint8_t index;
+	bool critical;
+	TQ15_filter filter;
+	uint16_t window_low;
+	uint16_t window_high;
+	uint32_t baseline;
+	bool baseline_primed;
+	TGoertzel flicker_bank;
+	uint16_t flicker;
+	uint32_t flicker_rejects;
+	TLockin *lockin;
+	bool lockin_on;
+	TAdc_calibration *calibration;
+	uint32_t calibration_updates;
+	TLight_history *history;
 	TBuzzer *buzzer;
-
+	uint32_t events;
+	uint32_t alarms;
+	uint16_t saturated_blocks;
 } TPhotoresistor;
 
+/* Operations of the photoresistors, to add them to the sensor registry */
+extern const TSensor_ops photoresistor_ops;
+
 /*
- * @fn 			void photoresistor_init(TPhotoresistor *photoresistor, uint8_t alarm_delay,
-										uint8_t alarm_duration, TIM_HandleTypeDef *htim, ADC_HandleTypeDef *hadc, TBuzzer *buzzer);
+ * @fn 			int photoresistor_init(TPhotoresistor *photoresistor, uint32_t alarm_delay,
+										uint32_t alarm_duration, TAdc_stream *stream, uint32_t channel, TBuzzer *buzzer);
  * @brief  		initialize the photoresistor module
  * @param   	photoresistor: reference to the photoresistor variable
- * @param   	alarm_delay: value of the alarm delay
- * @param   	alarm_duration: value of the alarm duration
- * @param   	htim: reference to the timer used for control the alarm duration
- * @param   	hadc: reference to the ADC who does the conversion
+ * @param   	alarm_delay: value of the alarm delay, in milliseconds
+ * @param   	alarm_duration: value of the alarm duration, in milliseconds
+ * @param   	stream: reference to the stream of the ADC who does the conversions, it gets the photoresistor as consumer
+ * @param   	channel: the channel of the ADC, as ADC_CHANNEL_0, with its pin in analog mode
  * @param 		buzzer: reference to the buzzer associated to the photoresistor
+ * @retval		a negative value if the channel cannot be added to the scan of the stream
+ */
+int photoresistor_init(TPhotoresistor *photoresistor, uint32_t alarm_delay,
+		uint32_t alarm_duration, TAdc_stream *stream, uint32_t channel, TBuzzer *buzzer);
+
+/*
+ * @fn 			void photoresistor_set_critical(TPhotoresistor *photoresistor)
+ * @brief  	 	moves the hardware watchdog of the ADC to the channel of the photoresistor, that becomes the critical one.
+ * 				Only one photoresistor of an ADC can be critical
+ * @param   	photoresistor: reference to the photoresistor variable
+ */
+void photoresistor_set_critical(TPhotoresistor *photoresistor);
+
+/*
+ * @fn 			void photoresistor_attach_lockin(TPhotoresistor *photoresistor, TLockin *lockin)
+ * @brief  	 	gives the photoresistor the detector of its emitter, without turning the lock-in mode on
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	lockin: reference to the initialized detector
+ */
+void photoresistor_attach_lockin(TPhotoresistor *photoresistor, TLockin *lockin);
+
+/*
+ * @fn 			int photoresistor_use_lockin(TPhotoresistor *photoresistor, bool on)
+ * @brief  	 	turns the lock-in mode on or off. The emitter is driven only in lock-in mode, and the channel
+ * 				must not be oversampled, the decimation would average the emitter away
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	on: TRUE to turn the mode on
+ * @retval  	PHOTORESISTOR_ERR_NO_LOCKIN if there is no detector, PHOTORESISTOR_OK otherwise
+ */
+int photoresistor_use_lockin(TPhotoresistor *photoresistor, bool on);
+
+/*
+ * @fn 			void photoresistor_attach_calibration(TPhotoresistor *photoresistor, TAdc_calibration *calibration)
+ * @brief  	 	corrects the next samples of the photoresistor with the calibration of its ADC
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	calibration: reference to the initialized calibration of the ADC of the stream
  */
-void photoresistor_init(TPhotoresistor *photoresistor, uint8_t alarm_delay,
-		uint8_t alarm_duration, TIM_HandleTypeDef *htim, ADC_HandleTypeDef *hadc, TBuzzer *buzzer);
+void photoresistor_attach_calibration(TPhotoresistor *photoresistor, TAdc_calibration *calibration);
+
+/*
+ * @fn 			void photoresistor_attach_history(TPhotoresistor *photoresistor, TLight_history *history)
+ * @brief  	 	folds the filtered value of the next blocks into a history, while the photoresistor samples
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	history: reference to the initialized history
+ */
+void photoresistor_attach_history(TPhotoresistor *photoresistor, TLight_history *history);
 
 /*
  * @fn 			void photoresistor_activate(TPhotoresistor* photoresistor)
@@ -72,50 +212,12 @@ void photoresistor_activate(TPhotoresistor *photoresistor);
 void photoresistor_deactivate(TPhotoresistor *photoresistor);
 
 /*
- * @fn 			static void photoresistor_change_state(TPhotoresistor *photoresistor, TAlarmState new_state)
- * @brief 		private function that change the state and threshold of ADC watchdog  associated with
- * 				the photoresitor according to the new state passed as parameter
- * @param		photoresistor: reference to the photoresistor variable
- * @param		new_state: the new state that the photoresistor must assume
+ * @fn 			void photoresistor_watchdog(TPhotoresistor *photoresistor)
+ * @brief  	 	updates the state of the photoresistor when the light level leaves the window:
+ * 				an intruder has been detected if the photoresistor is active, it has gone away if it is delayed
+ * @param   	photoresistor: reference to the photoresistor variable
  */
-static void photoresistor_change_state(TPhotoresistor *photoresistor,
-		TAlarmState new_state) {
-	TPulse pulse = buzzer_short_pulse();
-	switch (new_state) {
-	case ALARM_STATE_INACTIVE:
-		photoresistor->state = ALARM_STATE_INACTIVE;
-		photoresistor->counter = 0;
-		buzzer_decrease_pulse(photoresistor->buzzer, pulse);
-		HAL_ADC_Stop_DMA(photoresistor->hadc);
-		HAL_TIM_Base_Stop_IT(photoresistor->htim);
-		break;
-	case ALARM_STATE_ACTIVE:
-		photoresistor->state = ALARM_STATE_ACTIVE;
-		photoresistor->counter = 0;
-		buzzer_decrease_pulse(photoresistor->buzzer, pulse);
-		photoresistor->hadc->Instance->HTR = 2500; 	//detect low light level (with HTR) and
-		photoresistor->hadc->Instance->LTR = 0; 	//ignore high light level (with LTR) in order to detect an intruder
-		HAL_TIM_Base_Start_IT(photoresistor->htim);
-		break;
-	case ALARM_STATE_DELAYED:
-		photoresistor->state = ALARM_STATE_DELAYED;
-		photoresistor->hadc->Instance->HTR = 4095; 	// ignore low light level (HTR) because now we want to check
-		photoresistor->hadc->Instance->LTR = 1500; 	// if the intruder go away (photoresistor read LTR value) before that the state change to alarmed
-		photoresistor->counter = 0;
-		buzzer_decrease_pulse(photoresistor->buzzer, pulse);
-		break;
-	case ALARM_STATE_ALARMED:
-		photoresistor->state = ALARM_STATE_ALARMED;
-		photoresistor->hadc->Instance->HTR = 4095;  // here with HTR and LTR we ignore both low and high value of light beacuase
-		photoresistor->hadc->Instance->LTR = 0; 	// we are in alarmed state so the intruder is detected
-		photoresistor->counter = 0;
-		buzzer_increase_pulse(photoresistor->buzzer, pulse);
-		HAL_ADC_Stop_DMA(photoresistor->hadc);
-		break;
-	default:
-		break;
-	}
-}
+void photoresistor_watchdog(TPhotoresistor *photoresistor);
 
 /*
  * @fn 			void photoresistor_get_string_state(TPhotoresistor *photoresistor, char *barrier_state)
@@ -126,4 +228,13 @@ static void photoresistor_change_state(TPhotoresistor *photoresistor,
 void photoresistor_get_string_state(TPhotoresistor *photoresistor,
 		char *barrier_state);
 
+/*
+ * @fn 			void photoresistor_register_commands(TPhotoresistor *photoresistor, TShell *shell)
+ * @brief  	 	adds to the shell the command flicker, that shows the flicker measured on the photoresistor,
+ * 				and the command lockin [on|off], that shows and optionally changes the lock-in mode
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	shell: reference to the shell
+ */
+void photoresistor_register_commands(TPhotoresistor *photoresistor, TShell *shell);
+
 #endif /* INC_PHOTORESISTOR_H_ */
@@ -0,0 +1,86 @@
+/*
+ * This module groups up to PIR_ARRAY_ZONES_N PIR sensors in zones, one for each EXTI line.
+ * Every zone has its own delay and duration, and the zone of a pin is found in constant time through a table
+ * indexed by the line number, the same number used by the EXTI dispatcher to call the handler of the zone.
+ * The zones don't own a hardware timer: their delays, alarm durations and storm hold-offs are software timers
+ * of the timing wheel, all driven by the SysTick.
+ * The zones are activated, polled and reported through the sensor registry, where each one is added as a sensor.
+ */
+
+#ifndef INC_PIR_ARRAY_H_
+#define INC_PIR_ARRAY_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "pir_sensor.h"
+#include "shell.h"
+
+#define PIR_ARRAY_OK				(0)
+#define PIR_ARRAY_ERR_INVALID		(-1)
+#define PIR_ARRAY_ERR_BUSY			(-2)
+
+/* Maximum number of zones, one for each EXTI line */
+#define PIR_ARRAY_ZONES_N			(16U)
+
+/* Value of the table of the lines for the lines without a zone */
+#define PIR_ARRAY_NO_ZONE			(0xFFU)
+
+/*
+ * @brief	This struct represents the zones of PIR sensors.
+ * @param	zones			the sensors, in the order they have been added
+ * @param	zone_of_line	index of the zone of every EXTI line, PIR_ARRAY_NO_ZONE if the line has no zone
+ * @param	zones_n			number of zones added
+ */
+typedef struct {
+	TPIR_sensor zones[PIR_ARRAY_ZONES_N];
+	uint8_t zone_of_line[PIR_ARRAY_ZONES_N];
+	uint8_t zones_n;
+} TPIR_array;
+
+/*
+ * @fn		void PIR_array_init(TPIR_array *array)
+ * @brief	Initializes an array without zones
+ * @param	array	pointer to the TPIR_array structure to initialize
+ */
+void PIR_array_init(TPIR_array *array);
+
+/*
+ * @fn		int PIR_array_add(TPIR_array *array, uint32_t delay, uint32_t alarm_duration,
+ * 				IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer)
+ * @brief	Adds a zone, inactive, with a sensor on the given pin
+ * @param	array			pointer to the TPIR_array structure
+ * @param	delay			the alarm delay of the zone in milliseconds
+ * @param	alarm_duration	for how much time in milliseconds the zone will be in alarm state
+ * @param	irq				the irq of the line of the pin
+ * @param	port			the port which the sensor is connected to
+ * @param	pin				the pin which the sensor is connected to
+ * @param	buzzer			the buzzer associated to the zone
+ * @retval	PIR_ARRAY_ERR_INVALID if pin is not a single pin,
+ * 			PIR_ARRAY_ERR_BUSY if the line of the pin already has a zone,
+ * 			the index of the zone otherwise
+ */
+int PIR_array_add(TPIR_array *array, uint32_t delay, uint32_t alarm_duration,
+		IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer);
+
+/*
+ * @fn		TPIR_sensor* PIR_array_get_zone(TPIR_array *array, uint16_t pin)
+ * @brief	Returns the zone of a pin
+ * @param	array	pointer to the TPIR_array structure
+ * @param	pin		the pin, one of GPIO_PIN_0 ... GPIO_PIN_15
+ * @retval	the sensor of the zone, NULL if the line of the pin has no zone
+ */
+TPIR_sensor* PIR_array_get_zone(TPIR_array *array, uint16_t pin);
+
+/*
+ * @fn		void PIR_array_register_commands(TPIR_array *array, TShell *shell)
+ * @brief	Adds to the shell the command zones, that shows the line, the state, the delay, the duration,
+ * 			the interrupt rate and the activity of every zone
+ * @param	array	pointer to the TPIR_array structure
+ * @param	shell	pointer to the TShell structure
+ */
+void PIR_array_register_commands(TPIR_array *array, TShell *shell);
+
+#endif /* INC_PIR_ARRAY_H_ */
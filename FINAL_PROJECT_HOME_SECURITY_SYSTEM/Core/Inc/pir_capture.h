@@ -0,0 +1,136 @@
+/*
+ * This module timestamps the edges of the PIR output with a timer in input capture mode.
+ * The output is connected to the channel 2 of the timer, and it is captured twice: the rising edges by the channel 1
+ * (mapped on the same input) and the falling edges by the channel 2. So the direction of every edge is given
+ * by the hardware, and it is never guessed by reading the pin after the edge.
+ * Every capture is moved by the DMA into a circular ring: the firmware reads the edges in batches with
+ * PIR_capture_next_edge(), merged in time order, and gets the exact pulse widths and gaps.
+ * The DMA interrupts only at every half of a ring, to count the edges written. When more edges than a ring holds
+ * come between two reads, the oldest ones are overwritten: they are skipped and counted as lost.
+ * Every capture also raises the interrupt of the timer, which does nothing but wake the sleep of the main loop,
+ * so the main loop can sleep while the rings hold no edges to read.
+ * A tap can receive every edge as it is read, as the raw stream does.
+ */
+
+#ifndef INC_PIR_CAPTURE_H_
+#define INC_PIR_CAPTURE_H_
+
+#include <stdint.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+/* Number of edges of each direction the rings can hold before they are read. It must be a power of two */
+#define PIR_CAPTURE_RING_SIZE		(64U)
+
+/* Frequency of the counter of the timer, so the timestamps are in microseconds */
+#define PIR_CAPTURE_TICKS_PER_MS	(1000U)
+
+/*
+ * @brief	Function receiving the edges as they are read, from the main loop.
+ */
+typedef void (*TPIR_capture_tap)(void *context, bool rising, uint32_t time);
+
+/*
+ * @brief	This struct represents the capture of the edges of the PIR output.
+ * @param	htim				the timer capturing the rising edges on the channel 1 and the falling ones on the channel 2
+ * @param	rising				ring of the timestamps of the rising edges, written by the DMA
+ * @param	falling				ring of the timestamps of the falling edges, written by the DMA
+ * @param	rising_written		number of rising edges written by the DMA, at the last half of the ring it finished
+ * @param	falling_written		number of falling edges written by the DMA, at the last half of the ring it finished
+ * @param	rising_read			number of rising edges read, the next one is at this index modulo the size of the ring
+ * @param	falling_read		number of falling edges read, the next one is at this index modulo the size of the ring
+ * @param	edges				number of edges read
+ * @param	lost				number of edges overwritten in the rings before they were read
+ * @param	last_rising			timestamp of the last rising edge read
+ * @param	last_falling		timestamp of the last falling edge read
+ * @param	pulse_width			duration of the last pulse in microseconds
+ * @param	gap					time between the last two pulses in microseconds
+ * @param	min_pulse_width		shortest pulse in microseconds
+ * @param	max_pulse_width		longest pulse in microseconds
+ * @param	tap					the function receiving the edges, NULL if there is none
+ * @param	tap_context			the argument of the tap
+ */
+typedef struct {
+	TIM_HandleTypeDef *htim;
+	volatile uint32_t rising[PIR_CAPTURE_RING_SIZE];
+	volatile uint32_t falling[PIR_CAPTURE_RING_SIZE];
+	volatile uint32_t rising_written;
+	volatile uint32_t falling_written;
+	uint32_t rising_read;
+	uint32_t falling_read;
+	uint32_t edges;
+	uint32_t lost;
+	uint32_t last_rising;
+	uint32_t last_falling;
+	uint32_t pulse_width;
+	uint32_t gap;
+	uint32_t min_pulse_width;
+	uint32_t max_pulse_width;
+	TPIR_capture_tap tap;
+	void *tap_context;
+} TPIR_capture;
+
+/*
+ * @fn		void PIR_capture_init(TPIR_capture *capture, TIM_HandleTypeDef *htim)
+ * @brief	Initializes the capture, without starting it
+ * @param	capture		pointer to the TPIR_capture structure to initialize
+ * @param	htim		the timer, with the DMA streams of the channels 1 and 2 linked to it
+ */
+void PIR_capture_init(TPIR_capture *capture, TIM_HandleTypeDef *htim);
+
+/*
+ * @fn		void PIR_capture_start(TPIR_capture *capture)
+ * @brief	Starts the timer and the DMA streams filling the rings. Only one capture can run at a time
+ * @param	capture		pointer to the TPIR_capture structure
+ */
+void PIR_capture_start(TPIR_capture *capture);
+
+/*
+ * @fn		bool PIR_capture_next_edge(TPIR_capture *capture, bool *rising, uint32_t *time)
+ * @brief	Reads the oldest edge not read yet, updating the pulse statistics. The edges lost since the last call
+ * 			are skipped and counted
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	rising		set to TRUE if the edge is rising, FALSE if it is falling
+ * @param	time		set to the timestamp of the edge in microseconds
+ * @retval	TRUE if an edge has been read, FALSE if there are no new edges
+ */
+bool PIR_capture_next_edge(TPIR_capture *capture, bool *rising, uint32_t *time);
+
+/*
+ * @fn		uint32_t PIR_capture_to_tick(TPIR_capture *capture, uint32_t time)
+ * @brief	Converts the timestamp of an edge to the time base of HAL_GetTick(), going back from the current counter
+ * 			of the timer. The edge must be younger than a lap of the counter, about 71 minutes
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	time		the timestamp of the edge in microseconds
+ * @retval	the milliseconds of HAL_GetTick() at the edge
+ */
+uint32_t PIR_capture_to_tick(TPIR_capture *capture, uint32_t time);
+
+/*
+ * @fn		bool PIR_capture_has_edges(TPIR_capture *capture)
+ * @brief	Tells if the rings hold edges not read yet. Nothing is read or skipped
+ * @param	capture		pointer to the TPIR_capture structure
+ * @retval	TRUE if PIR_capture_next_edge() would read an edge, FALSE otherwise
+ */
+bool PIR_capture_has_edges(TPIR_capture *capture);
+
+/*
+ * @fn		void PIR_capture_set_tap(TPIR_capture *capture, TPIR_capture_tap tap, void *context)
+ * @brief	Hands every edge to a function as it is read by PIR_capture_next_edge()
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	tap			the function receiving the edges, NULL to remove it
+ * @param	context		the argument of the function
+ */
+void PIR_capture_set_tap(TPIR_capture *capture, TPIR_capture_tap tap, void *context);
+
+/*
+ * @fn		void PIR_capture_register_commands(TPIR_capture *capture, TShell *shell)
+ * @brief	Adds to the shell the command pir, that shows the number of edges read and lost and the pulse statistics
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	shell		pointer to the TShell structure
+ */
+void PIR_capture_register_commands(TPIR_capture *capture, TShell *shell);
+
+#endif /* INC_PIR_CAPTURE_H_ */
@@ -14,95 +14,137 @@
 #include "gpio.h"
 #include "sensors_state.h"
 #include "buzzer.h"
+#include "exti_dispatcher.h"
+#include "pir_capture.h"
+#include "timer_wheel.h"
+#include "alarm_fsm.h"
+#include "sensor_registry.h"
 #include "string.h"
 
+/*
+ * Storm protection: if a sensor has more than PIR_STORM_THRESHOLD edges in PIR_STORM_WINDOW milliseconds,
+ * its line is masked and its edges are dropped for PIR_STORM_HOLDOFF milliseconds
+ */
+#define PIR_STORM_WINDOW			(100U)
+#define PIR_STORM_THRESHOLD			(20U)
+#define PIR_STORM_HOLDOFF			(2000U)
+
+/*
+ * Activity estimation: every PIR_ACTIVITY_PERIOD milliseconds the fraction of the period the output has been high
+ * is folded in an exponentially weighted average, with weight 1/2^PIR_ACTIVITY_SHIFT (a time constant of about
+ * one minute), and the rising edges are counted in fixed windows of PIR_ACTIVITY_WINDOW periods
+ */
+#define PIR_ACTIVITY_PERIOD			(1000U)
+#define PIR_ACTIVITY_SHIFT			(6U)
+#define PIR_ACTIVITY_WINDOW			(60U)
+
+/* An output held high for more than PIR_STUCK_TIME milliseconds raises a health fault, cleared by its falling edge */
+#define PIR_STUCK_TIME				(300000U)
+
+/* Fixed point value of a duty cycle of 100% */
+#define PIR_DUTY_ONE				(65536L)
+
+/* Maximum length of the event logged at the end of a storm */
+#define PIR_STORM_MESSAGE_LENGTH	(48U)
+
 /**
  * @brief 			Structure that holds the configuration parameters of the PIR sensor. This structure allows the installation of multiple sensor
  * 						with small modifications.
- * @param alarm_delay		the delay of the sensor
- * @param remaining_delay	counter of the remaining delay
+ * @param alarm_delay		the delay of the sensor, in milliseconds
  * @param state				current state of the sensor
- * @param alarm_duration	the alarm duration. Remaining duration isn't necessary
+ * @param alarm_duration	the alarm duration, in milliseconds. Remaining duration isn't necessary
  * @param irq				the IRQn which is dedicated to the sensor
  * @param port				the port which the sensor is connected to
  * @param pin				the pin which the sensor is connected to
- * @param timer				the timer used by the pir sensor
+ * @param timer				the software timer counting the delay and the duration of the alarm
  * @param buzzer			the buzzer associated to the sensor
+ * @param capture			the input capture timestamping the edges, NULL if the sensor uses its EXTI line
+ * @param retrigger			set when the sensor is activated while its output is still high, or when captured edges
+ * 							are lost, in capture mode
+ * @param storming			TRUE while the line is masked by the storm protection
+ * @param storm_timer		the software timer releasing the line at the end of the storm
+ * @param window_start		time at which the current window of the storm protection started
+ * @param window_edges		number of edges in the current window
+ * @param suppressed		number of edges dropped since the line has been masked
+ * @param edges				number of edges since the initialization
+ * @param storms			number of times the line has been masked
+ * @param storm_message		the message logged at the end of a storm, the logger keeps a reference to it
+ * @param peak_edges		maximum number of edges in a window
+ * @param alarms			number of times the sensor went in alarm
+ * @param motion			level of the output after the last edge processed
+ * @param motion_since		time of the last edge processed, or of the last activity period
+ * @param high_time			milliseconds the output has been high in the current activity period
+ * @param duty				exponentially weighted duty cycle of the output, PIR_DUTY_ONE is 100%
+ * @param activity_timer	the software timer closing the activity periods
+ * @param window_periods	number of activity periods in the current window
+ * @param window_events		number of rising edges in the current window
+ * @param event_rate		number of rising edges in the last complete window
+ * @param high_since		time of the last rising edge processed, to find an output stuck high
+ * @param stuck				TRUE while the stuck fault of the sensor is raised
  */
 typedef struct PIR_sensor {
-	uint8_t alarm_delay;
-	uint8_t remaining_delay;
-	uint8_t state;
-	uint8_t alarm_duration;
+	uint32_t alarm_delay;
+	TAlarmState state;
+	uint32_t alarm_duration;
 	IRQn_Type irq;
 	GPIO_TypeDef *port;
 	uint16_t pin;
-	TIM_HandleTypeDef *timer;
+	TTimer timer;
 	TBuzzer *buzzer;
+	TPIR_capture *capture;
+	volatile bool retrigger;
+	volatile bool storming;
+	TTimer storm_timer;
+	uint32_t window_start;
+	uint16_t window_edges;
+	uint32_t suppressed;
+	uint32_t edges;
+	uint32_t storms;
+	char storm_message[PIR_STORM_MESSAGE_LENGTH];
+	uint16_t peak_edges;
+	uint32_t alarms;
+	bool motion;
+	uint32_t motion_since;
+	uint32_t high_time;
+	int32_t duty;
+	TTimer activity_timer;
+	uint8_t window_periods;
+	uint32_t window_events;
+	uint32_t event_rate;
+	uint32_t high_since;
+	bool stuck;
 } TPIR_sensor;
 
+/* Operations of the PIR sensors, to add them to the sensor registry */
+extern const TSensor_ops PIR_sensor_ops;
 
-/*
- * @fn       static void PIR_change_state(TPIR_sensor *pir, TAlarmState new_state)
- * @brief    private function that change the state of the pir sensor according to the new state passed as parameter. This funcion will also disable
- * 				the corresponing IRQ and the buzzer
- * @param    pir: reference to the pir structure which needs the state to be changed
- * @param    new_state: the new state that the pir sensor must assume
- */
-static void PIR_change_state(TPIR_sensor *pir, TAlarmState new_state) {
-	// Get the pulse associated to the pir sensor.
-	TPulse pulse = buzzer_medium_pulse();
-
-	switch (new_state) {
-	case ALARM_STATE_INACTIVE:
-		HAL_TIM_Base_Stop_IT(pir->timer);
-		HAL_NVIC_DisableIRQ(pir->irq);
-		buzzer_decrease_pulse(pir->buzzer, pulse);
-		break;
-	case ALARM_STATE_ACTIVE:
-		HAL_TIM_Base_Stop_IT(pir->timer);
-		HAL_NVIC_EnableIRQ(pir->irq);
-		pir->remaining_delay = pir->alarm_delay;
-		buzzer_decrease_pulse(pir->buzzer, pulse);
-		if (HAL_GPIO_ReadPin(pir->port, pir->pin) == GPIO_PIN_SET) {
-			//if the sensor is still high, retrigger the interrupt
-			HAL_NVIC_SetPendingIRQ(pir->irq);
-		}
-		break;
-	case ALARM_STATE_DELAYED:
-		pir->timer->Instance->CNT = 0;
-		HAL_TIM_Base_Start_IT(pir->timer);
-		pir->remaining_delay = pir->alarm_delay;
-		buzzer_decrease_pulse(pir->buzzer, pulse);
-		break;
-	case ALARM_STATE_ALARMED:
-		buzzer_increase_pulse(pir->buzzer, pulse);
-		break;
-	default:
-		break;
-	}
-	pir->state = new_state;
-}
 
 
 /**
- * @fn 		PIR_sensor_init(TPIR_sensor *pir, uint8_t delay, uint8_t alarm_duration,
-							IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin,
-							TIM_HandleTypeDef *timer, TBuzzer *buzzer)
+ * @fn 		PIR_sensor_init(TPIR_sensor *pir, uint32_t delay, uint32_t alarm_duration,
+							IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer)
  * @brief Initialize a pir sensor with the given parameters.
  * @param pir				the structure which will hold the sensor
- * @param delay				the alarm_delay in second. If zero, this will be set to NO_DELAY value
- * @param alarm_duration 	for how much time in seconds the sensor will be in alarm state
+ * @param delay				the alarm_delay in milliseconds. If zero, this will be set to NO_DELAY value
+ * @param alarm_duration 	for how much time in milliseconds the sensor will be in alarm state
  * @param irq		 		the irq corresponding to the port of the pir sensor
  * @param port				the port which the sensor is connected to
  * @param pin				the port which the sensor is connected to
- * @param timer 			the timer dedicated to the sensor
  * @param buzzer			the buzzer associated to the sensor
  * @return None
  */
-void PIR_sensor_init(TPIR_sensor *pir, uint8_t delay, uint8_t alarm_duration,
-		IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin,
-		TIM_HandleTypeDef *timer, TBuzzer *buzzer);
+void PIR_sensor_init(TPIR_sensor *pir, uint32_t delay, uint32_t alarm_duration,
+		IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer);
+
+/**
+ * @fn 			void PIR_sensor_attach_capture(TPIR_sensor *pir, TPIR_capture *capture)
+ * @brief		Moves the sensor from its EXTI line to an input capture, and starts it. The edges are then
+ * 				read in batches by PIR_sensor_process(), with the direction given by the timer.
+ * @param pir		the structure of the sensor
+ * @param capture	the capture, already initialized, on the pin of the sensor
+ * @return 		None
+ */
+void PIR_sensor_attach_capture(TPIR_sensor *pir, TPIR_capture *capture);
 
 /**
  * @fn 			void PIR_sensor_activate(TPIR_sensor *pir)
@@ -129,12 +171,21 @@ void PIR_sensor_deactivate(TPIR_sensor *pir);
 void PIR_sensor_handler(TPIR_sensor *pir);
 
 /**
- * @fn			PIR_time_elapsed(TPIR_sensor *pir)
- * @brief 		ISR of the associated timer. This will reduce the remaing delay or the duration of the alarm
- * @param pir 	the structure of the pin which is currently on alarm or delayed state
- * @retval 		None
+ * @fn 			PIR_sensor_process(TPIR_sensor *pir)
+ * @brief 		Processes the edges captured since the last call. It must be called in the main loop
+ * 				when the sensor uses an input capture, otherwise it does nothing.
+ * @param pir 	the structure of the sensor
+ * @retval		None
+ */
+void PIR_sensor_process(TPIR_sensor *pir);
+
+/**
+ * @fn 			uint16_t PIR_sensor_get_duty(TPIR_sensor *pir)
+ * @brief 		Returns the exponentially weighted duty cycle of the output of the sensor, updated while it is not inactive
+ * @param pir 	the structure of the sensor
+ * @retval		the duty cycle, in thousandths
  */
-void PIR_time_elapsed();
+uint16_t PIR_sensor_get_duty(TPIR_sensor *pir);
 
 /*
  * @fn        PIR_get_string_state(TPIR_sensor *pir, char *area_state)
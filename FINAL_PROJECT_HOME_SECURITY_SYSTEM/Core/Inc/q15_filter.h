@@ -0,0 +1,122 @@
+/*
+ * This module filters blocks of 12 bits ADC samples in Q15 fixed point, with three stages in a row:
+ * 		a median of 3 or 5 samples, removing the single spikes
+ * 		a moving average of a power of two of samples, smoothing the noise
+ * 		a first order IIR low pass, y += alpha * (x - y), following the slow changes
+ * The samples are scaled to Q15 by a shift of 3 bits, so the filtered values come back to the ADC scale
+ * with Q15_FILTER_TO_ADC. On the Cortex-M4 the median and the average handle two samples per instruction
+ * with the SIMD instructions of the DSP extension; elsewhere the same operations are done one half at a time,
+ * with the same results bit by bit.
+ * The filtered values are checked against the window of the barrier in the same way, two of them at a time.
+ */
+
+#ifndef INC_Q15_FILTER_H_
+#define INC_Q15_FILTER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+#define Q15_FILTER_OK				(0)
+#define Q15_FILTER_ERR_INVALID		(-1)
+
+/* Longest median, it must be odd */
+#define Q15_FILTER_MAX_MEDIAN		(5U)
+
+/* Longest moving average, it must be a power of two */
+#define Q15_FILTER_MAX_AVERAGE		(16U)
+
+/* Samples filtered in one pass, longer blocks are filtered in more passes */
+#define Q15_FILTER_MAX_BLOCK		(32U)
+
+/* Resolution of the samples of the ADC, and conversions between them and Q15 */
+#define Q15_FILTER_ADC_BITS			(12U)
+#define Q15_FILTER_FROM_ADC(sample)	((int16_t) ((sample) << 3))
+#define Q15_FILTER_TO_ADC(value)	((uint16_t) ((value) >> 3))
+
+/*
+ * @brief	This struct represents a filter and the samples it remembers between the blocks.
+ * @param	median_length		samples of the median, 1, 3 or 5, 1 turns the stage off
+ * @param	average_length		samples of the moving average, a power of two up to Q15_FILTER_MAX_AVERAGE,
+ * 								1 turns the stage off
+ * @param	average_shift		log2 of average_length
+ * @param	iir_alpha			coefficient of the IIR in Q15, 0 turns the stage off
+ * @param	input_shift			shift of the samples to Q15, 3 for the samples of the ADC
+ * @param	primed				FALSE until the first sample, that fills the history
+ * @param	input_history		last input samples of the previous block, for the median
+ * @param	median_history		last outputs of the median of the previous block, for the moving average
+ * @param	iir_state			last output of the IIR
+ */
+typedef struct {
+	uint8_t median_length;
+	uint8_t average_length;
+	uint8_t average_shift;
+	int16_t iir_alpha;
+	uint8_t input_shift;
+	bool primed;
+	int16_t input_history[Q15_FILTER_MAX_MEDIAN - 1];
+	int16_t median_history[Q15_FILTER_MAX_AVERAGE - 1];
+	int16_t iir_state;
+} TQ15_filter;
+
+/*
+ * @fn		int q15_filter_init(TQ15_filter *filter, uint8_t median_length, uint8_t average_length, int16_t iir_alpha)
+ * @brief	Sets the stages of the filter and forgets the previous samples. The samples have Q15_FILTER_ADC_BITS bits
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	median_length	samples of the median, 1, 3 or 5
+ * @param	average_length	samples of the moving average, a power of two up to Q15_FILTER_MAX_AVERAGE
+ * @param	iir_alpha		coefficient of the IIR in Q15, from 0 to 32767
+ * @retval	Q15_FILTER_ERR_INVALID if a length is not allowed, Q15_FILTER_OK otherwise
+ */
+int q15_filter_init(TQ15_filter *filter, uint8_t median_length, uint8_t average_length, int16_t iir_alpha);
+
+/*
+ * @fn		void q15_filter_reset(TQ15_filter *filter)
+ * @brief	Forgets the previous samples: the next sample fills the history, so the output does not ramp from 0
+ * @param	filter			pointer to the TQ15_filter structure
+ */
+void q15_filter_reset(TQ15_filter *filter);
+
+/*
+ * @fn		int q15_filter_set_resolution(TQ15_filter *filter, uint8_t bits)
+ * @brief	Sets the resolution of the next samples, that keep the same full scale in Q15, so the history is not lost
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	bits			bits of the samples, from Q15_FILTER_ADC_BITS to 15
+ * @retval	Q15_FILTER_ERR_INVALID if the resolution is not allowed, Q15_FILTER_OK otherwise
+ */
+int q15_filter_set_resolution(TQ15_filter *filter, uint8_t bits);
+
+/*
+ * @fn		void q15_filter_block(TQ15_filter *filter, const uint16_t *samples, int16_t *output, uint16_t length)
+ * @brief	Filters a block of samples
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	samples			the samples of the ADC, with the resolution set by q15_filter_set_resolution
+ * @param	output			where to write the filtered values in Q15, as many as the samples
+ * @param	length			number of samples
+ */
+void q15_filter_block(TQ15_filter *filter, const uint16_t *samples, int16_t *output, uint16_t length);
+
+/*
+ * @fn		int32_t q15_filter_find_outside(const int16_t *values, uint16_t length, int16_t low, int16_t high)
+ * @brief	Looks for the first value outside a window, checking two values per instruction
+ * @param	values			the values in Q15, not negative
+ * @param	length			number of values
+ * @param	low				lowest value inside the window, not negative
+ * @param	high			highest value inside the window, not negative
+ * @retval	the index of the first value lower than low or greater than high, -1 if all of them are inside
+ */
+int32_t q15_filter_find_outside(const int16_t *values, uint16_t length, int16_t low, int16_t high);
+
+/*
+ * @fn		void q15_filter_register_commands(TQ15_filter *filter, TShell *shell)
+ * @brief	Adds to the shell the command filter [median average alpha], that shows and optionally changes the stages
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	shell			pointer to the TShell structure
+ */
+void q15_filter_register_commands(TQ15_filter *filter, TShell *shell);
+
+#endif /* INC_Q15_FILTER_H_ */
@@ -0,0 +1,191 @@
+/*
+ * This module streams the raw samples of the ADC and the edges of the PIR off the board, for the commissioning.
+ * While it runs, the console is muted and its UART carries binary packets, at a rate higher than the one of the
+ * console: every block of the ADC, as the DMA wrote it, every few edges of the PIR, and every RAW_STREAM_STATS_PERIOD
+ * milliseconds the statistics of the stream. A packet is a header, the payload and a CRC, all little endian:
+ * 		type		uint8, one of RAW_STREAM_PACKET_ADC, RAW_STREAM_PACKET_PIR, RAW_STREAM_PACKET_STATS
+ * 		info		uint8, the channels interleaved in the samples of an ADC packet, 0 otherwise
+ * 		sequence	uint16, incremented for every packet, even for the dropped ones, so the receiver sees the losses
+ * 		tick		uint32, HAL_GetTick() when the packet has been made
+ * 		payload		the samples as uint16; the edges as a uint32 timestamp in microseconds and a uint8, 1 if rising;
+ * 					or the statistics, see RAW_STREAM_PACKET_STATS
+ * 		crc			uint16, CRC-16/CCITT-FALSE of the header and of the payload
+ * Each packet is COBS encoded, so it holds no zero byte, and it is followed by a zero: a receiver finds the start
+ * of the next packet after any loss. The encoded packets are appended to one of two buffers while the DMA sends
+ * the other one, and the interrupt at the end of a transfer starts the next buffer at once, so the line stays busy.
+ * A packet that does not fit in the buffer is dropped and counted.
+ * The receiver stops the stream by sending "stream off" at the rate of the stream: the console is then restored.
+ */
+
+#ifndef INC_RAW_STREAM_H_
+#define INC_RAW_STREAM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "console.h"
+#include "adc_stream.h"
+#include "pir_capture.h"
+#include "timer_wheel.h"
+#include "shell.h"
+
+#define RAW_STREAM_OK				(0)
+#define RAW_STREAM_ERR_INVALID		(-1)
+#define RAW_STREAM_ERR_BUSY			(-2)
+
+/* Rates of the stream: 2 Mbaud is exact with the 42 MHz clock of APB1, the highest one is a sixteenth of it */
+#define RAW_STREAM_MIN_BAUD			(9600UL)
+#define RAW_STREAM_DEFAULT_BAUD		(2000000UL)
+
+/* Bytes of each of the two buffers, at least one encoded packet of the largest size must fit */
+#define RAW_STREAM_BUFFER_SIZE		(1024U)
+
+/* Time between two packets of statistics in milliseconds */
+#define RAW_STREAM_STATS_PERIOD		(1000U)
+
+/* Edges of the PIR gathered in a packet, a packet is sent anyway at every round of the main loop */
+#define RAW_STREAM_MAX_EDGES		(32U)
+#define RAW_STREAM_EDGE_SIZE		(5U)
+
+/* Sizes of a packet before the encoding */
+#define RAW_STREAM_HEADER_SIZE		(8U)
+#define RAW_STREAM_CRC_SIZE			(2U)
+#define RAW_STREAM_MAX_PAYLOAD		(ADC_STREAM_BLOCK_SIZE * ADC_STREAM_MAX_CHANNELS * sizeof(uint16_t))
+#define RAW_STREAM_MAX_PACKET		(RAW_STREAM_HEADER_SIZE + RAW_STREAM_MAX_PAYLOAD + RAW_STREAM_CRC_SIZE)
+
+/* Largest size of a packet of n bytes once encoded: a code every 254 bytes, the first code and the zero after it */
+#define RAW_STREAM_ENCODED_SIZE(n)	((n) + (n) / 254U + 2U)
+
+/*
+ * Types of the packets. The payload of the statistics is made of the packets made and dropped since the start,
+ * the bytes sent, all uint32, the use of the UART in the last period in thousandths, uint16, and the overruns
+ * of the ADC since its start, uint32
+ */
+enum {
+	RAW_STREAM_PACKET_ADC = 1,
+	RAW_STREAM_PACKET_PIR,
+	RAW_STREAM_PACKET_STATS
+};
+
+#define RAW_STREAM_STATS_SIZE		(18U)
+
+/*
+ * @brief	This struct represents the raw stream.
+ * @param	huart		the UART of the console, carrying the packets while the stream runs
+ * @param	adc			the stream of the ADC, whose blocks are sent
+ * @param	capture		the capture of the PIR, whose edges are sent
+ * @param	timer		the periodic timer of the statistics
+ * @param	due			TRUE when the statistics must be sent, set by the timer
+ * @param	running		TRUE while the stream runs
+ * @param	baud		the rate of the stream
+ * @param	console_baud	the rate of the console, restored when the stream stops
+ * @param	buffers		the two buffers of encoded packets, in turn one is filled and the other one is sent
+ * @param	lengths		bytes of the buffers
+ * @param	frames		packets of the buffers
+ * @param	fill		the buffer being filled
+ * @param	busy		TRUE while the DMA sends a buffer
+ * @param	appending	TRUE while a packet is appended, the interrupt does not take the buffer being filled then
+ * @param	sending		bytes of the buffer sent by the DMA
+ * @param	packet		the packet being made, before its encoding
+ * @param	edges		the edges of the PIR not sent yet
+ * @param	edges_n		number of edges not sent yet
+ * @param	sequence	the sequence number of the next packet
+ * @param	packets		number of packets made since the start
+ * @param	dropped		number of packets dropped since the start
+ * @param	bytes		number of bytes sent since the start
+ * @param	period_bytes	number of bytes sent since the last statistics
+ * @param	start		HAL_GetTick() at the start
+ * @param	stop		HAL_GetTick() at the stop
+ */
+typedef struct {
+	UART_HandleTypeDef *huart;
+	TAdc_stream *adc;
+	TPIR_capture *capture;
+	TTimer timer;
+	volatile bool due;
+	bool running;
+	uint32_t baud;
+	uint32_t console_baud;
+	uint8_t buffers[2][RAW_STREAM_BUFFER_SIZE];
+	volatile uint16_t lengths[2];
+	volatile uint16_t frames[2];
+	volatile uint8_t fill;
+	volatile bool busy;
+	volatile bool appending;
+	volatile uint16_t sending;
+	uint8_t packet[RAW_STREAM_MAX_PACKET];
+	uint8_t edges[RAW_STREAM_MAX_EDGES * RAW_STREAM_EDGE_SIZE];
+	uint8_t edges_n;
+	uint16_t sequence;
+	uint32_t packets;
+	volatile uint32_t dropped;
+	volatile uint32_t bytes;
+	volatile uint32_t period_bytes;
+	uint32_t start;
+	uint32_t stop;
+} TRaw_stream;
+
+/*
+ * @fn		void raw_stream_init(TRaw_stream *stream, UART_HandleTypeDef *huart, TAdc_stream *adc,
+ * 				TPIR_capture *capture)
+ * @brief	Initializes the stream, without starting it. The timer wheel must be initialized
+ * @param	stream		pointer to the TRaw_stream structure to initialize
+ * @param	huart		the UART of the console
+ * @param	adc			the stream of the ADC
+ * @param	capture		the capture of the PIR
+ */
+void raw_stream_init(TRaw_stream *stream, UART_HandleTypeDef *huart, TAdc_stream *adc, TPIR_capture *capture);
+
+/*
+ * @fn		int raw_stream_start(TRaw_stream *stream, uint32_t baud)
+ * @brief	Waits for the console to be free, mutes it and starts sending the packets at the given rate
+ * @param	stream		pointer to the TRaw_stream structure
+ * @param	baud		the rate, from RAW_STREAM_MIN_BAUD to a sixteenth of the clock of the UART
+ * @retval	RAW_STREAM_OK, RAW_STREAM_ERR_BUSY if the stream runs, RAW_STREAM_ERR_INVALID if the rate is out of range
+ */
+int raw_stream_start(TRaw_stream *stream, uint32_t baud);
+
+/*
+ * @fn		void raw_stream_stop(TRaw_stream *stream)
+ * @brief	Sends the last edges and statistics, waits for the buffers to be sent,
+ * 			and restores the console at its rate
+ * @param	stream		pointer to the TRaw_stream structure
+ */
+void raw_stream_stop(TRaw_stream *stream);
+
+/*
+ * @fn		bool raw_stream_transmit_callback(UART_HandleTypeDef *huart)
+ * @brief	Starts sending the next buffer. It must be called by HAL_UART_TxCpltCallback
+ * @param	huart		the UART of the callback
+ * @retval	TRUE if the transfer belonged to the running stream, FALSE otherwise
+ */
+bool raw_stream_transmit_callback(UART_HandleTypeDef *huart);
+
+/*
+ * @fn		void raw_stream_process(TRaw_stream *stream)
+ * @brief	Sends the edges gathered and the statistics when they are due. It must be called by the main loop
+ * @param	stream		pointer to the TRaw_stream structure
+ */
+void raw_stream_process(TRaw_stream *stream);
+
+/*
+ * @fn		bool raw_stream_is_pending(TRaw_stream *stream)
+ * @brief	Tells if some edges or the statistics are waiting for raw_stream_process
+ * @param	stream		pointer to the TRaw_stream structure
+ * @retval	TRUE if raw_stream_process has something to do, FALSE otherwise
+ */
+bool raw_stream_is_pending(TRaw_stream *stream);
+
+/*
+ * @fn		void raw_stream_register_commands(TRaw_stream *stream, TShell *shell)
+ * @brief	Adds to the shell the command stream [on [baud] | off], that starts or stops the stream,
+ * 			and shows the losses and the use of the UART of the last one
+ * @param	stream		pointer to the TRaw_stream structure
+ * @param	shell		pointer to the TShell structure
+ */
+void raw_stream_register_commands(TRaw_stream *stream, TShell *shell);
+
+#endif /* INC_RAW_STREAM_H_ */
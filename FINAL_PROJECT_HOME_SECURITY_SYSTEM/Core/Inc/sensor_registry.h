@@ -0,0 +1,216 @@
+/*
+ * This module keeps the sensors of the system in a static registry, behind a common interface.
+ * Every sensor type offers a table of operations (activate, deactivate, poll, state, stats, signal), and every
+ * instance is registered once during the initialization with its name and the zones it belongs to.
+ * The keypad, the logger, the main loop and the interrupts then work on zones through the registry,
+ * without knowing which sensors are installed.
+ * Arming a zone applies the timing profile of the zone to its sensors, and activates them after the exit delay.
+ */
+
+#ifndef INC_SENSOR_REGISTRY_H_
+#define INC_SENSOR_REGISTRY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "sensors_state.h"
+#include "shell.h"
+#include "timer_wheel.h"
+#include "zone_profile.h"
+
+#define SENSOR_REGISTRY_OK				(0)
+#define SENSOR_REGISTRY_ERR_INVALID		(-1)
+#define SENSOR_REGISTRY_ERR_FULL		(-2)
+
+/* Maximum number of sensors */
+#define SENSOR_REGISTRY_SIZE			(32U)
+
+/* Length of the strings written by sensor_registry_get_string_state(), terminator included */
+#define SENSOR_STATE_STRING_LENGTH		(10U)
+
+/*
+ * @brief	This struct holds the counters of a sensor.
+ * @param	events	number of inputs received by the sensor, e.g. the edges of a PIR sensor
+ * @param	alarms	number of times the sensor went in alarm
+ * @param	duty	fraction of time the sensor detects some activity, in thousandths, 0 if it is not estimated
+ * @param	rate	number of detections in the last window of the sensor, 0 if it is not estimated
+ * @param	peak_rate	highest rate of the inputs, in inputs per second, 0 if it is not measured
+ * @param	storms	number of times the inputs have been masked for coming too fast
+ */
+typedef struct {
+	uint32_t events;
+	uint32_t alarms;
+	uint16_t duty;
+	uint32_t rate;
+	uint32_t peak_rate;
+	uint32_t storms;
+} TSensor_stats;
+
+/*
+ * @brief	This struct holds the operations of a sensor type. They receive the instance given to sensor_registry_add().
+ * @param	activate	starts watching, from any state
+ * @param	deactivate	stops watching and the alarm, from any state
+ * @param	poll		processes the inputs of the sensor in the main loop, NULL if not needed
+ * @param	state		returns the current state
+ * @param	stats		fills the counters of the sensor
+ * @param	signal		called in an interrupt shared by the sensors, with the handle of the peripheral that raised it.
+ * 						The sensor must ignore the peripherals it doesn't own. NULL if not needed
+ * @param	set_timing	sets the delay and the duration of the alarm, in milliseconds, NULL if the sensor has no timing
+ * @param	busy		tells if the sensor must be polled, so the core can't stop the SysTick. NULL if it is never busy
+ */
+typedef struct {
+	void (*activate)(void *sensor);
+	void (*deactivate)(void *sensor);
+	void (*poll)(void *sensor);
+	TAlarmState (*state)(void *sensor);
+	void (*stats)(void *sensor, TSensor_stats *stats);
+	void (*signal)(void *sensor, void *source);
+	void (*set_timing)(void *sensor, uint32_t delay, uint32_t duration);
+	bool (*busy)(void *sensor);
+} TSensor_ops;
+
+/*
+ * @brief	This struct represents a registered sensor.
+ * @param	ops			the operations of the type of the sensor
+ * @param	instance	the structure of the sensor, passed to the operations
+ * @param	name		name shown by the command sensors
+ * @param	zones		mask of the zones of the sensor, the same bits as USER_ZONE_AREA, USER_ZONE_BARRIER ...
+ * @param	exit_timer	the software timer activating the sensor at the end of the exit delay
+ */
+typedef struct {
+	const TSensor_ops *ops;
+	void *instance;
+	const char *name;
+	uint16_t zones;
+	TTimer exit_timer;
+} TSensor;
+
+/*
+ * @fn		void sensor_registry_init()
+ * @brief	Empties the registry. It must be called before any sensor is added.
+ */
+void sensor_registry_init();
+
+/*
+ * @fn		int sensor_registry_add(const TSensor_ops *ops, void *instance, const char *name, uint16_t zones)
+ * @brief	Adds a sensor, already initialized, to the registry
+ * @param	ops			the operations of the type of the sensor
+ * @param	instance	the structure of the sensor
+ * @param	name		name of the sensor, it must be a constant string
+ * @param	zones		mask of the zones of the sensor
+ * @retval	SENSOR_REGISTRY_ERR_INVALID if a mandatory operation is missing,
+ * 			SENSOR_REGISTRY_ERR_FULL if there are already SENSOR_REGISTRY_SIZE sensors,
+ * 			the index of the sensor otherwise
+ */
+int sensor_registry_add(const TSensor_ops *ops, void *instance, const char *name, uint16_t zones);
+
+/*
+ * @fn		uint8_t sensor_registry_count()
+ * @brief	Returns the number of sensors in the registry
+ */
+uint8_t sensor_registry_count();
+
+/*
+ * @fn		const TSensor* sensor_registry_get(uint8_t index)
+ * @brief	Returns a sensor of the registry
+ * @param	index	the index of the sensor, from 0 to sensor_registry_count() - 1
+ * @retval	the sensor, NULL if index is out of range
+ */
+const TSensor* sensor_registry_get(uint8_t index);
+
+/*
+ * @fn		int sensor_registry_find(const void *instance)
+ * @brief	Returns the index of a sensor from its structure
+ * @param	instance	the structure given to sensor_registry_add()
+ * @retval	the index of the sensor, SENSOR_REGISTRY_ERR_INVALID if it is not in the registry
+ */
+int sensor_registry_find(const void *instance);
+
+/*
+ * @fn		void sensor_registry_activate(uint16_t zones)
+ * @brief	Arms the sensors belonging to at least one of the given zones: every sensor takes the entry delay and
+ * 			the duration of the profile of its zones, and it is activated when the exit delay of the profile ends
+ * @param	zones	mask of the zones
+ */
+void sensor_registry_activate(uint16_t zones);
+
+/*
+ * @fn		void sensor_registry_deactivate(uint16_t zones)
+ * @brief	Deactivates the sensors belonging to at least one of the given zones, also the ones still in the exit delay
+ * @param	zones	mask of the zones
+ */
+void sensor_registry_deactivate(uint16_t zones);
+
+/*
+ * @fn		void sensor_registry_poll()
+ * @brief	Polls all the sensors. It must be called in the main loop.
+ */
+void sensor_registry_poll();
+
+/*
+ * @fn		bool sensor_registry_is_idle()
+ * @brief	Tells if no sensor needs to be polled
+ * @retval	TRUE if all the sensors are idle, FALSE otherwise
+ */
+bool sensor_registry_is_idle();
+
+/*
+ * @fn		bool sensor_registry_is_disarmed()
+ * @brief	Tells if every sensor is inactive, none of them waiting for the end of its exit delay
+ * @retval	TRUE if every zone is disarmed, FALSE otherwise
+ */
+bool sensor_registry_is_disarmed();
+
+/*
+ * @fn		void sensor_registry_signal(void *source)
+ * @brief	Forwards an interrupt shared by the sensors to all of them, e.g. the ADC watchdog.
+ * 			Should be called only by the interrupt callbacks.
+ * @param	source	the handle of the peripheral that raised the interrupt
+ */
+void sensor_registry_signal(void *source);
+
+/*
+ * @fn		TAlarmState sensor_registry_get_state(uint16_t zones)
+ * @brief	Returns the most severe state among the sensors of the given zones
+ * @param	zones	mask of the zones
+ * @retval	the state, ALARM_STATE_INACTIVE if the zones have no sensor
+ */
+TAlarmState sensor_registry_get_state(uint16_t zones);
+
+/*
+ * @fn		uint16_t sensor_registry_get_duty(uint16_t zones)
+ * @brief	Returns the highest activity duty cycle among the sensors of the given zones
+ * @param	zones	mask of the zones
+ * @retval	the duty cycle, in thousandths
+ */
+uint16_t sensor_registry_get_duty(uint16_t zones);
+
+/*
+ * @fn		void sensor_registry_get_string_state(uint16_t zones, char *state)
+ * @brief	Sets in state the most severe state among the sensors of the given zones, as a string
+ * @param	zones	mask of the zones
+ * @param	state	reference to the buffer, of at least SENSOR_STATE_STRING_LENGTH characters, where to write the state
+ */
+void sensor_registry_get_string_state(uint16_t zones, char *state);
+
+/*
+ * @fn		void sensor_registry_get_string_rates(uint16_t zones, char *rates, size_t size)
+ * @brief	Writes in rates, for every sensor of the given zones, its name, the peak rate of its inputs and its storms,
+ * 			e.g. "pir PA1 40/s 1 storms", separated by commas. "none" if the zones have no sensor
+ * @param	zones	mask of the zones
+ * @param	rates	reference to the buffer where to write the rates
+ * @param	size	size of the buffer, the rates that don't fit are left out
+ */
+void sensor_registry_get_string_rates(uint16_t zones, char *rates, size_t size);
+
+/*
+ * @fn		void sensor_registry_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command sensors, that shows the zones, the state and the counters of every sensor
+ * @param	shell	pointer to the TShell structure
+ */
+void sensor_registry_register_commands(TShell *shell);
+
+#endif /* INC_SENSOR_REGISTRY_H_ */
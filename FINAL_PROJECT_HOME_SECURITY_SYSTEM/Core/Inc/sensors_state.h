@@ -5,7 +5,7 @@
 #ifndef INC_SENSORS_STATE_H_
 #define INC_SENSORS_STATE_H_
 
-/* This is the mininum amount of time that a sensor must wait before going in alarm */
+/* This is the mininum amount of time, in milliseconds, that a sensor must wait before going in alarm */
 #define NO_DELAY					(1U)
 
 typedef enum {
@@ -0,0 +1,183 @@
+/*
+ * This module contains methods to handle the command line available on the console once the system is booted.
+ * The characters are received in interrupt mode and stored in a ring buffer, while the lines are parsed
+ * and executed by shell_process(), that must be called in the main loop: commands never run in interrupt context.
+ * To add a command, just call shell_register_command() during the initialization of the system.
+ */
+
+#ifndef INC_SHELL_H_
+#define INC_SHELL_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "stm32f4xx_hal.h"
+#include "console.h"
+#include "bool.h"
+
+#define SHELL_OK						(0)
+#define SHELL_ERR_FULL					(-1)
+
+/* Maximum number of commands that can be registered */
+#define SHELL_MAX_COMMANDS				(32U)
+
+/* Maximum length of a line, terminator included. Longer lines are truncated */
+#define SHELL_LINE_LENGTH				(64U)
+
+/* Size of the ring buffer used by the receiver. It must be a power of two */
+#define SHELL_RX_BUFFER_SIZE			(256U)
+
+/* Size of the buffer used to format the output of the commands */
+#define SHELL_OUTPUT_LENGTH				(256U)
+
+#define SHELL_MESSAGE_UNKNOWN_COMMAND	("Unknown command, type help for the list of commands")
+#define SHELL_NEWLINE					("\r\n")
+
+struct Shell;
+
+/*
+ * @brief	Function executed when a command is received.
+ * @param	shell		pointer to the TShell structure that received the command
+ * @param	context		the context given when the command has been registered
+ * @param	args		the rest of the line after the command name, never NULL
+ */
+typedef void (*TShell_handler)(struct Shell *shell, void *context, char *args);
+
+/*
+ * @brief	Function receiving the raw lines while it is installed with shell_set_line_handler().
+ * @param	shell		pointer to the TShell structure that received the line
+ * @param	context		the context given when the handler has been installed
+ * @param	line		the received line
+ * @retval	TRUE if the handler wants to receive the next line too, FALSE to give the lines back to the commands
+ */
+typedef bool (*TShell_line_handler)(struct Shell *shell, void *context, char *line);
+
+/*
+ * @brief	This struct represents a command of the shell.
+ * @param	name		the word that must be typed to execute the command
+ * @param	help		a short description printed by the help command
+ * @param	handler		the function executing the command
+ * @param	context		pointer passed to handler as it is
+ */
+typedef struct {
+	const char *name;
+	const char *help;
+	TShell_handler handler;
+	void *context;
+} TShell_command;
+
+/*
+ * @brief	This struct represents the shell.
+ * @param	huart			pointer to the UART_HandleTypeDef structure used to receive the commands
+ * @param	commands		the registered commands
+ * @param	commands_n		number of registered commands
+ * @param	rx_buffer		ring buffer filled by the receiver interrupt
+ * @param	rx_head			index of the next character written by the interrupt
+ * @param	rx_tail			index of the next character read by the main loop
+ * @param	rx_char			the character being received
+ * @param	rx_overflows	number of characters dropped because the ring buffer was full
+ * @param	line			the line being assembled
+ * @param	line_length		number of characters in line
+ * @param	line_handler	if not NULL, it receives the lines instead of the commands
+ * @param	line_context	context passed to line_handler
+ * @param	output			buffer used by shell_print()
+ * @param	running			TRUE after shell_start() has been called
+ */
+typedef struct Shell {
+	UART_HandleTypeDef *huart;
+	TShell_command commands[SHELL_MAX_COMMANDS];
+	uint8_t commands_n;
+	uint8_t rx_buffer[SHELL_RX_BUFFER_SIZE];
+	volatile uint16_t rx_head;
+	volatile uint16_t rx_tail;
+	uint8_t rx_char;
+	volatile uint32_t rx_overflows;
+	char line[SHELL_LINE_LENGTH];
+	uint8_t line_length;
+	TShell_line_handler line_handler;
+	void *line_context;
+	char output[SHELL_OUTPUT_LENGTH];
+	volatile bool running;
+} TShell;
+
+/*
+ * @fn		void shell_init(TShell *shell, UART_HandleTypeDef *huart)
+ * @brief	Initializes the shell, registering the help command
+ * @param	shell	pointer to the TShell structure to initialize
+ * @param	huart	pointer to the UART_HandleTypeDef structure used to receive the commands
+ */
+void shell_init(TShell *shell, UART_HandleTypeDef *huart);
+
+/*
+ * @fn		int shell_register_command(TShell *shell, const char *name, const char *help,
+ * 									TShell_handler handler, void *context)
+ * @brief	Adds a command to the shell. The strings are not copied, so they must be constant.
+ * @param	shell		pointer to the TShell structure
+ * @param	name		the word that must be typed to execute the command
+ * @param	help		a short description printed by the help command
+ * @param	handler		the function executing the command
+ * @param	context		pointer passed to handler as it is
+ * @retval	SHELL_ERR_FULL if SHELL_MAX_COMMANDS commands are already registered, SHELL_OK otherwise
+ */
+int shell_register_command(TShell *shell, const char *name, const char *help,
+		TShell_handler handler, void *context);
+
+/*
+ * @fn		void shell_start(TShell *shell)
+ * @brief	Starts receiving characters. It must be called once the configuration is done,
+ * 			since the configuration reads the console in blocking mode.
+ * @param	shell	pointer to the TShell structure
+ */
+void shell_start(TShell *shell);
+
+/*
+ * @fn		void shell_process(TShell *shell)
+ * @brief	Assembles the received characters in lines and executes them. It must be called in the main loop.
+ * @param	shell	pointer to the TShell structure
+ */
+void shell_process(TShell *shell);
+
+/*
+ * @fn		bool shell_has_input(TShell *shell)
+ * @brief	Tells if some received characters have not been processed yet
+ * @param	shell	pointer to the TShell structure
+ * @retval	TRUE if shell_process() has something to do, FALSE otherwise
+ */
+bool shell_has_input(TShell *shell);
+
+/*
+ * @fn		void shell_set_line_handler(TShell *shell, TShell_line_handler handler, void *context)
+ * @brief	Redirects the next lines to handler until it returns FALSE. Useful for bulk transfers.
+ * @param	shell		pointer to the TShell structure
+ * @param	handler		the function that will receive the lines, NULL to give them back to the commands
+ * @param	context		pointer passed to handler as it is
+ */
+void shell_set_line_handler(TShell *shell, TShell_line_handler handler, void *context);
+
+/*
+ * @fn		void shell_print(TShell *shell, const char *format, ...)
+ * @brief	Formats a message as printf does and prints it on the console, waiting if it is not ready for use
+ * @param	shell	pointer to the TShell structure
+ * @param	format	the printf-like format string
+ */
+void shell_print(TShell *shell, const char *format, ...);
+
+/*
+ * @fn		bool shell_receive_callback(UART_HandleTypeDef *huart)
+ * @brief	Stores the received character and waits for the next one. Should be called only by the irq.
+ * @param	huart	pointer to the UART_HandleTypeDef structure that completed the reception
+ * @retval	TRUE if the character belonged to the running shell, FALSE otherwise
+ */
+bool shell_receive_callback(UART_HandleTypeDef *huart);
+
+/*
+ * @fn		char* shell_next_token(char **args)
+ * @brief	Splits the next word out of a list of arguments separated by spaces or commas
+ * @param	args	pointer to the string of arguments, moved after the returned word
+ * @retval	the next word, or NULL if there are no more arguments
+ */
+char* shell_next_token(char **args);
+
+#endif /* INC_SHELL_H_ */
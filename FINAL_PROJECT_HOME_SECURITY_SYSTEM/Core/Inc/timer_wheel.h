@@ -0,0 +1,102 @@
+/*
+ * This module offers software timers, all driven by the SysTick interrupt of the HAL (1 ms).
+ * The timers are kept in a hierarchical timing wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots,
+ * where every slot of a level spans a whole revolution of the level below. A timer is linked in the slot of its
+ * expiration time at the lowest level that can hold it, and it is moved to the lower levels while its time comes closer.
+ * So starting, cancelling and expiring a timer take a constant time, whatever the number of running timers.
+ * The callbacks of the expired timers are executed by timer_wheel_tick(), in the SysTick interrupt.
+ * The earliest expiration is kept up to date when the timers are started, and found again only after it is consumed,
+ * so the system can sleep until exactly that moment.
+ */
+
+#ifndef INC_TIMER_WHEEL_H_
+#define INC_TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+
+/* Each level has 2^TIMER_WHEEL_SLOT_BITS slots */
+#define TIMER_WHEEL_SLOT_BITS		(6U)
+#define TIMER_WHEEL_SLOTS			(1U << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS			(4U)
+
+/* Longest time, in milliseconds, the wheel can hold. Longer timers are moved around the last level until they expire */
+#define TIMER_WHEEL_SPAN			(1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+typedef void (*TTimer_callback)(void *context);
+
+/*
+ * @brief	This struct represents a software timer. It must not be moved while it is running.
+ * @param	next		next timer of the slot
+ * @param	pprev		pointer to the link pointing to the timer, NULL if the timer is not running
+ * @param	expires		time of the expiration, in ticks of the wheel
+ * @param	period		milliseconds between two expirations, 0 if the timer expires once
+ * @param	callback	the function executed when the timer expires
+ * @param	context		pointer passed to callback as it is
+ */
+typedef struct Timer {
+	struct Timer *next;
+	struct Timer **pprev;
+	uint32_t expires;
+	uint32_t period;
+	TTimer_callback callback;
+	void *context;
+} TTimer;
+
+/*
+ * @fn		void timer_wheel_init()
+ * @brief	Empties the wheel. It must be called before any timer is started.
+ */
+void timer_wheel_init();
+
+/*
+ * @fn		void timer_wheel_setup(TTimer *timer, TTimer_callback callback, void *context)
+ * @brief	Initializes a stopped timer
+ * @param	timer		pointer to the TTimer structure to initialize
+ * @param	callback	the function executed when the timer expires
+ * @param	context		pointer passed to callback as it is
+ */
+void timer_wheel_setup(TTimer *timer, TTimer_callback callback, void *context);
+
+/*
+ * @fn		void timer_wheel_start(TTimer *timer, uint32_t delay, uint32_t period)
+ * @brief	Starts a timer, or restarts it if it is already running
+ * @param	timer	pointer to the TTimer structure
+ * @param	delay	milliseconds before the first expiration. 0 is the same as 1
+ * @param	period	milliseconds between the following expirations, 0 if the timer must expire once
+ */
+void timer_wheel_start(TTimer *timer, uint32_t delay, uint32_t period);
+
+/*
+ * @fn		void timer_wheel_cancel(TTimer *timer)
+ * @brief	Stops a timer. Nothing is done if the timer is not running
+ * @param	timer	pointer to the TTimer structure
+ */
+void timer_wheel_cancel(TTimer *timer);
+
+/*
+ * @fn		bool timer_wheel_is_running(TTimer *timer)
+ * @brief	Tells if a timer is running
+ * @param	timer	pointer to the TTimer structure
+ * @retval	TRUE if the timer is running, FALSE otherwise
+ */
+bool timer_wheel_is_running(TTimer *timer);
+
+/*
+ * @fn		uint32_t timer_wheel_next_deadline()
+ * @brief	Returns the milliseconds before the earliest expiration of the running timers
+ * @retval	the milliseconds, at least 1, TIMER_WHEEL_SPAN if no timer is running
+ */
+uint32_t timer_wheel_next_deadline();
+
+/*
+ * @fn		void timer_wheel_tick()
+ * @brief	Advances the wheel by one millisecond and executes the callbacks of the expired timers.
+ * 			Should be called only by the SysTick interrupt.
+ */
+void timer_wheel_tick();
+
+#endif /* INC_TIMER_WHEEL_H_ */
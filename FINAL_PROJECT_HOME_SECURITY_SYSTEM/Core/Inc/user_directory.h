@@ -0,0 +1,146 @@
+/*
+ * This module contains methods to handle the directory of the users allowed to send commands from the keypad.
+ * Every user is identified by its PIN, that is never stored in clear: the directory keeps only a salted hash of it,
+ * in an open-addressing table indexed by the hash itself. So looking for a PIN costs the same whatever
+ * the number of users is.
+ * Users can be added one by one or imported in bulk from the console, see user_directory_register_commands().
+ */
+
+#ifndef INC_USER_DIRECTORY_H_
+#define INC_USER_DIRECTORY_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "utils.h"
+#include "shell.h"
+
+#define USER_DIRECTORY_OK				(0)
+#define USER_DIRECTORY_ERR_FULL			(-1)
+#define USER_DIRECTORY_ERR_DUPLICATE	(-2)
+#define USER_DIRECTORY_ERR_NOT_FOUND	(-3)
+#define USER_DIRECTORY_ERR_INVALID		(-4)
+
+/* Number of digits of a PIN. It must be the same of USER_PIN_LENGTH, that the keypad protocol relies on */
+#define USER_DIRECTORY_PIN_LENGTH		(4U)
+
+/* Number of slots of the table. It must be a power of two */
+#ifndef USER_DIRECTORY_CAPACITY
+#define USER_DIRECTORY_CAPACITY			(1024U)
+#endif
+
+/* The table is never filled for more than 3/4, so that the probe sequences stay short */
+#define USER_DIRECTORY_MAX_USERS		((USER_DIRECTORY_CAPACITY * 3U) / 4U)
+
+/* Digest reserved to mark an empty slot. A computed digest never assumes this value */
+#define USER_DIGEST_EMPTY				(0x00000000U)
+
+/* Zones a user can activate or deactivate. Every bit is a zone, so up to 16 zones can be handled */
+#define USER_ZONE_AREA					(0x0001U)
+#define USER_ZONE_BARRIER				(0x0002U)
+#define USER_ZONE_ALL					(0xFFFFU)
+
+/*
+ * @brief	Roles of the users, from the least to the most powerful.
+ * 			Guests can only handle their zones, users can also enable and disable the system,
+ * 			admins can handle every zone.
+ */
+typedef enum {
+	USER_ROLE_GUEST, USER_ROLE_USER, USER_ROLE_ADMIN
+} TUser_role;
+
+/*
+ * @brief	This struct represents a slot of the directory, 8 bytes long.
+ * @param	digest		salted hash of the PIN, or USER_DIGEST_EMPTY if the slot is free
+ * @param	zones		bitmask of the zones the user can handle
+ * @param	role		role of the user, one of TUser_role
+ */
+typedef struct {
+	uint32_t digest;
+	uint16_t zones;
+	uint8_t role;
+} TUser;
+
+/*
+ * @brief	This struct represents the directory of the users.
+ * @param	slots		the open-addressing table
+ * @param	salt		the value mixed with every PIN before hashing it
+ * @param	count		number of users in the directory
+ */
+typedef struct {
+	TUser slots[USER_DIRECTORY_CAPACITY];
+	uint32_t salt;
+	uint16_t count;
+} TUser_directory;
+
+/*
+ * @fn		void user_directory_init(TUser_directory *directory, uint32_t salt)
+ * @brief	Initializes an empty directory
+ * @param	directory	pointer to the TUser_directory structure to initialize
+ * @param	salt		the value mixed with every PIN. Use a value unique for each device, e.g. its UID
+ */
+void user_directory_init(TUser_directory *directory, uint32_t salt);
+
+/*
+ * @fn		int user_directory_add(TUser_directory *directory, const uint8_t *pin, TUser_role role, uint16_t zones)
+ * @brief	Adds a user to the directory
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	pin			the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @param	role		role of the user
+ * @param	zones		bitmask of the zones the user can handle
+ * @retval	USER_DIRECTORY_ERR_INVALID if the PIN does not contain only digits,
+ * 			USER_DIRECTORY_ERR_DUPLICATE if the PIN is already used,
+ * 			USER_DIRECTORY_ERR_FULL if there are already USER_DIRECTORY_MAX_USERS users,
+ * 			USER_DIRECTORY_OK otherwise
+ */
+int user_directory_add(TUser_directory *directory, const uint8_t *pin, TUser_role role, uint16_t zones);
+
+/*
+ * @fn		int user_directory_remove(TUser_directory *directory, const uint8_t *pin)
+ * @brief	Removes a user from the directory
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	pin			the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @retval	USER_DIRECTORY_ERR_NOT_FOUND if no user has this PIN, USER_DIRECTORY_OK otherwise
+ */
+int user_directory_remove(TUser_directory *directory, const uint8_t *pin);
+
+/*
+ * @fn		TUser* user_directory_find(TUser_directory *directory, const uint8_t *pin)
+ * @brief	Looks for the user with a PIN
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	pin			the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @retval	pointer to the user, or NULL if no user has this PIN
+ */
+TUser* user_directory_find(TUser_directory *directory, const uint8_t *pin);
+
+/*
+ * @fn		bool user_can_handle(const TUser *user, uint16_t zones)
+ * @brief	Checks if a user is allowed to activate or deactivate some zones
+ * @param	user		pointer to the user
+ * @param	zones		bitmask of the zones
+ * @retval	TRUE if the user can handle all the zones, FALSE otherwise
+ */
+bool user_can_handle(const TUser *user, uint16_t zones);
+
+/*
+ * @fn		bool user_can_handle_system(const TUser *user)
+ * @brief	Checks if a user is allowed to enable or disable the whole system
+ * @param	user		pointer to the user
+ * @retval	TRUE if the role of the user is at least USER_ROLE_USER, FALSE otherwise
+ */
+bool user_can_handle_system(const TUser *user);
+
+/*
+ * @fn		void user_directory_register_commands(TUser_directory *directory, TShell *shell)
+ * @brief	Adds to the shell the commands to handle the directory:
+ * 			useradd <pin> <role> <zones>, userdel <pin>, users and userimport.
+ * 			userimport receives one user per line, in the same format of useradd, until a line with a single dot
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	shell		pointer to the TShell structure
+ */
+void user_directory_register_commands(TUser_directory *directory, TShell *shell);
+
+#endif /* INC_USER_DIRECTORY_H_ */
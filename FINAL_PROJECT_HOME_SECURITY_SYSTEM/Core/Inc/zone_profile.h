@@ -0,0 +1,74 @@
+/*
+ * This module keeps the timing profile of every zone, in milliseconds:
+ * 		the entry delay, between a detection and the alarm, so the user can disarm the zone when coming in
+ * 		the exit delay, between the arming of the zone and the activation of its sensors, so the user can go out
+ * 		the duration of the alarm
+ * The sensor registry applies the profile of the zones of a sensor every time the sensor is armed,
+ * so the profiles changed from the shell hold from the next arming.
+ */
+
+#ifndef INC_ZONE_PROFILE_H_
+#define INC_ZONE_PROFILE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+#include "shell.h"
+
+#define ZONE_PROFILE_OK				(0)
+#define ZONE_PROFILE_ERR_INVALID	(-1)
+
+/* Number of zone bits, the same bits as USER_ZONE_AREA, USER_ZONE_BARRIER ... */
+#define ZONE_PROFILES_N				(16U)
+
+/* Longest delay or duration of a profile, 10 minutes */
+#define ZONE_PROFILE_MAX_TIME		(600000UL)
+
+/*
+ * @brief	This struct represents the timing profile of a zone.
+ * @param	entry_delay		milliseconds between a detection and the alarm
+ * @param	exit_delay		milliseconds between the arming and the activation of the sensors
+ * @param	duration		milliseconds the alarm lasts
+ */
+typedef struct {
+	uint32_t entry_delay;
+	uint32_t exit_delay;
+	uint32_t duration;
+} TZone_profile;
+
+/*
+ * @fn		void zone_profile_init(const TZone_profile *profile)
+ * @brief	Gives the same profile to all the zones
+ * @param	profile	the default profile
+ */
+void zone_profile_init(const TZone_profile *profile);
+
+/*
+ * @fn		int zone_profile_set(uint16_t zones, const TZone_profile *profile)
+ * @brief	Sets the profile of some zones
+ * @param	zones	mask of the zones
+ * @param	profile	the profile, its times must not exceed ZONE_PROFILE_MAX_TIME
+ * @retval	ZONE_PROFILE_ERR_INVALID if the mask is empty or a time is too long, ZONE_PROFILE_OK otherwise
+ */
+int zone_profile_set(uint16_t zones, const TZone_profile *profile);
+
+/*
+ * @fn		const TZone_profile* zone_profile_get(uint16_t zones)
+ * @brief	Returns the profile of a sensor belonging to some zones: the profile of the lowest zone of the mask
+ * @param	zones	mask of the zones
+ * @retval	the profile, the one of the first zone if the mask is empty
+ */
+const TZone_profile* zone_profile_get(uint16_t zones);
+
+/*
+ * @fn		void zone_profile_register_commands(TShell *shell)
+ * @brief	Adds to the shell the commands profiles, that shows the profile of every zone,
+ * 			and profile <hex zones> <entry ms> <exit ms> <duration ms>, that changes the profile of some zones
+ * @param	shell	pointer to the TShell structure
+ */
+void zone_profile_register_commands(TShell *shell);
+
+#endif /* INC_ZONE_PROFILE_H_ */
@@ -0,0 +1,268 @@
+/*
+ * This module corrects the conversions of an ADC for the drift of the supply and of the temperature.
+ * Every ADC_CALIBRATION_PERIOD milliseconds the injected group converts, in turn, the internal reference VREFINT
+ * and the internal temperature sensor: an injected conversion is started by software between two scans of the
+ * regular group, so the stream of the DMA goes on, only delayed by a conversion, and it is taken only if the scan
+ * leaves room for it in the sample period. The end of the conversion is marked by its interrupt, and the main loop
+ * folds it into a moving average, so the correction moves a little at every conversion and nothing ever waits.
+ * VREFINT and the temperature sensor have been measured in the factory with a supply of 3.3 V: the ratio of the
+ * factory VREFINT to the measured one gives the supply, and scales the conversions to a supply of 3.3 V; the
+ * temperature scales them by a drift in ppm per degree around ADC_CALIBRATION_REFERENCE_TEMPERATURE.
+ * The correction is a single factor in Q16, so correcting a sample costs a multiply.
+ */
+
+#include "adc_calibration.h"
+
+/* The internal channels, in the order of the conversions */
+static const uint32_t calibration_channels[ADC_CALIBRATION_CHANNELS_N] = { ADC_CHANNEL_VREFINT,
+		ADC_CHANNEL_TEMPSENSOR };
+
+/*
+ * @fn		static void adc_calibration_expired(void *context)
+ * @brief	Callback of the periodic timer, the conversion is started by the main loop
+ */
+static void adc_calibration_expired(void *context) {
+	TAdc_calibration *calibration = context;
+	calibration->due = TRUE;
+}
+
+/*
+ * @fn		static void adc_calibration_update(TAdc_calibration *calibration)
+ * @brief	Computes the supply, the temperature and the factor from the averages of both the channels.
+ * 			The temperature sensor is scaled to a supply of 3.3 V first, like the factory measures
+ */
+static void adc_calibration_update(TAdc_calibration *calibration) {
+	uint32_t vrefint = calibration->averages[ADC_CALIBRATION_VREFINT];
+	uint32_t vrefint_cal = ADC_CALIBRATION_VREFINT_CAL;
+	int32_t ts_cal1 = (int32_t) ADC_CALIBRATION_TS_CAL1 << ADC_CALIBRATION_AVERAGE_SHIFT;
+	int32_t ts_cal2 = (int32_t) ADC_CALIBRATION_TS_CAL2 << ADC_CALIBRATION_AVERAGE_SHIFT;
+	int32_t sensor = (uint64_t) calibration->averages[ADC_CALIBRATION_TEMPERATURE] * vrefint_cal
+			* (1U << ADC_CALIBRATION_AVERAGE_SHIFT) / vrefint;
+	uint32_t gain = (vrefint_cal << (ADC_CALIBRATION_FACTOR_SHIFT + ADC_CALIBRATION_AVERAGE_SHIFT)) / vrefint;
+	int64_t drift;
+
+	calibration->supply = ADC_CALIBRATION_SUPPLY * gain >> ADC_CALIBRATION_FACTOR_SHIFT;
+	calibration->temperature = ADC_CALIBRATION_TS_CAL1_TEMPERATURE + (sensor - ts_cal1)
+			* (ADC_CALIBRATION_TS_CAL2_TEMPERATURE - ADC_CALIBRATION_TS_CAL1_TEMPERATURE) / (ts_cal2 - ts_cal1);
+
+	// a drift of d ppm per degree, with the temperature in tenths of degree, moves the conversions by d * t / 10^7
+	drift = (int64_t) calibration->drift * (calibration->temperature - ADC_CALIBRATION_REFERENCE_TEMPERATURE)
+			* (1L << ADC_CALIBRATION_FACTOR_SHIFT) / 10000000L;
+	calibration->factor = (uint64_t) gain * (uint32_t) ((1L << ADC_CALIBRATION_FACTOR_SHIFT) - drift)
+			>> ADC_CALIBRATION_FACTOR_SHIFT;
+	calibration->updates++;
+}
+
+/*
+ * @fn		static void adc_calibration_fold(TAdc_calibration *calibration, uint16_t result)
+ * @brief	Moves the average of the channel just converted towards the conversion, the first one sets it
+ */
+static void adc_calibration_fold(TAdc_calibration *calibration, uint16_t result) {
+	uint8_t channel = calibration->channel;
+	uint32_t *average = &calibration->averages[channel];
+
+	if ((calibration->primed & (1U << channel)) == 0) {
+		*average = (uint32_t) result << ADC_CALIBRATION_AVERAGE_SHIFT;
+		calibration->primed |= 1U << channel;
+	} else {
+		*average += result - (*average >> ADC_CALIBRATION_AVERAGE_SHIFT);
+	}
+	if (calibration->primed == (1U << ADC_CALIBRATION_CHANNELS_N) - 1U && *average != 0) {
+		adc_calibration_update(calibration);
+	}
+	calibration->channel = (channel + 1U) % ADC_CALIBRATION_CHANNELS_N;
+}
+
+/*
+ * @fn		static void adc_calibration_start(TAdc_calibration *calibration)
+ * @brief	Starts the injected conversion of the next channel, if the scan of the regular group leaves room for it
+ */
+static void adc_calibration_start(TAdc_calibration *calibration) {
+	ADC_InjectionConfTypeDef config = { 0 };
+
+	if (adc_stream_get_spare_cycles(calibration->stream) < ADC_CALIBRATION_CYCLES) {
+		calibration->skipped++;
+		return;
+	}
+	config.InjectedChannel = calibration_channels[calibration->channel];
+	config.InjectedRank = ADC_INJECTED_RANK_1;
+	config.InjectedNbrOfConversion = 1;
+	config.InjectedSamplingTime = ADC_CALIBRATION_SAMPLING_TIME;
+	config.InjectedOffset = 0;
+	config.InjectedDiscontinuousConvMode = DISABLE;
+	config.AutoInjectedConv = DISABLE;
+	config.ExternalTrigInjecConv = ADC_INJECTED_SOFTWARE_START;
+
+	// the stream is started and stopped also from the interrupts, and the HAL locks the ADC
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (HAL_ADCEx_InjectedConfigChannel(calibration->hadc, &config) == HAL_OK) {
+		HAL_ADCEx_InjectedStart_IT(calibration->hadc);
+	}
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		void adc_calibration_init(TAdc_calibration *calibration, TAdc_stream *stream)
+ * @brief	Checks the factory measures and starts the timer of the injected conversions.
+ * 			The timer wheel must be initialized
+ * @param	calibration		pointer to the TAdc_calibration structure to initialize
+ * @param	stream			the stream of the ADC, already initialized
+ */
+void adc_calibration_init(TAdc_calibration *calibration, TAdc_stream *stream) {
+	calibration->stream = stream;
+	calibration->hadc = stream->hadc;
+	calibration->valid = ADC_CALIBRATION_VREFINT_CAL >= ADC_CALIBRATION_VREFINT_MIN
+			&& ADC_CALIBRATION_VREFINT_CAL <= ADC_CALIBRATION_VREFINT_MAX
+			&& ADC_CALIBRATION_TS_CAL2 > ADC_CALIBRATION_TS_CAL1;
+	calibration->channel = ADC_CALIBRATION_VREFINT;
+	calibration->due = FALSE;
+	calibration->ready = FALSE;
+	calibration->result = 0;
+	calibration->primed = 0;
+	calibration->supply = ADC_CALIBRATION_SUPPLY;
+	calibration->temperature = ADC_CALIBRATION_REFERENCE_TEMPERATURE;
+	calibration->drift = ADC_CALIBRATION_DEFAULT_DRIFT;
+	calibration->factor = 1UL << ADC_CALIBRATION_FACTOR_SHIFT;
+	calibration->updates = 0;
+	calibration->skipped = 0;
+
+	timer_wheel_setup(&calibration->timer, adc_calibration_expired, calibration);
+	if (calibration->valid) {
+		timer_wheel_start(&calibration->timer, ADC_CALIBRATION_PERIOD, ADC_CALIBRATION_PERIOD);
+	}
+}
+
+/*
+ * @fn		void adc_calibration_set_drift(TAdc_calibration *calibration, int32_t drift)
+ * @brief	Sets the drift of the conversions with the temperature, applied from the next update of the factor
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	drift			the drift in ppm per degree, positive if the conversions grow with the temperature
+ */
+void adc_calibration_set_drift(TAdc_calibration *calibration, int32_t drift) {
+	calibration->drift = drift;
+}
+
+/*
+ * @fn		void adc_calibration_complete(TAdc_calibration *calibration, ADC_HandleTypeDef *hadc)
+ * @brief	Stores the injected conversion. It must be called by HAL_ADCEx_InjectedConvCpltCallback
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	hadc			the ADC of the callback
+ */
+void adc_calibration_complete(TAdc_calibration *calibration, ADC_HandleTypeDef *hadc) {
+	if (hadc == calibration->hadc) {
+		calibration->result = HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1);
+		calibration->ready = TRUE;
+	}
+}
+
+/*
+ * @fn		void adc_calibration_process(TAdc_calibration *calibration)
+ * @brief	Folds the completed conversion into the factor, and starts the next one when the period expired.
+ * 			It must be called by the main loop
+ * @param	calibration		pointer to the TAdc_calibration structure
+ */
+void adc_calibration_process(TAdc_calibration *calibration) {
+	if (calibration->ready) {
+		// the ADC started for the conversion alone is turned off again, the stream turns it on when it starts
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		if (!calibration->stream->running) {
+			HAL_ADCEx_InjectedStop_IT(calibration->hadc);
+		}
+		calibration->ready = FALSE;
+		__set_PRIMASK(primask);
+		adc_calibration_fold(calibration, calibration->result);
+	}
+
+	// a conversion lasts microseconds, one still not completed a period later was aborted by the stop of the stream
+	if (calibration->due) {
+		calibration->due = FALSE;
+		adc_calibration_start(calibration);
+	}
+}
+
+/*
+ * @fn		bool adc_calibration_is_pending(TAdc_calibration *calibration)
+ * @brief	Tells if a conversion is waiting to be started or folded by adc_calibration_process
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @retval	TRUE if adc_calibration_process has something to do, FALSE otherwise
+ */
+bool adc_calibration_is_pending(TAdc_calibration *calibration) {
+	return calibration->ready || calibration->due;
+}
+
+/*
+ * @fn		uint16_t adc_calibration_apply(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale)
+ * @brief	Corrects a conversion, or a value in the same unit
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	value			the value to correct
+ * @param	full_scale		the greatest value, the corrected one is limited to it
+ * @retval	the corrected value
+ */
+uint16_t adc_calibration_apply(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale) {
+	uint32_t corrected = (uint32_t) value * calibration->factor >> ADC_CALIBRATION_FACTOR_SHIFT;
+	return (corrected > full_scale) ? full_scale : corrected;
+}
+
+/*
+ * @fn		void adc_calibration_apply_block(TAdc_calibration *calibration, const uint16_t *values, uint16_t *corrected,
+ * 				uint16_t length, uint16_t full_scale)
+ * @brief	Corrects a block of conversions
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	values			the values to correct
+ * @param	corrected		the corrected values, it can be the same array as the values
+ * @param	length			number of values
+ * @param	full_scale		the greatest value, the corrected ones are limited to it
+ */
+void adc_calibration_apply_block(TAdc_calibration *calibration, const uint16_t *values, uint16_t *corrected,
+		uint16_t length, uint16_t full_scale) {
+	uint32_t factor = calibration->factor;
+
+	for (uint16_t i = 0; i < length; i++) {
+		uint32_t value = (uint32_t) values[i] * factor >> ADC_CALIBRATION_FACTOR_SHIFT;
+		corrected[i] = (value > full_scale) ? full_scale : value;
+	}
+}
+
+/*
+ * @fn		uint16_t adc_calibration_to_raw(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale)
+ * @brief	Returns the conversion that gives a corrected value, as the thresholds of the analog watchdog
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	value			the corrected value
+ * @param	full_scale		the greatest value, the conversion is limited to it
+ * @retval	the conversion
+ */
+uint16_t adc_calibration_to_raw(TAdc_calibration *calibration, uint16_t value, uint16_t full_scale) {
+	uint32_t raw = ((uint32_t) value << ADC_CALIBRATION_FACTOR_SHIFT) / calibration->factor;
+	return (raw > full_scale) ? full_scale : raw;
+}
+
+static void adc_calibration_command(TShell *shell, void *context, char *args) {
+	TAdc_calibration *calibration = context;
+	char *drift = shell_next_token(&args);
+
+	if (drift != NULL) {
+		adc_calibration_set_drift(calibration, strtol(drift, NULL, 10));
+	}
+	if (!calibration->valid) {
+		shell_print(shell, "no factory calibration, the conversions are not corrected\r\n");
+		return;
+	}
+	shell_print(shell, "supply %u mV, temperature %d.%u C, drift %ld ppm/C\r\n", calibration->supply,
+			calibration->temperature / 10, abs(calibration->temperature % 10), calibration->drift);
+	shell_print(shell, "factor %lu/65536, %lu updates, %lu skipped\r\n", calibration->factor, calibration->updates,
+			calibration->skipped);
+}
+
+/*
+ * @fn		void adc_calibration_register_commands(TAdc_calibration *calibration, TShell *shell)
+ * @brief	Adds to the shell the command cal [drift], that shows the supply, the temperature and the correction,
+ * 			and optionally changes the drift
+ * @param	calibration		pointer to the TAdc_calibration structure
+ * @param	shell			pointer to the TShell structure
+ */
+void adc_calibration_register_commands(TAdc_calibration *calibration, TShell *shell) {
+	shell_register_command(shell, "cal", "[drift ppm/C] shows the supply and the temperature of the ADC, and sets"
+			" the drift corrected with the temperature", adc_calibration_command, calibration);
+}
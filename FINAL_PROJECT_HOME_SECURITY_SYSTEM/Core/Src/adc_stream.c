@@ -0,0 +1,520 @@
+/*
+ * This module streams the conversions of an ADC into a circular buffer, with the DMA.
+ * Every scan of the channels is started in hardware by the TRGO of a timer, at the sample rate, so a sample costs
+ * no code at all. The DMA fills the two halves of the buffer in turn, with the samples of the channels interleaved:
+ * when a half is full, the interrupt of the DMA marks its block as ready, and the main loop hands the samples of every
+ * started channel to the consumer of the channel, while the DMA fills the other half.
+ * A block still not consumed when the DMA completes the other half is counted as an overrun.
+ * The ADC runs while at least one channel is started.
+ * A channel can be oversampled by 4 or 16: its samples are summed in groups and decimated, giving 1 or 2 more bits
+ * of resolution and less noise, at a quarter or a sixteenth of the sample rate. The time spent decimating, and the one
+ * spent on every block by the consumers, are measured with the DWT cycle counter, enabled by latency_init():
+ * a block must be consumed before the DMA fills the other half, its budget is the period of a block.
+ * A tap can receive every block as the DMA wrote it, all the channels interleaved and before any decimation.
+ */
+
+#include "adc_stream.h"
+
+/* ADC cycles of the sampling times, from ADC_SAMPLETIME_3CYCLES to ADC_SAMPLETIME_480CYCLES */
+static const uint16_t sampling_cycles[] = { 3, 15, 28, 56, 84, 112, 144, 480 };
+
+/*
+ * @fn		static uint32_t adc_stream_period(uint32_t rate)
+ * @brief	Returns the auto-reload value of the trigger timer giving a sample rate
+ */
+static uint32_t adc_stream_period(uint32_t rate) {
+	return ADC_STREAM_TIMER_FREQUENCY / rate - 1U;
+}
+
+/*
+ * @fn		static uint32_t adc_stream_budget(TAdc_stream *stream)
+ * @brief	Returns the cycles of the core in the period of a block, the time the DMA takes to fill the other half
+ */
+static uint32_t adc_stream_budget(TAdc_stream *stream) {
+	return ADC_STREAM_BLOCK_SIZE * (SystemCoreClock / stream->rate);
+}
+
+/*
+ * @fn		static uint32_t adc_stream_scan_cycles(TAdc_stream *stream, uint8_t index, uint32_t sampling_time)
+ * @brief	Returns the cycles of the ADC of a scan of all the channels, with the sampling time of a channel
+ * 			replaced by a new one. The channel may be the one being added at the end of the scan
+ */
+static uint32_t adc_stream_scan_cycles(TAdc_stream *stream, uint8_t index, uint32_t sampling_time) {
+	uint8_t channels_n = (index == stream->channels_n && index < ADC_STREAM_MAX_CHANNELS) ? index + 1U
+			: stream->channels_n;
+	uint32_t cycles = 0;
+
+	for (uint8_t i = 0; i < channels_n; i++) {
+		cycles += sampling_cycles[(i == index) ? sampling_time : stream->sampling_times[i]]
+				+ ADC_STREAM_CONVERSION_CYCLES;
+	}
+	return cycles;
+}
+
+/*
+ * @fn		static bool adc_stream_fits(TAdc_stream *stream, uint32_t rate, uint8_t index, uint32_t sampling_time)
+ * @brief	Tells if a scan of all the channels ends before the next trigger, with the sampling time of a channel
+ * 			replaced by a new one
+ */
+static bool adc_stream_fits(TAdc_stream *stream, uint32_t rate, uint8_t index, uint32_t sampling_time) {
+	return adc_stream_scan_cycles(stream, index, sampling_time) * rate <= ADC_STREAM_ADC_FREQUENCY;
+}
+
+/*
+ * @fn		static uint16_t adc_stream_gather(const uint16_t *scans, uint8_t channels_n, uint8_t index, uint8_t shift,
+ * 				uint16_t *samples)
+ * @brief	Copies the samples of a channel out of the scans of a block, decimating them if the channel is oversampled:
+ * 			the sum of 4^shift samples shifted to the right by shift bits is the mean with shift more bits
+ * @retval	the number of samples written
+ */
+static uint16_t adc_stream_gather(const uint16_t *scans, uint8_t channels_n, uint8_t index, uint8_t shift,
+		uint16_t *samples) {
+	uint16_t ratio = 1U << (2U * shift);
+	uint16_t length = ADC_STREAM_BLOCK_SIZE >> (2U * shift);
+	const uint16_t *sample = &scans[index];
+
+	if (shift == 0) {
+		for (uint16_t i = 0; i < ADC_STREAM_BLOCK_SIZE; i++) {
+			samples[i] = sample[i * channels_n];
+		}
+		return ADC_STREAM_BLOCK_SIZE;
+	}
+	for (uint16_t i = 0; i < length; i++) {
+		uint32_t sum = 0;
+
+		for (uint16_t j = 0; j < ratio; j++) {
+			sum += *sample;
+			sample += channels_n;
+		}
+		samples[i] = sum >> shift;
+	}
+	return length;
+}
+
+/*
+ * @fn		static void adc_stream_ready(TAdc_stream *stream, uint8_t half)
+ * @brief	Marks a half of the buffer as ready, from the interrupt of the DMA
+ */
+static void adc_stream_ready(TAdc_stream *stream, uint8_t half) {
+	uint8_t bit = 1U << half;
+
+	if ((stream->ready & bit) != 0) {
+		stream->overruns++;
+	}
+	stream->ready |= bit;
+	stream->blocks++;
+}
+
+/*
+ * @fn		int adc_stream_init(TAdc_stream *stream, ADC_HandleTypeDef *hadc, TIM_HandleTypeDef *htim)
+ * @brief	Initializes the stream at ADC_STREAM_DEFAULT_RATE, without starting the ADC and the timer.
+ * 			The channels are added with adc_stream_add_channel
+ * @param	stream		pointer to the TAdc_stream structure to initialize
+ * @param	hadc		the ADC, as configured by MX_ADC1_Init: a scan on the rising edges of the TRGO of the timer,
+ * 						with its DMA stream in circular mode
+ * @param	htim		a timer on the APB1 bus, not used by anything else, as configured by MX_TIM2_Init:
+ * 						counting at ADC_STREAM_TIMER_FREQUENCY, with its auto-reload preloaded and its update on TRGO
+ * @retval	ADC_STREAM_ERR_INVALID if the ADC is not triggered in hardware or its DMA is not circular,
+ * 			ADC_STREAM_OK otherwise
+ */
+int adc_stream_init(TAdc_stream *stream, ADC_HandleTypeDef *hadc, TIM_HandleTypeDef *htim) {
+	stream->hadc = hadc;
+	stream->htim = htim;
+	stream->rate = ADC_STREAM_DEFAULT_RATE;
+	stream->channels_n = 0;
+	stream->started = 0;
+	stream->ready = 0;
+	stream->next = 0;
+	stream->running = FALSE;
+	stream->blocks = 0;
+	stream->overruns = 0;
+	stream->decimation_cycles = 0;
+	stream->decimated = 0;
+	stream->block_cycles = 0;
+	stream->block_cycles_max = 0;
+	stream->late = 0;
+	stream->tap = NULL;
+	stream->tap_context = NULL;
+
+	// one scan for every rising edge of the trigger, and a DMA request for every conversion, into the circular buffer
+	if (hadc->Init.ExternalTrigConvEdge == ADC_EXTERNALTRIGCONVEDGE_NONE || hadc->Init.ContinuousConvMode != DISABLE
+			|| hadc->Init.DMAContinuousRequests != ENABLE || hadc->DMA_Handle == NULL
+			|| hadc->DMA_Handle->Init.Mode != DMA_CIRCULAR) {
+		return ADC_STREAM_ERR_INVALID;
+	}
+	// the auto-reload is buffered, so a new rate starts at the next update without losing the current period
+	__HAL_TIM_SET_AUTORELOAD(htim, adc_stream_period(stream->rate));
+	return ADC_STREAM_OK;
+}
+
+/*
+ * @fn		int adc_stream_add_channel(TAdc_stream *stream, uint32_t channel, TAdc_stream_consumer consumer,
+ * 				void *context)
+ * @brief	Adds a channel at the end of the scan, with ADC_STREAM_SAMPLING_TIME and without oversampling.
+ * 			It must be called while no channel is started
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	channel		the channel of the ADC, as ADC_CHANNEL_0, with its pin already in analog mode
+ * @param	consumer	the function receiving the blocks of the channel, NULL to drop them
+ * @param	context		the argument of the function
+ * @retval	the index of the channel in the scan, ADC_STREAM_ERR_INVALID if the scan is full or running,
+ * 			ADC_STREAM_ERR_HAL if the HAL refused the configuration
+ */
+int adc_stream_add_channel(TAdc_stream *stream, uint32_t channel, TAdc_stream_consumer consumer, void *context) {
+	ADC_HandleTypeDef *hadc = stream->hadc;
+	ADC_ChannelConfTypeDef config = { 0 };
+	uint8_t index = stream->channels_n;
+
+	if (index == ADC_STREAM_MAX_CHANNELS || stream->running
+			|| !adc_stream_fits(stream, stream->rate, index, ADC_STREAM_SAMPLING_TIME)) {
+		return ADC_STREAM_ERR_INVALID;
+	}
+
+	config.Channel = channel;
+	config.Rank = index + 1U;
+	config.SamplingTime = ADC_STREAM_SAMPLING_TIME;
+	if (HAL_ADC_ConfigChannel(hadc, &config) != HAL_OK) {
+		return ADC_STREAM_ERR_HAL;
+	}
+	hadc->Init.NbrOfConversion = index + 1U;
+	hadc->Init.ScanConvMode = (index == 0) ? DISABLE : ENABLE;
+	if (HAL_ADC_Init(hadc) != HAL_OK) {
+		return ADC_STREAM_ERR_HAL;
+	}
+
+	stream->channels[index] = channel;
+	stream->consumers[index] = consumer;
+	stream->contexts[index] = context;
+	stream->sampling_times[index] = ADC_STREAM_SAMPLING_TIME;
+	stream->oversampling_shifts[index] = 0;
+	stream->channels_n++;
+	return index;
+}
+
+/*
+ * @fn		void adc_stream_set_tap(TAdc_stream *stream, TAdc_stream_consumer tap, void *context)
+ * @brief	Hands every block to a function before the consumers, as the DMA wrote it: ADC_STREAM_BLOCK_SIZE scans
+ * 			of channels_n samples, not decimated. The tap is called even for the channels not started
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	tap			the function receiving the blocks, NULL to remove it
+ * @param	context		the argument of the function
+ */
+void adc_stream_set_tap(TAdc_stream *stream, TAdc_stream_consumer tap, void *context) {
+	stream->tap = tap;
+	stream->tap_context = context;
+}
+
+/*
+ * @fn		int adc_stream_set_channel(TAdc_stream *stream, uint8_t index, uint32_t sampling_time, uint8_t oversampling)
+ * @brief	Changes the sampling time and the oversampling of a channel, even while the stream is running.
+ * 			The consumer of an oversampled channel gets ADC_STREAM_BLOCK_SIZE / oversampling samples per block,
+ * 			see adc_stream_get_bits
+ * @param	stream			pointer to the TAdc_stream structure
+ * @param	index			the index of the channel in the scan
+ * @param	sampling_time	the sampling time, as ADC_SAMPLETIME_3CYCLES
+ * @param	oversampling	samples decimated into one, 1, 4 or 16
+ * @retval	ADC_STREAM_ERR_INVALID if a value is not allowed or the scan would last longer than the sample period,
+ * 			ADC_STREAM_ERR_HAL if the HAL refused the configuration, ADC_STREAM_OK otherwise
+ */
+int adc_stream_set_channel(TAdc_stream *stream, uint8_t index, uint32_t sampling_time, uint8_t oversampling) {
+	ADC_ChannelConfTypeDef config = { 0 };
+	uint8_t shift;
+
+	switch (oversampling) {
+	case 1:
+		shift = 0;
+		break;
+	case 4:
+		shift = 1;
+		break;
+	case 16:
+		shift = 2;
+		break;
+	default:
+		return ADC_STREAM_ERR_INVALID;
+	}
+	if (index >= stream->channels_n || sampling_time > ADC_SAMPLETIME_480CYCLES
+			|| !adc_stream_fits(stream, stream->rate, index, sampling_time)) {
+		return ADC_STREAM_ERR_INVALID;
+	}
+
+	// the sampling time is read by the ADC at every conversion, so it can change between two scans
+	config.Channel = stream->channels[index];
+	config.Rank = index + 1U;
+	config.SamplingTime = sampling_time;
+	if (HAL_ADC_ConfigChannel(stream->hadc, &config) != HAL_OK) {
+		return ADC_STREAM_ERR_HAL;
+	}
+	stream->sampling_times[index] = sampling_time;
+	stream->oversampling_shifts[index] = shift;
+	return ADC_STREAM_OK;
+}
+
+/*
+ * @fn		uint8_t adc_stream_get_bits(TAdc_stream *stream, uint8_t index)
+ * @brief	Returns the resolution of the samples of a channel: ADC_STREAM_RESOLUTION, one more bit with
+ * 			the oversampling by 4 and two more with the one by 16. The full scale is the one of the ADC shifted
+ * 			to the left by the extra bits
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ * @retval	the bits of the samples
+ */
+uint8_t adc_stream_get_bits(TAdc_stream *stream, uint8_t index) {
+	return ADC_STREAM_RESOLUTION + ((index < stream->channels_n) ? stream->oversampling_shifts[index] : 0);
+}
+
+/*
+ * @fn		uint32_t adc_stream_get_spare_cycles(TAdc_stream *stream)
+ * @brief	Returns the cycles of the ADC left free in every sample period after the scan of all the channels,
+ * 			the room for a conversion of the injected group, that delays the scan
+ * @param	stream		pointer to the TAdc_stream structure
+ * @retval	the cycles of the ADC, 0 if the scan takes the whole period
+ */
+uint32_t adc_stream_get_spare_cycles(TAdc_stream *stream) {
+	uint32_t period = ADC_STREAM_ADC_FREQUENCY / stream->rate;
+	uint32_t scan = adc_stream_scan_cycles(stream, ADC_STREAM_MAX_CHANNELS, 0);
+
+	return (scan < period) ? period - scan : 0;
+}
+
+/*
+ * @fn		int adc_stream_set_rate(TAdc_stream *stream, uint32_t rate)
+ * @brief	Changes the sample rate, even while the stream is running
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	rate		the sample rate in Hz, from ADC_STREAM_MIN_RATE to ADC_STREAM_MAX_RATE
+ * @retval	ADC_STREAM_ERR_INVALID if the rate is out of range or the scan would last longer than its period,
+ * 			ADC_STREAM_OK otherwise
+ */
+int adc_stream_set_rate(TAdc_stream *stream, uint32_t rate) {
+	if (rate < ADC_STREAM_MIN_RATE || rate > ADC_STREAM_MAX_RATE
+			|| !adc_stream_fits(stream, rate, ADC_STREAM_MAX_CHANNELS, 0)) {
+		return ADC_STREAM_ERR_INVALID;
+	}
+	stream->rate = rate;
+	stream->block_cycles_max = 0;
+	__HAL_TIM_SET_AUTORELOAD(stream->htim, adc_stream_period(rate));
+	return ADC_STREAM_OK;
+}
+
+/*
+ * @fn		void adc_stream_start(TAdc_stream *stream, uint8_t index)
+ * @brief	Starts handing the blocks of a channel to its consumer, and the DMA and the timer if they are not running
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ */
+void adc_stream_start(TAdc_stream *stream, uint8_t index) {
+	if (index >= stream->channels_n) {
+		return;
+	}
+
+	// the channels are started by the state machines of the sensors, also from the interrupts
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	stream->started |= 1U << index;
+	if (!stream->running) {
+		stream->ready = 0;
+		stream->next = 0;
+
+		// the ADC waits for the trigger, so the DMA is armed before the first edge
+		if (HAL_ADC_Start_DMA(stream->hadc, (uint32_t*) stream->buffer,
+				2 * ADC_STREAM_BLOCK_SIZE * stream->channels_n) == HAL_OK) {
+			__HAL_TIM_SET_COUNTER(stream->htim, 0);
+			HAL_TIM_Base_Start(stream->htim);
+			stream->running = TRUE;
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		void adc_stream_stop(TAdc_stream *stream, uint8_t index)
+ * @brief	Stops handing the blocks of a channel to its consumer. After the last channel the timer and the DMA stop,
+ * 			and the blocks not consumed yet are dropped
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ */
+void adc_stream_stop(TAdc_stream *stream, uint8_t index) {
+	if (index >= stream->channels_n) {
+		return;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	stream->started &= ~(1U << index);
+	if (stream->started == 0 && stream->running) {
+		HAL_TIM_Base_Stop(stream->htim);
+		HAL_ADC_Stop_DMA(stream->hadc);
+		stream->ready = 0;
+		stream->running = FALSE;
+	}
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		bool adc_stream_is_started(TAdc_stream *stream, uint8_t index)
+ * @brief	Tells if a channel is started
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	index		the index of the channel in the scan
+ * @retval	TRUE if the channel is started, FALSE otherwise
+ */
+bool adc_stream_is_started(TAdc_stream *stream, uint8_t index) {
+	return index < stream->channels_n && (stream->started & (1U << index)) != 0;
+}
+
+/*
+ * @fn		void adc_stream_half_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc)
+ * @brief	Marks the first block as ready. It must be called by HAL_ADC_ConvHalfCpltCallback
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	hadc		the ADC of the callback
+ */
+void adc_stream_half_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc) {
+	if (hadc == stream->hadc) {
+		adc_stream_ready(stream, 0);
+	}
+}
+
+/*
+ * @fn		void adc_stream_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc)
+ * @brief	Marks the second block as ready. It must be called by HAL_ADC_ConvCpltCallback
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	hadc		the ADC of the callback
+ */
+void adc_stream_complete(TAdc_stream *stream, ADC_HandleTypeDef *hadc) {
+	if (hadc == stream->hadc) {
+		adc_stream_ready(stream, 1);
+	}
+}
+
+/*
+ * @fn		void adc_stream_process(TAdc_stream *stream)
+ * @brief	Hands the ready blocks to the consumers of the started channels, the oldest first.
+ * 			It must be called by the main loop
+ * @param	stream		pointer to the TAdc_stream structure
+ */
+void adc_stream_process(TAdc_stream *stream) {
+	uint16_t samples[ADC_STREAM_BLOCK_SIZE];
+
+	while (stream->ready != 0) {
+		uint8_t half = ((stream->ready & (1U << stream->next)) != 0) ? stream->next : stream->next ^ 1U;
+		const uint16_t *scans = &stream->buffer[half * ADC_STREAM_BLOCK_SIZE * stream->channels_n];
+		uint32_t block_start = DWT->CYCCNT;
+
+		if (stream->tap != NULL) {
+			stream->tap(stream->tap_context, scans, ADC_STREAM_BLOCK_SIZE * stream->channels_n);
+		}
+
+		// the samples of every channel are gathered out of the scans, so each consumer gets a plain block
+		for (uint8_t index = 0; index < stream->channels_n; index++) {
+			uint8_t shift = stream->oversampling_shifts[index];
+			uint32_t start;
+			uint16_t length;
+
+			if (stream->consumers[index] == NULL || !adc_stream_is_started(stream, index)) {
+				continue;
+			}
+			start = DWT->CYCCNT;
+			length = adc_stream_gather(scans, stream->channels_n, index, shift, samples);
+			if (shift != 0) {
+				stream->decimation_cycles += DWT->CYCCNT - start;
+				stream->decimated += length;
+			}
+			stream->consumers[index](stream->contexts[index], samples, length);
+		}
+
+		stream->block_cycles = DWT->CYCCNT - block_start;
+		if (stream->block_cycles > stream->block_cycles_max) {
+			stream->block_cycles_max = stream->block_cycles;
+		}
+		if (stream->block_cycles > adc_stream_budget(stream)) {
+			stream->late++;
+		}
+
+		// a block completed again while it was consumed has already been counted as an overrun
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		stream->ready &= ~(1U << half);
+		__set_PRIMASK(primask);
+		stream->next = half ^ 1U;
+	}
+}
+
+/*
+ * @fn		bool adc_stream_has_block(TAdc_stream *stream)
+ * @brief	Tells if a block is waiting for adc_stream_process
+ * @param	stream		pointer to the TAdc_stream structure
+ * @retval	TRUE if a block is ready, FALSE otherwise
+ */
+bool adc_stream_has_block(TAdc_stream *stream) {
+	return stream->ready != 0;
+}
+
+static void adc_stream_command(TShell *shell, void *context, char *args) {
+	TAdc_stream *stream = context;
+	char *rate = shell_next_token(&args);
+
+	if (rate != NULL && adc_stream_set_rate(stream, strtoul(rate, NULL, 10)) != ADC_STREAM_OK) {
+		shell_print(shell, "Usage: adc [rate Hz, %u to %u]\r\n", ADC_STREAM_MIN_RATE, ADC_STREAM_MAX_RATE);
+		return;
+	}
+
+	__disable_irq();
+	uint32_t blocks = stream->blocks;
+	uint32_t overruns = stream->overruns;
+	__enable_irq();
+
+	shell_print(shell, "rate %lu Hz, %s, block of %u samples every %lu ms\r\n", stream->rate,
+			stream->running ? "running" : "stopped", ADC_STREAM_BLOCK_SIZE,
+			ADC_STREAM_BLOCK_SIZE * 1000UL / stream->rate);
+	shell_print(shell, "channels %u, started 0x%02x\r\n", stream->channels_n, stream->started);
+	for (uint8_t index = 0; index < stream->channels_n; index++) {
+		shell_print(shell, "  %u: sampling %u cycles, oversampling %u, %u bits\r\n", index,
+				sampling_cycles[stream->sampling_times[index]], 1U << (2U * stream->oversampling_shifts[index]),
+				adc_stream_get_bits(stream, index));
+	}
+	shell_print(shell, "blocks %lu, overruns %lu\r\n", blocks, overruns);
+	if (stream->decimated != 0) {
+		shell_print(shell, "decimation %lu cycles per sample\r\n", stream->decimation_cycles / stream->decimated);
+	}
+	shell_print(shell, "block %lu cycles, at most %lu, budget %lu, %lu late\r\n", stream->block_cycles,
+			stream->block_cycles_max, adc_stream_budget(stream), stream->late);
+}
+
+static void adc_stream_channel_command(TShell *shell, void *context, char *args) {
+	TAdc_stream *stream = context;
+	char *index = shell_next_token(&args);
+	char *cycles = shell_next_token(&args);
+	char *oversampling = shell_next_token(&args);
+	uint32_t sampling_time = ADC_SAMPLETIME_480CYCLES + 1U;
+	uint32_t channel = (index == NULL) ? ADC_STREAM_MAX_CHANNELS : strtoul(index, NULL, 10);
+	uint32_t ratio = (oversampling == NULL) ? 0 : strtoul(oversampling, NULL, 10);
+
+	if (cycles != NULL) {
+		uint32_t value = strtoul(cycles, NULL, 10);
+
+		for (uint32_t i = 0; i <= ADC_SAMPLETIME_480CYCLES; i++) {
+			if (sampling_cycles[i] == value) {
+				sampling_time = i;
+			}
+		}
+	}
+	if (channel >= ADC_STREAM_MAX_CHANNELS || ratio > ADC_STREAM_MAX_OVERSAMPLING
+			|| adc_stream_set_channel(stream, channel, sampling_time, ratio) != ADC_STREAM_OK) {
+		shell_print(shell, "Usage: adcch <index> <cycles 3, 15, 28, 56, 84, 112, 144 or 480> <oversampling 1, 4 or 16>\r\n");
+		return;
+	}
+	shell_print(shell, "channel %lu: %u bits\r\n", channel, adc_stream_get_bits(stream, channel));
+}
+
+/*
+ * @fn		void adc_stream_register_commands(TAdc_stream *stream, TShell *shell)
+ * @brief	Adds to the shell the command adc [rate], that shows the statistics of the stream
+ * 			and optionally changes its sample rate, and the command adcch <index> <cycles> <oversampling>,
+ * 			that changes the sampling time and the oversampling of a channel
+ * @param	stream		pointer to the TAdc_stream structure
+ * @param	shell		pointer to the TShell structure
+ */
+void adc_stream_register_commands(TAdc_stream *stream, TShell *shell) {
+	shell_register_command(shell, "adc", "[rate Hz] shows the blocks of the ADC stream, and sets its sample rate",
+			adc_stream_command, stream);
+	shell_register_command(shell, "adcch", "<index> <cycles> <oversampling> sets the sampling time and the oversampling"
+			" of a channel of the ADC stream", adc_stream_channel_command, stream);
+}
@@ -0,0 +1,51 @@
+/*
+ * This module executes the alarm state machine of the sensors from a table.
+ * Every sensor type describes its behavior with a constant table indexed by state and event: each cell holds
+ * the next state and the list of the actions to execute, as indices in the table of the actions of the sensor type.
+ * alarm_fsm_dispatch() is the only interpreter of the tables, so a new sensor type needs only its tables.
+ * Every transition is also reported to an optional observer, that sees the state changes of all the sensors.
+ */
+
+#include "alarm_fsm.h"
+
+static TAlarm_observer transition_observer = NULL;
+
+/*
+ * @fn		bool alarm_fsm_dispatch(const TAlarm_fsm *fsm, TAlarmState *state, TAlarmEvent event, void *sensor)
+ * @brief	Executes the transition of an event. The new state is stored before the actions are executed,
+ * 			so an action can dispatch another event on the same sensor.
+ * @param	fsm		the state machine of the sensor type
+ * @param	state	pointer to the state of the sensor
+ * @param	event	the event to execute
+ * @param	sensor	pointer passed to the actions as it is
+ * @retval	TRUE if the event caused a transition, FALSE if it has been ignored
+ */
+bool alarm_fsm_dispatch(const TAlarm_fsm *fsm, TAlarmState *state, TAlarmEvent event, void *sensor) {
+	if (*state >= ALARM_STATES_N || event >= ALARM_EVENTS_N) {
+		return FALSE;
+	}
+
+	const TAlarm_transition *transition = &fsm->transitions[*state][event];
+	if (transition->next_state == ALARM_FSM_IGNORE) {
+		return FALSE;
+	}
+
+	TAlarmState previous = *state;
+	*state = transition->next_state;
+	if (transition_observer != NULL) {
+		transition_observer(sensor, previous, *state);
+	}
+	for (uint8_t i = 0; i < ALARM_FSM_MAX_ACTIONS && transition->actions[i] != ALARM_ACTION_END; i++) {
+		fsm->actions[transition->actions[i]](sensor);
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		void alarm_fsm_set_observer(TAlarm_observer observer)
+ * @brief	Sets the function called after every transition of every sensor
+ * @param	observer	the function, NULL to remove it
+ */
+void alarm_fsm_set_observer(TAlarm_observer observer) {
+	transition_observer = observer;
+}
@@ -6,6 +6,9 @@
  */
 
 #include <configuration.h>
+#include "shell.h"
+#include "raw_stream.h"
+#include "latency.h"
 
 /*
  * @fn		void configuration_init()
@@ -147,23 +150,34 @@ void configuration_recap() {
 }
 
 /*
- * When the UART interface has fully received the data, the console will be set to be ready to use
+ * When the UART interface has fully received the data, the console will be set to be ready to use.
+ * Once the system is booted, the received characters are commands for the shell instead.
  */
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
 	TConsole *console = get_console(NULL);
 
+	if (shell_receive_callback(huart)) {
+		return;
+	}
+
 	if (huart == console->huart) {
 		console->ready = TRUE;
 	}
 }
 
 /*
- * When the UART interface has fully trasmitted the data, the console will be set to be ready to use
+ * When the UART interface has fully trasmitted the data, the console will be set to be ready to use.
+ * While the raw stream runs, the transfers are its buffers instead.
  */
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
 	TConsole *console = get_console(NULL);
 
+	if (raw_stream_transmit_callback(huart)) {
+		return;
+	}
+
 	if (huart == console->huart) {
+		latency_mark(LATENCY_MARK_EMITTED);
 		console->ready = TRUE;
 	}
 }
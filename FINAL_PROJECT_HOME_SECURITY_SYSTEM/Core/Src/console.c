@@ -2,6 +2,7 @@
  * This module contains methods to handle with the console, representing it with a singleton.
  * To instantiate a console, just call console_init() with the UART interface you want to use to communicate.
  * To print messages, just call the proper methods, without specifying again the UART interface.
+ * While the UART carries something else, as a binary stream, the console can be muted: the messages are dropped.
  */
 
 #include "console.h"
@@ -12,6 +13,7 @@
  * @param	huart	pointer to the UART_HandleTypeDef structure
  * 					representing the UART interface used for communication
  * @param	ready	a boolean value set to TRUE if the console is ready for use, FALSE otherwise
+ * @param	muted	a boolean value set to TRUE if the messages must be dropped, FALSE otherwise
  */
 void console_init(UART_HandleTypeDef *huart) {
 	get_console(huart);
@@ -40,6 +42,7 @@ TConsole* get_console(UART_HandleTypeDef *huart) {
 		console = malloc(sizeof(*console));
 		console->huart = huart;
 		console->ready = TRUE;
+		console->muted = FALSE;
 	}
 
 	return console;
@@ -64,6 +67,16 @@ void free_console() {
 	}
 }
 
+/*
+ * @fn		void mute_console(bool muted)
+ * @brief	Drops the next messages, or prints them again.
+ * 			The console must be free before it is muted, so no message is left halfway
+ * @param	muted	TRUE to drop the messages, FALSE to print them
+ */
+void mute_console(bool muted) {
+	get_console(NULL)->muted = muted;
+}
+
 /*
  * @fn		void print_on_console(const char *message)
  * @brief	Prints a string on the console, waiting if it is not ready for use.
@@ -71,6 +84,10 @@ void free_console() {
  * @param	message		string to print
  */
 void print_on_console(const char *message) {
+	// a muted console is never set free by the UART, so it must not be waited for
+	if (get_console(NULL)->muted) {
+		return;
+	}
 	free_console();
 	get_console(NULL)->ready = FALSE;
 	print_message(message);
@@ -0,0 +1,290 @@
+/*
+ * This module correlates the detections of different sensors to compute a confidence-weighted alarm level.
+ * It observes the transitions of all the sensors: a sensor entering the delayed state is a detection, stamped with
+ * the SysTick time and with the zones of the sensor in the registry. Two kinds of rules are evaluated on the detections:
+ * 		a sequence, a detection in some zones followed by a detection in other zones within a window,
+ * 			e.g. "barrier break followed by area motion within 10 s"
+ * 		a count, detections of different sensors of some zones within a window, e.g. "two zones within 2 s"
+ * Every rule keeps its own sliding window, updated only by the detections of its zones: the rules are indexed by zone,
+ * so a detection touches only the rules that can match it. A matched rule adds its weight to the alarm level,
+ * that decays linearly with the time and is computed when it is read.
+ */
+
+#include "correlation.h"
+
+/* Maximum length of the event logged when the alarm level is reached */
+#define CORRELATION_MESSAGE_LENGTH	(48U)
+
+/* The level is kept in thousandths of point, so it decays by CORRELATION_LEVEL_DECAY every millisecond */
+#define CORRELATION_LEVEL_SCALE		(1000U)
+
+extern TLogger logger;
+
+static TCorrelation_rule rules[CORRELATION_RULES_N];
+static uint8_t rules_n = 0;
+
+/* Mask of the rules interested in each zone bit, the rule i is the bit i % 32 of the word i / 32 */
+static uint32_t rules_of_zone[CORRELATION_ZONES_N][CORRELATION_RULE_WORDS];
+
+/* Alarm level, in thousandths of point, at the time level_time */
+static uint32_t level = 0;
+static uint32_t level_time = 0;
+
+/* The logger keeps a reference to the message, so it can't be on the stack */
+static char message[CORRELATION_MESSAGE_LENGTH];
+
+static void correlation_transition(void *sensor, TAlarmState previous, TAlarmState state);
+
+/*
+ * @fn		void correlation_init()
+ * @brief	Removes all the rules, clears the alarm level and starts observing the transitions of the sensors
+ */
+void correlation_init() {
+	memset(rules, 0, sizeof(rules));
+	memset(rules_of_zone, 0, sizeof(rules_of_zone));
+	rules_n = 0;
+	level = 0;
+	level_time = HAL_GetTick();
+	alarm_fsm_set_observer(correlation_transition);
+}
+
+/*
+ * @fn		static int correlation_add(TCorrelation_kind kind, const char *name, uint16_t first, uint16_t then,
+ * 				uint8_t count, uint32_t window, uint8_t weight)
+ * @brief	Adds a rule and indexes it by the zones it is interested in
+ */
+static int correlation_add(TCorrelation_kind kind, const char *name, uint16_t first, uint16_t then,
+		uint8_t count, uint32_t window, uint8_t weight) {
+	if (rules_n >= CORRELATION_RULES_N) {
+		return CORRELATION_ERR_FULL;
+	}
+
+	TCorrelation_rule *rule = &rules[rules_n];
+	rule->name = name;
+	rule->kind = kind;
+	rule->first = first;
+	rule->then = then;
+	rule->count = count;
+	rule->window = window;
+	rule->weight = weight;
+	rule->recent_n = 0;
+	rule->matches = 0;
+
+	uint16_t zones = first | then;
+	for (uint8_t zone = 0; zone < CORRELATION_ZONES_N; zone++) {
+		if ((zones & (1U << zone)) != 0) {
+			rules_of_zone[zone][rules_n / 32U] |= 1UL << (rules_n % 32U);
+		}
+	}
+	return rules_n++;
+}
+
+/*
+ * @fn		int correlation_add_sequence(const char *name, uint16_t first, uint16_t then, uint32_t window, uint8_t weight)
+ * @brief	Adds a rule matching a detection in the zones first followed, within window milliseconds,
+ * 			by a detection of another sensor in the zones then
+ * @param	name	name of the rule, it must be a constant string
+ * @param	first	mask of the zones of the first detection
+ * @param	then	mask of the zones of the second detection
+ * @param	window	maximum milliseconds between the two detections
+ * @param	weight	points added to the alarm level when the rule matches
+ * @retval	CORRELATION_ERR_INVALID if a mask is empty, CORRELATION_ERR_FULL if there is no room for the rule,
+ * 			the index of the rule otherwise
+ */
+int correlation_add_sequence(const char *name, uint16_t first, uint16_t then, uint32_t window, uint8_t weight) {
+	if (first == 0 || then == 0) {
+		return CORRELATION_ERR_INVALID;
+	}
+	return correlation_add(CORRELATION_RULE_SEQUENCE, name, first, then, 2, window, weight);
+}
+
+/*
+ * @fn		int correlation_add_count(const char *name, uint16_t zones, uint8_t count, uint32_t window, uint8_t weight)
+ * @brief	Adds a rule matching detections of count different sensors of the given zones within window milliseconds
+ * @param	name	name of the rule, it must be a constant string
+ * @param	zones	mask of the zones of the detections
+ * @param	count	number of sensors, from 2 to CORRELATION_COUNT_MAX
+ * @param	window	maximum milliseconds between the first and the last detection
+ * @param	weight	points added to the alarm level when the rule matches
+ * @retval	CORRELATION_ERR_INVALID if the mask is empty or count is out of range,
+ * 			CORRELATION_ERR_FULL if there is no room for the rule, the index of the rule otherwise
+ */
+int correlation_add_count(const char *name, uint16_t zones, uint8_t count, uint32_t window, uint8_t weight) {
+	if (zones == 0 || count < 2 || count > CORRELATION_COUNT_MAX) {
+		return CORRELATION_ERR_INVALID;
+	}
+	return correlation_add(CORRELATION_RULE_COUNT, name, zones, 0, count, window, weight);
+}
+
+/*
+ * @fn		static void correlation_decay(uint32_t now)
+ * @brief	Brings the alarm level to the given time
+ */
+static void correlation_decay(uint32_t now) {
+	uint32_t elapsed = now - level_time;
+
+	level_time = now;
+	// the check comes first, so the product can't overflow
+	if (elapsed >= level / CORRELATION_LEVEL_DECAY) {
+		level = 0;
+	} else {
+		level -= elapsed * CORRELATION_LEVEL_DECAY;
+	}
+}
+
+/*
+ * @fn		static void correlation_match(TCorrelation_rule *rule, uint32_t now)
+ * @brief	Adds the weight of a matched rule to the alarm level, and logs the correlated alarm
+ * 			when the level reaches CORRELATION_ALARM_LEVEL
+ */
+static void correlation_match(TCorrelation_rule *rule, uint32_t now) {
+	const uint32_t alarm_level = CORRELATION_ALARM_LEVEL * CORRELATION_LEVEL_SCALE;
+	const uint32_t max_level = CORRELATION_LEVEL_MAX * CORRELATION_LEVEL_SCALE;
+
+	rule->matches++;
+	correlation_decay(now);
+
+	bool below = level < alarm_level;
+	level += (uint32_t) rule->weight * CORRELATION_LEVEL_SCALE;
+	if (level > max_level) {
+		level = max_level;
+	}
+
+	if (below && level >= alarm_level) {
+		snprintf(message, sizeof(message), "Correlated alarm: %s", rule->name);
+		logger_print(&logger, message);
+	}
+}
+
+/*
+ * @fn		static bool correlation_sequence(TCorrelation_rule *rule, uint8_t sensor, uint16_t zones, uint32_t now)
+ * @brief	Updates a sequence rule with a detection
+ * @retval	TRUE if the rule matched
+ */
+static bool correlation_sequence(TCorrelation_rule *rule, uint8_t sensor, uint16_t zones, uint32_t now) {
+	TCorrelation_detection *first = &rule->recent[0];
+
+	if ((zones & rule->then) != 0 && rule->recent_n != 0 && first->sensor != sensor
+			&& now - first->time <= rule->window) {
+		rule->recent_n = 0;
+		return TRUE;
+	}
+
+	// the latest detection in the first zones restarts the window
+	if ((zones & rule->first) != 0) {
+		first->sensor = sensor;
+		first->time = now;
+		rule->recent_n = 1;
+	}
+	return FALSE;
+}
+
+/*
+ * @fn		static bool correlation_count(TCorrelation_rule *rule, uint8_t sensor, uint32_t now)
+ * @brief	Updates a count rule with a detection
+ * @retval	TRUE if the rule matched
+ */
+static bool correlation_count(TCorrelation_rule *rule, uint8_t sensor, uint32_t now) {
+	uint8_t kept = 0;
+
+	// slide the window, and forget the previous detection of the same sensor so the sensors are all different
+	for (uint8_t i = 0; i < rule->recent_n; i++) {
+		TCorrelation_detection *detection = &rule->recent[i];
+		if (now - detection->time <= rule->window && detection->sensor != sensor) {
+			rule->recent[kept++] = *detection;
+		}
+	}
+	if (kept == CORRELATION_COUNT_MAX) {
+		memmove(&rule->recent[0], &rule->recent[1], (kept - 1U) * sizeof(TCorrelation_detection));
+		kept--;
+	}
+	rule->recent[kept].sensor = sensor;
+	rule->recent[kept].time = now;
+	rule->recent_n = kept + 1U;
+
+	if (rule->recent_n >= rule->count) {
+		rule->recent_n = 0;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * @fn		static void correlation_transition(void *sensor, TAlarmState previous, TAlarmState state)
+ * @brief	Observer of the transitions of the sensors. A sensor entering the delayed state is a detection,
+ * 			evaluated only by the rules of the zones of the sensor.
+ * 			It is called by the interrupts, or by the main loop with the interrupts disabled.
+ */
+static void correlation_transition(void *sensor, TAlarmState previous, TAlarmState state) {
+	if (state != ALARM_STATE_DELAYED || previous == ALARM_STATE_DELAYED) {
+		return;
+	}
+
+	int index = sensor_registry_find(sensor);
+	if (index < 0) {
+		return;
+	}
+
+	uint16_t zones = sensor_registry_get(index)->zones;
+	uint32_t now = HAL_GetTick();
+
+	for (uint8_t word = 0; word < CORRELATION_RULE_WORDS; word++) {
+		uint32_t candidates = 0;
+
+		for (uint16_t bits = zones; bits != 0; bits &= bits - 1U) {
+			candidates |= rules_of_zone[__builtin_ctz(bits)][word];
+		}
+
+		for (; candidates != 0; candidates &= candidates - 1U) {
+			TCorrelation_rule *rule = &rules[word * 32U + __builtin_ctz(candidates)];
+			bool matched;
+
+			if (rule->kind == CORRELATION_RULE_SEQUENCE) {
+				matched = correlation_sequence(rule, index, zones, now);
+			} else {
+				matched = (zones & rule->first) != 0 && correlation_count(rule, index, now);
+			}
+			if (matched) {
+				correlation_match(rule, now);
+			}
+		}
+	}
+}
+
+/*
+ * @fn		uint8_t correlation_get_level()
+ * @brief	Returns the current alarm level
+ * @retval	the level, from 0 to CORRELATION_LEVEL_MAX
+ */
+uint8_t correlation_get_level() {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	correlation_decay(HAL_GetTick());
+	uint32_t current = level;
+	__set_PRIMASK(primask);
+
+	// rounded up, so a level still decaying is never shown as 0
+	return (current + CORRELATION_LEVEL_SCALE - 1U) / CORRELATION_LEVEL_SCALE;
+}
+
+static void correlation_command(TShell *shell, void *context, char *args) {
+	static const char *const kinds[] = { "sequence", "count" };
+
+	shell_print(shell, "alarm level %u/%u\r\n", correlation_get_level(), CORRELATION_LEVEL_MAX);
+	shell_print(shell, "%-3s %-20s %-9s %9s %7s %8s\r\n", "id", "rule", "kind", "window", "weight", "matches");
+	for (uint8_t i = 0; i < rules_n; i++) {
+		TCorrelation_rule *rule = &rules[i];
+		shell_print(shell, "%-3u %-20s %-9s %9lu %7u %8lu\r\n", i, rule->name, kinds[rule->kind], rule->window,
+				rule->weight, rule->matches);
+	}
+}
+
+/*
+ * @fn		void correlation_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command correlation, that shows the alarm level and the matches of every rule
+ * @param	shell	pointer to the TShell structure
+ */
+void correlation_register_commands(TShell *shell) {
+	shell_register_command(shell, "correlation", "shows the correlated alarm level and the rules",
+			correlation_command, NULL);
+}
@@ -0,0 +1,109 @@
+/*
+ * This module dispatches the external interrupts to the modules owning the lines.
+ * Every module registers a handler for its pins during the initialization, then the irq handlers of the EXTI
+ * vectors just call exti_dispatcher_dispatch() with the lines they serve: the pending register is read and
+ * cleared once, and the handlers of the pending lines are called through a table indexed by the line number.
+ * The time from the dispatch to each handler is measured with the DWT cycle counter, that is enabled by latency_init().
+ */
+
+#include "exti_dispatcher.h"
+
+static TEXTI_line lines_table[EXTI_DISPATCHER_LINES_N];
+
+/* Mask of the lines having a handler, so the pending bits of the other lines are left untouched */
+static uint32_t registered_lines = 0;
+
+/*
+ * @fn		void exti_dispatcher_init()
+ * @brief	Removes all the handlers. It must be called before any module registers its handlers.
+ */
+void exti_dispatcher_init() {
+	memset(lines_table, 0, sizeof(lines_table));
+	registered_lines = 0;
+}
+
+/*
+ * @fn		int exti_dispatcher_register(uint16_t pin, TEXTI_handler handler, void *context)
+ * @brief	Registers the handler of the line of a pin
+ * @param	pin			the pin, one of GPIO_PIN_0 ... GPIO_PIN_15
+ * @param	handler		the function executed when the line is pending
+ * @param	context		pointer passed to handler as it is
+ * @retval	EXTI_DISPATCHER_ERR_INVALID if pin is not a single pin or handler is NULL,
+ * 			EXTI_DISPATCHER_ERR_BUSY if the line already has a handler,
+ * 			EXTI_DISPATCHER_OK otherwise
+ */
+int exti_dispatcher_register(uint16_t pin, TEXTI_handler handler, void *context) {
+	if (pin == 0 || (pin & (pin - 1U)) != 0 || handler == NULL) {
+		return EXTI_DISPATCHER_ERR_INVALID;
+	}
+
+	uint8_t line = __builtin_ctz(pin);
+	if (lines_table[line].handler != NULL) {
+		return EXTI_DISPATCHER_ERR_BUSY;
+	}
+
+	lines_table[line].context = context;
+	lines_table[line].count = 0;
+	lines_table[line].latency_sum = 0;
+	lines_table[line].latency_max = 0;
+	lines_table[line].handler = handler;
+	registered_lines |= pin;
+	return EXTI_DISPATCHER_OK;
+}
+
+/*
+ * @fn		void exti_dispatcher_dispatch(uint32_t lines)
+ * @brief	Clears the pending lines among the given ones and executes their handlers, from the lowest line.
+ * 			Should be called only by the irq handlers of the EXTI vectors.
+ * @param	lines	mask of the lines served by the calling vector
+ */
+void exti_dispatcher_dispatch(uint32_t lines) {
+	uint32_t entry = DWT->CYCCNT;
+	uint32_t pending = EXTI->PR & lines & registered_lines;
+
+	// the register is write-one-to-clear: the lines becoming pending from now on will fire the irq again
+	EXTI->PR = pending;
+
+	while (pending != 0) {
+		uint8_t line = __builtin_ctz(pending);
+		TEXTI_line *exti_line = &lines_table[line];
+
+		uint32_t latency = DWT->CYCCNT - entry;
+		exti_line->count++;
+		exti_line->latency_sum += latency;
+		if (latency > exti_line->latency_max) {
+			exti_line->latency_max = latency;
+		}
+
+		exti_line->handler(1U << line, exti_line->context);
+		pending &= pending - 1U;
+	}
+}
+
+static void exti_dispatcher_command(TShell *shell, void *context, char *args) {
+	shell_print(shell, "%-5s %9s %11s %11s\r\n", "line", "count", "avg cycles", "max cycles");
+
+	for (uint8_t line = 0; line < EXTI_DISPATCHER_LINES_N; line++) {
+		if ((registered_lines & (1U << line)) == 0) {
+			continue;
+		}
+
+		__disable_irq();
+		TEXTI_line exti_line = lines_table[line];
+		__enable_irq();
+
+		uint32_t avg = (exti_line.count == 0) ? 0 : (uint32_t) (exti_line.latency_sum / exti_line.count);
+		shell_print(shell, "%-5u %9lu %11lu %11lu\r\n", line, exti_line.count, avg, exti_line.latency_max);
+	}
+}
+
+/*
+ * @fn		void exti_dispatcher_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command exti, that shows how many times each line has been dispatched
+ * 			and the average and maximum cycles from the dispatch to its handler
+ * @param	shell	pointer to the TShell structure
+ */
+void exti_dispatcher_register_commands(TShell *shell) {
+	shell_register_command(shell, "exti", "shows the dispatch latency of the EXTI lines",
+			exti_dispatcher_command, NULL);
+}
@@ -0,0 +1,250 @@
+/*
+ * This module measures the amplitude of a few frequencies in a stream of samples, with a bank of Goertzel filters
+ * in fixed point. Each filter is a resonator, s = x + c * s1 - s2 with c = 2 cos(2 pi f / rate) in Q29, so a sample
+ * costs a multiply and two additions per frequency, and the amplitude is computed once per window.
+ * The window lasts rate / GOERTZEL_RESOLUTION samples, so every frequency multiple of GOERTZEL_RESOLUTION
+ * falls exactly on a bin: the constant level and the other bins do not leak into it.
+ * Above GOERTZEL_MAX_RATE the samples are averaged in groups before the resonators, that never run faster, and
+ * the mean of the previous window is subtracted from them: so the resonators stay far from overflowing.
+ * The groups split the window exactly, so it still lasts a whole number of periods of every bin.
+ */
+
+#include "goertzel.h"
+
+/*
+ * @fn		static uint32_t goertzel_sqrt(uint64_t value)
+ * @brief	Returns the integer square root of a value, one bit at a time
+ */
+static uint32_t goertzel_sqrt(uint64_t value) {
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t) root;
+}
+
+/*
+ * @fn		static void goertzel_end_window(TGoertzel *goertzel)
+ * @brief	Computes the mean and the amplitudes of the completed window: the squared magnitude of a bin is
+ * 			s1^2 + s2^2 - c * s1 * s2, and a sine of amplitude A gives a magnitude of A * length / 2
+ */
+static void goertzel_end_window(TGoertzel *goertzel) {
+	for (uint8_t bin = 0; bin < goertzel->bins_n; bin++) {
+		int64_t s1 = goertzel->s1[bin];
+		int64_t s2 = goertzel->s2[bin];
+		int64_t power = s1 * s1 + s2 * s2 - ((goertzel->coefficients[bin] * s1 >> GOERTZEL_COEFFICIENT_SHIFT) * s2);
+		uint32_t amplitude = 0;
+
+		if (goertzel->coefficients[bin] != 0 && power > 0) {
+			amplitude = 2U * goertzel_sqrt((uint64_t) power) / goertzel->length;
+		}
+		goertzel->amplitudes[bin] = (amplitude > UINT16_MAX) ? UINT16_MAX : amplitude;
+	}
+	goertzel->mean = goertzel->sum / goertzel->length;
+	goertzel->windows++;
+	goertzel_reset(goertzel);
+}
+
+/*
+ * @fn		void goertzel_init(TGoertzel *goertzel)
+ * @brief	Initializes an empty bank, without a sample rate
+ * @param	goertzel	pointer to the TGoertzel structure
+ */
+void goertzel_init(TGoertzel *goertzel) {
+	goertzel->bins_n = 0;
+	goertzel->rate = 0;
+	goertzel->decimation = 1;
+	goertzel->length = 0;
+	goertzel->mean = 0;
+	goertzel->windows = 0;
+	goertzel->offset = 0;
+	goertzel_reset(goertzel);
+}
+
+/*
+ * @fn		int goertzel_add_bin(TGoertzel *goertzel, uint16_t frequency)
+ * @brief	Adds a frequency to the bank. It is measured at the sample rates above twice the frequency
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @param	frequency	the frequency in Hz, a multiple of GOERTZEL_RESOLUTION
+ * @retval	GOERTZEL_ERR_INVALID if the bank is full or the frequency is not a multiple of GOERTZEL_RESOLUTION,
+ * 			GOERTZEL_OK otherwise
+ */
+int goertzel_add_bin(TGoertzel *goertzel, uint16_t frequency) {
+	uint32_t rate = goertzel->rate;
+
+	if (goertzel->bins_n == GOERTZEL_MAX_BINS || frequency == 0 || frequency % GOERTZEL_RESOLUTION != 0) {
+		return GOERTZEL_ERR_INVALID;
+	}
+	goertzel->frequencies[goertzel->bins_n] = frequency;
+	goertzel->amplitudes[goertzel->bins_n] = 0;
+	goertzel->bins_n++;
+
+	// the coefficients of all the bins are computed again
+	goertzel->rate = 0;
+	if (rate != 0) {
+		goertzel_set_rate(goertzel, rate);
+	}
+	return GOERTZEL_OK;
+}
+
+/*
+ * @fn		void goertzel_set_rate(TGoertzel *goertzel, uint32_t rate)
+ * @brief	Sets the sample rate of the next samples. If it changed the coefficients are computed again
+ * 			and the current window starts over, otherwise nothing happens, so it can be called for every block
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @param	rate		the sample rate in Hz, at least GOERTZEL_RESOLUTION
+ */
+void goertzel_set_rate(TGoertzel *goertzel, uint32_t rate) {
+	if (rate == goertzel->rate || rate < GOERTZEL_RESOLUTION) {
+		return;
+	}
+	uint32_t window = rate / GOERTZEL_RESOLUTION;
+	uint32_t decimation = (rate + GOERTZEL_MAX_RATE - 1U) / GOERTZEL_MAX_RATE;
+
+	// a window of 5000 samples at 50 kHz in groups of 16 would leave out 8 of them, and a part of every period
+	while (window % decimation != 0 && decimation < window) {
+		decimation++;
+	}
+	goertzel->rate = rate;
+	goertzel->decimation = decimation;
+	goertzel->length = window / decimation;
+
+	// the coefficients are computed only here, the samples are filtered in fixed point
+	for (uint8_t bin = 0; bin < goertzel->bins_n; bin++) {
+		uint32_t frequency = goertzel->frequencies[bin];
+
+		if (2U * frequency * goertzel->decimation < rate) {
+			goertzel->coefficients[bin] = lroundf(2.0f * cosf(2.0f * (float) M_PI * frequency * goertzel->decimation
+					/ rate) * (1UL << GOERTZEL_COEFFICIENT_SHIFT));
+		} else {
+			goertzel->coefficients[bin] = 0;
+		}
+		goertzel->amplitudes[bin] = 0;
+	}
+	goertzel_reset(goertzel);
+}
+
+/*
+ * @fn		void goertzel_reset(TGoertzel *goertzel)
+ * @brief	Starts the current window over, forgetting its samples
+ * @param	goertzel	pointer to the TGoertzel structure
+ */
+void goertzel_reset(TGoertzel *goertzel) {
+	for (uint8_t bin = 0; bin < GOERTZEL_MAX_BINS; bin++) {
+		goertzel->s1[bin] = 0;
+		goertzel->s2[bin] = 0;
+	}
+	goertzel->group_count = 0;
+	goertzel->group_sum = 0;
+	goertzel->count = 0;
+	goertzel->sum = 0;
+}
+
+/*
+ * @fn		static bool goertzel_run(TGoertzel *goertzel, const int32_t *inputs, uint16_t length)
+ * @brief	Runs inputs of the current window through the resonators, ending the window with the last of them
+ * @retval	TRUE if the window has been completed, FALSE otherwise
+ */
+static bool goertzel_run(TGoertzel *goertzel, const int32_t *inputs, uint16_t length) {
+	int32_t offset = goertzel->offset;
+
+	// the inputs are run through one resonator at a time, keeping its state in registers
+	for (uint8_t bin = 0; bin < goertzel->bins_n; bin++) {
+		int32_t coefficient = goertzel->coefficients[bin];
+		int32_t s1 = goertzel->s1[bin];
+		int32_t s2 = goertzel->s2[bin];
+
+		if (coefficient == 0) {
+			continue;
+		}
+		for (uint16_t i = 0; i < length; i++) {
+			int32_t s0 = inputs[i] - offset + (int32_t) (((int64_t) coefficient * s1) >> GOERTZEL_COEFFICIENT_SHIFT)
+					- s2;
+			s2 = s1;
+			s1 = s0;
+		}
+		goertzel->s1[bin] = s1;
+		goertzel->s2[bin] = s2;
+	}
+	for (uint16_t i = 0; i < length; i++) {
+		goertzel->sum += inputs[i];
+	}
+
+	goertzel->count += length;
+	if (goertzel->count == goertzel->length) {
+		goertzel_end_window(goertzel);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * @fn		bool goertzel_block(TGoertzel *goertzel, const uint16_t *samples, uint16_t length)
+ * @brief	Feeds a block of samples to the bank, computing the mean and the amplitudes of every window completed
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @param	samples		the samples, of 15 bits at most
+ * @param	length		number of samples
+ * @retval	TRUE if a window has been completed, FALSE otherwise
+ */
+bool goertzel_block(TGoertzel *goertzel, const uint16_t *samples, uint16_t length) {
+	int32_t inputs[GOERTZEL_CHUNK];
+	uint16_t inputs_n = 0;
+	bool completed = FALSE;
+
+	if (goertzel->rate == 0) {
+		return FALSE;
+	}
+	for (uint16_t i = 0; i < length; i++) {
+		int32_t input;
+
+		goertzel->group_sum += samples[i];
+		if (++goertzel->group_count < goertzel->decimation) {
+			continue;
+		}
+		input = goertzel->group_sum / goertzel->decimation;
+		goertzel->group_count = 0;
+		goertzel->group_sum = 0;
+
+		// the first window has no mean before it, its first input is the best guess
+		if (goertzel->count == 0 && inputs_n == 0) {
+			goertzel->offset = (goertzel->windows == 0) ? input : goertzel->mean;
+		}
+		inputs[inputs_n++] = input;
+		if (inputs_n == GOERTZEL_CHUNK || goertzel->count + inputs_n == goertzel->length) {
+			completed |= goertzel_run(goertzel, inputs, inputs_n);
+			inputs_n = 0;
+		}
+	}
+	if (inputs_n > 0) {
+		completed |= goertzel_run(goertzel, inputs, inputs_n);
+	}
+	return completed;
+}
+
+/*
+ * @fn		uint16_t goertzel_get_peak(TGoertzel *goertzel)
+ * @brief	Returns the greatest amplitude of the last window
+ * @param	goertzel	pointer to the TGoertzel structure
+ * @retval	the amplitude, in the unit of the samples
+ */
+uint16_t goertzel_get_peak(TGoertzel *goertzel) {
+	uint16_t peak = 0;
+
+	for (uint8_t bin = 0; bin < goertzel->bins_n; bin++) {
+		if (goertzel->amplitudes[bin] > peak) {
+			peak = goertzel->amplitudes[bin];
+		}
+	}
+	return peak;
+}
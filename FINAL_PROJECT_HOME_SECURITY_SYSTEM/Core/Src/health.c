@@ -0,0 +1,201 @@
+/*
+ * This module collects the faults of the sensors and of the peripherals, found by background checks
+ * that reuse the data the modules already read:
+ * 		a PIR output held high for more than PIR_STUCK_TIME, seen from its edges
+ * 		an ADC reading of the photoresistor pinned at 0 or 4095, seen from the samples of the photoresistor
+ * 		the RTC not answering a reading of the datetime, seen from the I2C callbacks
+ * 		a row of the keypad held high for more than KEYPAD_ROW_STUCK_TIME, seen from the release debouncing
+ * 		an ambient light so close to the top of the ADC that the barrier can't tell an intruder, seen from its baseline
+ * Every kind of fault keeps the mask of its faulty sources (the PIR lines, the keypad rows ...): a fault is logged
+ * once when it is raised and once when it is cleared, and the active ones are shown in the periodic log message.
+ * The events are written in a ring of messages while the interrupts are disabled, so the events of the interrupts
+ * and of the main loop never share a message.
+ */
+
+#include "health.h"
+#include "logger.h"
+
+_Static_assert(HEALTH_MESSAGES_N >= 2U * LOGGER_QUEUE_SIZE, "the events would be overwritten while queued");
+
+extern TLogger logger;
+
+static THealth_entry faults[HEALTH_FAULTS_N];
+
+/* The events logged, the logger keeps a reference to them: a message is reused after HEALTH_MESSAGES_N events */
+static char messages[HEALTH_MESSAGES_N][HEALTH_MESSAGE_LENGTH];
+static uint8_t next_message = 0;
+
+/* Names of the faults, indexed by THealth_fault */
+static const char *const fault_names[] = { "pir stuck", "adc saturated", "rtc timeout", "keypad row stuck",
+		"barrier window" };
+
+/* Events logged when a fault is raised, the argument is the source */
+static const char *const raise_formats[] = {
+	"Fault: PIR line %u stuck high",
+	"Fault: light sensor ADC saturated",
+	"Fault: RTC not responding",
+	"Fault: keypad row %u stuck high",
+	"Fault: light barrier too bright to detect"
+};
+
+/* TRUE while a reading of the datetime is waiting for the RTC, since rtc_request_time */
+static bool rtc_waiting = FALSE;
+static uint32_t rtc_request_time = 0;
+
+/*
+ * @fn		void health_init()
+ * @brief	Clears all the faults
+ */
+void health_init() {
+	memset(faults, 0, sizeof(faults));
+	next_message = 0;
+	rtc_waiting = FALSE;
+}
+
+/*
+ * @fn		static char* health_next_message()
+ * @brief	Takes the next message of the ring. It must be called with the interrupts disabled
+ */
+static char* health_next_message() {
+	char *message = messages[next_message];
+	next_message = (next_message + 1U) % HEALTH_MESSAGES_N;
+	return message;
+}
+
+/*
+ * @fn		void health_raise(THealth_fault fault, uint8_t source)
+ * @brief	Raises a fault of a source, and logs it if it was not already raised
+ * @param	fault	the kind of fault
+ * @param	source	the faulty source, from 0 to 15
+ */
+void health_raise(THealth_fault fault, uint8_t source) {
+	THealth_entry *entry = &faults[fault];
+	uint16_t bit = 1U << source;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if ((entry->sources & bit) != 0) {
+		__set_PRIMASK(primask);
+		return;
+	}
+	entry->sources |= bit;
+	entry->raised++;
+	entry->last_time = HAL_GetTick();
+	char *message = health_next_message();
+	snprintf(message, HEALTH_MESSAGE_LENGTH, raise_formats[fault], source);
+	__set_PRIMASK(primask);
+
+	logger_print(&logger, message);
+}
+
+/*
+ * @fn		void health_clear(THealth_fault fault, uint8_t source)
+ * @brief	Clears a fault of a source, and logs it if it was raised
+ * @param	fault	the kind of fault
+ * @param	source	the source, from 0 to 15
+ */
+void health_clear(THealth_fault fault, uint8_t source) {
+	THealth_entry *entry = &faults[fault];
+	uint16_t bit = 1U << source;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if ((entry->sources & bit) == 0) {
+		__set_PRIMASK(primask);
+		return;
+	}
+	entry->sources &= ~bit;
+	entry->last_time = HAL_GetTick();
+	char *message = health_next_message();
+	snprintf(message, HEALTH_MESSAGE_LENGTH, "Fault cleared: %s %u", fault_names[fault], source);
+	__set_PRIMASK(primask);
+
+	logger_print(&logger, message);
+}
+
+/*
+ * @fn		bool health_is_raised(THealth_fault fault)
+ * @brief	Tells if a fault is raised for at least one source
+ * @param	fault	the kind of fault
+ * @retval	TRUE if the fault is raised, FALSE otherwise
+ */
+bool health_is_raised(THealth_fault fault) {
+	return faults[fault].sources != 0;
+}
+
+/*
+ * @fn		void health_rtc_request()
+ * @brief	Notifies that a reading of the datetime is starting. If the previous one is still waiting
+ * 			for more than HEALTH_RTC_TIMEOUT, the RTC fault is raised.
+ */
+void health_rtc_request() {
+	uint32_t now = HAL_GetTick();
+
+	if (!rtc_waiting) {
+		rtc_waiting = TRUE;
+		rtc_request_time = now;
+	} else if (now - rtc_request_time >= HEALTH_RTC_TIMEOUT) {
+		// the timing restarts, so the readings keep probing the RTC
+		rtc_request_time = now;
+		health_raise(HEALTH_FAULT_RTC_TIMEOUT, 0);
+	}
+}
+
+/*
+ * @fn		void health_rtc_response(bool ok)
+ * @brief	Notifies the end of a reading of the datetime, from the I2C callbacks
+ * @param	ok	TRUE if the reading completed, FALSE if the I2C reported an error
+ */
+void health_rtc_response(bool ok) {
+	rtc_waiting = FALSE;
+	if (ok) {
+		health_clear(HEALTH_FAULT_RTC_TIMEOUT, 0);
+	} else {
+		health_raise(HEALTH_FAULT_RTC_TIMEOUT, 0);
+	}
+}
+
+/*
+ * @fn		void health_get_string(char *string, size_t length)
+ * @brief	Writes the names of the raised faults, separated by commas, or "none"
+ * @param	string	reference to the buffer where to write the names
+ * @param	length	size of the buffer
+ */
+void health_get_string(char *string, size_t length) {
+	size_t used = 0;
+
+	string[0] = '\0';
+	for (uint8_t fault = 0; fault < HEALTH_FAULTS_N && used < length; fault++) {
+		if (faults[fault].sources != 0) {
+			used += snprintf(string + used, length - used, "%s%s", (used == 0) ? "" : ",", fault_names[fault]);
+		}
+	}
+	if (used == 0) {
+		strncpy(string, "none", length - 1U);
+		string[length - 1U] = '\0';
+	}
+}
+
+static void health_command(TShell *shell, void *context, char *args) {
+	uint32_t now = HAL_GetTick();
+
+	shell_print(shell, "%-17s %-8s %7s %10s\r\n", "fault", "sources", "raised", "changed s");
+	for (uint8_t fault = 0; fault < HEALTH_FAULTS_N; fault++) {
+		__disable_irq();
+		THealth_entry entry = faults[fault];
+		__enable_irq();
+
+		shell_print(shell, "%-17s 0x%04x   %7lu %10lu\r\n", fault_names[fault], entry.sources, entry.raised,
+				(entry.raised == 0) ? 0 : (now - entry.last_time) / 1000U);
+	}
+}
+
+/*
+ * @fn		void health_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command health, that shows the faulty sources and the counters of every fault
+ * @param	shell	pointer to the TShell structure
+ */
+void health_register_commands(TShell *shell) {
+	shell_register_command(shell, "health", "shows the faults of the sensors and of the peripherals",
+			health_command, NULL);
+}
@@ -0,0 +1,128 @@
+/*
+ * This module puts the core to sleep when the main loop has nothing to do.
+ * While some module must be polled, the core sleeps until the next interrupt, at most until the next SysTick.
+ * Otherwise the sleep is tickless: the SysTick is suspended and a 16 bits timer, counting tenths of millisecond, wakes the core
+ * at the earliest deadline of the timing wheel. Any other interrupt ends the sleep before, and the milliseconds slept
+ * are given back to the HAL tick at once, and to the wheel by the next SysTick, so the timers expire at the right time
+ * and their callbacks run with the interrupts enabled, as usual: they may wait for the console.
+ */
+
+#include "idle.h"
+
+static TIM_HandleTypeDef *idle_htim = NULL;
+static IRQn_Type idle_irq;
+static TIdle_stats stats;
+
+/* Ticks of the timer slept and not given back yet, since the tick only counts whole milliseconds */
+static uint32_t residue = 0;
+
+/* Milliseconds slept and not given back to the wheel yet, written with the interrupts disabled */
+static volatile uint32_t missed_ticks = 0;
+
+/*
+ * @fn		void idle_init(TIM_HandleTypeDef *htim, IRQn_Type irq)
+ * @brief	Sets the timer waking the core from the tickless sleeps
+ * @param	htim	a timer already initialized at 10 kHz in one pulse mode, not used by anything else
+ * @param	irq		the interrupt of the timer
+ */
+void idle_init(TIM_HandleTypeDef *htim, IRQn_Type irq) {
+	__HAL_TIM_CLEAR_FLAG(htim, TIM_FLAG_UPDATE);
+
+	idle_htim = htim;
+	idle_irq = irq;
+	memset(&stats, 0, sizeof(stats));
+	residue = 0;
+	missed_ticks = 0;
+}
+
+/*
+ * @fn		void idle_sleep(bool tickless)
+ * @brief	Sleeps until the next interrupt. It must be called with the interrupts disabled, right after checking
+ * 			that the main loop has nothing to do: an interrupt raised in the meanwhile ends the sleep at once,
+ * 			and it is served when the interrupts are enabled again.
+ * @param	tickless	TRUE if no module needs to be polled, so the SysTick can be suspended
+ * 						until the earliest deadline of the timing wheel
+ */
+void idle_sleep(bool tickless) {
+	uint32_t deadline = timer_wheel_next_deadline();
+
+	// the deadline is late by the milliseconds the wheel has not been given back yet: the next SysTick gives them
+	if (!tickless || idle_htim == NULL || missed_ticks != 0 || deadline < IDLE_MIN_SLEEP) {
+		__WFI();
+		return;
+	}
+	if (deadline > IDLE_MAX_SLEEP) {
+		deadline = IDLE_MAX_SLEEP;
+	}
+
+	// the SysTick, running again after the sleep, gives the last millisecond
+	uint32_t sleep = (deadline - 1U) * IDLE_TIMER_TICKS_PER_MS;
+
+	HAL_SuspendTick();
+	__HAL_TIM_SET_AUTORELOAD(idle_htim, sleep - 1U);
+	__HAL_TIM_SET_COUNTER(idle_htim, 0);
+	__HAL_TIM_ENABLE_IT(idle_htim, TIM_IT_UPDATE);
+	__HAL_TIM_ENABLE(idle_htim);
+
+	__DSB();
+	__WFI();
+
+	__HAL_TIM_DISABLE(idle_htim);
+	bool expired = __HAL_TIM_GET_FLAG(idle_htim, TIM_FLAG_UPDATE) != RESET;
+	uint32_t slept = expired ? sleep : __HAL_TIM_GET_COUNTER(idle_htim);
+	__HAL_TIM_DISABLE_IT(idle_htim, TIM_IT_UPDATE);
+	__HAL_TIM_CLEAR_FLAG(idle_htim, TIM_FLAG_UPDATE);
+	HAL_NVIC_ClearPendingIRQ(idle_irq);
+	HAL_ResumeTick();
+
+	residue += slept;
+	uint32_t milliseconds = residue / IDLE_TIMER_TICKS_PER_MS;
+	residue %= IDLE_TIMER_TICKS_PER_MS;
+
+	stats.sleeps++;
+	stats.slept += milliseconds;
+	if (!expired) {
+		stats.woken++;
+	}
+
+	// the wheel can't run here: its callbacks may wait for the console, that needs the interrupts
+	missed_ticks += milliseconds;
+	for (; milliseconds > 0; milliseconds--) {
+		HAL_IncTick();
+	}
+}
+
+/*
+ * @fn		void idle_tick()
+ * @brief	Advances the timing wheel by one millisecond, and by the milliseconds of the last tickless sleep.
+ * 			Should be called only by the SysTick interrupt, in place of timer_wheel_tick().
+ */
+void idle_tick() {
+	uint32_t ticks = missed_ticks + 1U;
+
+	missed_ticks = 0;
+	// no timer expires before the deadline of the sleep, so only the last milliseconds can run some callbacks
+	for (; ticks > 0; ticks--) {
+		timer_wheel_tick();
+	}
+}
+
+static void idle_command(TShell *shell, void *context, char *args) {
+	__disable_irq();
+	TIdle_stats current = stats;
+	__enable_irq();
+
+	uint32_t uptime = HAL_GetTick();
+	shell_print(shell, "tickless sleeps %lu, woken early %lu\r\n", current.sleeps, current.woken);
+	shell_print(shell, "slept %lu ms of %lu ms (%lu%%)\r\n", current.slept, uptime,
+			(uptime == 0) ? 0 : (uint32_t) ((uint64_t) current.slept * 100U / uptime));
+}
+
+/*
+ * @fn		void idle_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command idle, that shows the number and the length of the tickless sleeps
+ * @param	shell	pointer to the TShell structure
+ */
+void idle_register_commands(TShell *shell) {
+	shell_register_command(shell, "idle", "shows the tickless sleeps of the core", idle_command, NULL);
+}
@@ -1,18 +1,117 @@
 /*
  * This module allows to connect a keypad to the system. This module will also manage the activation and deactivation of
- * the sensors. The user pin is automatically retrieved by the configuration.
+ * the sensors. The user pins are looked up in the user directory, which always contains the PIN set during the configuration.
  * */
 
 #include "keypad.h"
 
+/* The digits typed on the keypad are looked up in the directory as they are */
+_Static_assert(USER_DIRECTORY_PIN_LENGTH == USER_PIN_LENGTH, "the PINs of the directory and of the keypad differ");
+
 /* Private variable definition*/
 static volatile uint8_t last_row;
 
+/* TRUE while the panic alarm sounds: it is apart from the state of the system, and only D* stops it */
+static bool panic_alarm;
+
 extern uint8_t system_state;
 extern TBuzzer buzzer;
 extern TLogger logger;
-extern TPIR_sensor pir;
-extern TPhotoresistor photoresistor;
+extern TUser_directory users;
+
+/*
+ * @fn		static bool KEYPAD_user_allowed(const TUser *user, uint8_t command)
+ * @brief	Checks if a user has the rights to send a command
+ * @param	user		the user that sent the command
+ * @param	command		the letter of the command, from {'A', 'B', 'C', 'D'}
+ * @retval	TRUE if the user can handle the zones involved by the command, FALSE otherwise
+ */
+static bool KEYPAD_user_allowed(const TUser *user, uint8_t command) {
+	switch (command) {
+	case KEYPAD_Button_A:
+		return user_can_handle(user, USER_ZONE_AREA);
+	case KEYPAD_Button_B:
+		return user_can_handle(user, USER_ZONE_BARRIER);
+	case KEYPAD_Button_C:
+		return user_can_handle(user, USER_ZONE_AREA | USER_ZONE_BARRIER);
+	case KEYPAD_Button_D:
+		return user_can_handle_system(user);
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * @fn		static uint16_t KEYPAD_key_bit(TKEYPAD_Button button)
+ * @brief	Finds the bit of a button in a keys mask
+ * @param	button	the button to look for
+ * @retval	the bit of the button, 0 if the button is not on the keypad
+ */
+static uint16_t KEYPAD_key_bit(TKEYPAD_Button button) {
+	for (uint8_t row = 0; row < ROWS_N; row++) {
+		for (uint8_t col = 0; col < COLUMNS_N; col++) {
+			if (KEYS[row][col] == button) {
+				return KEYPAD_KEY_BIT(row, col);
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * @fn		static void KEYPAD_exti_handler(uint16_t pin, void *context)
+ * @brief	Handler of the lines of the rows, registered in the EXTI dispatcher
+ */
+static void KEYPAD_exti_handler(uint16_t pin, void *context) {
+	KEYPAD_key_pressed(context, pin);
+}
+
+/**
+ * @fn		static void KEYPAD_timer_expired(void *context)
+ * @brief	Callback of the debouncing timer
+ */
+static void KEYPAD_timer_expired(void *context) {
+	KEYPAD_time_elapsed(context);
+}
+
+/**
+ * @fn		static void KEYPAD_acknowledge(void)
+ * @brief	Beeps for an accepted command, unless the panic alarm sounds: the beep would stop its pulse
+ */
+static void KEYPAD_acknowledge(void) {
+	if (!panic_alarm) {
+		buzzer_play_beep(&buzzer);
+	}
+}
+
+/**
+ * @fn		static void KEYPAD_panic_alarm(void *context)
+ * @brief	Action of the long press of '*': the alarm is raised whatever the state of the system is,
+ * 			and the state is left as it is, so the commands are still checked against it
+ */
+static void KEYPAD_panic_alarm(void *context) {
+	panic_alarm = TRUE;
+	// a beep still playing would restore its previous pulse when it ends, silencing the alarm
+	buzzer_stop(&buzzer);
+	buzzer_play_pulse(&buzzer, buzzer_long_pulse());
+	logger_print(&logger, MESSAGE_PANIC_ALARM);
+}
+
+/**
+ * @fn		static void KEYPAD_quick_arm(void *context)
+ * @brief	Action of the chord 'A'+'B': the sensors of KEYPAD_QUICK_ARM_ZONES are activated, if the system is enabled.
+ * 			No PIN is asked, so no other zone can be activated this way
+ */
+static void KEYPAD_quick_arm(void *context) {
+	if (system_state != SYSTEM_STATE_ENABLED) {
+		logger_print(&logger, MESSAGE_COMMAND_REJECTED);
+		return;
+	}
+
+	sensor_registry_activate(KEYPAD_QUICK_ARM_ZONES);
+	logger_print(&logger, MESSAGE_QUICK_ARM);
+	KEYPAD_acknowledge();
+}
 
 /**
  * @fn 		void KEYPAD_init_default(TKeypad *keypad)
@@ -25,8 +124,25 @@ void KEYPAD_init_default(TKeypad *keypad) {
 
 	keypad->last_pressed_key = KEYPAD_Button_NOT_PRESSED;
 	keypad->index = 0; //top of the buffer
-	keypad->timer = &KEYPAD_TIMER; //pointer to the timer to use, defined in the header file
+	timer_wheel_setup(&keypad->timer, KEYPAD_timer_expired, keypad);
 	keypad->last_pressed_time = 0;
+	keypad->pressed_keys = 0;
+	keypad->notified_keys = 0;
+	memset(keypad->row_low_since, 0, sizeof(keypad->row_low_since));
+	memset(keypad->row_high_since, 0, sizeof(keypad->row_high_since));
+	keypad->accepted_commands = 0;
+	keypad->rejected_commands = 0;
+	panic_alarm = FALSE;
+
+	//setting up the default gestures
+	KEYPAD_gesture_init(&keypad->gestures);
+	KEYPAD_gesture_add(&keypad->gestures, KEYPAD_key_bit(KEYPAD_Button_STAR), KEYPAD_PANIC_HOLD_TIME,
+			KEYPAD_panic_alarm, keypad);
+	if (KEYPAD_QUICK_ARM_ZONES != 0) {
+		KEYPAD_gesture_add(&keypad->gestures,
+				KEYPAD_key_bit(KEYPAD_Button_A) | KEYPAD_key_bit(KEYPAD_Button_B), KEYPAD_QUICK_ARM_HOLD_TIME,
+				KEYPAD_quick_arm, keypad);
+	}
 
 	//setting up the structure f the pins. Please note that the port used is the same for every pin.
 	// if different ports are used, this library needs some changes
@@ -42,10 +158,9 @@ void KEYPAD_init_default(TKeypad *keypad) {
 
 	KEYPAD_init_columns(keypad);
 
-	//setting up the timer, so even if it is not configured via gui, it is done directly here.
-	keypad->timer->Init.Prescaler = KEYPAD_PRESCALER;
-	keypad->timer->Init.Period = KEYPAD_DELAY_PERIOD;
-
+	for (uint8_t i = 0; i < ROWS_N; i++) {
+		exti_dispatcher_register(keypad->rows_pins[i], KEYPAD_exti_handler, keypad);
+	}
 	HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
 	system_state = SYSTEM_STATE_DISABLED;
 
@@ -102,16 +217,19 @@ void KEYPAD_key_pressed(TKeypad *keypad, uint16_t pin) {
 		return;
 	}
 
-	//initializing the timer
-	HAL_TIM_Base_Stop_IT(keypad->timer);
-	keypad->timer->Instance->CNT = 0;
-	HAL_TIM_Base_Start_IT(keypad->timer);
+	//the first edge of a press starts the measure of its latency, the bounces only restart the timer
+	if (!timer_wheel_is_running(&keypad->timer)) {
+		latency_mark(LATENCY_MARK_EDGE);
+	}
+
+	//(re)starting the timer
+	timer_wheel_start(&keypad->timer, KEYPAD_DEBOUNCE_TIME, 0);
 	return;
 }
 
 /**
  * @fn 		void KEYPAD_time_elapsed(TKeypad *keypad)
- * @brief 	ISR of the timer used to prevent bouncing (keypad is really bouncy:) ). Should be called only by the irq.
+ * @brief 	Callback of the timer used to prevent bouncing (keypad is really bouncy:) ). Should be called only by the timer.
  * 			When the time is elapsed, the function will scan the columns and will read the last saved row. If it is valid,
  * 			the read button will be saved in a buffer. When the buffer is full, the function will restart the timer,
  * 			and the buffer will be checked later.
@@ -119,11 +237,12 @@ void KEYPAD_key_pressed(TKeypad *keypad, uint16_t pin) {
  * @retval	none
  */
 void KEYPAD_time_elapsed(TKeypad *keypad) {
-	//stop the timer
-	HAL_TIM_Base_Stop_IT(keypad->timer);
-
 	if (keypad->index == KEYPAD_DEFAULT_BUFFER_SIZE) {
-		KEYPAD_check_buffer(keypad->buffer);
+		if (KEYPAD_check_buffer(keypad->buffer)) {
+			keypad->accepted_commands++;
+		} else {
+			keypad->rejected_commands++;
+		}
 		keypad->index = 0;
 		keypad->last_pressed_time = 0;
 		return;
@@ -131,8 +250,10 @@ void KEYPAD_time_elapsed(TKeypad *keypad) {
 
 	// check that the last pressed row is valid
 	if (last_row == ROWS_N) {
+		latency_end();
 		return;
 	}
+	latency_mark(LATENCY_MARK_DECODE);
 
 	// finding the column which the button is connected to
 	uint8_t col = 0;
@@ -148,8 +269,9 @@ void KEYPAD_time_elapsed(TKeypad *keypad) {
 			break;
 		}
 	}
-	// safety check
+	// safety check, the edge was the bounce of a release
 	if (col == COLUMNS_N) {
+		latency_end();
 		return;
 	}
 
@@ -159,12 +281,20 @@ void KEYPAD_time_elapsed(TKeypad *keypad) {
 
 	//now save the pressed key, the time and increase buffer
 	keypad->buffer[keypad->index++] = KEYS[last_row][col];
+
+	//the press will be notified to the gesture engine by KEYPAD_poll
+	uint8_t key = last_row * COLUMNS_N + col;
+	keypad->key_press_time[key] = HAL_GetTick();
+	keypad->pressed_keys |= (1U << key);
+	latency_mark(LATENCY_MARK_DECODED);
+
 	if (keypad->index < KEYPAD_DEFAULT_BUFFER_SIZE) {
 		keypad->last_pressed_time = HAL_GetTick();
+		//only the last key of a command waits for its execution
+		latency_end();
 	} else {
 		//buffer is full, restart the timer and check it in a few ms
-		keypad->timer->Instance->CNT = 0;
-		HAL_TIM_Base_Start_IT(keypad->timer);
+		timer_wheel_start(&keypad->timer, KEYPAD_DEBOUNCE_TIME, 0);
 	}
 
 	return;
@@ -172,14 +302,16 @@ void KEYPAD_time_elapsed(TKeypad *keypad) {
 
 
 /**
- * @fn 		void KEYPAD_check_buffer(uint8_t *buffer)
+ * @fn 		bool KEYPAD_check_buffer(uint8_t *buffer)
  * @brief 	ISR of the timer used to check the buffer. This is called only when the buffer size is full.
  * 			The buffer will be checked and, if the command is valid,it is executed. So it will enable and disable
  * 			the sensors and the system. This will also log on the console.
  * @param 	buffer a pointer to the buffer to be checked
- * @return none
+ * @return	TRUE if the command has been accepted, FALSE otherwise
  */
-void KEYPAD_check_buffer(uint8_t *buffer) {
+bool KEYPAD_check_buffer(uint8_t *buffer) {
+	latency_mark(LATENCY_MARK_EXECUTE);
+
 	//when 7 button have been pressed in a short period of time, check them
 	/**
 	 * Structure of correct message
@@ -192,51 +324,59 @@ void KEYPAD_check_buffer(uint8_t *buffer) {
 	// Checking the structure of the buffer
 	if (buffer[0] != KEYPAD_Button_HASH) {
 		logger_print(&logger, MESSAGE_COMMAND_REJECTED);
-		return;
+		return FALSE;
 	}
 
-	//if the pin is not correct, do not process the message
-	for (uint8_t i = 1; i < USER_PIN_LENGTH + 1; i++) {
-		if (buffer[i] != get_configuration()->user_PIN[i - 1]) {
-			logger_print(&logger, MESSAGE_WRONG_USER_PIN);
-			return;
-		}
+	//if the pin does not belong to any user, do not process the message
+	TUser *user = user_directory_find(&users, &buffer[1]);
+	if (user == NULL) {
+		logger_print(&logger, MESSAGE_WRONG_USER_PIN);
+		return FALSE;
 	}
 
 	if (!isalpha(buffer[5])) {
 		logger_print(&logger, MESSAGE_COMMAND_REJECTED);
-		return;
+		return FALSE;
 	}
 
 	if (buffer[6] != KEYPAD_Button_HASH && buffer[6] != KEYPAD_Button_STAR) {
 		logger_print(&logger, MESSAGE_COMMAND_REJECTED);
-		return;
+		return FALSE;
+	}
+
+	//the user must be allowed to handle the zones involved by the command
+	if (!KEYPAD_user_allowed(user, buffer[5])) {
+		logger_print(&logger, MESSAGE_COMMAND_NOT_ALLOWED);
+		return FALSE;
 	}
 
 	//if the system is disabled and we are not trying to enable it, return
 	if (system_state == SYSTEM_STATE_DISABLED && buffer[5] != KEYPAD_Button_D) {
 		logger_print(&logger, MESSAGE_COMMAND_REJECTED);
-		return;
+		return FALSE;
 	}
 
 	if (buffer[6] == KEYPAD_Button_STAR) {
 		//if last element is '*' deactivate the corresponding sensor
 		switch (buffer[5]) {
 		case KEYPAD_Button_A:
-			PIR_sensor_deactivate(&pir);
+			sensor_registry_deactivate(USER_ZONE_AREA);
 			break;
 		case KEYPAD_Button_B:
-			photoresistor_deactivate(&photoresistor);
+			sensor_registry_deactivate(USER_ZONE_BARRIER);
 			break;
 		case KEYPAD_Button_C:
-			PIR_sensor_deactivate(&pir);
-			photoresistor_deactivate(&photoresistor);
+			sensor_registry_deactivate(USER_ZONE_AREA | USER_ZONE_BARRIER);
 			break;
 		case KEYPAD_Button_D:
+			if (panic_alarm) {
+				//the panic alarm is stopped only by disabling the system
+				panic_alarm = FALSE;
+				buzzer_stop(&buzzer);
+			}
 			system_state = SYSTEM_STATE_DISABLED;
 			HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
-			PIR_sensor_deactivate(&pir);
-			photoresistor_deactivate(&photoresistor);
+			sensor_registry_deactivate(USER_ZONE_ALL);
 			break;
 		default:
 			break;
@@ -245,14 +385,13 @@ void KEYPAD_check_buffer(uint8_t *buffer) {
 		//if last element is '#' activate the corresponding sensor
 		switch (buffer[5]) {
 		case KEYPAD_Button_A:
-			PIR_sensor_activate(&pir);
+			sensor_registry_activate(USER_ZONE_AREA);
 			break;
 		case KEYPAD_Button_B:
-			photoresistor_activate(&photoresistor);
+			sensor_registry_activate(USER_ZONE_BARRIER);
 			break;
 		case KEYPAD_Button_C:
-			PIR_sensor_activate(&pir);
-			photoresistor_activate(&photoresistor);
+			sensor_registry_activate(USER_ZONE_AREA | USER_ZONE_BARRIER);
 			break;
 		case KEYPAD_Button_D:
 			system_state = SYSTEM_STATE_ENABLED;
@@ -262,9 +401,88 @@ void KEYPAD_check_buffer(uint8_t *buffer) {
 		}
 	}
 
+	latency_mark(LATENCY_MARK_LOG);
 	logger_print(&logger, MESSAGE_COMMAND_ACCEPTED);
-	buzzer_play_beep(&buzzer);
+	KEYPAD_acknowledge();
+	latency_mark(LATENCY_MARK_BEEP);
 
-	return;
+	return TRUE;
 }
 
+/**
+ * @fn 		void KEYPAD_poll(TKeypad *keypad)
+ * @brief 	Feeds the gesture engine with the presses decoded by the irq and with the releases, and recognizes
+ * 			the gestures. When a gesture is recognized, the keys typed so far are discarded.
+ * 			It must be called in the main loop: it is the only tick of the gesture engine.
+ * @param 	keypad a pointer to the structure of the keypad
+ * @retval	none
+ */
+void KEYPAD_poll(TKeypad *keypad) {
+	uint32_t now = HAL_GetTick();
+
+	// notify the new presses, with the time they have been decoded at
+	uint16_t new_keys = keypad->pressed_keys & ~keypad->notified_keys;
+	keypad->notified_keys |= new_keys;
+	while (new_keys != 0) {
+		uint8_t key = __builtin_ctz(new_keys);
+		KEYPAD_gesture_key_down(&keypad->gestures, 1U << key, keypad->key_press_time[key]);
+		new_keys &= new_keys - 1U;
+	}
+
+	// a row reads high while at least one of its keys is held, since the columns are kept high
+	for (uint8_t row = 0; row < ROWS_N; row++) {
+		uint16_t row_keys = keypad->notified_keys & (((1U << COLUMNS_N) - 1U) << (row * COLUMNS_N));
+		if (row_keys == 0) {
+			continue;
+		}
+
+		if (HAL_GPIO_ReadPin(ROW_1_PORT, keypad->rows_pins[row]) == GPIO_PIN_SET) {
+			keypad->row_low_since[row] = 0;
+			if (keypad->row_high_since[row] == 0) {
+				keypad->row_high_since[row] = now | 1U;
+			} else if (now - keypad->row_high_since[row] >= KEYPAD_ROW_STUCK_TIME) {
+				// a key can't be held for so long, the row or one of its keys is shorted
+				health_raise(HEALTH_FAULT_KEYPAD_ROW_STUCK, row);
+			}
+		} else if (keypad->row_low_since[row] == 0) {
+			// 0 means "reads high", so a time equal to 0 is moved forward of a millisecond
+			keypad->row_low_since[row] = now | 1U;
+		} else if (now - keypad->row_low_since[row] >= KEYPAD_RELEASE_DEBOUNCE) {
+			// the irq sets the bits of pressed_keys, so they are cleared atomically
+			__disable_irq();
+			keypad->pressed_keys &= ~row_keys;
+			__enable_irq();
+			keypad->notified_keys &= ~row_keys;
+			keypad->row_low_since[row] = 0;
+			keypad->row_high_since[row] = 0;
+			health_clear(HEALTH_FAULT_KEYPAD_ROW_STUCK, row);
+			KEYPAD_gesture_key_up(&keypad->gestures, row_keys, now);
+		}
+	}
+
+	if (KEYPAD_gesture_tick(&keypad->gestures, now)) {
+		// the keys of the gesture are not part of a command
+		keypad->index = 0;
+		keypad->last_pressed_time = 0;
+		latency_end();
+	}
+}
+
+/**
+ * @fn 		bool KEYPAD_is_panic_alarm()
+ * @brief 	Tells if the panic alarm sounds
+ * @retval	TRUE from the long press of '*' to the command D*, FALSE otherwise
+ */
+bool KEYPAD_is_panic_alarm() {
+	return panic_alarm;
+}
+
+/**
+ * @fn 		bool KEYPAD_is_idle(TKeypad *keypad)
+ * @brief 	Tells if no key is held: the releases and the gestures are polled by KEYPAD_poll() while a key is held
+ * @param 	keypad a pointer to the structure of the keypad
+ * @retval	TRUE if KEYPAD_poll() has nothing to do, FALSE otherwise
+ */
+bool KEYPAD_is_idle(TKeypad *keypad) {
+	return keypad->pressed_keys == 0 && keypad->notified_keys == 0;
+}
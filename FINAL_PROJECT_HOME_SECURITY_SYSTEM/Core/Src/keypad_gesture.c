@@ -0,0 +1,174 @@
+/*
+ * This module recognizes gestures on the keypad: a gesture is a set of keys held down together for a minimum time,
+ * so both long presses (e.g. '*' held for 3 seconds) and chords (e.g. 'A' and 'B' pressed together) are handled.
+ * The engine does not need any timer: it is fed with the timestamps of the debounced presses and releases,
+ * and all the recognizers are evaluated by a single shared tick, KEYPAD_gesture_tick().
+ */
+
+#include "keypad_gesture.h"
+
+/* TRUE if the time a comes before the time b, even across the overflow of the millisecond counter */
+#define KEYPAD_GESTURE_BEFORE(a, b)		((int32_t) ((a) - (b)) < 0)
+
+/*
+ * @fn		static void KEYPAD_gesture_update_deadline(TKeypad_gestures *engine)
+ * @brief	Computes again the earliest deadline among the armed gestures
+ * @param	engine	pointer to the TKeypad_gestures structure
+ */
+static void KEYPAD_gesture_update_deadline(TKeypad_gestures *engine) {
+	engine->armed_n = 0;
+
+	for (uint8_t i = 0; i < engine->gestures_n; i++) {
+		TKeypad_gesture *gesture = &engine->gestures[i];
+		if (!gesture->armed) {
+			continue;
+		}
+		if (engine->armed_n == 0 || KEYPAD_GESTURE_BEFORE(gesture->deadline, engine->next_deadline)) {
+			engine->next_deadline = gesture->deadline;
+		}
+		engine->armed_n++;
+	}
+}
+
+/*
+ * @fn		static bool KEYPAD_gesture_pressed_together(TKeypad_gestures *engine, uint16_t keys, uint32_t time)
+ * @brief	Checks if all the keys of a mask have been pressed within KEYPAD_GESTURE_CHORD_WINDOW milliseconds
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	keys	mask of the keys, all currently pressed
+ * @param	time	time of the press of the last key
+ * @retval	TRUE if the keys have been pressed together, FALSE otherwise
+ */
+static bool KEYPAD_gesture_pressed_together(TKeypad_gestures *engine, uint16_t keys, uint32_t time) {
+	while (keys != 0) {
+		uint8_t index = __builtin_ctz(keys);
+		if (time - engine->press_time[index] > KEYPAD_GESTURE_CHORD_WINDOW) {
+			return FALSE;
+		}
+		keys &= keys - 1U;
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		void KEYPAD_gesture_init(TKeypad_gestures *engine)
+ * @brief	Initializes a gesture engine without gestures
+ * @param	engine	pointer to the TKeypad_gestures structure to initialize
+ */
+void KEYPAD_gesture_init(TKeypad_gestures *engine) {
+	engine->gestures_n = 0;
+	engine->pressed = 0;
+	engine->armed_n = 0;
+	engine->next_deadline = 0;
+	engine->recognized = 0;
+}
+
+/*
+ * @fn		int KEYPAD_gesture_add(TKeypad_gestures *engine, uint16_t keys, uint32_t hold_time,
+ * 								TKeypad_gesture_action action, void *context)
+ * @brief	Adds a gesture to recognize. A gesture with a single key is a long press, otherwise it is a chord.
+ * @param	engine		pointer to the TKeypad_gestures structure
+ * @param	keys		mask of the keys that must be held, see KEYPAD_KEY_BIT()
+ * @param	hold_time	milliseconds the keys must be held together
+ * @param	action		function executed when the gesture is recognized
+ * @param	context		pointer passed to action as it is
+ * @retval	KEYPAD_GESTURE_ERR_FULL if there are already KEYPAD_GESTURE_MAX_RECOGNIZERS gestures,
+ * 			KEYPAD_GESTURE_OK otherwise
+ */
+int KEYPAD_gesture_add(TKeypad_gestures *engine, uint16_t keys, uint32_t hold_time,
+		TKeypad_gesture_action action, void *context) {
+	if (engine->gestures_n >= KEYPAD_GESTURE_MAX_RECOGNIZERS) {
+		return KEYPAD_GESTURE_ERR_FULL;
+	}
+
+	TKeypad_gesture *gesture = &engine->gestures[engine->gestures_n++];
+	gesture->keys = keys;
+	gesture->hold_time = hold_time;
+	gesture->action = action;
+	gesture->context = context;
+	gesture->deadline = 0;
+	gesture->armed = FALSE;
+	return KEYPAD_GESTURE_OK;
+}
+
+/*
+ * @fn		void KEYPAD_gesture_key_down(TKeypad_gestures *engine, uint16_t key, uint32_t time)
+ * @brief	Notifies the debounced press of a key
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	key		the bit of the key, see KEYPAD_KEY_BIT()
+ * @param	time	time of the press in milliseconds
+ */
+void KEYPAD_gesture_key_down(TKeypad_gestures *engine, uint16_t key, uint32_t time) {
+	engine->pressed |= key;
+	engine->press_time[__builtin_ctz(key)] = time;
+
+	// only the gestures completed by this key can be armed now
+	for (uint8_t i = 0; i < engine->gestures_n; i++) {
+		TKeypad_gesture *gesture = &engine->gestures[i];
+		if ((gesture->keys & key) == 0 || (engine->pressed & gesture->keys) != gesture->keys) {
+			continue;
+		}
+		if (KEYPAD_gesture_pressed_together(engine, gesture->keys, time)) {
+			gesture->armed = TRUE;
+			gesture->deadline = time + gesture->hold_time;
+		}
+	}
+
+	KEYPAD_gesture_update_deadline(engine);
+}
+
+/*
+ * @fn		void KEYPAD_gesture_key_up(TKeypad_gestures *engine, uint16_t keys, uint32_t time)
+ * @brief	Notifies the debounced release of one or more keys
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	keys	mask of the released keys
+ * @param	time	time of the release in milliseconds
+ */
+void KEYPAD_gesture_key_up(TKeypad_gestures *engine, uint16_t keys, uint32_t time) {
+	engine->pressed &= ~keys;
+
+	for (uint8_t i = 0; i < engine->gestures_n; i++) {
+		if (engine->gestures[i].keys & keys) {
+			engine->gestures[i].armed = FALSE;
+		}
+	}
+
+	KEYPAD_gesture_update_deadline(engine);
+}
+
+/*
+ * @fn		bool KEYPAD_gesture_tick(TKeypad_gestures *engine, uint32_t now)
+ * @brief	Recognizes the gestures whose keys have been held long enough, executing their action.
+ * 			A gesture is recognized only once, until one of its keys is released.
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @param	now		current time in milliseconds
+ * @retval	TRUE if at least one gesture has been recognized, FALSE otherwise
+ */
+bool KEYPAD_gesture_tick(TKeypad_gestures *engine, uint32_t now) {
+	if (engine->armed_n == 0 || KEYPAD_GESTURE_BEFORE(now, engine->next_deadline)) {
+		return FALSE;
+	}
+
+	bool recognized = FALSE;
+	for (uint8_t i = 0; i < engine->gestures_n; i++) {
+		TKeypad_gesture *gesture = &engine->gestures[i];
+		if (gesture->armed && !KEYPAD_GESTURE_BEFORE(now, gesture->deadline)) {
+			gesture->armed = FALSE;
+			gesture->action(gesture->context);
+			engine->recognized++;
+			recognized = TRUE;
+		}
+	}
+
+	KEYPAD_gesture_update_deadline(engine);
+	return recognized;
+}
+
+/*
+ * @fn		uint32_t KEYPAD_gesture_next_deadline(TKeypad_gestures *engine)
+ * @brief	Returns the time at which the next gesture will be recognized if its keys are still held
+ * @param	engine	pointer to the TKeypad_gestures structure
+ * @retval	the deadline in milliseconds, or KEYPAD_GESTURE_NO_DEADLINE if no gesture is armed
+ */
+uint32_t KEYPAD_gesture_next_deadline(TKeypad_gestures *engine) {
+	return engine->armed_n == 0 ? KEYPAD_GESTURE_NO_DEADLINE : engine->next_deadline;
+}
@@ -0,0 +1,229 @@
+/*
+ * This module measures the end-to-end latency of the keypad commands, from the edge of the row interrupt
+ * to the log line on the console and to the beep of the buzzer.
+ * The pipeline is marked in a few points with latency_mark(): the timestamps come from the DWT cycle counter,
+ * so marking costs a few cycles and can be done in interrupt context. Every stage of the pipeline is the time
+ * between two marks, and it is collected as min/avg/max and as a histogram with power-of-two buckets.
+ * The statistics are shown on the console by the latency command, see latency_register_commands().
+ */
+
+#include "latency.h"
+
+/*
+ * @brief	Marks delimiting a stage
+ */
+typedef struct {
+	TLatency_mark from;
+	TLatency_mark to;
+	const char *name;
+} TLatency_stage_bounds;
+
+static const TLatency_stage_bounds stages[LATENCY_STAGES_N] = {
+	[LATENCY_STAGE_DEBOUNCE] = { LATENCY_MARK_EDGE, LATENCY_MARK_DECODE, "debounce" },
+	[LATENCY_STAGE_DECODE] = { LATENCY_MARK_DECODE, LATENCY_MARK_DECODED, "decode" },
+	[LATENCY_STAGE_QUEUE] = { LATENCY_MARK_DECODED, LATENCY_MARK_EXECUTE, "queue" },
+	[LATENCY_STAGE_EXECUTE] = { LATENCY_MARK_EXECUTE, LATENCY_MARK_LOG, "execute" },
+	[LATENCY_STAGE_EMIT] = { LATENCY_MARK_LOG, LATENCY_MARK_EMITTED, "emit" },
+	[LATENCY_STAGE_BEEP] = { LATENCY_MARK_EDGE, LATENCY_MARK_BEEP, "beep" },
+	[LATENCY_STAGE_TOTAL] = { LATENCY_MARK_EDGE, LATENCY_MARK_EMITTED, "total" },
+};
+
+/*
+ * Mark that must have been taken before each mark, so that a rejected command or an unrelated transmission
+ * cannot end a stage
+ */
+static const TLatency_mark previous_marks[LATENCY_MARKS_N] = {
+	[LATENCY_MARK_EDGE] = LATENCY_MARK_EDGE,
+	[LATENCY_MARK_DECODE] = LATENCY_MARK_EDGE,
+	[LATENCY_MARK_DECODED] = LATENCY_MARK_DECODE,
+	[LATENCY_MARK_EXECUTE] = LATENCY_MARK_DECODED,
+	[LATENCY_MARK_LOG] = LATENCY_MARK_EXECUTE,
+	[LATENCY_MARK_BEEP] = LATENCY_MARK_LOG,
+	[LATENCY_MARK_PRINTED] = LATENCY_MARK_LOG,
+	[LATENCY_MARK_EMITTED] = LATENCY_MARK_PRINTED,
+};
+
+/* Timestamps of the current measure, valid only if their bit is set in taken_marks */
+static uint32_t timestamps[LATENCY_MARKS_N];
+static volatile uint16_t taken_marks;
+
+/* TRUE between the first edge of a press and the end of its debounce, so the bounces do not restart the measure */
+static volatile bool debouncing;
+
+static TLatency_stats statistics[LATENCY_STAGES_N];
+
+/*
+ * @fn		static uint8_t latency_bucket(uint32_t cycles)
+ * @brief	Returns the bucket of the histograms a sample falls in
+ */
+static uint8_t latency_bucket(uint32_t cycles) {
+	uint32_t us = cycles / (SystemCoreClock / 1000000U);
+	uint8_t bucket = (us == 0) ? 0 : 32U - __builtin_clz(us);
+	return (bucket < LATENCY_HISTOGRAM_BUCKETS) ? bucket : LATENCY_HISTOGRAM_BUCKETS - 1U;
+}
+
+/*
+ * @fn		static void latency_add_sample(TLatency_stats *stats, uint32_t cycles)
+ * @brief	Adds a sample to the statistics of a stage
+ */
+static void latency_add_sample(TLatency_stats *stats, uint32_t cycles) {
+	if (stats->count == 0 || cycles < stats->min) {
+		stats->min = cycles;
+	}
+	if (cycles > stats->max) {
+		stats->max = cycles;
+	}
+	stats->sum += cycles;
+	stats->count++;
+	stats->histogram[latency_bucket(cycles)]++;
+}
+
+/*
+ * @fn		void latency_init()
+ * @brief	Enables the DWT cycle counter and clears the statistics
+ */
+void latency_init() {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	taken_marks = 0;
+	debouncing = FALSE;
+	latency_reset();
+}
+
+/*
+ * @fn		void latency_mark(TLatency_mark mark)
+ * @brief	Takes the timestamp of a point of the pipeline and updates the stages ending there.
+ * 			Only the first timestamp of a mark is kept until a new measure is started by an edge,
+ * 			so the bounces of the keys and the unrelated transmissions are ignored. An edge does not restart
+ * 			a measure that reached DECODED and waits for EXECUTE: the release of the last key may bounce.
+ * @param	mark	the point of the pipeline that has been reached
+ */
+void latency_mark(TLatency_mark mark) {
+	uint32_t now = DWT->CYCCNT;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (mark == LATENCY_MARK_EDGE) {
+		uint16_t queued = (1U << LATENCY_MARK_DECODED) | (1U << LATENCY_MARK_EXECUTE);
+		if (debouncing || (taken_marks & queued) == (1U << LATENCY_MARK_DECODED)) {
+			__set_PRIMASK(primask);
+			return;
+		}
+		// a new press: the timestamps of the previous one are dropped, and the edge starts the new measure
+		debouncing = TRUE;
+		timestamps[mark] = now;
+		taken_marks = (1U << mark);
+		__set_PRIMASK(primask);
+		return;
+	}
+
+	if (mark == LATENCY_MARK_DECODE) {
+		debouncing = FALSE;
+	}
+
+	if ((taken_marks & (1U << previous_marks[mark])) == 0 || (taken_marks & (1U << mark)) != 0) {
+		// the pipeline did not get here, or the mark has already been taken
+		__set_PRIMASK(primask);
+		return;
+	}
+
+	timestamps[mark] = now;
+	taken_marks |= (1U << mark);
+
+	for (uint8_t i = 0; i < LATENCY_STAGES_N; i++) {
+		if (stages[i].to == mark && (taken_marks & (1U << stages[i].from)) != 0) {
+			latency_add_sample(&statistics[i], now - timestamps[stages[i].from]);
+		}
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		void latency_end()
+ * @brief	Ends the measure in flight: its next marks are ignored until an edge starts a new one.
+ * 			The keypad calls it when a debounce ends without a key, and when a key does not complete a command
+ */
+void latency_end() {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	debouncing = FALSE;
+	taken_marks = 0;
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		void latency_reset()
+ * @brief	Clears the statistics of all the stages
+ */
+void latency_reset() {
+	__disable_irq();
+	memset(statistics, 0, sizeof(statistics));
+	__enable_irq();
+}
+
+/*
+ * @fn		void latency_get_stats(TLatency_stage stage, TLatency_stats *stats)
+ * @brief	Copies the statistics of a stage. It can be called while the pipeline is running.
+ * @param	stage	the stage
+ * @param	stats	pointer to the structure the statistics will be copied in
+ */
+void latency_get_stats(TLatency_stage stage, TLatency_stats *stats) {
+	__disable_irq();
+	*stats = statistics[stage];
+	__enable_irq();
+}
+
+static void latency_command(TShell *shell, void *context, char *args) {
+	uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+	char *name = shell_next_token(&args);
+	TLatency_stats stats;
+
+	if (name != NULL && strcmp(name, "reset") == 0) {
+		latency_reset();
+		shell_print(shell, "Done\r\n");
+		return;
+	}
+
+	if (name == NULL) {
+		shell_print(shell, "%-9s %7s %9s %9s %9s\r\n", "stage", "count", "min us", "avg us", "max us");
+		for (uint8_t i = 0; i < LATENCY_STAGES_N; i++) {
+			latency_get_stats(i, &stats);
+			uint32_t avg = (stats.count == 0) ? 0 : (uint32_t) (stats.sum / stats.count);
+			shell_print(shell, "%-9s %7lu %9lu %9lu %9lu\r\n", stages[i].name, stats.count,
+					stats.min / cycles_per_us, avg / cycles_per_us, stats.max / cycles_per_us);
+		}
+		return;
+	}
+
+	for (uint8_t i = 0; i < LATENCY_STAGES_N; i++) {
+		if (strcmp(name, stages[i].name) != 0) {
+			continue;
+		}
+
+		latency_get_stats(i, &stats);
+		for (uint8_t bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++) {
+			if (stats.histogram[bucket] != 0) {
+				shell_print(shell, "%s %9lu us %7lu\r\n", (bucket < LATENCY_HISTOGRAM_BUCKETS - 1U) ? "< " : ">=",
+						1UL << (bucket < LATENCY_HISTOGRAM_BUCKETS - 1U ? bucket : bucket - 1U),
+						stats.histogram[bucket]);
+			}
+		}
+		return;
+	}
+
+	shell_print(shell, "Unknown stage\r\n");
+}
+
+/*
+ * @fn		void latency_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command latency, that shows min/avg/max of every stage in microseconds.
+ * 			latency <stage> shows the histogram of a stage, latency reset clears the statistics.
+ * @param	shell	pointer to the TShell structure
+ */
+void latency_register_commands(TShell *shell) {
+	shell_register_command(shell, "latency", "[reset|<stage>] shows the keypad latency",
+			latency_command, NULL);
+}
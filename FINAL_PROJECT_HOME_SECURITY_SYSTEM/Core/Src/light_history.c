@@ -0,0 +1,502 @@
+/*
+ * This module keeps the history of a light level for days, in a few KB of RAM and in a sector of the flash.
+ * The values are folded as they come into the minimum, the maximum and the mean of the current interval, and every
+ * LIGHT_HISTORY_INTERVAL milliseconds the interval is closed into a record of a few bytes: the mean as the difference
+ * from the mean of the previous record, zig-zag encoded so that small changes of both signs stay small, and the
+ * minimum and the maximum as their distance from the mean, each one as a varint of 7 bits per byte. A steady level
+ * costs 3 bytes every interval. The intervals without values are not recorded: the next record counts them.
+ * The values are light levels, or the share of the emitter of a barrier lost in lock-in mode: every chunk holds
+ * records of one of them, written in its header, and an interval takes the unit of its last values.
+ * The records are appended to chunks of LIGHT_HISTORY_CHUNK_SIZE bytes, each one starting again from a mean of 0
+ * with the date of its first record, so a chunk is decoded on its own. The chunks are kept in a ring in RAM: when
+ * it is full the oldest one is programmed in the flash. Two sectors take turns: the chunks fill one of them while
+ * the other one keeps the older chunks, and only when the first one is nearly full the other one is erased, to be
+ * filled next, so the history never loses much more than its oldest sector. An erase stalls the core for a second
+ * or two, so it is left to the main loop, which runs it only while every zone is disarmed: if the sector fills up
+ * before, the oldest chunks in RAM are dropped. The chunks in RAM are lost at the reset, the ones
+ * in the flash are found again, and the flash is never erased at the start.
+ * The history is shown on the console, interval by interval or with a few intervals merged in each line.
+ */
+
+#include "light_history.h"
+
+/*
+ * @fn		static void light_history_expired(void *context)
+ * @brief	Callback of the periodic timer, the interval is closed by the main loop
+ */
+static void light_history_expired(void *context) {
+	TLight_history *history = context;
+	history->due = TRUE;
+}
+
+/*
+ * @fn		static uint8_t light_history_put_varint(uint8_t *data, uint32_t value)
+ * @brief	Writes a value 7 bits per byte, the least significant first, with the high bit set on all but the last
+ * @retval	the number of bytes written
+ */
+static uint8_t light_history_put_varint(uint8_t *data, uint32_t value) {
+	uint8_t length = 0;
+
+	while (value >= 0x80U) {
+		data[length++] = (uint8_t) value | 0x80U;
+		value >>= 7;
+	}
+	data[length++] = (uint8_t) value;
+	return length;
+}
+
+/*
+ * @fn		static bool light_history_get_varint(const TLight_history_chunk *chunk, uint16_t *position, uint32_t *value)
+ * @brief	Reads a value written by light_history_put_varint, within the records of the chunk
+ * @retval	FALSE if the records end before the value, TRUE otherwise
+ */
+static bool light_history_get_varint(const TLight_history_chunk *chunk, uint16_t *position, uint32_t *value) {
+	*value = 0;
+	for (uint8_t shift = 0; shift < 32U && *position < chunk->header.length && *position < LIGHT_HISTORY_CHUNK_DATA;
+			shift += 7U) {
+		uint8_t byte = chunk->data[(*position)++];
+
+		*value |= (uint32_t) (byte & 0x7FU) << shift;
+		if ((byte & 0x80U) == 0) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * @fn		static uint8_t light_history_encode(uint8_t *data, uint16_t previous, uint32_t gap, uint16_t min,
+ * 				uint16_t mean, uint16_t max)
+ * @brief	Encodes a record. The difference of the mean is zig-zag encoded, 0, -1, 1, -2 becoming 0, 1, 2, 3,
+ * 			and shifted to the left by one bit, set if the count of the intervals without values follows
+ * @retval	the number of bytes written, at most LIGHT_HISTORY_MAX_RECORD
+ */
+static uint8_t light_history_encode(uint8_t *data, uint16_t previous, uint32_t gap, uint16_t min, uint16_t mean,
+		uint16_t max) {
+	int32_t delta = (int32_t) mean - previous;
+	uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+	uint8_t length;
+
+	length = light_history_put_varint(data, (zigzag << 1) | (gap != 0));
+	if (gap != 0) {
+		length += light_history_put_varint(&data[length], gap);
+	}
+	length += light_history_put_varint(&data[length], mean - min);
+	length += light_history_put_varint(&data[length], max - mean);
+	return length;
+}
+
+/*
+ * @fn		static bool light_history_decode(const TLight_history_chunk *chunk, uint16_t *position,
+ * 				TLight_history_record *record)
+ * @brief	Decodes the record at a position of a chunk, the previous one must be in record.
+ * 			The first record of the chunk is decoded from position 0 and any record
+ * @retval	FALSE at the end of the records, TRUE otherwise
+ */
+static bool light_history_decode(const TLight_history_chunk *chunk, uint16_t *position,
+		TLight_history_record *record) {
+	bool first = (*position == 0);
+	uint32_t field;
+	uint32_t gap = 0;
+	uint32_t below;
+	uint32_t above;
+
+	if (!light_history_get_varint(chunk, position, &field)
+			|| ((field & 1U) != 0 && !light_history_get_varint(chunk, position, &gap))
+			|| !light_history_get_varint(chunk, position, &below) || !light_history_get_varint(chunk, position, &above)) {
+		return FALSE;
+	}
+	field >>= 1;
+	record->mean = (first ? 0 : record->mean) + (int32_t) ((field >> 1) ^ -(field & 1U));
+	record->offset = first ? 0 : record->offset + 1U + gap;
+	record->min = record->mean - below;
+	record->max = record->mean + above;
+	return TRUE;
+}
+
+/*
+ * @fn		static const TLight_history_chunk* light_history_flash_chunk(uint8_t sector, uint16_t index)
+ * @brief	Returns a chunk of a flash sector, read in place
+ */
+static const TLight_history_chunk* light_history_flash_chunk(uint8_t sector, uint16_t index) {
+	return (const TLight_history_chunk*) (LIGHT_HISTORY_FLASH_ADDRESS + sector * LIGHT_HISTORY_FLASH_SIZE
+			+ index * LIGHT_HISTORY_CHUNK_SIZE);
+}
+
+/*
+ * @fn		static bool light_history_is_erased(const TLight_history_chunk *chunk)
+ * @brief	Tells if all the bytes of a chunk of a flash sector are erased
+ */
+static bool light_history_is_erased(const TLight_history_chunk *chunk) {
+	const uint8_t *bytes = (const uint8_t*) chunk;
+
+	for (uint16_t i = 0; i < LIGHT_HISTORY_CHUNK_SIZE; i++) {
+		if (bytes[i] != 0xFFU) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		static uint16_t light_history_count(uint8_t sector)
+ * @brief	Counts the chunks programmed from the start of a flash sector, the first chunk without the magic ends them
+ */
+static uint16_t light_history_count(uint8_t sector) {
+	uint16_t count = 0;
+
+	while (count < LIGHT_HISTORY_FLASH_CHUNKS && light_history_flash_chunk(sector, count)->header.magic
+			== LIGHT_HISTORY_MAGIC) {
+		count++;
+	}
+	return count;
+}
+
+/*
+ * @fn		static const TLight_history_chunk* light_history_chunk(TLight_history *history, uint16_t index)
+ * @brief	Returns a chunk, from the oldest one in the other sector, through the sector being filled,
+ * 			to the open one in RAM
+ */
+static const TLight_history_chunk* light_history_chunk(TLight_history *history, uint16_t index) {
+	if (index < history->older_n) {
+		return light_history_flash_chunk(history->sector ^ 1U, index);
+	}
+	index -= history->older_n;
+	if (index < history->flash_n) {
+		return light_history_flash_chunk(history->sector, index);
+	}
+	return &history->chunks[(history->first + index - history->flash_n) % LIGHT_HISTORY_RAM_CHUNKS];
+}
+
+/*
+ * @fn		static bool light_history_erase(uint8_t sector)
+ * @brief	Erases a flash sector, unless it is already erased. While the flash erases, every fetch from it
+ * 			stalls: the code, the constants and the vector table are in the flash, so the core and all the
+ * 			interrupts stop for 1 s, up to 2 s, and the blocks of the ADC stream completed meanwhile are lost.
+ * 			It happens once every LIGHT_HISTORY_FLASH_CHUNKS chunks, from light_history_erase_ahead()
+ * @retval	TRUE if the sector is erased, FALSE otherwise
+ */
+static bool light_history_erase(uint8_t sector) {
+	FLASH_EraseInitTypeDef erase = { 0 };
+	uint32_t error;
+	HAL_StatusTypeDef status;
+	uint16_t index = 0;
+
+	while (index < LIGHT_HISTORY_FLASH_CHUNKS && light_history_is_erased(light_history_flash_chunk(sector, index))) {
+		index++;
+	}
+	if (index == LIGHT_HISTORY_FLASH_CHUNKS) {
+		return TRUE;
+	}
+	erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+	erase.Sector = LIGHT_HISTORY_FLASH_SECTOR + sector;
+	erase.NbSectors = 1;
+	erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+	HAL_FLASH_Unlock();
+	status = HAL_FLASHEx_Erase(&erase, &error);
+	HAL_FLASH_Lock();
+	return status == HAL_OK;
+}
+
+/*
+ * @fn		static void light_history_spill(TLight_history *history)
+ * @brief	Programs the oldest chunk of the ring after the last one of the sector being filled, and drops it
+ * 			from the ring. When the sector is full, the other one, already erased, is filled in the next turn,
+ * 			the chunks of the full one becoming the older ones; if it is not erased yet the chunk is dropped, since
+ * 			the erase would stall the core. The first word, with the magic, is programmed last: a chunk cut
+ * 			by a reset is not taken for a chunk of records, and the sector is taken for full at the next start
+ */
+static void light_history_spill(TLight_history *history) {
+	TLight_history_chunk *chunk = &history->chunks[history->first];
+	const uint8_t *bytes = (const uint8_t*) chunk;
+	uint32_t address;
+	uint32_t word;
+
+	if (history->flash_ok && history->flash_full && history->next_erased) {
+		history->older_n = history->flash_n;
+		history->sector ^= 1U;
+		history->turn++;
+		history->flash_n = 0;
+		history->flash_full = FALSE;
+		history->next_erased = FALSE;
+	}
+	if (history->flash_ok && !history->flash_full) {
+		address = LIGHT_HISTORY_FLASH_ADDRESS + history->sector * LIGHT_HISTORY_FLASH_SIZE
+				+ history->flash_n * LIGHT_HISTORY_CHUNK_SIZE;
+		chunk->header.turn = history->turn;
+		HAL_FLASH_Unlock();
+		for (uint16_t i = 1; i <= LIGHT_HISTORY_CHUNK_SIZE / sizeof(uint32_t) && history->flash_ok; i++) {
+			uint16_t offset = (i % (LIGHT_HISTORY_CHUNK_SIZE / sizeof(uint32_t))) * sizeof(uint32_t);
+
+			memcpy(&word, &bytes[offset], sizeof(word));
+			history->flash_ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + offset, word) == HAL_OK;
+		}
+		HAL_FLASH_Lock();
+	}
+	if (history->flash_ok && !history->flash_full) {
+		history->flash_full = (++history->flash_n == LIGHT_HISTORY_FLASH_CHUNKS);
+	} else {
+		history->dropped++;
+	}
+	history->first = (history->first + 1U) % LIGHT_HISTORY_RAM_CHUNKS;
+	history->chunks_n--;
+}
+
+/*
+ * @fn		static TLight_history_chunk* light_history_open(TLight_history *history)
+ * @brief	Opens a new chunk at the end of the ring, spilling the oldest one if the ring is full
+ */
+static TLight_history_chunk* light_history_open(TLight_history *history) {
+	TLight_history_chunk *chunk;
+
+	if (history->chunks_n == LIGHT_HISTORY_RAM_CHUNKS) {
+		light_history_spill(history);
+	}
+	chunk = &history->chunks[(history->first + history->chunks_n) % LIGHT_HISTORY_RAM_CHUNKS];
+	history->chunks_n++;
+	memset(chunk, 0, sizeof(TLight_history_chunk));
+	chunk->header.magic = LIGHT_HISTORY_MAGIC;
+	chunk->header.interval = LIGHT_HISTORY_INTERVAL / 1000U;
+	return chunk;
+}
+
+/*
+ * @fn		static void light_history_close(TLight_history *history)
+ * @brief	Appends the record of the interval just over to the open chunk, or to a new one if it does not fit.
+ * 			An interval without values is only counted in the gap of the next record
+ */
+static void light_history_close(TLight_history *history) {
+	TLight_history_chunk *chunk = &history->chunks[(history->first + history->chunks_n - 1U) % LIGHT_HISTORY_RAM_CHUNKS];
+	uint8_t record[LIGHT_HISTORY_MAX_RECORD];
+	uint16_t mean;
+	uint8_t length;
+
+	if (history->count == 0) {
+		history->gap++;
+		return;
+	}
+	mean = history->sum / history->count;
+	length = light_history_encode(record, history->previous, history->gap, history->min, mean, history->max);
+	if (chunk->header.length + length > LIGHT_HISTORY_CHUNK_DATA
+			|| (chunk->header.records != 0 && chunk->header.unit != history->unit)) {
+		chunk = light_history_open(history);
+	}
+
+	// the first record of a chunk starts from a mean of 0, and its date and unit are the ones of the chunk
+	if (chunk->header.records == 0) {
+		chunk->header.start = *history->clock;
+		chunk->header.unit = history->unit;
+		length = light_history_encode(record, 0, 0, history->min, mean, history->max);
+	}
+	memcpy(&chunk->data[chunk->header.length], record, length);
+	chunk->header.length += length;
+	chunk->header.records++;
+	history->previous = mean;
+	history->records++;
+
+	history->gap = 0;
+	history->count = 0;
+	history->sum = 0;
+}
+
+/*
+ * @fn		void light_history_init(TLight_history *history, const TDatetime *clock)
+ * @brief	Finds the chunks already in the flash sectors, without erasing them, and starts the timer
+ * 			of the intervals. The timer wheel must be initialized
+ * @param	history		pointer to the TLight_history structure to initialize
+ * @param	clock		the date and time kept by the RTC, written in the header of every chunk
+ */
+void light_history_init(TLight_history *history, const TDatetime *clock) {
+	history->clock = clock;
+	history->due = FALSE;
+	history->count = 0;
+	history->sum = 0;
+	history->unit = LIGHT_HISTORY_LEVEL;
+	history->gap = 0;
+	history->previous = 0;
+	history->first = 0;
+	history->chunks_n = 0;
+	history->flash_ok = TRUE;
+	history->records = 0;
+	history->dropped = 0;
+
+	// the sector filled last has the later turn, compared in serial arithmetic since the turns wrap around
+	uint16_t counts[2] = { light_history_count(0), light_history_count(1) };
+	uint16_t turns[2] = { light_history_flash_chunk(0, 0)->header.turn, light_history_flash_chunk(1, 0)->header.turn };
+
+	history->sector = (counts[1] != 0 && (counts[0] == 0 || (int16_t) (turns[1] - turns[0]) > 0)) ? 1U : 0;
+	history->turn = (counts[history->sector] != 0) ? turns[history->sector] : 0;
+	history->flash_n = counts[history->sector];
+	history->older_n = counts[history->sector ^ 1U];
+	history->next_erased = FALSE;
+	// anything after the chunks, another content or a chunk cut by a reset, can only be erased:
+	// the sector is taken for full, and the next chunk is programmed in the other one
+	history->flash_full = history->flash_n == LIGHT_HISTORY_FLASH_CHUNKS
+			|| !light_history_is_erased(light_history_flash_chunk(history->sector, history->flash_n));
+	light_history_open(history);
+
+	timer_wheel_setup(&history->timer, light_history_expired, history);
+	timer_wheel_start(&history->timer, LIGHT_HISTORY_INTERVAL, LIGHT_HISTORY_INTERVAL);
+}
+
+/*
+ * @fn		void light_history_add(TLight_history *history, uint16_t value, TLight_history_unit unit)
+ * @brief	Folds a value into the current interval, dropping the values of the other unit already folded
+ * @param	history		pointer to the TLight_history structure
+ * @param	value		the light level or the loss
+ * @param	unit		what the value measures
+ */
+void light_history_add(TLight_history *history, uint16_t value, TLight_history_unit unit) {
+	if (unit != history->unit) {
+		history->unit = unit;
+		history->count = 0;
+		history->sum = 0;
+	}
+	if (history->count == 0) {
+		history->min = value;
+		history->max = value;
+	} else if (value < history->min) {
+		history->min = value;
+	} else if (value > history->max) {
+		history->max = value;
+	}
+	history->sum += value;
+	history->count++;
+}
+
+/*
+ * @fn		void light_history_process(TLight_history *history)
+ * @brief	Closes the current interval when it is over, appending its record.
+ * 			It must be called by the main loop, since a chunk may be programmed in the flash
+ * @param	history		pointer to the TLight_history structure
+ */
+void light_history_process(TLight_history *history) {
+	if (history->due) {
+		history->due = FALSE;
+		light_history_close(history);
+	}
+}
+
+/*
+ * @fn		void light_history_erase_ahead(TLight_history *history)
+ * @brief	Erases the other flash sector when the one being filled has LIGHT_HISTORY_ERASE_AHEAD chunks left,
+ * 			dropping its older chunks. The erase stalls the core and all the interrupts for 1 s, up to 2 s:
+ * 			it must be called by the main loop, only while every zone is disarmed
+ * @param	history		pointer to the TLight_history structure
+ */
+void light_history_erase_ahead(TLight_history *history) {
+	if (!history->flash_ok || history->next_erased
+			|| (!history->flash_full && history->flash_n + LIGHT_HISTORY_ERASE_AHEAD < LIGHT_HISTORY_FLASH_CHUNKS)) {
+		return;
+	}
+	// the older chunks are not shown any more, whatever the erase leaves
+	history->older_n = 0;
+	history->flash_ok = light_history_erase(history->sector ^ 1U);
+	history->next_erased = history->flash_ok;
+}
+
+/*
+ * @fn		bool light_history_is_pending(TLight_history *history)
+ * @brief	Tells if an interval is waiting to be closed by light_history_process
+ * @param	history		pointer to the TLight_history structure
+ * @retval	TRUE if an interval is over, FALSE otherwise
+ */
+bool light_history_is_pending(TLight_history *history) {
+	return history->due;
+}
+
+/*
+ * @fn		static void light_history_print(TShell *shell, const TLight_history_chunk *chunk,
+ * 				const TLight_history_record *group, uint16_t intervals)
+ * @brief	Prints a line of the history: the date of the chunk and the minutes from it, and the values
+ */
+static void light_history_print(TShell *shell, const TLight_history_chunk *chunk, const TLight_history_record *group,
+		uint16_t intervals) {
+	const TDatetime *start = &chunk->header.start;
+
+	shell_print(shell, "[%02u-%02u-%u%02u %02u:%02u:%02u] +%lu min, %u intervals: %s min %u, mean %u, max %u\r\n",
+			start->date, start->month, start->year_prefix, start->year, start->hour, start->minute, start->second,
+			group->offset * chunk->header.interval / 60U, intervals,
+			(chunk->header.unit == LIGHT_HISTORY_LOSS) ? "loss" : "light", group->min, group->mean, group->max);
+}
+
+static void light_history_command(TShell *shell, void *context, char *args) {
+	TLight_history *history = context;
+	char *lines_arg = shell_next_token(&args);
+	char *intervals_arg = shell_next_token(&args);
+	uint32_t lines = (lines_arg == NULL) ? LIGHT_HISTORY_DEFAULT_LINES : strtoul(lines_arg, NULL, 10);
+	uint32_t intervals = (intervals_arg == NULL) ? 1 : strtoul(intervals_arg, NULL, 10);
+	uint16_t chunks_n = history->older_n + history->flash_n + history->chunks_n;
+	uint32_t total = 0;
+	uint32_t skip;
+	const TLight_history_chunk *group_chunk = NULL;
+	TLight_history_record group = { 0 };
+	uint32_t group_n = 0;
+	uint32_t group_sum = 0;
+
+	if (lines == 0 || intervals == 0 || intervals > UINT16_MAX) {
+		shell_print(shell, "Usage: history [lines] [intervals per line]\r\n");
+		return;
+	}
+	for (uint16_t index = 0; index < chunks_n; index++) {
+		total += light_history_chunk(history, index)->header.records;
+	}
+	shell_print(shell, "%lu records of %lu s, %u chunks in RAM, %u of %lu in flash%s, %lu dropped\r\n", total,
+			LIGHT_HISTORY_INTERVAL / 1000U, history->chunks_n, history->older_n + history->flash_n,
+			2U * LIGHT_HISTORY_FLASH_CHUNKS,
+			history->flash_ok ? "" : " (failed)", history->dropped);
+
+	// the chunks are decoded from the start, the ones entirely before the last lines are skipped at once
+	skip = (total > lines * intervals) ? total - lines * intervals : 0;
+	for (uint16_t index = 0; index < chunks_n; index++) {
+		const TLight_history_chunk *chunk = light_history_chunk(history, index);
+		TLight_history_record record = { 0 };
+		uint16_t position = 0;
+
+		if (skip >= chunk->header.records) {
+			skip -= chunk->header.records;
+			continue;
+		}
+		while (light_history_decode(chunk, &position, &record)) {
+			if (skip > 0) {
+				skip--;
+				continue;
+			}
+			// a line does not merge the light levels with the losses
+			if (group_n != 0 && chunk->header.unit != group_chunk->header.unit) {
+				group.mean = group_sum / group_n;
+				light_history_print(shell, group_chunk, &group, group_n);
+				group_n = 0;
+			}
+			if (group_n == 0) {
+				group_chunk = chunk;
+				group = record;
+				group_sum = 0;
+			}
+			group.min = (record.min < group.min) ? record.min : group.min;
+			group.max = (record.max > group.max) ? record.max : group.max;
+			group_sum += record.mean;
+			if (++group_n == intervals) {
+				group.mean = group_sum / group_n;
+				light_history_print(shell, group_chunk, &group, group_n);
+				group_n = 0;
+			}
+		}
+	}
+	if (group_n != 0) {
+		group.mean = group_sum / group_n;
+		light_history_print(shell, group_chunk, &group, group_n);
+	}
+}
+
+/*
+ * @fn		void light_history_register_commands(TLight_history *history, TShell *shell)
+ * @brief	Adds to the shell the command history [lines] [intervals], that shows the last records,
+ * 			merging some intervals in each line
+ * @param	history		pointer to the TLight_history structure
+ * @param	shell		pointer to the TShell structure
+ */
+void light_history_register_commands(TLight_history *history, TShell *shell) {
+	shell_register_command(shell, "history", "[lines] [intervals per line] shows the last minimum, mean and maximum"
+			" light levels, or losses of the emitter", light_history_command, history);
+}
@@ -0,0 +1,163 @@
+/*
+ * This module drives the emitter of a barrier with a square wave and measures how much of it comes back,
+ * with a synchronous detection. The PWM timer is clocked by the TRGO of the timer triggering the ADC, so it counts
+ * the samples of the stream: the emitter switches every period / 2 samples, locked in phase with the conversions
+ * at any sample rate. The samples are correlated with a sine and a cosine at the frequency of the emitter over
+ * windows of whole periods: the ambient light, constant or changing at other frequencies, falls out of the sums,
+ * and the amplitude comes from both of them, so it does not depend on the delay of the receiver.
+ */
+
+#include "lockin.h"
+
+/*
+ * @fn		static void lockin_end_window(TLockin *lockin)
+ * @brief	Computes the amplitude of the completed window: a sine of amplitude A gives correlations
+ * 			whose magnitude is A * LOCKIN_WINDOW / 2 in Q15. The first window after the reset is the reference
+ */
+static void lockin_end_window(TLockin *lockin) {
+	float in_phase = (float) lockin->in_phase;
+	float quadrature = (float) lockin->quadrature;
+	float amplitude = 2.0f * sqrtf(in_phase * in_phase + quadrature * quadrature) / (LOCKIN_WINDOW * 32768.0f);
+
+	lockin->amplitude = (amplitude > UINT16_MAX) ? UINT16_MAX : (uint16_t) amplitude;
+	if (lockin->reference == 0) {
+		lockin->reference = (lockin->amplitude == 0) ? 1 : lockin->amplitude;
+	}
+	lockin->windows++;
+	lockin->count = 0;
+	lockin->in_phase = 0;
+	lockin->quadrature = 0;
+}
+
+/*
+ * @fn		int lockin_init(TLockin *lockin, TIM_HandleTypeDef *htim, uint32_t channel, uint32_t trigger, uint8_t period)
+ * @brief	Makes the timer count the rising edges of the trigger, and sets its period and a duty cycle
+ * 			of 50%, without starting it
+ * @param	lockin		pointer to the TLockin structure to initialize
+ * @param	htim		a timer with a slave mode controller, with its channel configured as a PWM by MX_TIMx_Init
+ * @param	channel		the channel of the timer wired to the emitter, as TIM_CHANNEL_3
+ * @param	trigger		the internal trigger of the timer matching the timer of the ADC, as TIM_TS_ITR1
+ * @param	period		samples of a period of the emitter, from 2 to LOCKIN_MAX_PERIOD, dividing LOCKIN_WINDOW
+ * @retval	LOCKIN_ERR_INVALID if the period is not allowed, LOCKIN_ERR_HAL if the HAL refused the configuration,
+ * 			LOCKIN_OK otherwise
+ */
+int lockin_init(TLockin *lockin, TIM_HandleTypeDef *htim, uint32_t channel, uint32_t trigger, uint8_t period) {
+	TIM_SlaveConfigTypeDef slave = { 0 };
+
+	if (period < 2 || period > LOCKIN_MAX_PERIOD || LOCKIN_WINDOW % period != 0) {
+		return LOCKIN_ERR_INVALID;
+	}
+	lockin->htim = htim;
+	lockin->channel = channel;
+	lockin->period = period;
+	lockin->running = FALSE;
+	lockin->amplitude = 0;
+	lockin->windows = 0;
+	lockin_reset(lockin);
+
+	// the references are computed only here, the samples are correlated in fixed point
+	for (uint8_t i = 0; i < period; i++) {
+		float angle = 2.0f * (float) M_PI * i / period;
+		lockin->cosines[i] = (int16_t) lroundf(cosf(angle) * 32767.0f);
+		lockin->sines[i] = (int16_t) lroundf(sinf(angle) * 32767.0f);
+	}
+
+	// every rising edge of the trigger, a sample of the ADC, is a clock of the counter
+	slave.SlaveMode = TIM_SLAVEMODE_EXTERNAL1;
+	slave.InputTrigger = trigger;
+	if (HAL_TIM_SlaveConfigSynchro(htim, &slave) != HAL_OK) {
+		return LOCKIN_ERR_HAL;
+	}
+	__HAL_TIM_SET_AUTORELOAD(htim, period - 1U);
+	__HAL_TIM_SET_COMPARE(htim, channel, period / 2U);
+	return LOCKIN_OK;
+}
+
+/*
+ * @fn		void lockin_start(TLockin *lockin)
+ * @brief	Starts driving the emitter, that switches with the samples of the ADC
+ * @param	lockin		pointer to the TLockin structure
+ */
+void lockin_start(TLockin *lockin) {
+	if (!lockin->running && HAL_TIM_PWM_Start(lockin->htim, lockin->channel) == HAL_OK) {
+		lockin->running = TRUE;
+	}
+	lockin_reset(lockin);
+}
+
+/*
+ * @fn		void lockin_stop(TLockin *lockin)
+ * @brief	Stops driving the emitter
+ * @param	lockin		pointer to the TLockin structure
+ */
+void lockin_stop(TLockin *lockin) {
+	if (lockin->running) {
+		HAL_TIM_PWM_Stop(lockin->htim, lockin->channel);
+		lockin->running = FALSE;
+	}
+}
+
+/*
+ * @fn		void lockin_reset(TLockin *lockin)
+ * @brief	Starts the current window over and forgets the reference, set again by the next window
+ * @param	lockin		pointer to the TLockin structure
+ */
+void lockin_reset(TLockin *lockin) {
+	lockin->phase = 0;
+	lockin->count = 0;
+	lockin->in_phase = 0;
+	lockin->quadrature = 0;
+	lockin->reference = 0;
+}
+
+/*
+ * @fn		bool lockin_block(TLockin *lockin, const uint16_t *samples, uint16_t length)
+ * @brief	Correlates a block of samples, computing the amplitude of every window completed
+ * @param	lockin		pointer to the TLockin structure
+ * @param	samples		the samples, one for each rising edge of the trigger
+ * @param	length		number of samples
+ * @retval	TRUE if a window has been completed, FALSE otherwise
+ */
+bool lockin_block(TLockin *lockin, const uint16_t *samples, uint16_t length) {
+	bool completed = FALSE;
+	int64_t in_phase = lockin->in_phase;
+	int64_t quadrature = lockin->quadrature;
+	uint8_t phase = lockin->phase;
+
+	// the phase of the emitter is unknown, it only has to stay the same along a window
+	for (uint16_t i = 0; i < length; i++) {
+		in_phase += (int32_t) samples[i] * lockin->cosines[phase];
+		quadrature += (int32_t) samples[i] * lockin->sines[phase];
+		if (++phase == lockin->period) {
+			phase = 0;
+		}
+		if (++lockin->count == LOCKIN_WINDOW) {
+			lockin->in_phase = in_phase;
+			lockin->quadrature = quadrature;
+			lockin_end_window(lockin);
+			in_phase = 0;
+			quadrature = 0;
+			completed = TRUE;
+		}
+	}
+	lockin->in_phase = in_phase;
+	lockin->quadrature = quadrature;
+	lockin->phase = phase;
+	return completed;
+}
+
+/*
+ * @fn		uint16_t lockin_get_loss(TLockin *lockin, uint16_t full_scale)
+ * @brief	Returns how much of the reference amplitude is missing in the last window
+ * @param	lockin		pointer to the TLockin structure
+ * @param	full_scale	the value returned when the emitter is not received at all
+ * @retval	0 with the whole reference amplitude, full_scale without any, proportional in the middle
+ */
+uint16_t lockin_get_loss(TLockin *lockin, uint16_t full_scale) {
+	uint16_t amplitude = lockin->amplitude;
+
+	if (lockin->reference == 0 || amplitude >= lockin->reference) {
+		return 0;
+	}
+	return (uint32_t) full_scale * (lockin->reference - amplitude) / lockin->reference;
+}
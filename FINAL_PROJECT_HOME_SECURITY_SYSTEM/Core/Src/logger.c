@@ -2,52 +2,83 @@
  * This module contains methods to handle with the logger, represented with a structure holding:
  * 		a pointer to the UART_HandleTypeDef structure representing the UART interface used to print
  * 			the log messages
- * 		a pointer to the PIR sensor to print the status of
- * 		a pointer to the photoresistor to print the status of
- * 		a message to print
+ * 		the messages to print
+ * The periodic message shows the state of the area and of the barrier zones, taken from the sensor registry,
+ * the occupancy of the area, the highest activity duty cycle among its sensors, the active health faults,
+ * and the peak rate of the inputs and the storms of every sensor of the area.
+ * The event messages wait in a queue for the datetime, so the ones of the same tick are all printed.
+ * While the RTC is not responding the messages are printed at once, with the last datetime read.
  */
 
 #include "logger.h"
 
 /*
- *	@fn		void logger_init(TLogger *logger, UART_HandleTypeDef *huart, TPIR_sensor *pir, TPhotoresistor *photoresistor)
+ *	@fn		void logger_init(TLogger *logger, UART_HandleTypeDef *huart)
  *	@brief	Instantiates the logger
  *	@param	logger			pointer to the TLogger structure to store the parameters in
  *	@param	huart			pointer to the UART_HandleTypeDef structure
  *							representing the UART interface used to print the log messages
- *	@param	pir				pointer to the PIR sensor to print the status of
- *	@param	photoresistor	pointer to the photoresistor to print the status of
  */
-void logger_init(TLogger *logger, UART_HandleTypeDef *huart, TPIR_sensor *pir, TPhotoresistor *photoresistor) {
+void logger_init(TLogger *logger, UART_HandleTypeDef *huart) {
 	logger->huart = huart;
-	logger->pir = pir;
-	logger->photoresistor = photoresistor;
-	logger->message[0] = '\0';
+	logger->first = 0;
+	logger->count = 0;
+	logger->dropped = 0;
 }
 
 /*
  * @fn	void logger_callback(TLogger *logger)
  * @brief	This function is called every time the RTC is asked to get the datetime.
- * 			Automatically shows either the periodic log message or an aperiodic event message
+ * 			Automatically shows either the periodic log message or the aperiodic event messages queued
  * @param logger	pointer to the TLogger structure
  */
 void logger_callback(TLogger *logger) {
 	TDatetime *datetime = get_configuration()->datetime;
 
-	if (strlen(logger->message) == 0) {
+	if (logger->count == 0) {
 		logger_show_periodic_message(logger, datetime);
-	} else {
-		logger_show_event_message(datetime, logger->message);
+		return;
+	}
+
+	// the messages are queued by the interrupts too: each one is taken out before it is printed
+	while (logger->count > 0) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		const char *message = logger->messages[logger->first];
+		logger->first = (logger->first + 1U) % LOGGER_QUEUE_SIZE;
+		logger->count--;
+		__set_PRIMASK(primask);
+
+		logger_show_event_message(datetime, message);
+		latency_mark(LATENCY_MARK_PRINTED);
 	}
 }
 
 /*
  * @fn	void logger_print(TLogger *logger, char *event_message)
- * @brief	Sets a message to print in a TLogger structure, and shows the specific message
+ * @brief	Queues a message to print in a TLogger structure, and shows the messages queued.
+ * 			The datetime is asked to the RTC; if the RTC is not responding the messages are shown at once.
+ * 			An empty message asks for the periodic message, shown if no event message is queued.
  * @param	logger			pointer to the TLogger structure
  * @param	event_message	the message to print
  */
 void logger_print(TLogger *logger, char *message) {
-	logger->message = message;
+	// it may raise the RTC fault, that is logged before this message
+	health_rtc_request();
+
+	if (message[0] != '\0') {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		if (logger->count < LOGGER_QUEUE_SIZE) {
+			logger->messages[(logger->first + logger->count) % LOGGER_QUEUE_SIZE] = message;
+			logger->count++;
+		} else {
+			logger->dropped++;
+		}
+		__set_PRIMASK(primask);
+	}
 	rtc_ds1307_get_datetime();
+	if (health_is_raised(HEALTH_FAULT_RTC_TIMEOUT) && get_configuration()->done) {
+		logger_callback(logger);
+	}
 }
@@ -33,10 +33,23 @@
 #include "rtc_ds1307.h"
 #include "configuration.h"
 #include "photoresistor.h"
-#include "pir_sensor.h"
+#include "adc_stream.h"
+#include "adc_calibration.h"
+#include "light_history.h"
+#include "raw_stream.h"
+#include "pir_array.h"
 #include "buzzer.h"
 #include "keypad.h"
 #include "logger.h"
+#include "shell.h"
+#include "user_directory.h"
+#include "latency.h"
+#include "exti_dispatcher.h"
+#include "sensor_registry.h"
+#include "correlation.h"
+#include "health.h"
+#include "zone_profile.h"
+#include "idle.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -46,7 +59,15 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/* Milliseconds between two periodic log messages */
+#define LOG_PERIOD			(10000U)
 
+/* The delays and the duration asked by the configuration are in seconds, the profiles of the zones in milliseconds */
+#define MS_PER_SECOND		(1000U)
+
+/* Windows of the correlation rules, in milliseconds */
+#define BARRIER_THEN_AREA_WINDOW	(10000U)
+#define TWO_AREA_SENSORS_WINDOW		(2000U)
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -70,12 +91,39 @@ TBuzzer buzzer;
 /* Used logger */
 TLogger logger;
 
-/* Used PIR sensor */
-TPIR_sensor pir;
+/* Zones of PIR sensors */
+TPIR_array pir_array;
+
+/* Input capture timestamping the edges of the PIR sensor */
+TPIR_capture pir_capture;
 
 /* Used photoresistor */
 TPhotoresistor photoresistor;
 
+/* Conversions of the ADC, triggered by TIM2 */
+TAdc_stream adc_stream;
+
+/* Correction of the conversions of the ADC, from VREFINT and the temperature sensor */
+TAdc_calibration adc_calibration;
+
+/* History of the light level of the barrier, kept in RAM and in the last two sectors of the flash */
+TLight_history light_history;
+
+/* Binary stream of the raw samples of the ADC and of the edges of the PIR, on the UART of the console */
+TRaw_stream raw_stream;
+
+/* Emitter of the barrier on PB8, driven by TIM4 in step with the samples of TIM2 */
+TLockin lockin;
+
+/* Used command line */
+TShell shell;
+
+/* Users allowed to send commands from the keypad */
+TUser_directory users;
+
+/* Used to print the periodic log message */
+TTimer log_timer;
+
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -83,6 +131,12 @@ void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
 void configure_photoresistor();
 void configure_PIR_sensor();
+void configure_user_directory();
+void configure_shell();
+void configure_correlation();
+void configure_zone_profiles();
+bool system_is_idle();
+void log_timer_expired(void *context);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -127,24 +181,58 @@ int main(void)
   MX_TIM3_Init();
   MX_TIM2_Init();
   MX_TIM9_Init();
+  MX_TIM5_Init();
+  MX_TIM4_Init();
   /* USER CODE BEGIN 2 */
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+	sensor_registry_init();
 	rtc_ds1307_init(get_configuration()->datetime);
 	system_boot();
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
 
+	configure_user_directory();
 	KEYPAD_init_default(&keypad);
 	buzzer_init(&buzzer, &htim3, TIM_CHANNEL_1);
+	configure_zone_profiles();
 	configure_PIR_sensor();
+	adc_stream_init(&adc_stream, &hadc1, &htim2);
+	adc_calibration_init(&adc_calibration, &adc_stream);
+	light_history_init(&light_history, get_configuration()->datetime);
 	configure_photoresistor();
-	logger_init(&logger, get_console(NULL)->huart, &pir, &photoresistor);
+	configure_correlation();
+	raw_stream_init(&raw_stream, get_console(NULL)->huart, &adc_stream, &pir_capture);
+	logger_init(&logger, get_console(NULL)->huart);
+
+	configure_shell();
 
 	logger_print(&logger, "System boot");
-	HAL_TIM_Base_Start_IT(&htim10);
+	timer_wheel_setup(&log_timer, log_timer_expired, NULL);
+	timer_wheel_start(&log_timer, LOG_PERIOD, LOG_PERIOD);
+	idle_init(&htim11, TIM1_TRG_COM_TIM11_IRQn);
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
 	while (1) {
+		shell_process(&shell);
+		KEYPAD_poll(&keypad);
+		sensor_registry_poll();
+		adc_stream_process(&adc_stream);
+		adc_calibration_process(&adc_calibration);
+		light_history_process(&light_history);
+		// the erase of a flash sector stops everything for a second or two: never while a zone watches
+		if (sensor_registry_is_disarmed()) {
+			light_history_erase_ahead(&light_history);
+		}
+		raw_stream_process(&raw_stream);
+
+		// the checks and the sleep are atomic: an interrupt raised after the checks ends the sleep at once
+		__disable_irq();
+		idle_sleep(system_is_idle());
+		__enable_irq();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -196,18 +284,97 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+void configure_zone_profiles() {
+	TConfiguration *configuration = get_configuration();
+	TZone_profile profile = { 0, 0, configuration->alarm_duration * MS_PER_SECOND };
+
+	// the exit delay is not asked by the configuration, it can be set from the shell
+	zone_profile_init(&profile);
+	profile.entry_delay = configuration->area_alarm_delay * MS_PER_SECOND;
+	zone_profile_set(USER_ZONE_AREA, &profile);
+	profile.entry_delay = configuration->barrier_alarm_delay * MS_PER_SECOND;
+	zone_profile_set(USER_ZONE_BARRIER, &profile);
+}
+
 void configure_photoresistor() {
-	uint8_t area_alarm_delay = get_configuration()->area_alarm_delay;
-	uint8_t alarm_duration = get_configuration()->alarm_duration;
-	photoresistor_init(&photoresistor, area_alarm_delay, alarm_duration, &htim2,
-			&hadc1, &buzzer);
+	const TZone_profile *profile = zone_profile_get(USER_ZONE_BARRIER);
+	// the photoresistor is wired to PA0, the channel 0 of the ADC, and its window is watched also by the hardware
+	// watchdog. Other barriers are added with their analog pins as more channels of the same scan.
+	photoresistor_init(&photoresistor, profile->entry_delay, profile->duration, &adc_stream, ADC_CHANNEL_0, &buzzer);
+	photoresistor_set_critical(&photoresistor);
+	photoresistor_attach_calibration(&photoresistor, &adc_calibration);
+	photoresistor_attach_history(&photoresistor, &light_history);
+	// the lock-in mode is turned on from the shell, once an emitter is wired to PB8 and aimed at the photoresistor
+	if (lockin_init(&lockin, &htim4, TIM_CHANNEL_3, TIM_TS_ITR1, LOCKIN_DEFAULT_PERIOD) == LOCKIN_OK) {
+		photoresistor_attach_lockin(&photoresistor, &lockin);
+	}
+	sensor_registry_add(&photoresistor_ops, &photoresistor, "barrier", USER_ZONE_BARRIER);
 }
 
 void configure_PIR_sensor() {
-	uint8_t barrier_alarm_delay = get_configuration()->barrier_alarm_delay;
-	uint8_t alarm_duration = get_configuration()->alarm_duration;
-	PIR_sensor_init(&pir, barrier_alarm_delay, alarm_duration, EXTI4_IRQn,
-			GPIOC, GPIO_PIN_4, &htim9, &buzzer);
+	const TZone_profile *profile = zone_profile_get(USER_ZONE_AREA);
+	PIR_array_init(&pir_array);
+
+	// the sensor output is wired to PA1, the channel 2 of TIM5, so its edges are timestamped by the timer.
+	// Other zones are added with their pins, configured as EXTI on both edges.
+	PIR_array_add(&pir_array, profile->entry_delay, profile->duration, EXTI1_IRQn,
+			GPIOA, GPIO_PIN_1, &buzzer);
+	PIR_capture_init(&pir_capture, &htim5);
+	PIR_sensor_attach_capture(PIR_array_get_zone(&pir_array, GPIO_PIN_1), &pir_capture);
+	sensor_registry_add(&PIR_sensor_ops, PIR_array_get_zone(&pir_array, GPIO_PIN_1), "pir PA1", USER_ZONE_AREA);
+}
+
+void configure_correlation() {
+	correlation_init();
+	// an intruder crossing the barrier and then moving in the area is more likely than a single detection
+	correlation_add_sequence("barrier then area", USER_ZONE_BARRIER, USER_ZONE_AREA, BARRIER_THEN_AREA_WINDOW, 60);
+	correlation_add_count("two area sensors", USER_ZONE_AREA, 2, TWO_AREA_SENSORS_WINDOW, 50);
+}
+
+void configure_user_directory() {
+	// the salt is unique for each device, so the same PIN has a different digest on every board
+	uint32_t salt = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2();
+	user_directory_init(&users, salt);
+	user_directory_add(&users, get_configuration()->user_PIN, USER_ROLE_ADMIN, USER_ZONE_ALL);
+}
+
+void configure_shell() {
+	shell_init(&shell, get_console(NULL)->huart);
+	user_directory_register_commands(&users, &shell);
+	latency_register_commands(&shell);
+	exti_dispatcher_register_commands(&shell);
+	PIR_capture_register_commands(&pir_capture, &shell);
+	PIR_array_register_commands(&pir_array, &shell);
+	sensor_registry_register_commands(&shell);
+	correlation_register_commands(&shell);
+	health_register_commands(&shell);
+	zone_profile_register_commands(&shell);
+	idle_register_commands(&shell);
+	adc_stream_register_commands(&adc_stream, &shell);
+	adc_calibration_register_commands(&adc_calibration, &shell);
+	light_history_register_commands(&light_history, &shell);
+	raw_stream_register_commands(&raw_stream, &shell);
+	q15_filter_register_commands(&photoresistor.filter, &shell);
+	photoresistor_register_commands(&photoresistor, &shell);
+	shell_start(&shell);
+}
+
+bool system_is_idle() {
+	// the edges captured by the DMA, the held keys, the blocks of the ADC, its calibration,
+	// the intervals of the history and the packets of the raw stream are polled
+	return !shell_has_input(&shell) && KEYPAD_is_idle(&keypad) && sensor_registry_is_idle()
+			&& !adc_stream_has_block(&adc_stream) && !adc_calibration_is_pending(&adc_calibration)
+			&& !light_history_is_pending(&light_history) && !raw_stream_is_pending(&raw_stream);
+}
+
+void log_timer_expired(void *context) {
+	/*
+	 * When this time has passed, a new log message is printed, and the user LED is toggled also
+	 */
+	logger_print(&logger, "\0");
+	if (system_state == SYSTEM_STATE_ENABLED) {
+		HAL_GPIO_TogglePin(GPIOA, GPIO_PIN_5);
+	}
 }
 
 /* USER CODE END 4 */
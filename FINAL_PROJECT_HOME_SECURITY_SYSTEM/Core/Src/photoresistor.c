@@ -1,23 +1,149 @@
 /*
  *	This module contains methods to handle with a photoresistor
+ *	Every photoresistor is a channel of the scan of the ADC stream, with its own filter, window and state machine.
+ *	One of them can be critical: the hardware watchdog of the ADC watches its raw conversions too,
+ *	so an intruder is detected at the conversion, without waiting for the block.
  */
 
 #include "photoresistor.h"
 
+static void photoresistor_alarm_expired(void *context);
+static void photoresistor_block(void *context, const uint16_t *samples, uint16_t length);
+static void photoresistor_set_window(TPhotoresistor *photoresistor, uint16_t low, uint16_t high);
+static bool photoresistor_watchdog_usable(TPhotoresistor *photoresistor);
+static void photoresistor_arm_watchdog(TPhotoresistor *photoresistor);
+
+/* Frequencies measured by the flicker bank, in Hz */
+static const uint16_t flicker_bins[] = PHOTORESISTOR_FLICKER_BINS;
+
+/* Actions of the state machine of the photoresistor, indices in photoresistor_actions */
+enum {
+	PHOTORESISTOR_ACTION_STOP_TIMER = ALARM_ACTION_END + 1,
+	PHOTORESISTOR_ACTION_START_DELAY,
+	PHOTORESISTOR_ACTION_START_DURATION,
+	PHOTORESISTOR_ACTION_WATCH_DARK,
+	PHOTORESISTOR_ACTION_WATCH_LIGHT,
+	PHOTORESISTOR_ACTION_WATCH_NONE,
+	PHOTORESISTOR_ACTION_START_SAMPLING,
+	PHOTORESISTOR_ACTION_STOP_SAMPLING,
+	PHOTORESISTOR_ACTION_SOUND,
+	PHOTORESISTOR_ACTION_SILENCE
+};
+
+static void photoresistor_stop_timer(void *sensor);
+static void photoresistor_start_delay(void *sensor);
+static void photoresistor_start_duration(void *sensor);
+static void photoresistor_watch_dark(void *sensor);
+static void photoresistor_watch_light(void *sensor);
+static void photoresistor_watch_none(void *sensor);
+static void photoresistor_start_sampling(void *sensor);
+static void photoresistor_stop_sampling(void *sensor);
+static void photoresistor_sound(void *sensor);
+static void photoresistor_silence(void *sensor);
+
+static const TAlarm_action photoresistor_actions[] = {
+	[PHOTORESISTOR_ACTION_STOP_TIMER] = photoresistor_stop_timer,
+	[PHOTORESISTOR_ACTION_START_DELAY] = photoresistor_start_delay,
+	[PHOTORESISTOR_ACTION_START_DURATION] = photoresistor_start_duration,
+	[PHOTORESISTOR_ACTION_WATCH_DARK] = photoresistor_watch_dark,
+	[PHOTORESISTOR_ACTION_WATCH_LIGHT] = photoresistor_watch_light,
+	[PHOTORESISTOR_ACTION_WATCH_NONE] = photoresistor_watch_none,
+	[PHOTORESISTOR_ACTION_START_SAMPLING] = photoresistor_start_sampling,
+	[PHOTORESISTOR_ACTION_STOP_SAMPLING] = photoresistor_stop_sampling,
+	[PHOTORESISTOR_ACTION_SOUND] = photoresistor_sound,
+	[PHOTORESISTOR_ACTION_SILENCE] = photoresistor_silence
+};
+
+/*
+ * Transitions of the photoresistor. The ADC watchdog is a TRIGGER while the photoresistor is active,
+ * a CLEAR while it is delayed. The buzzer is silenced only when the photoresistor leaves the alarm.
+ */
+static const TAlarm_transition photoresistor_transitions[ALARM_STATES_N][ALARM_EVENTS_N] = {
+	[ALARM_STATE_INACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_WATCH_DARK, PHOTORESISTOR_ACTION_START_SAMPLING } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_STOP_SAMPLING } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_WATCH_DARK, PHOTORESISTOR_ACTION_START_SAMPLING } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_STOP_SAMPLING } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_STATE_DELAYED, { PHOTORESISTOR_ACTION_WATCH_LIGHT,
+				PHOTORESISTOR_ACTION_START_DELAY } },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ALARMED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER, PHOTORESISTOR_ACTION_SILENCE,
+				PHOTORESISTOR_ACTION_WATCH_DARK, PHOTORESISTOR_ACTION_START_SAMPLING } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_SILENCE, PHOTORESISTOR_ACTION_STOP_SAMPLING } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_STATE_ACTIVE, { PHOTORESISTOR_ACTION_SILENCE,
+				PHOTORESISTOR_ACTION_WATCH_DARK, PHOTORESISTOR_ACTION_START_SAMPLING } }
+	},
+	[ALARM_STATE_DELAYED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_WATCH_DARK, PHOTORESISTOR_ACTION_START_SAMPLING } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_STOP_SAMPLING } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_STATE_ACTIVE, { PHOTORESISTOR_ACTION_STOP_TIMER,
+				PHOTORESISTOR_ACTION_WATCH_DARK, PHOTORESISTOR_ACTION_START_SAMPLING } },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_STATE_ALARMED, { PHOTORESISTOR_ACTION_WATCH_NONE,
+				PHOTORESISTOR_ACTION_START_DURATION, PHOTORESISTOR_ACTION_SOUND, PHOTORESISTOR_ACTION_STOP_SAMPLING } }
+	}
+};
+
+static const TAlarm_fsm photoresistor_fsm = { photoresistor_transitions, photoresistor_actions };
+
+static void photoresistor_op_activate(void *sensor);
+static void photoresistor_op_deactivate(void *sensor);
+static TAlarmState photoresistor_op_state(void *sensor);
+static void photoresistor_op_stats(void *sensor, TSensor_stats *stats);
+static void photoresistor_op_signal(void *sensor, void *source);
+static void photoresistor_op_set_timing(void *sensor, uint32_t delay, uint32_t duration);
+
+const TSensor_ops photoresistor_ops = {
+	.activate = photoresistor_op_activate,
+	.deactivate = photoresistor_op_deactivate,
+	.poll = NULL,
+	.state = photoresistor_op_state,
+	.stats = photoresistor_op_stats,
+	.signal = photoresistor_op_signal,
+	.set_timing = photoresistor_op_set_timing,
+	.busy = NULL
+};
+
 /*
- * @fn 			void photoresistor_init(TPhotoresistor *photoresistor, uint8_t alarm_delay,
-										uint8_t alarm_duration, TIM_HandleTypeDef *htim, ADC_HandleTypeDef *hadc, TBuzzer *buzzer);
+ * @fn 			static void photoresistor_event(TPhotoresistor *photoresistor, TAlarmEvent event)
+ * @brief  	 	executes an event on the state machine of the photoresistor
+ */
+static void photoresistor_event(TPhotoresistor *photoresistor, TAlarmEvent event) {
+	alarm_fsm_dispatch(&photoresistor_fsm, &photoresistor->state, event, photoresistor);
+}
+
+/*
+ * @fn 			int photoresistor_init(TPhotoresistor *photoresistor, uint32_t alarm_delay,
+										uint32_t alarm_duration, TAdc_stream *stream, uint32_t channel, TBuzzer *buzzer);
  * @brief  		initialize the photoresistor module
  * @param   	photoresistor: reference to the photoresistor variable
- * @param   	alarm_delay: value of the alarm delay
- * @param   	alarm_duration: value of the alarm duration
- * @param   	htim: reference to the timer used for control the alarm duration
- * @param   	hadc: reference to the ADC who does the conversion
+ * @param   	alarm_delay: value of the alarm delay, in milliseconds
+ * @param   	alarm_duration: value of the alarm duration, in milliseconds
+ * @param   	stream: reference to the stream of the ADC who does the conversions, it gets the photoresistor as consumer
+ * @param   	channel: the channel of the ADC, as ADC_CHANNEL_0, with its pin in analog mode
  * @param 		buzzer: reference to the buzzer associated to the photoresistor
+ * @retval		a negative value if the channel cannot be added to the scan of the stream
  */
-void photoresistor_init(TPhotoresistor *photoresistor, uint8_t alarm_delay,
-		uint8_t alarm_duration, TIM_HandleTypeDef *htim,
-		ADC_HandleTypeDef *hadc, TBuzzer *buzzer) {
+int photoresistor_init(TPhotoresistor *photoresistor, uint32_t alarm_delay,
+		uint32_t alarm_duration, TAdc_stream *stream, uint32_t channel, TBuzzer *buzzer) {
+	int index;
 
 	if(alarm_delay == 0) {
 		alarm_delay = NO_DELAY;
@@ -25,12 +151,120 @@ void photoresistor_init(TPhotoresistor *photoresistor, uint8_t alarm_delay,
 
 	photoresistor->value = 0;
 	photoresistor->alarm_delay = alarm_delay;
-	photoresistor->counter = 0;
 	photoresistor->alarm_duration = alarm_duration;
 	photoresistor->state = ALARM_STATE_INACTIVE;
-	photoresistor->htim = htim;
-	photoresistor->hadc = hadc;
+	timer_wheel_setup(&photoresistor->alarm_timer, photoresistor_alarm_expired, photoresistor);
+	photoresistor->stream = stream;
+	photoresistor->hadc = stream->hadc;
+	photoresistor->channel = channel;
+	photoresistor->critical = FALSE;
+	q15_filter_init(&photoresistor->filter, PHOTORESISTOR_MEDIAN_LENGTH, PHOTORESISTOR_AVERAGE_LENGTH,
+			PHOTORESISTOR_IIR_ALPHA);
+	photoresistor->window_low = 0;
+	photoresistor->window_high = PHOTORESISTOR_ADC_MAX;
+	photoresistor->baseline = PHOTORESISTOR_INITIAL_BASELINE << PHOTORESISTOR_BASELINE_SHIFT;
+	photoresistor->baseline_primed = FALSE;
+	goertzel_init(&photoresistor->flicker_bank);
+	for (uint8_t i = 0; i < sizeof(flicker_bins) / sizeof(flicker_bins[0]); i++) {
+		goertzel_add_bin(&photoresistor->flicker_bank, flicker_bins[i]);
+	}
+	photoresistor->flicker = 0;
+	photoresistor->flicker_rejects = 0;
+	photoresistor->lockin = NULL;
+	photoresistor->lockin_on = FALSE;
+	photoresistor->calibration = NULL;
+	photoresistor->calibration_updates = 0;
+	photoresistor->history = NULL;
 	photoresistor->buzzer = buzzer;
+	photoresistor->events = 0;
+	photoresistor->alarms = 0;
+	photoresistor->saturated_blocks = 0;
+
+	// the window is checked on the filtered values, a single noisy conversion must not fire the watchdog
+	// but on the critical channel
+	__HAL_ADC_DISABLE_IT(photoresistor->hadc, ADC_IT_AWD);
+
+	index = adc_stream_add_channel(stream, channel, photoresistor_block, photoresistor);
+	photoresistor->index = (index < 0) ? ADC_STREAM_MAX_CHANNELS : (uint8_t) index;
+	return index;
+}
+
+/*
+ * @fn 			void photoresistor_set_critical(TPhotoresistor *photoresistor)
+ * @brief  	 	moves the hardware watchdog of the ADC to the channel of the photoresistor, that becomes the critical one.
+ * 				Only one photoresistor of an ADC can be critical
+ * @param   	photoresistor: reference to the photoresistor variable
+ */
+void photoresistor_set_critical(TPhotoresistor *photoresistor) {
+	ADC_AnalogWDGConfTypeDef config = { 0 };
+
+	config.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+	config.HighThreshold = photoresistor->window_high;
+	config.LowThreshold = photoresistor->window_low;
+	config.Channel = photoresistor->channel;
+	config.ITMode = photoresistor_watchdog_usable(photoresistor) ? ENABLE : DISABLE;
+	if (HAL_ADC_AnalogWDGConfig(photoresistor->hadc, &config) == HAL_OK) {
+		photoresistor->critical = TRUE;
+	}
+}
+
+/*
+ * @fn 			void photoresistor_attach_lockin(TPhotoresistor *photoresistor, TLockin *lockin)
+ * @brief  	 	gives the photoresistor the detector of its emitter, without turning the lock-in mode on
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	lockin: reference to the initialized detector
+ */
+void photoresistor_attach_lockin(TPhotoresistor *photoresistor, TLockin *lockin) {
+	photoresistor->lockin = lockin;
+}
+
+/*
+ * @fn 			int photoresistor_use_lockin(TPhotoresistor *photoresistor, bool on)
+ * @brief  	 	turns the lock-in mode on or off. The emitter is driven only in lock-in mode, and the channel
+ * 				must not be oversampled, the decimation would average the emitter away
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	on: TRUE to turn the mode on
+ * @retval  	PHOTORESISTOR_ERR_NO_LOCKIN if there is no detector, PHOTORESISTOR_OK otherwise
+ */
+int photoresistor_use_lockin(TPhotoresistor *photoresistor, bool on) {
+	if (photoresistor->lockin == NULL) {
+		return PHOTORESISTOR_ERR_NO_LOCKIN;
+	}
+	if (on == photoresistor->lockin_on) {
+		return PHOTORESISTOR_OK;
+	}
+	if (on) {
+		lockin_start(photoresistor->lockin);
+	} else {
+		lockin_stop(photoresistor->lockin);
+	}
+
+	// the values change meaning, the filter and the baseline start again from the next block
+	photoresistor->lockin_on = on;
+	q15_filter_reset(&photoresistor->filter);
+	photoresistor->baseline_primed = FALSE;
+	photoresistor_arm_watchdog(photoresistor);
+	return PHOTORESISTOR_OK;
+}
+
+/*
+ * @fn 			void photoresistor_attach_calibration(TPhotoresistor *photoresistor, TAdc_calibration *calibration)
+ * @brief  	 	corrects the next samples of the photoresistor with the calibration of its ADC
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	calibration: reference to the initialized calibration of the ADC of the stream
+ */
+void photoresistor_attach_calibration(TPhotoresistor *photoresistor, TAdc_calibration *calibration) {
+	photoresistor->calibration = calibration;
+}
+
+/*
+ * @fn 			void photoresistor_attach_history(TPhotoresistor *photoresistor, TLight_history *history)
+ * @brief  	 	folds the filtered value of the next blocks into a history, while the photoresistor samples
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	history: reference to the initialized history
+ */
+void photoresistor_attach_history(TPhotoresistor *photoresistor, TLight_history *history) {
+	photoresistor->history = history;
 }
 
 /*
@@ -39,7 +273,7 @@ void photoresistor_init(TPhotoresistor *photoresistor, uint8_t alarm_delay,
  * @param   	photoresistor: reference to the photoresistor variable
  */
 void photoresistor_activate(TPhotoresistor *photoresistor) {
-	photoresistor_change_state(photoresistor, ALARM_STATE_ACTIVE);
+	photoresistor_event(photoresistor, ALARM_EVENT_ACTIVATE);
 }
 
 /*
@@ -48,7 +282,434 @@ void photoresistor_activate(TPhotoresistor *photoresistor) {
  * @param   	photoresistor: reference to the photoresistor variable
  */
 void photoresistor_deactivate(TPhotoresistor *photoresistor) {
-	photoresistor_change_state(photoresistor, ALARM_STATE_INACTIVE);
+	photoresistor_event(photoresistor, ALARM_EVENT_DEACTIVATE);
+}
+
+/*
+ * @fn 			void photoresistor_watchdog(TPhotoresistor *photoresistor)
+ * @brief  	 	updates the state of the photoresistor when the light level leaves the window:
+ * 				an intruder has been detected if the photoresistor is active, it has gone away if it is delayed
+ * @param   	photoresistor: reference to the photoresistor variable
+ */
+void photoresistor_watchdog(TPhotoresistor *photoresistor) {
+	if (photoresistor->state == ALARM_STATE_ACTIVE || photoresistor->state == ALARM_STATE_DELAYED) {
+		photoresistor->events++;
+	}
+	if (photoresistor->state == ALARM_STATE_DELAYED) {
+		photoresistor_event(photoresistor, ALARM_EVENT_CLEAR);
+	} else {
+		photoresistor_event(photoresistor, ALARM_EVENT_TRIGGER);
+	}
+}
+
+/*
+ * @fn 			static void photoresistor_alarm_expired(void *context)
+ * @brief  	 	callback of the alarm timer. When the delay has passed the alarm starts,
+ * 				when the duration of the alarm has passed the photoresistor goes back to active
+ * @param   	context: reference to the photoresistor variable
+ */
+static void photoresistor_alarm_expired(void *context) {
+	photoresistor_event(context, ALARM_EVENT_TIMEOUT);
+}
+
+/*
+ * @fn 			static uint16_t photoresistor_margin(TPhotoresistor *photoresistor, uint16_t margin)
+ * @brief  	 	returns a margin over the baseline, shrunk in proportion to the room left above the baseline
+ * 				when it is less than above the initial baseline
+ */
+static uint16_t photoresistor_margin(TPhotoresistor *photoresistor, uint16_t margin) {
+	uint32_t baseline = photoresistor->baseline >> PHOTORESISTOR_BASELINE_SHIFT;
+	uint32_t room = (baseline < PHOTORESISTOR_ADC_MAX) ? PHOTORESISTOR_ADC_MAX - baseline : 0;
+	uint32_t scaled = margin * room / (PHOTORESISTOR_ADC_MAX - PHOTORESISTOR_INITIAL_BASELINE);
+
+	return (scaled < margin) ? scaled : margin;
+}
+
+/*
+ * @fn 			static uint16_t photoresistor_threshold(TPhotoresistor *photoresistor, uint16_t margin)
+ * @brief  	 	returns the baseline plus a margin, scaled to the room left up to the top of the ADC
+ */
+static uint16_t photoresistor_threshold(TPhotoresistor *photoresistor, uint16_t margin) {
+	uint32_t threshold = (photoresistor->baseline >> PHOTORESISTOR_BASELINE_SHIFT)
+			+ photoresistor_margin(photoresistor, margin);
+	return (threshold > PHOTORESISTOR_ADC_MAX) ? PHOTORESISTOR_ADC_MAX : threshold;
+}
+
+/*
+ * @fn 			static void photoresistor_track_baseline(TPhotoresistor *photoresistor, uint16_t value)
+ * @brief  	 	moves the baseline towards a filtered value, only while the photoresistor is active.
+ * 				The first value after the start of the sampling sets the baseline. The detection threshold
+ * 				is reprogrammed only when it moves by PHOTORESISTOR_THRESHOLD_STEP. The barrier window fault
+ * 				tells if the dark margin left by the baseline is too narrow
+ */
+static void photoresistor_track_baseline(TPhotoresistor *photoresistor, uint16_t value) {
+	if (photoresistor->state != ALARM_STATE_ACTIVE) {
+		return;
+	}
+	if (!photoresistor->baseline_primed) {
+		photoresistor->baseline = (uint32_t) value << PHOTORESISTOR_BASELINE_SHIFT;
+		photoresistor->baseline_primed = TRUE;
+	} else {
+		// the sum wraps around the same way whether the value is above or below the baseline
+		photoresistor->baseline += value - (photoresistor->baseline >> PHOTORESISTOR_BASELINE_SHIFT);
+	}
+
+	if (photoresistor_margin(photoresistor, PHOTORESISTOR_DARK_MARGIN) < PHOTORESISTOR_MIN_DARK_MARGIN) {
+		health_raise(HEALTH_FAULT_BARRIER_WINDOW, photoresistor->index);
+	} else {
+		health_clear(HEALTH_FAULT_BARRIER_WINDOW, photoresistor->index);
+	}
+
+	uint16_t high = photoresistor_threshold(photoresistor, PHOTORESISTOR_DARK_MARGIN);
+	if (abs((int32_t) high - photoresistor->window_high) >= PHOTORESISTOR_THRESHOLD_STEP) {
+		// the state may change from the interrupts, the window of another state must not be touched
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		if (photoresistor->state == ALARM_STATE_ACTIVE) {
+			photoresistor_set_window(photoresistor, 0, high);
+		}
+		__set_PRIMASK(primask);
+	}
+}
+
+/*
+ * @fn 			static bool photoresistor_watchdog_usable(TPhotoresistor *photoresistor)
+ * @brief  	 	tells if the hardware watchdog can watch the raw conversions: not while the flicker is strong,
+ * 				since they swing with the lamps, and not in lock-in mode, since they swing with the emitter
+ */
+static bool photoresistor_watchdog_usable(TPhotoresistor *photoresistor) {
+	return photoresistor->flicker < PHOTORESISTOR_FLICKER_MIN && !photoresistor->lockin_on;
+}
+
+/*
+ * @fn 			static void photoresistor_arm_watchdog(TPhotoresistor *photoresistor)
+ * @brief  	 	unmasks the interrupt of the hardware watchdog of the critical channel if it can be used,
+ * 				masks it otherwise
+ */
+static void photoresistor_arm_watchdog(TPhotoresistor *photoresistor) {
+	if (!photoresistor->critical) {
+		return;
+	}
+	if (photoresistor_watchdog_usable(photoresistor)) {
+		__HAL_ADC_ENABLE_IT(photoresistor->hadc, ADC_IT_AWD);
+	} else {
+		__HAL_ADC_DISABLE_IT(photoresistor->hadc, ADC_IT_AWD);
+	}
+}
+
+/*
+ * @fn 			static bool photoresistor_is_flicker(TPhotoresistor *photoresistor, const int16_t *filtered,
+ * 					uint16_t length)
+ * @brief  	 	tells if the values of a block leaving the window are explained by the flicker:
+ * 				it is strong and the mean of the block is still inside the window
+ */
+static bool photoresistor_is_flicker(TPhotoresistor *photoresistor, const int16_t *filtered, uint16_t length) {
+	int32_t sum = 0;
+	uint16_t mean;
+
+	if (photoresistor->flicker < PHOTORESISTOR_FLICKER_MIN) {
+		return FALSE;
+	}
+	for (uint16_t i = 0; i < length; i++) {
+		sum += filtered[i];
+	}
+	mean = Q15_FILTER_TO_ADC(sum / length);
+	return mean >= photoresistor->window_low && mean <= photoresistor->window_high;
+}
+
+/*
+ * @fn 			static void photoresistor_check(TPhotoresistor *photoresistor, const uint16_t *values, uint16_t length,
+ * 					uint8_t bits, TLight_history_unit unit)
+ * @brief  	 	filters the values of a block, and handles every filtered value outside the window as a hit
+ * 				of the ADC watchdog, unless the flicker explains it
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	values: the values, the samples of the block or the loss of the emitter in lock-in mode
+ * @param   	length: number of values, at most ADC_STREAM_BLOCK_SIZE
+ * @param   	bits: resolution of the values, with the full scale of the ADC shifted by the extra bits
+ * @param   	unit: what the values measure, the last filtered one is folded into the history with it
+ */
+static void photoresistor_check(TPhotoresistor *photoresistor, const uint16_t *values, uint16_t length,
+		uint8_t bits, TLight_history_unit unit) {
+	int16_t filtered[ADC_STREAM_BLOCK_SIZE];
+	int32_t outside;
+	uint16_t start = 0;
+
+	q15_filter_set_resolution(&photoresistor->filter, bits);
+	q15_filter_block(&photoresistor->filter, values, filtered, length);
+	photoresistor_track_baseline(photoresistor, Q15_FILTER_TO_ADC(filtered[length - 1U]));
+
+	// the window in Q15 holds all the values falling inside the window of the ADC after the shift back
+	if (q15_filter_find_outside(filtered, length, Q15_FILTER_FROM_ADC(photoresistor->window_low),
+			Q15_FILTER_FROM_ADC(photoresistor->window_high) | 7) >= 0
+			&& photoresistor_is_flicker(photoresistor, filtered, length)) {
+		photoresistor->flicker_rejects++;
+		start = length;
+	}
+	while (start < length && (outside = q15_filter_find_outside(&filtered[start], length - start,
+			Q15_FILTER_FROM_ADC(photoresistor->window_low), Q15_FILTER_FROM_ADC(photoresistor->window_high) | 7)) >= 0) {
+		// the state machine is also driven by the interrupts
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		photoresistor_watchdog(photoresistor);
+		__set_PRIMASK(primask);
+		start += outside + 1;
+	}
+	photoresistor->value = Q15_FILTER_TO_ADC(filtered[length - 1U]);
+	if (photoresistor->history != NULL) {
+		light_history_add(photoresistor->history, photoresistor->value, unit);
+	}
+}
+
+/*
+ * @fn 			static void photoresistor_block(void *context, const uint16_t *samples, uint16_t length)
+ * @brief  	 	consumer of the ADC stream, called by the main loop for every block of samples
+ * 				while the photoresistor is active or delayed. The samples are checked against the window,
+ * 				in lock-in mode the loss of the emitter measured on them.
+ * 				A block stuck at the limits of the ADC means a broken or shorted photoresistor.
+ * 				An oversampled channel gives fewer samples with more bits, with the same full scale in Q15.
+ * 				The raw samples feed the flicker bank, the filters would smooth the flicker away.
+ * 				The samples checked are corrected by the calibration, the loss of the emitter is a ratio
+ * 				and needs no correction
+ * @param   	context: reference to the photoresistor variable
+ * @param   	samples: the block of samples
+ * @param   	length: number of samples of the block, at most ADC_STREAM_BLOCK_SIZE
+ */
+static void photoresistor_block(void *context, const uint16_t *samples, uint16_t length) {
+	TPhotoresistor *photoresistor = context;
+	TAdc_calibration *calibration = photoresistor->calibration;
+	uint8_t extra_bits = adc_stream_get_bits(photoresistor->stream, photoresistor->index) - ADC_STREAM_RESOLUTION;
+	uint16_t corrected[ADC_STREAM_BLOCK_SIZE];
+	uint32_t sum = 0;
+
+	// the rate and the oversampling can be changed from the shell at any time
+	goertzel_set_rate(&photoresistor->flicker_bank, photoresistor->stream->rate >> (2U * extra_bits));
+	if (goertzel_block(&photoresistor->flicker_bank, samples, length)) {
+		photoresistor->flicker = goertzel_get_peak(&photoresistor->flicker_bank) >> extra_bits;
+		photoresistor_arm_watchdog(photoresistor);
+	}
+
+	// in lock-in mode a window of the detector gives a single value, the share of the emitter lost
+	if (photoresistor->lockin_on && extra_bits == 0) {
+		if (lockin_block(photoresistor->lockin, samples, length)) {
+			uint16_t loss = lockin_get_loss(photoresistor->lockin, PHOTORESISTOR_ADC_MAX);
+			photoresistor_check(photoresistor, &loss, 1, ADC_STREAM_RESOLUTION, LIGHT_HISTORY_LOSS);
+		}
+	} else if (calibration != NULL) {
+		adc_calibration_apply_block(calibration, samples, corrected, length, PHOTORESISTOR_ADC_MAX << extra_bits);
+		photoresistor_check(photoresistor, corrected, length, ADC_STREAM_RESOLUTION + extra_bits,
+				LIGHT_HISTORY_LEVEL);
+	} else {
+		photoresistor_check(photoresistor, samples, length, ADC_STREAM_RESOLUTION + extra_bits, LIGHT_HISTORY_LEVEL);
+	}
+
+	// the watchdog compares the raw conversions, its thresholds follow the correction
+	if (calibration != NULL && calibration->updates != photoresistor->calibration_updates) {
+		photoresistor->calibration_updates = calibration->updates;
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		photoresistor_set_window(photoresistor, photoresistor->window_low, photoresistor->window_high);
+		__set_PRIMASK(primask);
+	}
+
+	for (uint16_t i = 0; i < length; i++) {
+		sum += samples[i];
+	}
+
+	// the mean of the raw samples is 0 or PHOTORESISTOR_ADC_MAX only if all of them are
+	sum /= length;
+	if (sum == 0 || sum >= (PHOTORESISTOR_ADC_MAX << extra_bits)) {
+		if (++photoresistor->saturated_blocks == PHOTORESISTOR_SATURATION_BLOCKS) {
+			health_raise(HEALTH_FAULT_ADC_SATURATED, photoresistor->index);
+		}
+	} else if (photoresistor->saturated_blocks != 0) {
+		photoresistor->saturated_blocks = 0;
+		health_clear(HEALTH_FAULT_ADC_SATURATED, photoresistor->index);
+	}
+}
+
+/*
+ * @fn 			static void photoresistor_stop_timer(void *sensor)
+ * @brief  	 	action: stops the delay or the duration of the alarm
+ */
+static void photoresistor_stop_timer(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	timer_wheel_cancel(&photoresistor->alarm_timer);
+}
+
+/*
+ * @fn 			static void photoresistor_start_delay(void *sensor)
+ * @brief  	 	action: starts the delay before the alarm
+ */
+static void photoresistor_start_delay(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	timer_wheel_start(&photoresistor->alarm_timer, photoresistor->alarm_delay, 0);
+}
+
+/*
+ * @fn 			static void photoresistor_start_duration(void *sensor)
+ * @brief  	 	action: starts the duration of the alarm
+ */
+static void photoresistor_start_duration(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	timer_wheel_start(&photoresistor->alarm_timer, photoresistor->alarm_duration, 0);
+}
+
+/*
+ * @fn 			static void photoresistor_set_window(TPhotoresistor *photoresistor, uint16_t low, uint16_t high)
+ * @brief  	 	sets the window checked on the filtered values. If the photoresistor is critical,
+ * 				the thresholds of the ADC watchdog are kept equal, in raw conversions if they are corrected
+ */
+static void photoresistor_set_window(TPhotoresistor *photoresistor, uint16_t low, uint16_t high) {
+	TAdc_calibration *calibration = photoresistor->calibration;
+
+	photoresistor->window_low = low;
+	photoresistor->window_high = high;
+	if (photoresistor->critical) {
+		photoresistor->hadc->Instance->HTR = (calibration == NULL || high == PHOTORESISTOR_ADC_MAX) ? high
+				: adc_calibration_to_raw(calibration, high, PHOTORESISTOR_ADC_MAX);
+		photoresistor->hadc->Instance->LTR = (calibration == NULL) ? low
+				: adc_calibration_to_raw(calibration, low, PHOTORESISTOR_ADC_MAX);
+	}
+}
+
+/*
+ * @fn 			static void photoresistor_watch_dark(void *sensor)
+ * @brief  	 	action: sets the window of the ADC watchdog to detect an intruder
+ */
+static void photoresistor_watch_dark(void *sensor) {
+	//detect low light level (with the high threshold) and
+	//ignore high light level (with the low threshold) in order to detect an intruder
+	photoresistor_set_window(sensor, 0, photoresistor_threshold(sensor, PHOTORESISTOR_DARK_MARGIN));
+}
+
+/*
+ * @fn 			static void photoresistor_watch_light(void *sensor)
+ * @brief  	 	action: sets the window of the ADC watchdog to detect that the intruder has gone away
+ */
+static void photoresistor_watch_light(void *sensor) {
+	// ignore low light level (high threshold) because now we want to check
+	// if the intruder go away (photoresistor read the low threshold) before that the state change to alarmed
+	photoresistor_set_window(sensor, photoresistor_threshold(sensor, PHOTORESISTOR_LIGHT_MARGIN), PHOTORESISTOR_ADC_MAX);
+}
+
+/*
+ * @fn 			static void photoresistor_watch_none(void *sensor)
+ * @brief  	 	action: opens the window of the ADC watchdog, so it never fires
+ */
+static void photoresistor_watch_none(void *sensor) {
+	// here with both the thresholds we ignore both low and high value of light beacuase
+	// we are in alarmed state so the intruder is detected
+	photoresistor_set_window(sensor, 0, PHOTORESISTOR_ADC_MAX);
+}
+
+/*
+ * @fn 			static void photoresistor_start_sampling(void *sensor)
+ * @brief  	 	action: starts the stream of conversions of the ADC, triggered by its timer
+ */
+static void photoresistor_start_sampling(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+
+	// the filter starts again from the first sample of the stream, its old history is stale,
+	// and the baseline from the first block, the ambient light may have changed while not sampling
+	if (!adc_stream_is_started(photoresistor->stream, photoresistor->index)) {
+		q15_filter_reset(&photoresistor->filter);
+		goertzel_reset(&photoresistor->flicker_bank);
+		if (photoresistor->lockin_on) {
+			lockin_reset(photoresistor->lockin);
+		}
+		photoresistor->baseline_primed = FALSE;
+	}
+	adc_stream_start(photoresistor->stream, photoresistor->index);
+}
+
+/*
+ * @fn 			static void photoresistor_stop_sampling(void *sensor)
+ * @brief  	 	action: stops the stream of conversions of the ADC
+ */
+static void photoresistor_stop_sampling(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	adc_stream_stop(photoresistor->stream, photoresistor->index);
+}
+
+/*
+ * @fn 			static void photoresistor_sound(void *sensor)
+ * @brief  	 	action: adds the pulse of the photoresistor to the buzzer
+ */
+static void photoresistor_sound(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	photoresistor->alarms++;
+	buzzer_increase_pulse(photoresistor->buzzer, buzzer_short_pulse());
+}
+
+/*
+ * @fn 			static void photoresistor_silence(void *sensor)
+ * @brief  	 	action: removes the pulse of the photoresistor from the buzzer
+ */
+static void photoresistor_silence(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	buzzer_decrease_pulse(photoresistor->buzzer, buzzer_short_pulse());
+}
+
+/*
+ * @fn 			static void photoresistor_op_activate(void *sensor)
+ * @brief  	 	operation activate of the sensor registry
+ */
+static void photoresistor_op_activate(void *sensor) {
+	photoresistor_activate(sensor);
+}
+
+/*
+ * @fn 			static void photoresistor_op_deactivate(void *sensor)
+ * @brief  	 	operation deactivate of the sensor registry
+ */
+static void photoresistor_op_deactivate(void *sensor) {
+	photoresistor_deactivate(sensor);
+}
+
+/*
+ * @fn 			static TAlarmState photoresistor_op_state(void *sensor)
+ * @brief  	 	operation state of the sensor registry
+ */
+static TAlarmState photoresistor_op_state(void *sensor) {
+	TPhotoresistor *photoresistor = sensor;
+	return photoresistor->state;
+}
+
+/*
+ * @fn 			static void photoresistor_op_stats(void *sensor, TSensor_stats *stats)
+ * @brief  	 	operation stats of the sensor registry: the events are the hits of the ADC watchdog
+ */
+static void photoresistor_op_stats(void *sensor, TSensor_stats *stats) {
+	TPhotoresistor *photoresistor = sensor;
+	stats->events = photoresistor->events;
+	stats->alarms = photoresistor->alarms;
+	stats->duty = 0;
+	stats->rate = 0;
+	stats->peak_rate = 0;
+	stats->storms = 0;
+}
+
+/*
+ * @fn 			static void photoresistor_op_set_timing(void *sensor, uint32_t delay, uint32_t duration)
+ * @brief  	 	operation set_timing of the sensor registry: the delay and the duration of the next alarms
+ */
+static void photoresistor_op_set_timing(void *sensor, uint32_t delay, uint32_t duration) {
+	TPhotoresistor *photoresistor = sensor;
+	photoresistor->alarm_delay = (delay == 0) ? NO_DELAY : delay;
+	photoresistor->alarm_duration = duration;
+}
+
+/*
+ * @fn 			static void photoresistor_op_signal(void *sensor, void *source)
+ * @brief  	 	operation signal of the sensor registry: handles the ADC watchdog of the ADC of the photoresistor,
+ * 				that watches only the critical one
+ */
+static void photoresistor_op_signal(void *sensor, void *source) {
+	TPhotoresistor *photoresistor = sensor;
+
+	if (source == photoresistor->hadc && photoresistor->critical) {
+		photoresistor_watchdog(photoresistor);
+	}
 }
 
 /*
@@ -76,3 +737,53 @@ void photoresistor_get_string_state(TPhotoresistor *photoresistor,
 		break;
 	}
 }
+
+static void photoresistor_flicker_command(TShell *shell, void *context, char *args) {
+	TPhotoresistor *photoresistor = context;
+	TGoertzel *bank = &photoresistor->flicker_bank;
+
+	shell_print(shell, "rate %lu Hz, window of %u inputs, averaged by %u, %lu windows\r\n", bank->rate, bank->length,
+			bank->decimation, bank->windows);
+	for (uint8_t bin = 0; bin < bank->bins_n; bin++) {
+		shell_print(shell, "  %u Hz: %u\r\n", bank->frequencies[bin], bank->amplitudes[bin]);
+	}
+	shell_print(shell, "mean %u, flicker %u of %u, %lu blocks rejected, watchdog %s\r\n", bank->mean,
+			photoresistor->flicker, PHOTORESISTOR_FLICKER_MIN, photoresistor->flicker_rejects,
+			!photoresistor->critical ? "not used" : photoresistor_watchdog_usable(photoresistor) ? "armed" : "masked");
+}
+
+static void photoresistor_lockin_command(TShell *shell, void *context, char *args) {
+	TPhotoresistor *photoresistor = context;
+	TLockin *lockin = photoresistor->lockin;
+	char *mode = shell_next_token(&args);
+
+	if (mode != NULL) {
+		if ((strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)
+				|| photoresistor_use_lockin(photoresistor, strcmp(mode, "on") == 0) != PHOTORESISTOR_OK) {
+			shell_print(shell, "Usage: lockin [on|off], with an emitter attached\r\n");
+			return;
+		}
+	}
+	if (lockin == NULL) {
+		shell_print(shell, "no emitter attached\r\n");
+		return;
+	}
+	shell_print(shell, "lock-in %s, emitter at %lu Hz, %u samples per period\r\n",
+			photoresistor->lockin_on ? "on" : "off", photoresistor->stream->rate / lockin->period, lockin->period);
+	shell_print(shell, "amplitude %u, reference %u, loss %u, %lu windows\r\n", lockin->amplitude, lockin->reference,
+			lockin_get_loss(lockin, PHOTORESISTOR_ADC_MAX), lockin->windows);
+}
+
+/*
+ * @fn 			void photoresistor_register_commands(TPhotoresistor *photoresistor, TShell *shell)
+ * @brief  	 	adds to the shell the command flicker, that shows the flicker measured on the photoresistor,
+ * 				and the command lockin [on|off], that shows and optionally changes the lock-in mode
+ * @param   	photoresistor: reference to the photoresistor variable
+ * @param   	shell: reference to the shell
+ */
+void photoresistor_register_commands(TPhotoresistor *photoresistor, TShell *shell) {
+	shell_register_command(shell, "flicker", "shows the flicker of the lamps measured on the barrier",
+			photoresistor_flicker_command, photoresistor);
+	shell_register_command(shell, "lockin", "[on|off] shows the emitter of the barrier, and turns the lock-in mode"
+			" on or off", photoresistor_lockin_command, photoresistor);
+}
@@ -0,0 +1,102 @@
+/*
+ * This module groups up to PIR_ARRAY_ZONES_N PIR sensors in zones, one for each EXTI line.
+ * Every zone has its own delay and duration, and the zone of a pin is found in constant time through a table
+ * indexed by the line number, the same number used by the EXTI dispatcher to call the handler of the zone.
+ * The zones don't own a hardware timer: their delays, alarm durations and storm hold-offs are software timers
+ * of the timing wheel, all driven by the SysTick.
+ * The zones are activated, polled and reported through the sensor registry, where each one is added as a sensor.
+ */
+
+#include "pir_array.h"
+
+/*
+ * @fn		void PIR_array_init(TPIR_array *array)
+ * @brief	Initializes an array without zones
+ * @param	array	pointer to the TPIR_array structure to initialize
+ */
+void PIR_array_init(TPIR_array *array) {
+	memset(array->zone_of_line, PIR_ARRAY_NO_ZONE, sizeof(array->zone_of_line));
+	array->zones_n = 0;
+}
+
+/*
+ * @fn		int PIR_array_add(TPIR_array *array, uint32_t delay, uint32_t alarm_duration,
+ * 				IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer)
+ * @brief	Adds a zone, inactive, with a sensor on the given pin
+ * @param	array			pointer to the TPIR_array structure
+ * @param	delay			the alarm delay of the zone in milliseconds
+ * @param	alarm_duration	for how much time in milliseconds the zone will be in alarm state
+ * @param	irq				the irq of the line of the pin
+ * @param	port			the port which the sensor is connected to
+ * @param	pin				the pin which the sensor is connected to
+ * @param	buzzer			the buzzer associated to the zone
+ * @retval	PIR_ARRAY_ERR_INVALID if pin is not a single pin,
+ * 			PIR_ARRAY_ERR_BUSY if the line of the pin already has a zone,
+ * 			the index of the zone otherwise
+ */
+int PIR_array_add(TPIR_array *array, uint32_t delay, uint32_t alarm_duration,
+		IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer) {
+	if (pin == 0 || (pin & (pin - 1U)) != 0) {
+		return PIR_ARRAY_ERR_INVALID;
+	}
+
+	uint8_t line = __builtin_ctz(pin);
+	if (array->zone_of_line[line] != PIR_ARRAY_NO_ZONE) {
+		return PIR_ARRAY_ERR_BUSY;
+	}
+
+	// the lines are unique, so there is always room for the new zone
+	uint8_t zone = array->zones_n;
+	TPIR_sensor *pir = &array->zones[zone];
+
+	PIR_sensor_init(pir, delay, alarm_duration, irq, port, pin, buzzer);
+
+	array->zone_of_line[line] = zone;
+	array->zones_n++;
+	return zone;
+}
+
+/*
+ * @fn		TPIR_sensor* PIR_array_get_zone(TPIR_array *array, uint16_t pin)
+ * @brief	Returns the zone of a pin
+ * @param	array	pointer to the TPIR_array structure
+ * @param	pin		the pin, one of GPIO_PIN_0 ... GPIO_PIN_15
+ * @retval	the sensor of the zone, NULL if the line of the pin has no zone
+ */
+TPIR_sensor* PIR_array_get_zone(TPIR_array *array, uint16_t pin) {
+	if (pin == 0) {
+		return NULL;
+	}
+
+	uint8_t zone = array->zone_of_line[__builtin_ctz(pin)];
+	return (zone == PIR_ARRAY_NO_ZONE) ? NULL : &array->zones[zone];
+}
+
+static void PIR_array_command(TShell *shell, void *context, char *args) {
+	TPIR_array *array = context;
+
+	shell_print(shell, "%-5s %-5s %-9s %8s %9s %9s %10s %7s %6s %7s\r\n", "zone", "line", "state", "delay ms", "alarm ms",
+			"edges", "peak/s", "storms", "duty%", "ev/min");
+	for (uint8_t zone = 0; zone < array->zones_n; zone++) {
+		TPIR_sensor *pir = &array->zones[zone];
+		char state[10] = { '\0' };
+		uint16_t duty = PIR_sensor_get_duty(pir);
+
+		PIR_get_string_state(pir, state);
+		shell_print(shell, "%-5u %-5u %-9s %8lu %9lu %9lu %10lu %7lu %4u.%u %7lu%s\r\n", zone, __builtin_ctz(pir->pin),
+				state, pir->alarm_delay, pir->alarm_duration, pir->edges,
+				(uint32_t) pir->peak_edges * 1000U / PIR_STORM_WINDOW, pir->storms, duty / 10U, duty % 10U,
+				pir->event_rate * 60000U / (PIR_ACTIVITY_PERIOD * PIR_ACTIVITY_WINDOW), pir->storming ? " masked" : "");
+	}
+}
+
+/*
+ * @fn		void PIR_array_register_commands(TPIR_array *array, TShell *shell)
+ * @brief	Adds to the shell the command zones, that shows the line, the state, the delay, the duration,
+ * 			the interrupt rate and the activity of every zone
+ * @param	array	pointer to the TPIR_array structure
+ * @param	shell	pointer to the TShell structure
+ */
+void PIR_array_register_commands(TPIR_array *array, TShell *shell) {
+	shell_register_command(shell, "zones", "shows the state of the PIR zones", PIR_array_command, array);
+}
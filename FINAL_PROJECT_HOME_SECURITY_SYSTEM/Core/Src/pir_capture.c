@@ -0,0 +1,247 @@
+/*
+ * This module timestamps the edges of the PIR output with a timer in input capture mode.
+ * The output is connected to the channel 2 of the timer, and it is captured twice: the rising edges by the channel 1
+ * (mapped on the same input) and the falling edges by the channel 2. So the direction of every edge is given
+ * by the hardware, and it is never guessed by reading the pin after the edge.
+ * Every capture is moved by the DMA into a circular ring: the firmware reads the edges in batches with
+ * PIR_capture_next_edge(), merged in time order, and gets the exact pulse widths and gaps.
+ * The DMA interrupts only at every half of a ring, to count the edges written. When more edges than a ring holds
+ * come between two reads, the oldest ones are overwritten: they are skipped and counted as lost.
+ * Every capture also raises the interrupt of the timer, which does nothing but wake the sleep of the main loop,
+ * so the main loop can sleep while the rings hold no edges to read.
+ * A tap can receive every edge as it is read, as the raw stream does.
+ */
+
+#include "pir_capture.h"
+
+/* The capture whose DMA streams are running, for their interrupts */
+static TPIR_capture *running_capture = NULL;
+
+/*
+ * @fn		static uint16_t PIR_capture_head(DMA_HandleTypeDef *hdma)
+ * @brief	Returns the index of the ring the DMA will write next
+ */
+static uint16_t PIR_capture_head(DMA_HandleTypeDef *hdma) {
+	return (PIR_CAPTURE_RING_SIZE - __HAL_DMA_GET_COUNTER(hdma)) & (PIR_CAPTURE_RING_SIZE - 1U);
+}
+
+/*
+ * @fn		static void PIR_capture_half_written(DMA_HandleTypeDef *hdma)
+ * @brief	Callback of the DMA, at the half and at the end of a ring: counts the edges written
+ */
+static void PIR_capture_half_written(DMA_HandleTypeDef *hdma) {
+	if (hdma == running_capture->htim->hdma[TIM_DMA_ID_CC1]) {
+		running_capture->rising_written += PIR_CAPTURE_RING_SIZE / 2U;
+	} else {
+		running_capture->falling_written += PIR_CAPTURE_RING_SIZE / 2U;
+	}
+}
+
+/*
+ * @fn		static uint32_t PIR_capture_written(DMA_HandleTypeDef *hdma, volatile uint32_t *written)
+ * @brief	Returns the number of edges written in a ring since the start
+ * @param	hdma		the DMA stream of the ring
+ * @param	written		the edges counted by the interrupts of the stream
+ */
+static uint32_t PIR_capture_written(DMA_HandleTypeDef *hdma, volatile uint32_t *written) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t head = PIR_capture_head(hdma);
+	uint32_t counted = *written;
+	__set_PRIMASK(primask);
+
+	// the interrupt of the last half may still be pending, the head tells how far the DMA went after the count
+	return counted + ((head - counted) & (PIR_CAPTURE_RING_SIZE - 1U));
+}
+
+/*
+ * @fn		static bool PIR_capture_pending(TPIR_capture *capture, DMA_HandleTypeDef *hdma,
+ * 				volatile uint32_t *written, uint32_t *read)
+ * @brief	Tells if a ring holds edges not read yet. If the DMA overwrote some of them, they are skipped and counted
+ */
+static bool PIR_capture_pending(TPIR_capture *capture, DMA_HandleTypeDef *hdma, volatile uint32_t *written,
+		uint32_t *read) {
+	uint32_t total = PIR_capture_written(hdma, written);
+
+	if (total - *read > PIR_CAPTURE_RING_SIZE) {
+		capture->lost += total - *read - PIR_CAPTURE_RING_SIZE;
+		*read = total - PIR_CAPTURE_RING_SIZE;
+	}
+	return total != *read;
+}
+
+/*
+ * @fn		void PIR_capture_init(TPIR_capture *capture, TIM_HandleTypeDef *htim)
+ * @brief	Initializes the capture, without starting it
+ * @param	capture		pointer to the TPIR_capture structure to initialize
+ * @param	htim		the timer, with the DMA streams of the channels 1 and 2 linked to it
+ */
+void PIR_capture_init(TPIR_capture *capture, TIM_HandleTypeDef *htim) {
+	capture->htim = htim;
+	capture->rising_written = 0;
+	capture->falling_written = 0;
+	capture->rising_read = 0;
+	capture->falling_read = 0;
+	capture->edges = 0;
+	capture->lost = 0;
+	capture->last_rising = 0;
+	capture->last_falling = 0;
+	capture->pulse_width = 0;
+	capture->gap = 0;
+	capture->min_pulse_width = UINT32_MAX;
+	capture->max_pulse_width = 0;
+	capture->tap = NULL;
+	capture->tap_context = NULL;
+}
+
+/*
+ * @fn		void PIR_capture_start(TPIR_capture *capture)
+ * @brief	Starts the timer and the DMA streams filling the rings. Only one capture can run at a time
+ * @param	capture		pointer to the TPIR_capture structure
+ */
+void PIR_capture_start(TPIR_capture *capture) {
+	TIM_HandleTypeDef *htim = capture->htim;
+
+	capture->rising_written = 0;
+	capture->falling_written = 0;
+	capture->rising_read = 0;
+	capture->falling_read = 0;
+	running_capture = capture;
+
+	// the rings are polled, the interrupts at every half of a ring only count the edges written
+	for (uint8_t id = TIM_DMA_ID_CC1; id <= TIM_DMA_ID_CC2; id++) {
+		htim->hdma[id]->XferHalfCpltCallback = PIR_capture_half_written;
+		htim->hdma[id]->XferCpltCallback = PIR_capture_half_written;
+		htim->hdma[id]->XferErrorCallback = NULL;
+	}
+	HAL_DMA_Start_IT(htim->hdma[TIM_DMA_ID_CC1], (uint32_t) &htim->Instance->CCR1, (uint32_t) capture->rising,
+			PIR_CAPTURE_RING_SIZE);
+	HAL_DMA_Start_IT(htim->hdma[TIM_DMA_ID_CC2], (uint32_t) &htim->Instance->CCR2, (uint32_t) capture->falling,
+			PIR_CAPTURE_RING_SIZE);
+
+	__HAL_TIM_ENABLE_DMA(htim, TIM_DMA_CC1 | TIM_DMA_CC2);
+	// the DMA reads the captures and clears their flags, but the interrupt stays pending and wakes the sleep
+	__HAL_TIM_ENABLE_IT(htim, TIM_IT_CC1 | TIM_IT_CC2);
+	TIM_CCxChannelCmd(htim->Instance, TIM_CHANNEL_1, TIM_CCx_ENABLE);
+	TIM_CCxChannelCmd(htim->Instance, TIM_CHANNEL_2, TIM_CCx_ENABLE);
+	__HAL_TIM_ENABLE(htim);
+}
+
+/*
+ * @fn		bool PIR_capture_next_edge(TPIR_capture *capture, bool *rising, uint32_t *time)
+ * @brief	Reads the oldest edge not read yet, updating the pulse statistics. The edges lost since the last call
+ * 			are skipped and counted
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	rising		set to TRUE if the edge is rising, FALSE if it is falling
+ * @param	time		set to the timestamp of the edge in microseconds
+ * @retval	TRUE if an edge has been read, FALSE if there are no new edges
+ */
+bool PIR_capture_next_edge(TPIR_capture *capture, bool *rising, uint32_t *time) {
+	bool has_rising = PIR_capture_pending(capture, capture->htim->hdma[TIM_DMA_ID_CC1], &capture->rising_written,
+			&capture->rising_read);
+	bool has_falling = PIR_capture_pending(capture, capture->htim->hdma[TIM_DMA_ID_CC2], &capture->falling_written,
+			&capture->falling_read);
+	uint16_t rising_tail = capture->rising_read & (PIR_CAPTURE_RING_SIZE - 1U);
+	uint16_t falling_tail = capture->falling_read & (PIR_CAPTURE_RING_SIZE - 1U);
+
+	if (!has_rising && !has_falling) {
+		return FALSE;
+	}
+
+	// the edges of the two rings are merged in time order, even across the overflow of the counter
+	if (has_rising && (!has_falling || (int32_t) (capture->rising[rising_tail] - capture->falling[falling_tail]) < 0)) {
+		*rising = TRUE;
+		*time = capture->rising[rising_tail];
+		capture->rising_read++;
+
+		if (capture->edges > 0) {
+			capture->gap = *time - capture->last_falling;
+		}
+		capture->last_rising = *time;
+	} else {
+		*rising = FALSE;
+		*time = capture->falling[falling_tail];
+		capture->falling_read++;
+
+		if (capture->edges > 0) {
+			capture->pulse_width = *time - capture->last_rising;
+			if (capture->pulse_width < capture->min_pulse_width) {
+				capture->min_pulse_width = capture->pulse_width;
+			}
+			if (capture->pulse_width > capture->max_pulse_width) {
+				capture->max_pulse_width = capture->pulse_width;
+			}
+		}
+		capture->last_falling = *time;
+	}
+
+	capture->edges++;
+	if (capture->tap != NULL) {
+		capture->tap(capture->tap_context, *rising, *time);
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		uint32_t PIR_capture_to_tick(TPIR_capture *capture, uint32_t time)
+ * @brief	Converts the timestamp of an edge to the time base of HAL_GetTick(), going back from the current counter
+ * 			of the timer. The edge must be younger than a lap of the counter, about 71 minutes
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	time		the timestamp of the edge in microseconds
+ * @retval	the milliseconds of HAL_GetTick() at the edge
+ */
+uint32_t PIR_capture_to_tick(TPIR_capture *capture, uint32_t time) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t tick = HAL_GetTick();
+	uint32_t counter = __HAL_TIM_GET_COUNTER(capture->htim);
+	__set_PRIMASK(primask);
+
+	return tick - (counter - time) / PIR_CAPTURE_TICKS_PER_MS;
+}
+
+/*
+ * @fn		bool PIR_capture_has_edges(TPIR_capture *capture)
+ * @brief	Tells if the rings hold edges not read yet. Nothing is read or skipped
+ * @param	capture		pointer to the TPIR_capture structure
+ * @retval	TRUE if PIR_capture_next_edge() would read an edge, FALSE otherwise
+ */
+bool PIR_capture_has_edges(TPIR_capture *capture) {
+	return PIR_capture_written(capture->htim->hdma[TIM_DMA_ID_CC1], &capture->rising_written) != capture->rising_read
+			|| PIR_capture_written(capture->htim->hdma[TIM_DMA_ID_CC2], &capture->falling_written)
+					!= capture->falling_read;
+}
+
+/*
+ * @fn		void PIR_capture_set_tap(TPIR_capture *capture, TPIR_capture_tap tap, void *context)
+ * @brief	Hands every edge to a function as it is read by PIR_capture_next_edge()
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	tap			the function receiving the edges, NULL to remove it
+ * @param	context		the argument of the function
+ */
+void PIR_capture_set_tap(TPIR_capture *capture, TPIR_capture_tap tap, void *context) {
+	capture->tap = tap;
+	capture->tap_context = context;
+}
+
+static void PIR_capture_command(TShell *shell, void *context, char *args) {
+	TPIR_capture *capture = context;
+
+	shell_print(shell, "%lu edges, %lu lost, last pulse %lu us, last gap %lu us\r\n", capture->edges,
+			capture->lost, capture->pulse_width, capture->gap);
+	if (capture->max_pulse_width > 0) {
+		shell_print(shell, "pulses from %lu us to %lu us\r\n", capture->min_pulse_width,
+				capture->max_pulse_width);
+	}
+}
+
+/*
+ * @fn		void PIR_capture_register_commands(TPIR_capture *capture, TShell *shell)
+ * @brief	Adds to the shell the command pir, that shows the number of edges read and lost and the pulse statistics
+ * @param	capture		pointer to the TPIR_capture structure
+ * @param	shell		pointer to the TShell structure
+ */
+void PIR_capture_register_commands(TPIR_capture *capture, TShell *shell) {
+	shell_register_command(shell, "pir", "shows the edges captured and lost on the PIR output", PIR_capture_command,
+			capture);
+}
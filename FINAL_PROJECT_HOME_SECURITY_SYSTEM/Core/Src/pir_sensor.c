@@ -6,25 +6,136 @@
  */
 
 #include "pir_sensor.h"
+#include "logger.h"
+#include "health.h"
+
+extern TLogger logger;
+
+static void PIR_sensor_edge(TPIR_sensor *pir, bool rising);
+static bool PIR_sensor_admit_edge(TPIR_sensor *pir);
+static void PIR_timer_expired(void *context);
+static void PIR_storm_expired(void *context);
+static void PIR_activity_edge(TPIR_sensor *pir, bool rising, uint32_t now);
+static void PIR_activity_expired(void *context);
+
+/* Actions of the state machine of the sensor, indices in PIR_actions */
+enum {
+	PIR_ACTION_STOP_TIMER = ALARM_ACTION_END + 1,
+	PIR_ACTION_START_DELAY,
+	PIR_ACTION_START_DURATION,
+	PIR_ACTION_ENABLE_INPUT,
+	PIR_ACTION_DISABLE_INPUT,
+	PIR_ACTION_SOUND,
+	PIR_ACTION_SILENCE
+};
+
+static void PIR_stop_timer(void *sensor);
+static void PIR_start_delay(void *sensor);
+static void PIR_start_duration(void *sensor);
+static void PIR_enable_input(void *sensor);
+static void PIR_disable_input(void *sensor);
+static void PIR_sound(void *sensor);
+static void PIR_silence(void *sensor);
+
+static const TAlarm_action PIR_actions[] = {
+	[PIR_ACTION_STOP_TIMER] = PIR_stop_timer,
+	[PIR_ACTION_START_DELAY] = PIR_start_delay,
+	[PIR_ACTION_START_DURATION] = PIR_start_duration,
+	[PIR_ACTION_ENABLE_INPUT] = PIR_enable_input,
+	[PIR_ACTION_DISABLE_INPUT] = PIR_disable_input,
+	[PIR_ACTION_SOUND] = PIR_sound,
+	[PIR_ACTION_SILENCE] = PIR_silence
+};
+
+/*
+ * Transitions of the sensor. A rising edge of the output is a TRIGGER, a falling edge a CLEAR.
+ * The buzzer is silenced only when the sensor leaves the alarm, so a zone doesn't stop the alarm of another zone.
+ */
+static const TAlarm_transition PIR_transitions[ALARM_STATES_N][ALARM_EVENTS_N] = {
+	[ALARM_STATE_INACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_STATE_DELAYED, { PIR_ACTION_START_DELAY } },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ALARMED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE,
+				{ PIR_ACTION_STOP_TIMER, PIR_ACTION_SILENCE, PIR_ACTION_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE,
+				{ PIR_ACTION_STOP_TIMER, PIR_ACTION_SILENCE, PIR_ACTION_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_STATE_ACTIVE, { PIR_ACTION_SILENCE, PIR_ACTION_ENABLE_INPUT } }
+	},
+	[ALARM_STATE_DELAYED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_STATE_DELAYED, { PIR_ACTION_START_DELAY } },
+		[ALARM_EVENT_CLEAR] = { ALARM_STATE_ACTIVE, { PIR_ACTION_STOP_TIMER, PIR_ACTION_ENABLE_INPUT } },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_STATE_ALARMED, { PIR_ACTION_START_DURATION, PIR_ACTION_SOUND } }
+	}
+};
+
+static const TAlarm_fsm PIR_fsm = { PIR_transitions, PIR_actions };
+
+static void PIR_sensor_op_activate(void *sensor);
+static void PIR_sensor_op_deactivate(void *sensor);
+static void PIR_sensor_op_poll(void *sensor);
+static TAlarmState PIR_sensor_op_state(void *sensor);
+static void PIR_sensor_op_stats(void *sensor, TSensor_stats *stats);
+static void PIR_sensor_op_set_timing(void *sensor, uint32_t delay, uint32_t duration);
+static bool PIR_sensor_op_busy(void *sensor);
+
+const TSensor_ops PIR_sensor_ops = {
+	.activate = PIR_sensor_op_activate,
+	.deactivate = PIR_sensor_op_deactivate,
+	.poll = PIR_sensor_op_poll,
+	.state = PIR_sensor_op_state,
+	.stats = PIR_sensor_op_stats,
+	.signal = NULL,
+	.set_timing = PIR_sensor_op_set_timing,
+	.busy = PIR_sensor_op_busy
+};
+
+/**
+ * @fn		static void PIR_sensor_event(TPIR_sensor *pir, TAlarmEvent event)
+ * @brief	Executes an event on the state machine of the sensor
+ */
+static void PIR_sensor_event(TPIR_sensor *pir, TAlarmEvent event) {
+	alarm_fsm_dispatch(&PIR_fsm, &pir->state, event, pir);
+}
+
+/**
+ * @fn		static void PIR_exti_handler(uint16_t pin, void *context)
+ * @brief	Handler of the line of the sensor, registered in the EXTI dispatcher
+ */
+static void PIR_exti_handler(uint16_t pin, void *context) {
+	PIR_sensor_handler(context);
+}
 
 /**
- * @fn 		PIR_sensor_init(TPIR_sensor *pir, uint8_t delay, uint8_t alarm_duration,
-							IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin,
-							TIM_HandleTypeDef *timer, TBuzzer *buzzer)
+ * @fn 		PIR_sensor_init(TPIR_sensor *pir, uint32_t delay, uint32_t alarm_duration,
+							IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer)
  * @brief Initialize a pir sensor with the given parameters.
  * @param pir				the structure which will hold the sensor
- * @param delay				the alarm_delay in second. If zero, this will be set to NO_DELAY value
- * @param alarm_duration 	for how much time in seconds the sensor will be in alarm state
+ * @param delay				the alarm_delay in milliseconds. If zero, this will be set to NO_DELAY value
+ * @param alarm_duration 	for how much time in milliseconds the sensor will be in alarm state
  * @param irq		 		the irq corresponding to the port of the pir sensor
  * @param port				the port which the sensor is connected to
  * @param pin				the port which the sensor is connected to
- * @param timer 			the timer dedicated to the sensor
  * @param buzzer			the buzzer associated to the sensor
  * @retval None
  */
-void PIR_sensor_init(TPIR_sensor *pir, uint8_t delay, uint8_t alarm_duration,
-		IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin,
-		TIM_HandleTypeDef *timer, TBuzzer *buzzer) {
+void PIR_sensor_init(TPIR_sensor *pir, uint32_t delay, uint32_t alarm_duration,
+		IRQn_Type irq, GPIO_TypeDef *port, uint16_t pin, TBuzzer *buzzer) {
 
 	if(delay == 0){
 		delay = NO_DELAY;
@@ -32,13 +143,49 @@ void PIR_sensor_init(TPIR_sensor *pir, uint8_t delay, uint8_t alarm_duration,
 
 	pir->state = ALARM_STATE_INACTIVE;
 	pir->alarm_delay = delay;
-	pir->remaining_delay = delay;
 	pir->alarm_duration = alarm_duration;
 	pir->irq = irq;
 	pir->pin = pin;
 	pir->port = port;
-	pir->timer = timer;
+	timer_wheel_setup(&pir->timer, PIR_timer_expired, pir);
 	pir->buzzer = buzzer;
+	pir->capture = NULL;
+	pir->retrigger = FALSE;
+	pir->storming = FALSE;
+	timer_wheel_setup(&pir->storm_timer, PIR_storm_expired, pir);
+	pir->window_start = 0;
+	pir->window_edges = 0;
+	pir->suppressed = 0;
+	pir->edges = 0;
+	pir->storms = 0;
+	pir->peak_edges = 0;
+	pir->alarms = 0;
+	pir->motion = FALSE;
+	pir->motion_since = HAL_GetTick();
+	pir->high_time = 0;
+	pir->duty = 0;
+	pir->window_periods = 0;
+	pir->window_events = 0;
+	pir->event_rate = 0;
+	pir->high_since = 0;
+	pir->stuck = FALSE;
+	timer_wheel_setup(&pir->activity_timer, PIR_activity_expired, pir);
+	exti_dispatcher_register(pin, PIR_exti_handler, pir);
+	return;
+}
+
+/**
+ * @fn 			void PIR_sensor_attach_capture(TPIR_sensor *pir, TPIR_capture *capture)
+ * @brief		Moves the sensor from its EXTI line to an input capture, and starts it. The edges are then
+ * 				read in batches by PIR_sensor_process(), with the direction given by the timer.
+ * @param pir		the structure of the sensor
+ * @param capture	the capture, already initialized, on the pin of the sensor
+ * @retval 		None
+ */
+void PIR_sensor_attach_capture(TPIR_sensor *pir, TPIR_capture *capture) {
+	HAL_NVIC_DisableIRQ(pir->irq);
+	pir->capture = capture;
+	PIR_capture_start(capture);
 	return;
 }
 
@@ -49,7 +196,7 @@ void PIR_sensor_init(TPIR_sensor *pir, uint8_t delay, uint8_t alarm_duration,
  * @retval 		None
  */
 void PIR_sensor_activate(TPIR_sensor *pir) {
-	PIR_change_state(pir, ALARM_STATE_ACTIVE);
+	PIR_sensor_event(pir, ALARM_EVENT_ACTIVATE);
 	return;
 }
 
@@ -60,64 +207,396 @@ void PIR_sensor_activate(TPIR_sensor *pir) {
  * @retval 		 None
  */
 void PIR_sensor_deactivate(TPIR_sensor *pir) {
-	PIR_change_state(pir, ALARM_STATE_INACTIVE);
+	PIR_sensor_event(pir, ALARM_EVENT_DEACTIVATE);
 	return;
 }
 
 
 /**
  * @fn 			PIR_sensor_handler(TPIR_sensor *pir)
- * @brief 		ISR of the pir_sensor. This should be called both on rising and falling edge.
+ * @brief 		ISR of the pir_sensor. This should be called both on rising and falling edge,
+ * 				by the EXTI dispatcher that already cleared the pending bit.
  * @param pir 	the structure of the pin which has triggered the interruption
  * @retval		None
  */
 void PIR_sensor_handler(TPIR_sensor *pir) {
-	__HAL_GPIO_EXTI_CLEAR_IT(pir->pin);
+	// the time of the interrupt, taken before the storm protection runs
+	uint32_t now = HAL_GetTick();
 
-	//If the interrupt is on the falling edge, then check the state of the sensor
-	if (HAL_GPIO_ReadPin(pir->port, pir->pin) == GPIO_PIN_RESET) {
-		if (pir->state == ALARM_STATE_DELAYED) {
-			//if the sensor was on delayed state, stop the timer and set the sensor back to active
-			PIR_change_state(pir, ALARM_STATE_ACTIVE);
-		}
-		//in any other case, ignore the interrupt. There are 3 other possible states
-		// active: it is not possible since if it is falling, it has raised, so it was already in delayed
-		// inactive: impossible, since the interrupt was deactivated
-		// alarm: ignore it, the sensor is already alarmed
-		return;
+	if (PIR_sensor_admit_edge(pir)) {
+		bool rising = HAL_GPIO_ReadPin(pir->port, pir->pin) == GPIO_PIN_SET;
+		PIR_activity_edge(pir, rising, now);
+		PIR_sensor_edge(pir, rising);
 	}
+}
 
-	// if it is rising, but it is already alarmed, don't do anything
-	if (pir->state == ALARM_STATE_ALARMED) {
+/**
+ * @fn 			PIR_sensor_process(TPIR_sensor *pir)
+ * @brief 		Processes the edges captured since the last call. It must be called in the main loop
+ * 				when the sensor uses an input capture, otherwise it does nothing.
+ * @param pir 	the structure of the sensor
+ * @retval		None
+ */
+void PIR_sensor_process(TPIR_sensor *pir) {
+	bool rising;
+	uint32_t time;
+
+	if (pir->capture == NULL) {
 		return;
 	}
+	uint32_t lost = pir->capture->lost;
+
+	// the edges are always read, so the ones captured while the sensor is inactive are dropped
+	while (PIR_capture_next_edge(pir->capture, &rising, &time)) {
+		// the state is shared with the timer and the keypad interrupts
+		__disable_irq();
+		if (pir->state != ALARM_STATE_INACTIVE && PIR_sensor_admit_edge(pir)) {
+			// the edge is accounted at the time it was captured, not at the time it is read
+			PIR_activity_edge(pir, rising, PIR_capture_to_tick(pir->capture, time));
+			PIR_sensor_edge(pir, rising);
+		}
+		__enable_irq();
+	}
+
+	// the edges lost may have hidden a rising one: the level of the output tells if the motion goes on
+	if (pir->capture->lost != lost) {
+		pir->retrigger = TRUE;
+	}
+	if (pir->retrigger) {
+		__disable_irq();
+		pir->retrigger = FALSE;
+		if (pir->state == ALARM_STATE_ACTIVE && HAL_GPIO_ReadPin(pir->port, pir->pin) == GPIO_PIN_SET) {
+			PIR_sensor_edge(pir, TRUE);
+		}
+		__enable_irq();
+	}
+}
+
+/**
+ * @fn 			static void PIR_storm_expired(void *context)
+ * @brief 		Callback of the storm timer. Unmasks the line of the sensor, updates its state to the current level
+ * 				of its output and logs a single event with the number of edges dropped during the storm
+ * @param context 	the structure of the sensor
+ * @retval		None
+ */
+static void PIR_storm_expired(void *context) {
+	TPIR_sensor *pir = context;
+	bool high = HAL_GPIO_ReadPin(pir->port, pir->pin) == GPIO_PIN_SET;
+
+	// every sensor has its own message, so the storms ending in the same tick are all logged
+	snprintf(pir->storm_message, sizeof(pir->storm_message), "Noisy PIR on line %u: %lu edges dropped",
+			__builtin_ctz(pir->pin), pir->suppressed);
+	logger_print(&logger, pir->storm_message);
+
+	pir->storming = FALSE;
+	pir->suppressed = 0;
+	pir->window_start = HAL_GetTick();
+	pir->window_edges = 0;
+
+	if (pir->capture == NULL) {
+		// the edges of the storm left the line pending, they must not fire the irq again
+		EXTI->PR = pir->pin;
+		EXTI->IMR |= pir->pin;
+	}
+
+	// the edges dropped may have hidden the last change of the output
+	if (high != pir->motion && pir->state != ALARM_STATE_INACTIVE) {
+		PIR_activity_edge(pir, high, HAL_GetTick());
+	}
+	if ((high && pir->state == ALARM_STATE_ACTIVE) || (!high && pir->state == ALARM_STATE_DELAYED)) {
+		PIR_sensor_edge(pir, high);
+	}
+}
+
+/**
+ * @fn 			static bool PIR_sensor_admit_edge(TPIR_sensor *pir)
+ * @brief 		Counts an edge and decides if it must be processed. When the edges in a window exceed
+ * 				PIR_STORM_THRESHOLD the line is masked, and the edges are dropped until the storm timer releases it.
+ * @param pir 	the structure of the sensor
+ * @retval		TRUE if the edge must be processed, FALSE if it must be dropped
+ */
+static bool PIR_sensor_admit_edge(TPIR_sensor *pir) {
+	uint32_t now = HAL_GetTick();
+
+	pir->edges++;
+	if (pir->storming) {
+		pir->suppressed++;
+		return FALSE;
+	}
 
-	PIR_change_state(pir, ALARM_STATE_DELAYED);
+	if (now - pir->window_start >= PIR_STORM_WINDOW) {
+		pir->window_start = now;
+		pir->window_edges = 0;
+	}
+	pir->window_edges++;
+	if (pir->window_edges > pir->peak_edges) {
+		pir->peak_edges = pir->window_edges;
+	}
+
+	if (pir->window_edges <= PIR_STORM_THRESHOLD) {
+		return TRUE;
+	}
 
+	// the sensor is noisy: stop the edges at the source, so they don't reach the state machine nor the buzzer
+	if (pir->capture == NULL) {
+		EXTI->IMR &= ~(pir->pin);
+	}
+	pir->storming = TRUE;
+	timer_wheel_start(&pir->storm_timer, PIR_STORM_HOLDOFF, 0);
+	pir->suppressed = 1;
+	pir->storms++;
+	return FALSE;
 }
 
 /**
- * @fn			PIR_time_elapsed(TPIR_sensor *pir)
- * @brief 		ISR of the associated timer. This will reduce the remaing delay or the duration of the alarm
- * @param pir 	the structure of the pin which is currently on alarm or delayed state
+ * @fn 			static void PIR_sensor_edge(TPIR_sensor *pir, bool rising)
+ * @brief 		Updates the state of the sensor after an edge of its output
+ * @param pir 	the structure of the sensor
+ * @param rising	TRUE on the rising edge, FALSE on the falling one
+ * @retval		None
+ */
+static void PIR_sensor_edge(TPIR_sensor *pir, bool rising) {
+	// the table ignores the rising edges when the sensor is already alarmed, and the falling ones unless it is delayed
+	PIR_sensor_event(pir, rising ? ALARM_EVENT_TRIGGER : ALARM_EVENT_CLEAR);
+}
+
+/**
+ * @fn			static void PIR_timer_expired(void *context)
+ * @brief 		Callback of the timer of the sensor. When the delay has passed the alarm starts,
+ * 				when the duration of the alarm has passed the sensor goes back to active
+ * @param context 	the structure of the sensor which is currently on alarm or delayed state
  * @retval 		None
  */
-void PIR_time_elapsed(TPIR_sensor *pir) {
+static void PIR_timer_expired(void *context) {
+	PIR_sensor_event(context, ALARM_EVENT_TIMEOUT);
+}
+
+/**
+ * @fn		static void PIR_stop_timer(void *sensor)
+ * @brief	Action: stops the delay or the duration of the alarm
+ */
+static void PIR_stop_timer(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	timer_wheel_cancel(&pir->timer);
+}
+
+/**
+ * @fn		static void PIR_start_delay(void *sensor)
+ * @brief	Action: starts, or restarts, the delay before the alarm
+ */
+static void PIR_start_delay(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	timer_wheel_start(&pir->timer, pir->alarm_delay, 0);
+}
+
+/**
+ * @fn		static void PIR_start_duration(void *sensor)
+ * @brief	Action: starts the duration of the alarm
+ */
+static void PIR_start_duration(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	timer_wheel_start(&pir->timer, pir->alarm_duration, 0);
+}
+
+/**
+ * @fn		static void PIR_enable_input(void *sensor)
+ * @brief	Action: enables the irq of the sensor, and processes again its output if it is still high
+ */
+static void PIR_enable_input(void *sensor) {
+	TPIR_sensor *pir = sensor;
+
+	if (pir->capture == NULL) {
+		HAL_NVIC_EnableIRQ(pir->irq);
+	}
+	// the activity restarts from the current level of the output, the edges are not seen while inactive
+	pir->motion = HAL_GPIO_ReadPin(pir->port, pir->pin) == GPIO_PIN_SET;
+	pir->motion_since = HAL_GetTick();
+	if (!timer_wheel_is_running(&pir->activity_timer)) {
+		timer_wheel_start(&pir->activity_timer, PIR_ACTIVITY_PERIOD, PIR_ACTIVITY_PERIOD);
+	}
+	if (pir->motion) {
+		pir->high_since = pir->motion_since;
+		//if the sensor is still high, retrigger the interrupt, or the edge processing in capture mode
+		if (pir->capture == NULL) {
+			HAL_NVIC_SetPendingIRQ(pir->irq);
+		} else {
+			pir->retrigger = TRUE;
+		}
+	}
+}
+
+/**
+ * @fn		static void PIR_disable_input(void *sensor)
+ * @brief	Action: disables the irq of the sensor. In capture mode the edges are dropped by PIR_sensor_process()
+ */
+static void PIR_disable_input(void *sensor) {
+	TPIR_sensor *pir = sensor;
+
+	if (pir->capture == NULL) {
+		HAL_NVIC_DisableIRQ(pir->irq);
+	}
+}
+
+/**
+ * @fn		static void PIR_sound(void *sensor)
+ * @brief	Action: adds the pulse of the PIR sensors to the buzzer
+ */
+static void PIR_sound(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	pir->alarms++;
+	buzzer_increase_pulse(pir->buzzer, buzzer_medium_pulse());
+}
+
+/**
+ * @fn		static void PIR_silence(void *sensor)
+ * @brief	Action: removes the pulse of the PIR sensors from the buzzer
+ */
+static void PIR_silence(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	buzzer_decrease_pulse(pir->buzzer, buzzer_medium_pulse());
+}
+
+/**
+ * @fn		static void PIR_activity_edge(TPIR_sensor *pir, bool rising, uint32_t now)
+ * @brief	Accounts an edge of the output in the activity of the current period, now being the time of the edge
+ * 			in milliseconds. A captured edge read after the end of its period is accounted at the start of the next one
+ */
+static void PIR_activity_edge(TPIR_sensor *pir, bool rising, uint32_t now) {
+	if ((int32_t) (now - pir->motion_since) < 0) {
+		now = pir->motion_since;
+	}
+	if (pir->motion) {
+		pir->high_time += now - pir->motion_since;
+	}
+	pir->motion = rising;
+	pir->motion_since = now;
+	if (rising) {
+		pir->window_events++;
+		pir->high_since = now;
+	} else if (pir->stuck) {
+		pir->stuck = FALSE;
+		health_clear(HEALTH_FAULT_PIR_STUCK, __builtin_ctz(pir->pin));
+	}
+}
+
+/**
+ * @fn		static void PIR_activity_expired(void *context)
+ * @brief	Callback of the activity timer. Folds the duty cycle of the period in the weighted average,
+ * 			and publishes the event rate at the end of every window. The timer runs from the activation of the sensor
+ * 			and stops at the first period the sensor is found inactive, so nothing is updated while it is inactive.
+ * 			It also raises the stuck fault when the output has been high for PIR_STUCK_TIME.
+ */
+static void PIR_activity_expired(void *context) {
+	TPIR_sensor *pir = context;
+	uint32_t now = HAL_GetTick();
 
-	//Decrease the remaining delay
-	--(pir->remaining_delay);
-	if (pir->remaining_delay == 0U) {
-		// if the delay has passed, start the alarm
-		PIR_change_state(pir, ALARM_STATE_ALARMED);
+	if (pir->state == ALARM_STATE_INACTIVE) {
+		pir->high_time = 0;
+		timer_wheel_cancel(&pir->activity_timer);
 		return;
 	}
-	//decreasing remaining delay will cause an under flow, so sum it to the duration and wait until it the overflow of the sum is zero
-	uint8_t t = pir->remaining_delay + pir->alarm_duration;
-	if (t == 0) {
-		PIR_change_state(pir, ALARM_STATE_ACTIVE);
+
+	if (pir->motion) {
+		pir->high_time += now - pir->motion_since;
+		pir->motion_since = now;
+	}
+	if (pir->motion && !pir->stuck && now - pir->high_since >= PIR_STUCK_TIME) {
+		pir->stuck = TRUE;
+		health_raise(HEALTH_FAULT_PIR_STUCK, __builtin_ctz(pir->pin));
+	}
+	if (pir->high_time > PIR_ACTIVITY_PERIOD) {
+		pir->high_time = PIR_ACTIVITY_PERIOD;
+	}
+
+	int32_t sample = (int32_t) (pir->high_time * PIR_DUTY_ONE / PIR_ACTIVITY_PERIOD);
+	pir->duty += (sample - pir->duty) / (1L << PIR_ACTIVITY_SHIFT);
+	pir->high_time = 0;
+
+	if (++pir->window_periods >= PIR_ACTIVITY_WINDOW) {
+		pir->event_rate = pir->window_events;
+		pir->window_events = 0;
+		pir->window_periods = 0;
 	}
 }
 
+/**
+ * @fn 			uint16_t PIR_sensor_get_duty(TPIR_sensor *pir)
+ * @brief 		Returns the exponentially weighted duty cycle of the output of the sensor, updated while it is not inactive
+ * @param pir 	the structure of the sensor
+ * @retval		the duty cycle, in thousandths
+ */
+uint16_t PIR_sensor_get_duty(TPIR_sensor *pir) {
+	return (uint16_t) ((pir->duty * 1000L + PIR_DUTY_ONE / 2) / PIR_DUTY_ONE);
+}
+
+/**
+ * @fn		static void PIR_sensor_op_activate(void *sensor)
+ * @brief	Operation activate of the sensor registry
+ */
+static void PIR_sensor_op_activate(void *sensor) {
+	PIR_sensor_activate(sensor);
+}
+
+/**
+ * @fn		static void PIR_sensor_op_deactivate(void *sensor)
+ * @brief	Operation deactivate of the sensor registry
+ */
+static void PIR_sensor_op_deactivate(void *sensor) {
+	PIR_sensor_deactivate(sensor);
+}
+
+/**
+ * @fn		static void PIR_sensor_op_poll(void *sensor)
+ * @brief	Operation poll of the sensor registry: processes the captured edges
+ */
+static void PIR_sensor_op_poll(void *sensor) {
+	PIR_sensor_process(sensor);
+}
+
+/**
+ * @fn		static TAlarmState PIR_sensor_op_state(void *sensor)
+ * @brief	Operation state of the sensor registry
+ */
+static TAlarmState PIR_sensor_op_state(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	return pir->state;
+}
+
+/**
+ * @fn		static void PIR_sensor_op_stats(void *sensor, TSensor_stats *stats)
+ * @brief	Operation stats of the sensor registry: the events are the edges of the output,
+ * 			the activity is the duty cycle and the rate of the rising edges
+ */
+static void PIR_sensor_op_stats(void *sensor, TSensor_stats *stats) {
+	TPIR_sensor *pir = sensor;
+	stats->events = pir->edges;
+	stats->alarms = pir->alarms;
+	stats->duty = PIR_sensor_get_duty(pir);
+	stats->rate = pir->event_rate;
+	stats->peak_rate = (uint32_t) pir->peak_edges * 1000U / PIR_STORM_WINDOW;
+	stats->storms = pir->storms;
+}
+
+/**
+ * @fn		static void PIR_sensor_op_set_timing(void *sensor, uint32_t delay, uint32_t duration)
+ * @brief	Operation set_timing of the sensor registry: the delay and the duration of the next alarms
+ */
+static void PIR_sensor_op_set_timing(void *sensor, uint32_t delay, uint32_t duration) {
+	TPIR_sensor *pir = sensor;
+	pir->alarm_delay = (delay == 0) ? NO_DELAY : delay;
+	pir->alarm_duration = duration;
+}
+
+/**
+ * @fn		static bool PIR_sensor_op_busy(void *sensor)
+ * @brief	Operation busy of the sensor registry: the edges captured by the DMA are processed in the main loop,
+ * 			so it must not sleep while the rings hold edges not read yet. A new capture wakes the sleep
+ */
+static bool PIR_sensor_op_busy(void *sensor) {
+	TPIR_sensor *pir = sensor;
+	return pir->capture != NULL && (pir->retrigger || PIR_capture_has_edges(pir->capture));
+}
+
 /*
  * @fn        PIR_get_string_state(TPIR_sensor *pir, char *area_state)
  * @brief     set in the area_state parameter the current state of the pir sensor, as a string
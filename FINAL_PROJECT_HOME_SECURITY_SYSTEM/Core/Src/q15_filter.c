@@ -0,0 +1,352 @@
+/*
+ * This module filters blocks of 12 bits ADC samples in Q15 fixed point, with three stages in a row:
+ * 		a median of 3 or 5 samples, removing the single spikes
+ * 		a moving average of a power of two of samples, smoothing the noise
+ * 		a first order IIR low pass, y += alpha * (x - y), following the slow changes
+ * The samples are scaled to Q15 by a shift of 3 bits, so the filtered values come back to the ADC scale
+ * with Q15_FILTER_TO_ADC. On the Cortex-M4 the median and the average handle two samples per instruction
+ * with the SIMD instructions of the DSP extension; elsewhere the same operations are done one half at a time,
+ * with the same results bit by bit.
+ * The filtered values are checked against the window of the barrier in the same way, two of them at a time.
+ */
+
+#include "q15_filter.h"
+
+/* Positions of the new samples in the buffers of a pass, after the history */
+#define INPUT_OFFSET		(Q15_FILTER_MAX_MEDIAN - 1U)
+#define MEDIAN_OFFSET		(Q15_FILTER_MAX_AVERAGE - 1U)
+
+/* Two halves equal to 1, to sum two samples with a multiply and accumulate */
+#define PAIR_ONES			(0x00010001UL)
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+
+/*
+ * @fn		static uint32_t pair_max(uint32_t a, uint32_t b)
+ * @brief	Returns the greater of each half: the subtraction sets the GE flags of the halves, the selection reads them
+ */
+static inline uint32_t pair_max(uint32_t a, uint32_t b) {
+	__SSUB16(a, b);
+	return __SEL(a, b);
+}
+
+/*
+ * @fn		static uint32_t pair_min(uint32_t a, uint32_t b)
+ * @brief	Returns the smaller of each half
+ */
+static inline uint32_t pair_min(uint32_t a, uint32_t b) {
+	__SSUB16(a, b);
+	return __SEL(b, a);
+}
+
+/*
+ * @fn		static int32_t pair_mac(uint32_t a, uint32_t b, int32_t accumulator)
+ * @brief	Adds to the accumulator the products of the halves
+ */
+static inline int32_t pair_mac(uint32_t a, uint32_t b, int32_t accumulator) {
+	return (int32_t) __SMLAD(a, b, (uint32_t) accumulator);
+}
+
+/*
+ * @fn		static uint32_t pair_sub(uint32_t a, uint32_t b)
+ * @brief	Returns the difference of each half, wrapping around
+ */
+static inline uint32_t pair_sub(uint32_t a, uint32_t b) {
+	return __SSUB16(a, b);
+}
+
+#else
+
+static inline int16_t pair_low(uint32_t pair) {
+	return (int16_t) (pair & 0xFFFFU);
+}
+
+static inline int16_t pair_high(uint32_t pair) {
+	return (int16_t) (pair >> 16);
+}
+
+static inline uint32_t pair_pack(int16_t low, int16_t high) {
+	return (uint32_t) (uint16_t) low | ((uint32_t) (uint16_t) high << 16);
+}
+
+static inline uint32_t pair_max(uint32_t a, uint32_t b) {
+	int16_t low = (pair_low(a) >= pair_low(b)) ? pair_low(a) : pair_low(b);
+	int16_t high = (pair_high(a) >= pair_high(b)) ? pair_high(a) : pair_high(b);
+	return pair_pack(low, high);
+}
+
+static inline uint32_t pair_min(uint32_t a, uint32_t b) {
+	int16_t low = (pair_low(a) >= pair_low(b)) ? pair_low(b) : pair_low(a);
+	int16_t high = (pair_high(a) >= pair_high(b)) ? pair_high(b) : pair_high(a);
+	return pair_pack(low, high);
+}
+
+static inline int32_t pair_mac(uint32_t a, uint32_t b, int32_t accumulator) {
+	return accumulator + (int32_t) pair_low(a) * pair_low(b) + (int32_t) pair_high(a) * pair_high(b);
+}
+
+static inline uint32_t pair_sub(uint32_t a, uint32_t b) {
+	return pair_pack(pair_low(a) - pair_low(b), pair_high(a) - pair_high(b));
+}
+
+#endif
+
+/*
+ * @fn		static uint32_t pair_read(const int16_t *values)
+ * @brief	Reads two consecutive values, the first in the low half. The address may be unaligned
+ */
+static inline uint32_t pair_read(const int16_t *values) {
+	uint32_t pair;
+	memcpy(&pair, values, sizeof(pair));
+	return pair;
+}
+
+/*
+ * @fn		static void pair_write(int16_t *values, uint32_t pair)
+ * @brief	Writes two consecutive values, the low half first. The address may be unaligned
+ */
+static inline void pair_write(int16_t *values, uint32_t pair) {
+	memcpy(values, &pair, sizeof(pair));
+}
+
+/*
+ * @fn		static uint32_t pair_pack_same(int16_t value)
+ * @brief	Returns a pair with the same value in both halves
+ */
+static inline uint32_t pair_pack_same(int16_t value) {
+	return (uint32_t) (uint16_t) value * PAIR_ONES;
+}
+
+/*
+ * @fn		static uint32_t pair_median3(uint32_t a, uint32_t b, uint32_t c)
+ * @brief	Returns the median of three values, for each half
+ */
+static inline uint32_t pair_median3(uint32_t a, uint32_t b, uint32_t c) {
+	return pair_max(pair_min(a, b), pair_min(pair_max(a, b), c));
+}
+
+/*
+ * @fn		static uint32_t pair_median5(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e)
+ * @brief	Returns the median of five values, for each half: the smallest and the greatest of a, b, c and d
+ * 			cannot be the median, so it is the median of e and of the two values left
+ */
+static inline uint32_t pair_median5(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e) {
+	uint32_t second = pair_max(pair_min(a, b), pair_min(c, d));
+	uint32_t third = pair_min(pair_max(a, b), pair_max(c, d));
+	return pair_median3(second, third, e);
+}
+
+/*
+ * @fn		int q15_filter_init(TQ15_filter *filter, uint8_t median_length, uint8_t average_length, int16_t iir_alpha)
+ * @brief	Sets the stages of the filter and forgets the previous samples. The samples have Q15_FILTER_ADC_BITS bits
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	median_length	samples of the median, 1, 3 or 5
+ * @param	average_length	samples of the moving average, a power of two up to Q15_FILTER_MAX_AVERAGE
+ * @param	iir_alpha		coefficient of the IIR in Q15, from 0 to 32767
+ * @retval	Q15_FILTER_ERR_INVALID if a length is not allowed, Q15_FILTER_OK otherwise
+ */
+int q15_filter_init(TQ15_filter *filter, uint8_t median_length, uint8_t average_length, int16_t iir_alpha) {
+	if ((median_length != 1 && median_length != 3 && median_length != 5) || average_length == 0
+			|| average_length > Q15_FILTER_MAX_AVERAGE || (average_length & (average_length - 1U)) != 0
+			|| iir_alpha < 0) {
+		return Q15_FILTER_ERR_INVALID;
+	}
+	filter->median_length = median_length;
+	filter->average_length = average_length;
+	filter->average_shift = __builtin_ctz(average_length);
+	filter->iir_alpha = iir_alpha;
+	filter->input_shift = 15U - Q15_FILTER_ADC_BITS;
+	q15_filter_reset(filter);
+	return Q15_FILTER_OK;
+}
+
+/*
+ * @fn		int q15_filter_set_resolution(TQ15_filter *filter, uint8_t bits)
+ * @brief	Sets the resolution of the next samples, that keep the same full scale in Q15, so the history is not lost
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	bits			bits of the samples, from Q15_FILTER_ADC_BITS to 15
+ * @retval	Q15_FILTER_ERR_INVALID if the resolution is not allowed, Q15_FILTER_OK otherwise
+ */
+int q15_filter_set_resolution(TQ15_filter *filter, uint8_t bits) {
+	if (bits < Q15_FILTER_ADC_BITS || bits > 15U) {
+		return Q15_FILTER_ERR_INVALID;
+	}
+	filter->input_shift = 15U - bits;
+	return Q15_FILTER_OK;
+}
+
+/*
+ * @fn		void q15_filter_reset(TQ15_filter *filter)
+ * @brief	Forgets the previous samples: the next sample fills the history, so the output does not ramp from 0
+ * @param	filter			pointer to the TQ15_filter structure
+ */
+void q15_filter_reset(TQ15_filter *filter) {
+	filter->primed = FALSE;
+}
+
+/*
+ * @fn		static void q15_filter_prime(TQ15_filter *filter, int16_t value)
+ * @brief	Fills the history with a value, as if it had been read forever
+ */
+static void q15_filter_prime(TQ15_filter *filter, int16_t value) {
+	for (uint8_t i = 0; i < INPUT_OFFSET; i++) {
+		filter->input_history[i] = value;
+	}
+	for (uint8_t i = 0; i < MEDIAN_OFFSET; i++) {
+		filter->median_history[i] = value;
+	}
+	filter->iir_state = value;
+	filter->primed = TRUE;
+}
+
+/*
+ * @fn		static void q15_filter_pass(TQ15_filter *filter, const uint16_t *samples, int16_t *output, uint16_t length)
+ * @brief	Filters up to Q15_FILTER_MAX_BLOCK samples. The median and the average work on pairs of outputs:
+ * 			the buffers have one more slot, so the last pair of an odd block never leaves them
+ */
+static void q15_filter_pass(TQ15_filter *filter, const uint16_t *samples, int16_t *output, uint16_t length) {
+	int16_t input[INPUT_OFFSET + Q15_FILTER_MAX_BLOCK + 1];
+	int16_t median[MEDIAN_OFFSET + Q15_FILTER_MAX_BLOCK + 1];
+	uint16_t i;
+
+	// the samples fit in 15 bits once shifted, so the shift of a pair never carries from the low half into the high one
+	memcpy(input, filter->input_history, sizeof(filter->input_history));
+	for (i = 0; i + 1U < length; i += 2) {
+		uint32_t pair;
+		memcpy(&pair, &samples[i], sizeof(pair));
+		pair_write(&input[INPUT_OFFSET + i], pair << filter->input_shift);
+	}
+	if (i < length) {
+		input[INPUT_OFFSET + i] = (int16_t) (samples[i] << filter->input_shift);
+	}
+	input[INPUT_OFFSET + length] = input[INPUT_OFFSET + length - 1U];
+
+	memcpy(median, filter->median_history, sizeof(filter->median_history));
+	for (i = 0; i < length; i += 2) {
+		const int16_t *last = &input[INPUT_OFFSET + i];
+		uint32_t pair;
+
+		if (filter->median_length == 5) {
+			pair = pair_median5(pair_read(last - 4), pair_read(last - 3), pair_read(last - 2), pair_read(last - 1),
+					pair_read(last));
+		} else if (filter->median_length == 3) {
+			pair = pair_median3(pair_read(last - 2), pair_read(last - 1), pair_read(last));
+		} else {
+			pair = pair_read(last);
+		}
+		pair_write(&median[MEDIAN_OFFSET + i], pair);
+	}
+
+	for (i = 0; i < length; i++) {
+		const int16_t *first = &median[MEDIAN_OFFSET + i + 1U - filter->average_length];
+		int32_t sum;
+
+		if (filter->average_length == 1) {
+			sum = *first;
+		} else {
+			sum = 0;
+			for (uint8_t k = 0; k < filter->average_length; k += 2) {
+				sum = pair_mac(pair_read(first + k), PAIR_ONES, sum);
+			}
+		}
+		output[i] = (int16_t) (sum >> filter->average_shift);
+	}
+
+	if (filter->iir_alpha != 0) {
+		int16_t state = filter->iir_state;
+		for (i = 0; i < length; i++) {
+			state += (int16_t) (((int32_t) (output[i] - state) * filter->iir_alpha + (1L << 14)) >> 15);
+			output[i] = state;
+		}
+		filter->iir_state = state;
+	}
+
+	memcpy(filter->input_history, &input[length], sizeof(filter->input_history));
+	memcpy(filter->median_history, &median[length], sizeof(filter->median_history));
+}
+
+/*
+ * @fn		void q15_filter_block(TQ15_filter *filter, const uint16_t *samples, int16_t *output, uint16_t length)
+ * @brief	Filters a block of samples
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	samples			the samples of the ADC, with the resolution set by q15_filter_set_resolution
+ * @param	output			where to write the filtered values in Q15, as many as the samples
+ * @param	length			number of samples
+ */
+void q15_filter_block(TQ15_filter *filter, const uint16_t *samples, int16_t *output, uint16_t length) {
+	if (length == 0) {
+		return;
+	}
+	if (!filter->primed) {
+		q15_filter_prime(filter, (int16_t) (samples[0] << filter->input_shift));
+	}
+	while (length > 0) {
+		uint16_t pass = (length > Q15_FILTER_MAX_BLOCK) ? Q15_FILTER_MAX_BLOCK : length;
+		q15_filter_pass(filter, samples, output, pass);
+		samples += pass;
+		output += pass;
+		length -= pass;
+	}
+}
+
+/*
+ * @fn		int32_t q15_filter_find_outside(const int16_t *values, uint16_t length, int16_t low, int16_t high)
+ * @brief	Looks for the first value outside a window, checking two values per instruction
+ * @param	values			the values in Q15, not negative
+ * @param	length			number of values
+ * @param	low				lowest value inside the window, not negative
+ * @param	high			highest value inside the window, not negative
+ * @retval	the index of the first value lower than low or greater than high, -1 if all of them are inside
+ */
+int32_t q15_filter_find_outside(const int16_t *values, uint16_t length, int16_t low, int16_t high) {
+	uint32_t lows = pair_pack_same(low);
+	uint32_t highs = pair_pack_same(high);
+	uint16_t i;
+
+	// values and limits are not negative, so the differences never overflow and their signs tell the outside ones
+	for (i = 0; i + 1U < length; i += 2) {
+		uint32_t pair = pair_read(&values[i]);
+		uint32_t signs = (pair_sub(pair, lows) | pair_sub(highs, pair)) & 0x80008000UL;
+
+		if (signs != 0) {
+			return ((signs & 0x8000UL) != 0) ? i : i + 1;
+		}
+	}
+	if (i < length && (values[i] < low || values[i] > high)) {
+		return i;
+	}
+	return -1;
+}
+
+static void q15_filter_command(TShell *shell, void *context, char *args) {
+	TQ15_filter *filter = context;
+	char *median = shell_next_token(&args);
+	char *average = shell_next_token(&args);
+	char *alpha = shell_next_token(&args);
+
+	if (median != NULL) {
+		uint32_t median_length = strtoul(median, NULL, 10);
+		uint32_t average_length = (average == NULL) ? 0 : strtoul(average, NULL, 10);
+		uint32_t iir_alpha = (alpha == NULL) ? UINT32_MAX : strtoul(alpha, NULL, 10);
+
+		if (median_length > Q15_FILTER_MAX_MEDIAN || average_length > Q15_FILTER_MAX_AVERAGE || iir_alpha > INT16_MAX
+				|| q15_filter_init(filter, median_length, average_length, iir_alpha) != Q15_FILTER_OK) {
+			shell_print(shell, "Usage: filter [<median 1, 3 or 5> <average 1 to %u, power of two> <alpha 0 to 32767>]\r\n",
+					Q15_FILTER_MAX_AVERAGE);
+			return;
+		}
+	}
+	shell_print(shell, "median of %u, average of %u, IIR alpha %d/32768%s\r\n", filter->median_length,
+			filter->average_length, filter->iir_alpha, (filter->iir_alpha == 0) ? " (off)" : "");
+}
+
+/*
+ * @fn		void q15_filter_register_commands(TQ15_filter *filter, TShell *shell)
+ * @brief	Adds to the shell the command filter [median average alpha], that shows and optionally changes the stages
+ * @param	filter			pointer to the TQ15_filter structure
+ * @param	shell			pointer to the TShell structure
+ */
+void q15_filter_register_commands(TQ15_filter *filter, TShell *shell) {
+	shell_register_command(shell, "filter", "[median average alpha] shows and sets the filter of the light samples",
+			q15_filter_command, filter);
+}
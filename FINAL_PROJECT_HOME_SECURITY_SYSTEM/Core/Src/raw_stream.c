@@ -0,0 +1,454 @@
+/*
+ * This module streams the raw samples of the ADC and the edges of the PIR off the board, for the commissioning.
+ * While it runs, the console is muted and its UART carries binary packets, at a rate higher than the one of the
+ * console: every block of the ADC, as the DMA wrote it, every few edges of the PIR, and every RAW_STREAM_STATS_PERIOD
+ * milliseconds the statistics of the stream. A packet is a header, the payload and a CRC, all little endian:
+ * 		type		uint8, one of RAW_STREAM_PACKET_ADC, RAW_STREAM_PACKET_PIR, RAW_STREAM_PACKET_STATS
+ * 		info		uint8, the channels interleaved in the samples of an ADC packet, 0 otherwise
+ * 		sequence	uint16, incremented for every packet, even for the dropped ones, so the receiver sees the losses
+ * 		tick		uint32, HAL_GetTick() when the packet has been made
+ * 		payload		the samples as uint16; the edges as a uint32 timestamp in microseconds and a uint8, 1 if rising;
+ * 					or the statistics, see RAW_STREAM_PACKET_STATS
+ * 		crc			uint16, CRC-16/CCITT-FALSE of the header and of the payload
+ * Each packet is COBS encoded, so it holds no zero byte, and it is followed by a zero: a receiver finds the start
+ * of the next packet after any loss. The encoded packets are appended to one of two buffers while the DMA sends
+ * the other one, and the interrupt at the end of a transfer starts the next buffer at once, so the line stays busy.
+ * A packet that does not fit in the buffer is dropped and counted.
+ * The receiver stops the stream by sending "stream off" at the rate of the stream: the console is then restored.
+ */
+
+#include "raw_stream.h"
+
+/* The stream receiving the ends of the transfers */
+static TRaw_stream *running_stream = NULL;
+
+/* CRC-16/CCITT-FALSE of the 16 values of a nibble, polynomial 0x1021 */
+static const uint16_t crc_nibbles[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/*
+ * @fn		static uint16_t raw_stream_crc(const uint8_t *data, uint16_t length)
+ * @brief	Returns the CRC-16/CCITT-FALSE of the data, a nibble at a time
+ */
+static uint16_t raw_stream_crc(const uint8_t *data, uint16_t length) {
+	uint16_t crc = 0xFFFFU;
+
+	for (uint16_t i = 0; i < length; i++) {
+		crc = (uint16_t) (crc << 4) ^ crc_nibbles[(crc >> 12) ^ (data[i] >> 4)];
+		crc = (uint16_t) (crc << 4) ^ crc_nibbles[(crc >> 12) ^ (data[i] & 0x0FU)];
+	}
+	return crc;
+}
+
+/*
+ * @fn		static uint16_t raw_stream_encode(const uint8_t *data, uint16_t length, uint8_t *encoded)
+ * @brief	Encodes the data with COBS, followed by a zero: every zero of the data is replaced by the distance
+ * 			to the next one, and a code is inserted every 254 bytes without zeros
+ * @retval	the number of bytes written, at most RAW_STREAM_ENCODED_SIZE(length)
+ */
+static uint16_t raw_stream_encode(const uint8_t *data, uint16_t length, uint8_t *encoded) {
+	uint16_t code_index = 0;
+	uint16_t out = 1;
+	uint8_t code = 1;
+
+	for (uint16_t i = 0; i < length; i++) {
+		if (data[i] == 0) {
+			encoded[code_index] = code;
+			code_index = out++;
+			code = 1;
+			continue;
+		}
+		encoded[out++] = data[i];
+		if (++code == 0xFFU) {
+			encoded[code_index] = code;
+			code_index = out++;
+			code = 1;
+		}
+	}
+	encoded[code_index] = code;
+	encoded[out++] = 0;
+	return out;
+}
+
+/*
+ * @fn		static void raw_stream_put16(uint8_t *data, uint16_t value)
+ * @brief	Writes a value little endian
+ */
+static void raw_stream_put16(uint8_t *data, uint16_t value) {
+	data[0] = (uint8_t) value;
+	data[1] = (uint8_t) (value >> 8);
+}
+
+/*
+ * @fn		static void raw_stream_put32(uint8_t *data, uint32_t value)
+ * @brief	Writes a value little endian
+ */
+static void raw_stream_put32(uint8_t *data, uint32_t value) {
+	raw_stream_put16(data, (uint16_t) value);
+	raw_stream_put16(&data[2], (uint16_t) (value >> 16));
+}
+
+/*
+ * @fn		static void raw_stream_kick(TRaw_stream *stream)
+ * @brief	Sends the buffer being filled, if it is not empty, and fills the other one.
+ * 			It must be called with the DMA idle and the interrupts disabled, or by the interrupt
+ */
+static void raw_stream_kick(TRaw_stream *stream) {
+	uint8_t fill = stream->fill;
+
+	if (stream->lengths[fill] == 0) {
+		return;
+	}
+
+	// the other buffer has been sent, it is emptied and filled next
+	stream->fill = fill ^ 1U;
+	stream->lengths[fill ^ 1U] = 0;
+	stream->frames[fill ^ 1U] = 0;
+	stream->sending = stream->lengths[fill];
+	stream->busy = TRUE;
+	if (HAL_UART_Transmit_DMA(stream->huart, stream->buffers[fill], stream->lengths[fill]) != HAL_OK) {
+		stream->busy = FALSE;
+		stream->dropped += stream->frames[fill];
+	}
+}
+
+/*
+ * @fn		static void raw_stream_send(TRaw_stream *stream, uint8_t type, uint8_t info, const void *payload,
+ * 				uint16_t length)
+ * @brief	Makes a packet, appends it encoded to the buffer being filled and sends it if the DMA is idle
+ */
+static void raw_stream_send(TRaw_stream *stream, uint8_t type, uint8_t info, const void *payload, uint16_t length) {
+	uint8_t *packet = stream->packet;
+	uint16_t size = RAW_STREAM_HEADER_SIZE + length;
+
+	packet[0] = type;
+	packet[1] = info;
+	raw_stream_put16(&packet[2], stream->sequence++);
+	raw_stream_put32(&packet[4], HAL_GetTick());
+	memcpy(&packet[RAW_STREAM_HEADER_SIZE], payload, length);
+	raw_stream_put16(&packet[size], raw_stream_crc(packet, size));
+	size += RAW_STREAM_CRC_SIZE;
+	stream->packets++;
+
+	// while appending, the interrupt leaves the buffer being filled alone
+	stream->appending = TRUE;
+	uint8_t fill = stream->fill;
+	if (stream->lengths[fill] + RAW_STREAM_ENCODED_SIZE(size) > RAW_STREAM_BUFFER_SIZE) {
+		stream->dropped++;
+	} else {
+		stream->lengths[fill] += raw_stream_encode(packet, size, &stream->buffers[fill][stream->lengths[fill]]);
+		stream->frames[fill]++;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	stream->appending = FALSE;
+	if (!stream->busy) {
+		raw_stream_kick(stream);
+	}
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		static void raw_stream_send_edges(TRaw_stream *stream)
+ * @brief	Sends the edges gathered
+ */
+static void raw_stream_send_edges(TRaw_stream *stream) {
+	raw_stream_send(stream, RAW_STREAM_PACKET_PIR, 0, stream->edges, stream->edges_n * RAW_STREAM_EDGE_SIZE);
+	stream->edges_n = 0;
+}
+
+/*
+ * @fn		static void raw_stream_send_stats(TRaw_stream *stream)
+ * @brief	Sends the statistics, with the use of the UART since the last ones
+ */
+static void raw_stream_send_stats(TRaw_stream *stream) {
+	uint8_t stats[RAW_STREAM_STATS_SIZE];
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t dropped = stream->dropped;
+	uint32_t bytes = stream->bytes;
+	uint32_t period_bytes = stream->period_bytes;
+	uint32_t overruns = stream->adc->overruns;
+	stream->period_bytes = 0;
+	__set_PRIMASK(primask);
+
+	// 10 bits on the line for every byte, with the start and the stop bits
+	uint64_t usage = (uint64_t) period_bytes * 10U * 1000U * 1000U / ((uint64_t) stream->baud * RAW_STREAM_STATS_PERIOD);
+
+	raw_stream_put32(&stats[0], stream->packets);
+	raw_stream_put32(&stats[4], dropped);
+	raw_stream_put32(&stats[8], bytes);
+	raw_stream_put16(&stats[12], (uint16_t) (usage > 1000U ? 1000U : usage));
+	raw_stream_put32(&stats[14], overruns);
+	raw_stream_send(stream, RAW_STREAM_PACKET_STATS, 0, stats, RAW_STREAM_STATS_SIZE);
+}
+
+/*
+ * @fn		static void raw_stream_adc_tap(void *context, const uint16_t *samples, uint16_t length)
+ * @brief	Sends a block of the ADC as it is, the samples are already little endian
+ */
+static void raw_stream_adc_tap(void *context, const uint16_t *samples, uint16_t length) {
+	TRaw_stream *stream = context;
+	raw_stream_send(stream, RAW_STREAM_PACKET_ADC, stream->adc->channels_n, samples, length * sizeof(uint16_t));
+}
+
+/*
+ * @fn		static void raw_stream_pir_tap(void *context, bool rising, uint32_t time)
+ * @brief	Gathers an edge of the PIR, sending them when the packet is full
+ */
+static void raw_stream_pir_tap(void *context, bool rising, uint32_t time) {
+	TRaw_stream *stream = context;
+	uint8_t *edge = &stream->edges[stream->edges_n * RAW_STREAM_EDGE_SIZE];
+
+	raw_stream_put32(edge, time);
+	edge[4] = rising ? 1U : 0U;
+	if (++stream->edges_n == RAW_STREAM_MAX_EDGES) {
+		raw_stream_send_edges(stream);
+	}
+}
+
+/*
+ * @fn		static void raw_stream_expired(void *context)
+ * @brief	Callback of the periodic timer, the statistics are sent by the main loop
+ */
+static void raw_stream_expired(void *context) {
+	TRaw_stream *stream = context;
+	stream->due = TRUE;
+}
+
+/*
+ * @fn		static void raw_stream_set_baud(TRaw_stream *stream, uint32_t baud)
+ * @brief	Changes the rate of the UART once the last byte has left the line, the reception goes on
+ */
+static void raw_stream_set_baud(TRaw_stream *stream, uint32_t baud) {
+	UART_HandleTypeDef *huart = stream->huart;
+
+	while (__HAL_UART_GET_FLAG(huart, UART_FLAG_TC) == RESET) {
+	}
+	// HAL_UART_Init would abort the reception of the shell, the divider alone is written
+	huart->Init.BaudRate = baud;
+	huart->Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK1Freq(), baud);
+}
+
+/*
+ * @fn		void raw_stream_init(TRaw_stream *stream, UART_HandleTypeDef *huart, TAdc_stream *adc,
+ * 				TPIR_capture *capture)
+ * @brief	Initializes the stream, without starting it. The timer wheel must be initialized
+ * @param	stream		pointer to the TRaw_stream structure to initialize
+ * @param	huart		the UART of the console
+ * @param	adc			the stream of the ADC
+ * @param	capture		the capture of the PIR
+ */
+void raw_stream_init(TRaw_stream *stream, UART_HandleTypeDef *huart, TAdc_stream *adc, TPIR_capture *capture) {
+	stream->huart = huart;
+	stream->adc = adc;
+	stream->capture = capture;
+	stream->due = FALSE;
+	stream->running = FALSE;
+	stream->baud = RAW_STREAM_DEFAULT_BAUD;
+	stream->console_baud = huart->Init.BaudRate;
+	stream->lengths[0] = 0;
+	stream->lengths[1] = 0;
+	stream->frames[0] = 0;
+	stream->frames[1] = 0;
+	stream->fill = 0;
+	stream->busy = FALSE;
+	stream->appending = FALSE;
+	stream->sending = 0;
+	stream->edges_n = 0;
+	stream->sequence = 0;
+	stream->packets = 0;
+	stream->dropped = 0;
+	stream->bytes = 0;
+	stream->period_bytes = 0;
+	stream->start = 0;
+	stream->stop = 0;
+	timer_wheel_setup(&stream->timer, raw_stream_expired, stream);
+}
+
+/*
+ * @fn		int raw_stream_start(TRaw_stream *stream, uint32_t baud)
+ * @brief	Waits for the console to be free, mutes it and starts sending the packets at the given rate
+ * @param	stream		pointer to the TRaw_stream structure
+ * @param	baud		the rate, from RAW_STREAM_MIN_BAUD to a sixteenth of the clock of the UART
+ * @retval	RAW_STREAM_OK, RAW_STREAM_ERR_BUSY if the stream runs, RAW_STREAM_ERR_INVALID if the rate is out of range
+ */
+int raw_stream_start(TRaw_stream *stream, uint32_t baud) {
+	if (stream->running) {
+		return RAW_STREAM_ERR_BUSY;
+	}
+	if (baud < RAW_STREAM_MIN_BAUD || baud > HAL_RCC_GetPCLK1Freq() / 16U) {
+		return RAW_STREAM_ERR_INVALID;
+	}
+
+	free_console();
+	mute_console(TRUE);
+	stream->console_baud = stream->huart->Init.BaudRate;
+	raw_stream_set_baud(stream, baud);
+
+	stream->baud = baud;
+	stream->due = FALSE;
+	stream->fill = 0;
+	stream->lengths[1] = 0;
+	stream->frames[1] = 0;
+	stream->busy = FALSE;
+	stream->edges_n = 0;
+	stream->sequence = 0;
+	stream->packets = 0;
+	stream->dropped = 0;
+	stream->bytes = 0;
+	stream->period_bytes = 0;
+	stream->start = HAL_GetTick();
+
+	// a zero first, so the receiver drops whatever it got before the first packet
+	stream->buffers[0][0] = 0;
+	stream->lengths[0] = 1;
+	stream->frames[0] = 0;
+
+	running_stream = stream;
+	stream->running = TRUE;
+	adc_stream_set_tap(stream->adc, raw_stream_adc_tap, stream);
+	PIR_capture_set_tap(stream->capture, raw_stream_pir_tap, stream);
+	timer_wheel_start(&stream->timer, RAW_STREAM_STATS_PERIOD, RAW_STREAM_STATS_PERIOD);
+	return RAW_STREAM_OK;
+}
+
+/*
+ * @fn		void raw_stream_stop(TRaw_stream *stream)
+ * @brief	Sends the last edges and statistics, waits for the buffers to be sent,
+ * 			and restores the console at its rate
+ * @param	stream		pointer to the TRaw_stream structure
+ */
+void raw_stream_stop(TRaw_stream *stream) {
+	if (!stream->running) {
+		return;
+	}
+
+	adc_stream_set_tap(stream->adc, NULL, NULL);
+	PIR_capture_set_tap(stream->capture, NULL, NULL);
+	timer_wheel_cancel(&stream->timer);
+	stream->due = FALSE;
+	if (stream->edges_n > 0) {
+		raw_stream_send_edges(stream);
+	}
+	raw_stream_send_stats(stream);
+
+	// the interrupt sends the buffer left after the current one
+	while (stream->busy || stream->lengths[stream->fill] != 0) {
+	}
+	stream->stop = HAL_GetTick();
+	stream->running = FALSE;
+	running_stream = NULL;
+
+	raw_stream_set_baud(stream, stream->console_baud);
+	mute_console(FALSE);
+}
+
+/*
+ * @fn		bool raw_stream_transmit_callback(UART_HandleTypeDef *huart)
+ * @brief	Starts sending the next buffer. It must be called by HAL_UART_TxCpltCallback
+ * @param	huart		the UART of the callback
+ * @retval	TRUE if the transfer belonged to the running stream, FALSE otherwise
+ */
+bool raw_stream_transmit_callback(UART_HandleTypeDef *huart) {
+	TRaw_stream *stream = running_stream;
+
+	if (stream == NULL || huart != stream->huart || !stream->busy) {
+		return FALSE;
+	}
+
+	stream->busy = FALSE;
+	stream->bytes += stream->sending;
+	stream->period_bytes += stream->sending;
+	if (!stream->appending) {
+		raw_stream_kick(stream);
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		void raw_stream_process(TRaw_stream *stream)
+ * @brief	Sends the edges gathered and the statistics when they are due. It must be called by the main loop
+ * @param	stream		pointer to the TRaw_stream structure
+ */
+void raw_stream_process(TRaw_stream *stream) {
+	if (!stream->running) {
+		return;
+	}
+
+	if (stream->edges_n > 0) {
+		raw_stream_send_edges(stream);
+	}
+	if (stream->due) {
+		stream->due = FALSE;
+		raw_stream_send_stats(stream);
+	}
+}
+
+/*
+ * @fn		bool raw_stream_is_pending(TRaw_stream *stream)
+ * @brief	Tells if some edges or the statistics are waiting for raw_stream_process
+ * @param	stream		pointer to the TRaw_stream structure
+ * @retval	TRUE if raw_stream_process has something to do, FALSE otherwise
+ */
+bool raw_stream_is_pending(TRaw_stream *stream) {
+	return stream->running && (stream->edges_n > 0 || stream->due);
+}
+
+static void raw_stream_command(TShell *shell, void *context, char *args) {
+	TRaw_stream *stream = context;
+	char *action = shell_next_token(&args);
+	char *baud = shell_next_token(&args);
+
+	if (action != NULL && strcmp(action, "on") == 0) {
+		uint32_t rate = (baud != NULL) ? strtoul(baud, NULL, 10) : RAW_STREAM_DEFAULT_BAUD;
+
+		if (stream->running) {
+			return;
+		}
+		if (rate < RAW_STREAM_MIN_BAUD || rate > HAL_RCC_GetPCLK1Freq() / 16U) {
+			shell_print(shell, "Rate from %lu to %lu baud\r\n", RAW_STREAM_MIN_BAUD, HAL_RCC_GetPCLK1Freq() / 16U);
+			return;
+		}
+		// the last message of the console, at its rate
+		shell_print(shell, "Streaming at %lu baud, send \"stream off\" at that rate to stop\r\n", rate);
+		raw_stream_start(stream, rate);
+		return;
+	}
+	if (action != NULL && strcmp(action, "off") == 0) {
+		raw_stream_stop(stream);
+	} else if (action != NULL) {
+		shell_print(shell, "Usage: stream [on [baud] | off]\r\n");
+		return;
+	}
+
+	if (stream->running || stream->stop == stream->start) {
+		shell_print(shell, "%s, no stream yet\r\n", stream->running ? "running" : "stopped");
+		return;
+	}
+
+	// the statistics of the last stream, the UART use is the mean over its whole duration
+	uint32_t duration = stream->stop - stream->start;
+	uint64_t usage = (uint64_t) stream->bytes * 10U * 1000U * 1000U / ((uint64_t) stream->baud * duration);
+	uint32_t loss = (stream->packets != 0) ? (uint32_t) ((uint64_t) stream->dropped * 1000U / stream->packets) : 0;
+
+	shell_print(shell, "last stream at %lu baud for %lu ms\r\n", stream->baud, duration);
+	shell_print(shell, "packets %lu, dropped %lu (%lu.%lu%%), bytes %lu, UART busy %lu.%lu%%\r\n", stream->packets,
+			stream->dropped, loss / 10U, loss % 10U, stream->bytes, (uint32_t) usage / 10U, (uint32_t) usage % 10U);
+}
+
+/*
+ * @fn		void raw_stream_register_commands(TRaw_stream *stream, TShell *shell)
+ * @brief	Adds to the shell the command stream [on [baud] | off], that starts or stops the stream,
+ * 			and shows the losses and the use of the UART of the last one
+ * @param	stream		pointer to the TRaw_stream structure
+ * @param	shell		pointer to the TShell structure
+ */
+void raw_stream_register_commands(TRaw_stream *stream, TShell *shell) {
+	shell_register_command(shell, "stream", "[on [baud] | off] streams the raw ADC samples and PIR edges in binary"
+			" packets", raw_stream_command, stream);
+}
@@ -0,0 +1,325 @@
+/*
+ * This module keeps the sensors of the system in a static registry, behind a common interface.
+ * Every sensor type offers a table of operations (activate, deactivate, poll, state, stats, signal), and every
+ * instance is registered once during the initialization with its name and the zones it belongs to.
+ * The keypad, the logger, the main loop and the interrupts then work on zones through the registry,
+ * without knowing which sensors are installed.
+ * Arming a zone applies the timing profile of the zone to its sensors, and activates them after the exit delay.
+ */
+
+#include "sensor_registry.h"
+
+static TSensor sensors[SENSOR_REGISTRY_SIZE];
+static uint8_t sensors_n = 0;
+
+/* Severity of the states, indexed by TAlarmState, used to choose the state shown for a zone */
+static const uint8_t state_severity[] = { 0, 1, 3, 2 };
+
+/* Names of the states, indexed by TAlarmState */
+static const char *const state_names[] = { "Inactive", "Active", "Alarmed", "Delayed" };
+
+static void sensor_registry_exit_expired(void *context);
+
+/*
+ * @fn		void sensor_registry_init()
+ * @brief	Empties the registry. It must be called before any sensor is added.
+ */
+void sensor_registry_init() {
+	memset(sensors, 0, sizeof(sensors));
+	sensors_n = 0;
+}
+
+/*
+ * @fn		int sensor_registry_add(const TSensor_ops *ops, void *instance, const char *name, uint16_t zones)
+ * @brief	Adds a sensor, already initialized, to the registry
+ * @param	ops			the operations of the type of the sensor
+ * @param	instance	the structure of the sensor
+ * @param	name		name of the sensor, it must be a constant string
+ * @param	zones		mask of the zones of the sensor
+ * @retval	SENSOR_REGISTRY_ERR_INVALID if a mandatory operation is missing,
+ * 			SENSOR_REGISTRY_ERR_FULL if there are already SENSOR_REGISTRY_SIZE sensors,
+ * 			the index of the sensor otherwise
+ */
+int sensor_registry_add(const TSensor_ops *ops, void *instance, const char *name, uint16_t zones) {
+	if (ops == NULL || ops->activate == NULL || ops->deactivate == NULL || ops->state == NULL
+			|| ops->stats == NULL) {
+		return SENSOR_REGISTRY_ERR_INVALID;
+	}
+	if (sensors_n >= SENSOR_REGISTRY_SIZE) {
+		return SENSOR_REGISTRY_ERR_FULL;
+	}
+
+	TSensor *sensor = &sensors[sensors_n];
+	sensor->ops = ops;
+	sensor->instance = instance;
+	sensor->name = name;
+	sensor->zones = zones;
+	timer_wheel_setup(&sensor->exit_timer, sensor_registry_exit_expired, sensor);
+	return sensors_n++;
+}
+
+/*
+ * @fn		uint8_t sensor_registry_count()
+ * @brief	Returns the number of sensors in the registry
+ */
+uint8_t sensor_registry_count() {
+	return sensors_n;
+}
+
+/*
+ * @fn		const TSensor* sensor_registry_get(uint8_t index)
+ * @brief	Returns a sensor of the registry
+ * @param	index	the index of the sensor, from 0 to sensor_registry_count() - 1
+ * @retval	the sensor, NULL if index is out of range
+ */
+const TSensor* sensor_registry_get(uint8_t index) {
+	return (index < sensors_n) ? &sensors[index] : NULL;
+}
+
+/*
+ * @fn		int sensor_registry_find(const void *instance)
+ * @brief	Returns the index of a sensor from its structure
+ * @param	instance	the structure given to sensor_registry_add()
+ * @retval	the index of the sensor, SENSOR_REGISTRY_ERR_INVALID if it is not in the registry
+ */
+int sensor_registry_find(const void *instance) {
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if (sensors[i].instance == instance) {
+			return i;
+		}
+	}
+	return SENSOR_REGISTRY_ERR_INVALID;
+}
+
+/*
+ * @fn		void sensor_registry_activate(uint16_t zones)
+ * @brief	Arms the sensors belonging to at least one of the given zones: every sensor takes the entry delay and
+ * 			the duration of the profile of its zones, and it is activated when the exit delay of the profile ends
+ * @param	zones	mask of the zones
+ */
+void sensor_registry_activate(uint16_t zones) {
+	// the states and the timers of the sensors are shared with the interrupts
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		TSensor *sensor = &sensors[i];
+		if ((sensor->zones & zones) == 0) {
+			continue;
+		}
+
+		const TZone_profile *profile = zone_profile_get(sensor->zones);
+		if (sensor->ops->set_timing != NULL) {
+			sensor->ops->set_timing(sensor->instance, profile->entry_delay, profile->duration);
+		}
+		if (profile->exit_delay == 0) {
+			timer_wheel_cancel(&sensor->exit_timer);
+			sensor->ops->activate(sensor->instance);
+		} else {
+			// the sensor doesn't watch while the user is going out
+			sensor->ops->deactivate(sensor->instance);
+			timer_wheel_start(&sensor->exit_timer, profile->exit_delay, 0);
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		void sensor_registry_deactivate(uint16_t zones)
+ * @brief	Deactivates the sensors belonging to at least one of the given zones, also the ones still in the exit delay
+ * @param	zones	mask of the zones
+ */
+void sensor_registry_deactivate(uint16_t zones) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if ((sensors[i].zones & zones) != 0) {
+			timer_wheel_cancel(&sensors[i].exit_timer);
+			sensors[i].ops->deactivate(sensors[i].instance);
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		static void sensor_registry_exit_expired(void *context)
+ * @brief	Callback of the exit timer of a sensor: the exit delay is over, the sensor starts watching
+ */
+static void sensor_registry_exit_expired(void *context) {
+	TSensor *sensor = context;
+	sensor->ops->activate(sensor->instance);
+}
+
+/*
+ * @fn		void sensor_registry_poll()
+ * @brief	Polls all the sensors. It must be called in the main loop.
+ */
+void sensor_registry_poll() {
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if (sensors[i].ops->poll != NULL) {
+			sensors[i].ops->poll(sensors[i].instance);
+		}
+	}
+}
+
+/*
+ * @fn		bool sensor_registry_is_idle()
+ * @brief	Tells if no sensor needs to be polled
+ * @retval	TRUE if all the sensors are idle, FALSE otherwise
+ */
+bool sensor_registry_is_idle() {
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if (sensors[i].ops->busy != NULL && sensors[i].ops->busy(sensors[i].instance)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		bool sensor_registry_is_disarmed()
+ * @brief	Tells if every sensor is inactive, none of them waiting for the end of its exit delay
+ * @retval	TRUE if every zone is disarmed, FALSE otherwise
+ */
+bool sensor_registry_is_disarmed() {
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if (sensors[i].ops->state(sensors[i].instance) != ALARM_STATE_INACTIVE
+				|| timer_wheel_is_running(&sensors[i].exit_timer)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * @fn		void sensor_registry_signal(void *source)
+ * @brief	Forwards an interrupt shared by the sensors to all of them, e.g. the ADC watchdog.
+ * 			Should be called only by the interrupt callbacks.
+ * @param	source	the handle of the peripheral that raised the interrupt
+ */
+void sensor_registry_signal(void *source) {
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if (sensors[i].ops->signal != NULL) {
+			sensors[i].ops->signal(sensors[i].instance, source);
+		}
+	}
+}
+
+/*
+ * @fn		TAlarmState sensor_registry_get_state(uint16_t zones)
+ * @brief	Returns the most severe state among the sensors of the given zones
+ * @param	zones	mask of the zones
+ * @retval	the state, ALARM_STATE_INACTIVE if the zones have no sensor
+ */
+TAlarmState sensor_registry_get_state(uint16_t zones) {
+	TAlarmState worst = ALARM_STATE_INACTIVE;
+
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if ((sensors[i].zones & zones) == 0) {
+			continue;
+		}
+		TAlarmState state = sensors[i].ops->state(sensors[i].instance);
+		if (state_severity[state] > state_severity[worst]) {
+			worst = state;
+		}
+	}
+	return worst;
+}
+
+/*
+ * @fn		uint16_t sensor_registry_get_duty(uint16_t zones)
+ * @brief	Returns the highest activity duty cycle among the sensors of the given zones
+ * @param	zones	mask of the zones
+ * @retval	the duty cycle, in thousandths
+ */
+uint16_t sensor_registry_get_duty(uint16_t zones) {
+	uint16_t duty = 0;
+
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if ((sensors[i].zones & zones) == 0) {
+			continue;
+		}
+		TSensor_stats stats;
+		sensors[i].ops->stats(sensors[i].instance, &stats);
+		if (stats.duty > duty) {
+			duty = stats.duty;
+		}
+	}
+	return duty;
+}
+
+/*
+ * @fn		void sensor_registry_get_string_state(uint16_t zones, char *state)
+ * @brief	Sets in state the most severe state among the sensors of the given zones, as a string
+ * @param	zones	mask of the zones
+ * @param	state	reference to the buffer, of at least SENSOR_STATE_STRING_LENGTH characters, where to write the state
+ */
+void sensor_registry_get_string_state(uint16_t zones, char *state) {
+	strncpy(state, state_names[sensor_registry_get_state(zones)], SENSOR_STATE_STRING_LENGTH - 1U);
+	state[SENSOR_STATE_STRING_LENGTH - 1U] = '\0';
+}
+
+/*
+ * @fn		void sensor_registry_get_string_rates(uint16_t zones, char *rates, size_t size)
+ * @brief	Writes in rates, for every sensor of the given zones, its name, the peak rate of its inputs and its storms,
+ * 			e.g. "pir PA1 40/s 1 storms", separated by commas. "none" if the zones have no sensor
+ * @param	zones	mask of the zones
+ * @param	rates	reference to the buffer where to write the rates
+ * @param	size	size of the buffer, the rates that don't fit are left out
+ */
+void sensor_registry_get_string_rates(uint16_t zones, char *rates, size_t size) {
+	size_t length = 0;
+
+	rates[0] = '\0';
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		if ((sensors[i].zones & zones) == 0) {
+			continue;
+		}
+		TSensor_stats stats;
+		sensors[i].ops->stats(sensors[i].instance, &stats);
+
+		int written = snprintf(&rates[length], size - length, "%s%s %lu/s %lu storms", (length == 0) ? "" : ", ",
+				sensors[i].name, (unsigned long) stats.peak_rate, (unsigned long) stats.storms);
+		if (written < 0 || (size_t) written >= size - length) {
+			// the last one is cut: it is removed
+			rates[length] = '\0';
+			break;
+		}
+		length += written;
+	}
+
+	if (length == 0) {
+		strncpy(rates, "none", size - 1U);
+		rates[size - 1U] = '\0';
+	}
+}
+
+static void sensor_registry_command(TShell *shell, void *context, char *args) {
+	shell_print(shell, "%-3s %-12s %-6s %-9s %9s %7s %6s %7s\r\n", "id", "name", "zones", "state", "events", "alarms",
+			"duty%", "rate");
+
+	for (uint8_t i = 0; i < sensors_n; i++) {
+		TSensor *sensor = &sensors[i];
+		TSensor_stats stats;
+
+		// the state, the timer and the statistics are updated by the interrupts, they are read together
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		TAlarmState state = sensor->ops->state(sensor->instance);
+		bool exiting = timer_wheel_is_running(&sensor->exit_timer);
+		sensor->ops->stats(sensor->instance, &stats);
+		__set_PRIMASK(primask);
+
+		shell_print(shell, "%-3u %-12s 0x%04x %-9s %9lu %7lu %4u.%u %7lu\r\n", i, sensor->name, sensor->zones,
+				exiting ? "Exiting" : state_names[state], stats.events, stats.alarms, stats.duty / 10U, stats.duty % 10U, stats.rate);
+	}
+}
+
+/*
+ * @fn		void sensor_registry_register_commands(TShell *shell)
+ * @brief	Adds to the shell the command sensors, that shows the zones, the state and the counters of every sensor
+ * @param	shell	pointer to the TShell structure
+ */
+void sensor_registry_register_commands(TShell *shell) {
+	shell_register_command(shell, "sensors", "shows the state of the registered sensors",
+			sensor_registry_command, NULL);
+}
@@ -0,0 +1,244 @@
+/*
+ * This module contains methods to handle the command line available on the console once the system is booted.
+ * The characters are received in interrupt mode and stored in a ring buffer, while the lines are parsed
+ * and executed by shell_process(), that must be called in the main loop: commands never run in interrupt context.
+ * To add a command, just call shell_register_command() during the initialization of the system.
+ */
+
+#include "shell.h"
+
+/* The shell receiving characters. Needed since the HAL callbacks only give back the UART handle */
+static TShell *running_shell = NULL;
+
+/*
+ * @fn		static void shell_help(TShell *shell, void *context, char *args)
+ * @brief	Prints the list of the registered commands
+ */
+static void shell_help(TShell *shell, void *context, char *args) {
+	for (uint8_t i = 0; i < shell->commands_n; i++) {
+		shell_print(shell, "%-12s %s\r\n", shell->commands[i].name, shell->commands[i].help);
+	}
+}
+
+/*
+ * @fn		static void shell_execute(TShell *shell, char *line)
+ * @brief	Looks for the command named by the first word of line and executes it
+ * @param	shell	pointer to the TShell structure
+ * @param	line	the received line
+ */
+static void shell_execute(TShell *shell, char *line) {
+	char *args = line;
+	char *name = shell_next_token(&args);
+
+	if (name == NULL) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < shell->commands_n; i++) {
+		if (strcmp(name, shell->commands[i].name) == 0) {
+			shell->commands[i].handler(shell, shell->commands[i].context, args);
+			return;
+		}
+	}
+
+	shell_print(shell, "%s%s", SHELL_MESSAGE_UNKNOWN_COMMAND, SHELL_NEWLINE);
+}
+
+/*
+ * @fn		void shell_init(TShell *shell, UART_HandleTypeDef *huart)
+ * @brief	Initializes the shell, registering the help command
+ * @param	shell	pointer to the TShell structure to initialize
+ * @param	huart	pointer to the UART_HandleTypeDef structure used to receive the commands
+ */
+void shell_init(TShell *shell, UART_HandleTypeDef *huart) {
+	shell->huart = huart;
+	shell->commands_n = 0;
+	shell->rx_head = 0;
+	shell->rx_tail = 0;
+	shell->rx_overflows = 0;
+	shell->line_length = 0;
+	shell->line_handler = NULL;
+	shell->line_context = NULL;
+	shell->running = FALSE;
+
+	shell_register_command(shell, "help", "shows this list", shell_help, NULL);
+}
+
+/*
+ * @fn		int shell_register_command(TShell *shell, const char *name, const char *help,
+ * 									TShell_handler handler, void *context)
+ * @brief	Adds a command to the shell. The strings are not copied, so they must be constant.
+ * @param	shell		pointer to the TShell structure
+ * @param	name		the word that must be typed to execute the command
+ * @param	help		a short description printed by the help command
+ * @param	handler		the function executing the command
+ * @param	context		pointer passed to handler as it is
+ * @retval	SHELL_ERR_FULL if SHELL_MAX_COMMANDS commands are already registered, SHELL_OK otherwise
+ */
+int shell_register_command(TShell *shell, const char *name, const char *help,
+		TShell_handler handler, void *context) {
+	if (shell->commands_n >= SHELL_MAX_COMMANDS) {
+		return SHELL_ERR_FULL;
+	}
+
+	TShell_command *command = &shell->commands[shell->commands_n++];
+	command->name = name;
+	command->help = help;
+	command->handler = handler;
+	command->context = context;
+	return SHELL_OK;
+}
+
+/*
+ * @fn		void shell_start(TShell *shell)
+ * @brief	Starts receiving characters. It must be called once the configuration is done,
+ * 			since the configuration reads the console in blocking mode.
+ * @param	shell	pointer to the TShell structure
+ */
+void shell_start(TShell *shell) {
+	running_shell = shell;
+	shell->running = TRUE;
+	HAL_UART_Receive_IT(shell->huart, &shell->rx_char, 1);
+}
+
+/*
+ * @fn		void shell_process(TShell *shell)
+ * @brief	Assembles the received characters in lines and executes them. It must be called in the main loop.
+ * @param	shell	pointer to the TShell structure
+ */
+void shell_process(TShell *shell) {
+	while (shell->rx_tail != shell->rx_head) {
+		char c = shell->rx_buffer[shell->rx_tail];
+		shell->rx_tail = (shell->rx_tail + 1) & (SHELL_RX_BUFFER_SIZE - 1);
+
+		if (c != '\r' && c != '\n') {
+			// the last character is kept for the terminator, so longer lines are truncated
+			if (shell->line_length < SHELL_LINE_LENGTH - 1) {
+				shell->line[shell->line_length++] = c;
+			}
+			continue;
+		}
+
+		if (shell->line_length == 0) {
+			// empty line or second character of a "\r\n" sequence
+			continue;
+		}
+
+		shell->line[shell->line_length] = '\0';
+		shell->line_length = 0;
+
+		if (shell->line_handler != NULL) {
+			if (!shell->line_handler(shell, shell->line_context, shell->line)) {
+				shell->line_handler = NULL;
+			}
+		} else {
+			shell_execute(shell, shell->line);
+		}
+	}
+}
+
+/*
+ * @fn		bool shell_has_input(TShell *shell)
+ * @brief	Tells if some received characters have not been processed yet
+ * @param	shell	pointer to the TShell structure
+ * @retval	TRUE if shell_process() has something to do, FALSE otherwise
+ */
+bool shell_has_input(TShell *shell) {
+	return shell->rx_tail != shell->rx_head;
+}
+
+/*
+ * @fn		void shell_set_line_handler(TShell *shell, TShell_line_handler handler, void *context)
+ * @brief	Redirects the next lines to handler until it returns FALSE. Useful for bulk transfers.
+ * @param	shell		pointer to the TShell structure
+ * @param	handler		the function that will receive the lines, NULL to give them back to the commands
+ * @param	context		pointer passed to handler as it is
+ */
+void shell_set_line_handler(TShell *shell, TShell_line_handler handler, void *context) {
+	shell->line_handler = handler;
+	shell->line_context = context;
+}
+
+/*
+ * @fn		void shell_print(TShell *shell, const char *format, ...)
+ * @brief	Formats a message as printf does and prints it on the console, waiting if it is not ready for use
+ * @param	shell	pointer to the TShell structure
+ * @param	format	the printf-like format string
+ */
+void shell_print(TShell *shell, const char *format, ...) {
+	va_list args;
+
+	// the output buffer may still be in use by the DMA
+	free_console();
+
+	va_start(args, format);
+	vsnprintf(shell->output, SHELL_OUTPUT_LENGTH, format, args);
+	va_end(args);
+
+	print_on_console(shell->output);
+}
+
+/*
+ * @fn		char* shell_next_token(char **args)
+ * @brief	Splits the next word out of a list of arguments separated by spaces or commas
+ * @param	args	pointer to the string of arguments, moved after the returned word
+ * @retval	the next word, or NULL if there are no more arguments
+ */
+char* shell_next_token(char **args) {
+	char *token = *args;
+
+	while (*token == ' ' || *token == ',') {
+		token++;
+	}
+	if (*token == '\0') {
+		*args = token;
+		return NULL;
+	}
+
+	char *end = token;
+	while (*end != '\0' && *end != ' ' && *end != ',') {
+		end++;
+	}
+	if (*end != '\0') {
+		*end++ = '\0';
+	}
+	*args = end;
+	return token;
+}
+
+/*
+ * @fn		bool shell_receive_callback(UART_HandleTypeDef *huart)
+ * @brief	Stores the received character and waits for the next one. Should be called only by the irq.
+ * @param	huart	pointer to the UART_HandleTypeDef structure that completed the reception
+ * @retval	TRUE if the character belonged to the running shell, FALSE otherwise
+ */
+bool shell_receive_callback(UART_HandleTypeDef *huart) {
+	TShell *shell = running_shell;
+
+	if (shell == NULL || huart != shell->huart) {
+		return FALSE;
+	}
+
+	uint16_t next = (shell->rx_head + 1) & (SHELL_RX_BUFFER_SIZE - 1);
+	if (next != shell->rx_tail) {
+		shell->rx_buffer[shell->rx_head] = shell->rx_char;
+		shell->rx_head = next;
+	} else {
+		shell->rx_overflows++;
+	}
+
+	HAL_UART_Receive_IT(shell->huart, &shell->rx_char, 1);
+	return TRUE;
+}
+
+/*
+ * If the UART stops the reception because of an error (e.g. an overrun while printing),
+ * the shell must start receiving again
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+	TShell *shell = running_shell;
+
+	if (shell != NULL && huart == shell->huart) {
+		HAL_UART_Receive_IT(shell->huart, &shell->rx_char, 1);
+	}
+}
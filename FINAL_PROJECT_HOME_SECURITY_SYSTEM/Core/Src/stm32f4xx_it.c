@@ -25,10 +25,15 @@
 /* USER CODE BEGIN Includes */
 #include "configuration.h"
 #include "rtc_ds1307.h"
-#include "pir_sensor.h"
-#include "photoresistor.h"
+#include "sensor_registry.h"
 #include "keypad.h"
 #include "logger.h"
+#include "latency.h"
+#include "exti_dispatcher.h"
+#include "timer_wheel.h"
+#include "idle.h"
+#include "adc_stream.h"
+#include "adc_calibration.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -51,8 +56,8 @@ extern uint8_t system_state;
 
 extern TKeypad keypad;
 extern TLogger logger;
-extern TPIR_sensor pir;
-extern TPhotoresistor photoresistor;
+extern TAdc_stream adc_stream;
+extern TAdc_calibration adc_calibration;
 
 extern uint8_t rtc_read_buffer[MAX_BUFFER_SIZE];
 
@@ -75,6 +80,9 @@ extern DMA_HandleTypeDef hdma_i2c1_rx;
 extern TIM_HandleTypeDef htim1;
 extern TIM_HandleTypeDef htim2;
 extern TIM_HandleTypeDef htim3;
+extern TIM_HandleTypeDef htim5;
+extern DMA_HandleTypeDef hdma_tim5_ch1;
+extern DMA_HandleTypeDef hdma_tim5_ch2;
 extern TIM_HandleTypeDef htim9;
 extern TIM_HandleTypeDef htim10;
 extern TIM_HandleTypeDef htim11;
@@ -197,7 +205,7 @@ void SysTick_Handler(void) {
 	/* USER CODE END SysTick_IRQn 0 */
 	HAL_IncTick();
 	/* USER CODE BEGIN SysTick_IRQn 1 */
-
+	idle_tick();
 	/* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -221,6 +229,32 @@ void DMA1_Stream0_IRQHandler(void) {
 	/* USER CODE END DMA1_Stream0_IRQn 1 */
 }
 
+/**
+ * @brief This function handles DMA1 stream2 global interrupt.
+ */
+void DMA1_Stream2_IRQHandler(void) {
+	/* USER CODE BEGIN DMA1_Stream2_IRQn 0 */
+
+	/* USER CODE END DMA1_Stream2_IRQn 0 */
+	HAL_DMA_IRQHandler(&hdma_tim5_ch1);
+	/* USER CODE BEGIN DMA1_Stream2_IRQn 1 */
+
+	/* USER CODE END DMA1_Stream2_IRQn 1 */
+}
+
+/**
+ * @brief This function handles DMA1 stream4 global interrupt.
+ */
+void DMA1_Stream4_IRQHandler(void) {
+	/* USER CODE BEGIN DMA1_Stream4_IRQn 0 */
+
+	/* USER CODE END DMA1_Stream4_IRQn 0 */
+	HAL_DMA_IRQHandler(&hdma_tim5_ch2);
+	/* USER CODE BEGIN DMA1_Stream4_IRQn 1 */
+
+	/* USER CODE END DMA1_Stream4_IRQn 1 */
+}
+
 /**
  * @brief This function handles DMA1 stream5 global interrupt.
  */
@@ -341,6 +375,19 @@ void USART2_IRQHandler(void) {
 	/* USER CODE END USART2_IRQn 1 */
 }
 
+/**
+ * @brief This function handles TIM5 global interrupt.
+ */
+void TIM5_IRQHandler(void) {
+	/* USER CODE BEGIN TIM5_IRQn 0 */
+
+	/* USER CODE END TIM5_IRQn 0 */
+	HAL_TIM_IRQHandler(&htim5);
+	/* USER CODE BEGIN TIM5_IRQn 1 */
+
+	/* USER CODE END TIM5_IRQn 1 */
+}
+
 /**
  * @brief This function handles DMA2 stream0 global interrupt.
  */
@@ -355,35 +402,52 @@ void DMA2_Stream0_IRQHandler(void) {
 }
 
 /* USER CODE BEGIN 1 */
-void EXTI4_IRQHandler(void) {
+void EXTI0_IRQHandler(void) {
 	/*
-	 * This interrupt is fired when the PIR sensor changes state. Since we are interested
-	 * in the change state, the interrupt is fired both on rising and falling edge.
+	 * The lines 0-4 and 5-9 are used by the PIR zones. Since we are interested in the change of state,
+	 * the interrupts are fired both on rising and falling edge. Every zone registered its handler in the dispatcher.
 	 */
-	PIR_sensor_handler(&pir);
+	exti_dispatcher_dispatch(GPIO_PIN_0);
 }
 
-void EXTI15_10_IRQHandler(void) {
-	HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_13);
-	HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_12);
-	HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_14);
-	HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_15);
+void EXTI1_IRQHandler(void) {
+	exti_dispatcher_dispatch(GPIO_PIN_1);
 }
 
-void HAL_GPIO_EXTI_Callback(uint16_t pin) {
-	/* When the pin that triggered the interrupt is associated to the keypad, call the function that manages the pression */
-	if (pin & (GPIO_PIN_12 | GPIO_PIN_13 | GPIO_PIN_14 | GPIO_PIN_15)) {
-		KEYPAD_key_pressed(&keypad, pin);
-	}
+void EXTI2_IRQHandler(void) {
+	exti_dispatcher_dispatch(GPIO_PIN_2);
+}
+
+void EXTI3_IRQHandler(void) {
+	exti_dispatcher_dispatch(GPIO_PIN_3);
+}
+
+void EXTI4_IRQHandler(void) {
+	exti_dispatcher_dispatch(GPIO_PIN_4);
+}
+
+void EXTI9_5_IRQHandler(void) {
+	exti_dispatcher_dispatch(EXTI_DISPATCHER_LINES_9_5);
+}
+
+void EXTI15_10_IRQHandler(void) {
+	/*
+	 * The lines 12-15 are the rows of the keypad: the pending register is read once and the handler
+	 * registered by the keypad is called for every pending row, that marks the edge of its latency
+	 */
+	exti_dispatcher_dispatch(EXTI_DISPATCHER_LINES_15_10);
 }
 
 void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
 	/*
 	 * When the reception from the RTC is completed, before assigning the values read to the buffer,
 	 * they must be converted in decimal.
-	 * Last, it writes on the console the proper log message.
+	 * Last, it writes on the console the proper log message, unless it has already been written
+	 * because the RTC was not responding.
 	 */
 	if (hi2c->Instance == I2C1) {
+		bool late = health_is_raised(HEALTH_FAULT_RTC_TIMEOUT);
+		health_rtc_response(TRUE);
 		TConfiguration *configuration = get_configuration();
 		TDatetime *datetime = configuration->datetime;
 		datetime->second = bcd2Dec(rtc_read_buffer[0]);
@@ -393,12 +457,19 @@ void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
 		datetime->date = bcd2Dec(rtc_read_buffer[4]);
 		datetime->month = bcd2Dec(rtc_read_buffer[5]);
 		datetime->year = bcd2Dec(rtc_read_buffer[6]);
-		if (configuration->done) {
+		if (configuration->done && !late) {
 			logger_callback(&logger);
 		}
 	}
 }
 
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+	/* A failed reading of the datetime raises the RTC fault, the next readings will probe the RTC again */
+	if (hi2c->Instance == I2C1) {
+		health_rtc_response(FALSE);
+	}
+}
+
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
 	if (htim->Instance == TIM1) {
 		/*
@@ -407,64 +478,31 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
 		 */
 		TConfiguration *configuration = get_configuration();
 		configuration->done = TRUE;
-	} else if (htim->Instance == TIM10) {
-		/*
-		 * TIM10 lasts 10 seconds.
-		 * When this time has passed, a new log message is printed, and the user LED is toggled also
-		 */
-		logger_print(&logger, "\0");
-		if (system_state == SYSTEM_STATE_ENABLED) {
-			HAL_GPIO_TogglePin(GPIOA, GPIO_PIN_5);
-		}
-	} else if (htim->Instance == keypad.timer->Instance) {
-		/*
-		 * TIM11 lasts 70ms and it's assigned to the keypad, used to prevent bouncing of the keypad.
-		 * It is started when a button is pressed and stopped right after the timer routine is executed
-		 */
-		KEYPAD_time_elapsed(&keypad);
-	} else if (htim->Instance == photoresistor.htim->Instance) {
-		/*
-		 * TIM2 lasts 0.05 seconds.
-		 * When this time has passed, the current state of the photoresistor is checked and
-		 * if alarm delay/duration has passed, then the state of the photoresistor is changed.
-		 * Moreover, if the current state of the photoresistor is delayed/active,
-		 * the ADC must work and read a new value from the photoresistor
-		 */
-		TAlarmState state = photoresistor.state;
-		if (state == ALARM_STATE_DELAYED || state == ALARM_STATE_ALARMED) {
-			photoresistor.counter += 1;
-			if (state == ALARM_STATE_DELAYED &&
-					photoresistor.counter == photoresistor.alarm_delay * ALARM_COUNTER_FACTOR) {
-				photoresistor_change_state(&photoresistor, ALARM_STATE_ALARMED);
-			} else if (state == ALARM_STATE_ALARMED &&
-					photoresistor.counter == photoresistor.alarm_duration * ALARM_COUNTER_FACTOR) {
-				photoresistor_change_state(&photoresistor, ALARM_STATE_ACTIVE);
-			}
-		}
-
-		if (state == ALARM_STATE_ACTIVE || state == ALARM_STATE_DELAYED) {
-			HAL_ADC_Start_DMA(photoresistor.hadc, &photoresistor.value, 1);
-			// HAL_ADC_Start_IT(photoresistor.hadc);
-		}
-	} else if (htim->Instance == pir.timer->Instance) {
-		/*
-		 * TIM9 lasts 1 second and it's assigned to the PIR sensor.
-		 * It is started when the sensor goes in a delayed state and lasts until the delay or the alarm stops.
-		 */
-		PIR_time_elapsed(&pir);
 	}
+	/*
+	 * The delays and the durations of the sensors, the debouncing of the keypad and the periodic log
+	 * are software timers, driven by the SysTick: see timer_wheel_tick()
+	 */
 }
 
-void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef *hadc) {
-	/* If the ADC watchdog is fired, the current state of the photoresistor is checked and its state is changed */
-	if (hadc->Instance == photoresistor.hadc->Instance) {
-		if (photoresistor.state == ALARM_STATE_ACTIVE) {
-			photoresistor_change_state(&photoresistor, ALARM_STATE_DELAYED);
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc) {
+	/* The DMA has filled the first half of the buffer of the stream, it goes on with the second one */
+	adc_stream_half_complete(&adc_stream, hadc);
+}
 
-		} else if (photoresistor.state == ALARM_STATE_DELAYED) {
-			photoresistor_change_state(&photoresistor, ALARM_STATE_ACTIVE);
-		}
-	}
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc) {
+	/* The DMA has filled the second half of the buffer of the stream, it starts again from the first one */
+	adc_stream_complete(&adc_stream, hadc);
+}
+
+void HAL_ADCEx_InjectedConvCpltCallback(ADC_HandleTypeDef *hadc) {
+	/* VREFINT or the temperature sensor has been converted between two scans of the stream */
+	adc_calibration_complete(&adc_calibration, hadc);
+}
+
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef *hadc) {
+	/* The ADC watchdog is forwarded to the sensors, each one checks if it owns the ADC */
+	sensor_registry_signal(hadc);
 }
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,258 @@
+/*
+ * This module offers software timers, all driven by the SysTick interrupt of the HAL (1 ms).
+ * The timers are kept in a hierarchical timing wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots,
+ * where every slot of a level spans a whole revolution of the level below. A timer is linked in the slot of its
+ * expiration time at the lowest level that can hold it, and it is moved to the lower levels while its time comes closer.
+ * So starting, cancelling and expiring a timer take a constant time, whatever the number of running timers.
+ * The callbacks of the expired timers are executed by timer_wheel_tick(), in the SysTick interrupt.
+ * The earliest expiration is kept up to date when the timers are started, and found again only after it is consumed,
+ * so the system can sleep until exactly that moment.
+ */
+
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_SLOT_MASK	(TIMER_WHEEL_SLOTS - 1U)
+
+static TTimer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+/* Ticks since the initialization of the wheel */
+static volatile uint32_t now = 0;
+
+/*
+ * Earliest expiration of the running timers, valid while next_known is TRUE, none if next_none is TRUE.
+ * Starting a timer can only bring it forward, so it is found again by timer_wheel_next_deadline() only after
+ * the timer holding it has expired or it has been cancelled.
+ */
+static uint32_t next_expires = 0;
+static bool next_known = TRUE;
+static bool next_none = TRUE;
+
+/*
+ * @fn		static void timer_wheel_forget(TTimer *timer)
+ * @brief	Forgets the earliest expiration if it belongs to a timer leaving the wheel
+ */
+static void timer_wheel_forget(TTimer *timer) {
+	if (next_known && !next_none && timer->expires == next_expires) {
+		next_known = FALSE;
+	}
+}
+
+/*
+ * @fn		static void timer_wheel_link(TTimer **head, TTimer *timer)
+ * @brief	Links a timer at the head of a list
+ */
+static void timer_wheel_link(TTimer **head, TTimer *timer) {
+	timer->next = *head;
+	if (timer->next != NULL) {
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = head;
+	*head = timer;
+}
+
+/*
+ * @fn		static void timer_wheel_unlink(TTimer *timer)
+ * @brief	Removes a timer from its list
+ */
+static void timer_wheel_unlink(TTimer *timer) {
+	*(timer->pprev) = timer->next;
+	if (timer->next != NULL) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/*
+ * @fn		static void timer_wheel_insert(TTimer *timer)
+ * @brief	Links a timer in the slot of its expiration time, at the lowest level that can hold it
+ */
+static void timer_wheel_insert(TTimer *timer) {
+	uint32_t delta = timer->expires - now;
+	uint8_t level = 0;
+
+	while (level < TIMER_WHEEL_LEVELS - 1U && delta >= (1UL << (TIMER_WHEEL_SLOT_BITS * (level + 1U)))) {
+		level++;
+	}
+
+	uint8_t shift = TIMER_WHEEL_SLOT_BITS * level;
+	uint32_t slot;
+	if (delta < TIMER_WHEEL_SPAN) {
+		slot = (timer->expires >> shift) & TIMER_WHEEL_SLOT_MASK;
+	} else {
+		// too far: park it in the last slot of the wheel, it will be inserted again when that slot is cascaded
+		slot = ((now >> shift) + TIMER_WHEEL_SLOT_MASK) & TIMER_WHEEL_SLOT_MASK;
+	}
+
+	timer_wheel_link(&slots[level][slot], timer);
+}
+
+/*
+ * @fn		static void timer_wheel_cascade(uint8_t level)
+ * @brief	Moves the timers of the current slot of a level to the lower levels
+ */
+static void timer_wheel_cascade(uint8_t level) {
+	uint32_t slot = (now >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+	TTimer *timer = slots[level][slot];
+
+	slots[level][slot] = NULL;
+	while (timer != NULL) {
+		TTimer *next = timer->next;
+		timer_wheel_insert(timer);
+		timer = next;
+	}
+}
+
+/*
+ * @fn		void timer_wheel_init()
+ * @brief	Empties the wheel. It must be called before any timer is started.
+ */
+void timer_wheel_init() {
+	memset(slots, 0, sizeof(slots));
+	now = 0;
+	next_known = TRUE;
+	next_none = TRUE;
+}
+
+/*
+ * @fn		void timer_wheel_setup(TTimer *timer, TTimer_callback callback, void *context)
+ * @brief	Initializes a stopped timer
+ * @param	timer		pointer to the TTimer structure to initialize
+ * @param	callback	the function executed when the timer expires
+ * @param	context		pointer passed to callback as it is
+ */
+void timer_wheel_setup(TTimer *timer, TTimer_callback callback, void *context) {
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->expires = 0;
+	timer->period = 0;
+	timer->callback = callback;
+	timer->context = context;
+}
+
+/*
+ * @fn		void timer_wheel_start(TTimer *timer, uint32_t delay, uint32_t period)
+ * @brief	Starts a timer, or restarts it if it is already running
+ * @param	timer	pointer to the TTimer structure
+ * @param	delay	milliseconds before the first expiration. 0 is the same as 1
+ * @param	period	milliseconds between the following expirations, 0 if the timer must expire once
+ */
+void timer_wheel_start(TTimer *timer, uint32_t delay, uint32_t period) {
+	// the wheel is shared with the SysTick interrupt, and this may be called with the interrupts already disabled
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (timer->pprev != NULL) {
+		timer_wheel_forget(timer);
+		timer_wheel_unlink(timer);
+	}
+	timer->expires = now + ((delay == 0) ? 1U : delay);
+	timer->period = period;
+	timer_wheel_insert(timer);
+
+	if (next_known && (next_none || (int32_t) (timer->expires - next_expires) < 0)) {
+		next_expires = timer->expires;
+		next_none = FALSE;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		void timer_wheel_cancel(TTimer *timer)
+ * @brief	Stops a timer. Nothing is done if the timer is not running
+ * @param	timer	pointer to the TTimer structure
+ */
+void timer_wheel_cancel(TTimer *timer) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (timer->pprev != NULL) {
+		timer_wheel_forget(timer);
+		timer_wheel_unlink(timer);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * @fn		bool timer_wheel_is_running(TTimer *timer)
+ * @brief	Tells if a timer is running
+ * @param	timer	pointer to the TTimer structure
+ * @retval	TRUE if the timer is running, FALSE otherwise
+ */
+bool timer_wheel_is_running(TTimer *timer) {
+	return timer->pprev != NULL;
+}
+
+/*
+ * @fn		uint32_t timer_wheel_next_deadline()
+ * @brief	Returns the milliseconds before the earliest expiration of the running timers
+ * @retval	the milliseconds, at least 1, TIMER_WHEEL_SPAN if no timer is running
+ */
+uint32_t timer_wheel_next_deadline() {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (!next_known) {
+		// the timers parked beyond the span keep their real expiration, so the scan is exact
+		uint32_t earliest = TIMER_WHEEL_SPAN;
+		next_none = TRUE;
+		for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+			for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+				for (TTimer *timer = slots[level][slot]; timer != NULL; timer = timer->next) {
+					if (next_none || timer->expires - now < earliest) {
+						earliest = timer->expires - now;
+						next_expires = timer->expires;
+						next_none = FALSE;
+					}
+				}
+			}
+		}
+		next_known = TRUE;
+	}
+	uint32_t deadline = next_none ? TIMER_WHEEL_SPAN : next_expires - now;
+
+	__set_PRIMASK(primask);
+	return deadline;
+}
+
+/*
+ * @fn		void timer_wheel_tick()
+ * @brief	Advances the wheel by one millisecond and executes the callbacks of the expired timers.
+ * 			Should be called only by the SysTick interrupt.
+ */
+void timer_wheel_tick() {
+	now++;
+	if (next_known && !next_none && now == next_expires) {
+		next_known = FALSE;
+	}
+
+	// when a level completes a revolution, the next slot of the level above is spread on it
+	for (uint8_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		if ((now & ((1UL << (TIMER_WHEEL_SLOT_BITS * level)) - 1U)) != 0) {
+			break;
+		}
+		timer_wheel_cascade(level);
+	}
+
+	// the expired timers are moved to their own list, so the callbacks can start and cancel any timer
+	TTimer *expired = NULL;
+	TTimer **slot = &slots[0][now & TIMER_WHEEL_SLOT_MASK];
+	while (*slot != NULL) {
+		TTimer *timer = *slot;
+		timer_wheel_unlink(timer);
+		timer_wheel_link(&expired, timer);
+	}
+
+	while (expired != NULL) {
+		TTimer *timer = expired;
+		timer_wheel_unlink(timer);
+
+		if (timer->period != 0) {
+			timer->expires += timer->period;
+			timer_wheel_insert(timer);
+		}
+		timer->callback(timer->context);
+	}
+}
@@ -0,0 +1,306 @@
+/*
+ * This module contains methods to handle the directory of the users allowed to send commands from the keypad.
+ * Every user is identified by its PIN, that is never stored in clear: the directory keeps only a salted hash of it,
+ * in an open-addressing table indexed by the hash itself. So looking for a PIN costs the same whatever
+ * the number of users is.
+ * Users can be added one by one or imported in bulk from the console, see user_directory_register_commands().
+ */
+
+#include "user_directory.h"
+
+#define USER_DIRECTORY_MASK		(USER_DIRECTORY_CAPACITY - 1U)
+
+/* Names of the roles, in the same order of TUser_role */
+static const char *const USER_ROLE_NAMES[] = { "guest", "user", "admin" };
+
+/* Counters of the import in progress */
+static uint16_t imported_users;
+static uint16_t rejected_users;
+
+/*
+ * @fn		static uint32_t user_directory_digest(uint32_t salt, const uint8_t *pin)
+ * @brief	Computes the salted hash of a PIN: FNV-1a over the digits, seeded with the salt,
+ * 			followed by the MurmurHash3 finalizer, so that also the low bits used as index are well mixed
+ * @param	salt	the salt of the directory
+ * @param	pin		the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @retval	the digest, never equal to USER_DIGEST_EMPTY
+ */
+static uint32_t user_directory_digest(uint32_t salt, const uint8_t *pin) {
+	uint32_t hash = 2166136261U ^ salt;
+
+	for (uint8_t i = 0; i < USER_DIRECTORY_PIN_LENGTH; i++) {
+		hash ^= pin[i];
+		hash *= 16777619U;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6BU;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35U;
+	hash ^= hash >> 16;
+
+	return hash == USER_DIGEST_EMPTY ? 1U : hash;
+}
+
+/*
+ * @fn		static TUser* user_directory_probe(TUser_directory *directory, uint32_t digest)
+ * @brief	Walks the probe sequence of a digest
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	digest		the digest to look for
+ * @retval	the slot holding digest if present, otherwise the empty slot where it should be inserted
+ */
+static TUser* user_directory_probe(TUser_directory *directory, uint32_t digest) {
+	uint32_t index = digest & USER_DIRECTORY_MASK;
+
+	// the table is never full, so an empty slot is always found
+	while (directory->slots[index].digest != digest
+			&& directory->slots[index].digest != USER_DIGEST_EMPTY) {
+		index = (index + 1U) & USER_DIRECTORY_MASK;
+	}
+	return &directory->slots[index];
+}
+
+/*
+ * @fn		void user_directory_init(TUser_directory *directory, uint32_t salt)
+ * @brief	Initializes an empty directory
+ * @param	directory	pointer to the TUser_directory structure to initialize
+ * @param	salt		the value mixed with every PIN. Use a value unique for each device, e.g. its UID
+ */
+void user_directory_init(TUser_directory *directory, uint32_t salt) {
+	memset(directory->slots, 0, sizeof(directory->slots));
+	directory->salt = salt;
+	directory->count = 0;
+}
+
+/*
+ * @fn		int user_directory_add(TUser_directory *directory, const uint8_t *pin, TUser_role role, uint16_t zones)
+ * @brief	Adds a user to the directory
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	pin			the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @param	role		role of the user
+ * @param	zones		bitmask of the zones the user can handle
+ * @retval	USER_DIRECTORY_ERR_INVALID if the PIN does not contain only digits,
+ * 			USER_DIRECTORY_ERR_DUPLICATE if the PIN is already used,
+ * 			USER_DIRECTORY_ERR_FULL if there are already USER_DIRECTORY_MAX_USERS users,
+ * 			USER_DIRECTORY_OK otherwise
+ */
+int user_directory_add(TUser_directory *directory, const uint8_t *pin, TUser_role role, uint16_t zones) {
+	if (!is_only_digit(pin, USER_DIRECTORY_PIN_LENGTH) || role > USER_ROLE_ADMIN) {
+		return USER_DIRECTORY_ERR_INVALID;
+	}
+
+	uint32_t digest = user_directory_digest(directory->salt, pin);
+	TUser *user = user_directory_probe(directory, digest);
+
+	if (user->digest == digest) {
+		return USER_DIRECTORY_ERR_DUPLICATE;
+	}
+	if (directory->count >= USER_DIRECTORY_MAX_USERS) {
+		return USER_DIRECTORY_ERR_FULL;
+	}
+
+	user->digest = digest;
+	user->role = role;
+	user->zones = zones;
+	directory->count++;
+	return USER_DIRECTORY_OK;
+}
+
+/*
+ * @fn		int user_directory_remove(TUser_directory *directory, const uint8_t *pin)
+ * @brief	Removes a user from the directory
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	pin			the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @retval	USER_DIRECTORY_ERR_NOT_FOUND if no user has this PIN, USER_DIRECTORY_OK otherwise
+ */
+int user_directory_remove(TUser_directory *directory, const uint8_t *pin) {
+	TUser *user = user_directory_find(directory, pin);
+
+	if (user == NULL) {
+		return USER_DIRECTORY_ERR_NOT_FOUND;
+	}
+
+	// Backward shift deletion: the following users of the same cluster are moved back,
+	// so that no probe sequence is broken and no tombstone is needed
+	uint32_t hole = user - directory->slots;
+	uint32_t next = hole;
+	for (;;) {
+		next = (next + 1U) & USER_DIRECTORY_MASK;
+		uint32_t digest = directory->slots[next].digest;
+		if (digest == USER_DIGEST_EMPTY) {
+			break;
+		}
+		// a user can fill the hole only if its home slot does not lie in (hole, next]
+		uint32_t home = digest & USER_DIRECTORY_MASK;
+		if (((next - home) & USER_DIRECTORY_MASK) >= ((next - hole) & USER_DIRECTORY_MASK)) {
+			directory->slots[hole] = directory->slots[next];
+			hole = next;
+		}
+	}
+
+	directory->slots[hole].digest = USER_DIGEST_EMPTY;
+	directory->count--;
+	return USER_DIRECTORY_OK;
+}
+
+/*
+ * @fn		TUser* user_directory_find(TUser_directory *directory, const uint8_t *pin)
+ * @brief	Looks for the user with a PIN
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	pin			the USER_DIRECTORY_PIN_LENGTH digits of the PIN
+ * @retval	pointer to the user, or NULL if no user has this PIN
+ */
+TUser* user_directory_find(TUser_directory *directory, const uint8_t *pin) {
+	uint32_t digest = user_directory_digest(directory->salt, pin);
+	TUser *user = user_directory_probe(directory, digest);
+
+	return user->digest == digest ? user : NULL;
+}
+
+/*
+ * @fn		bool user_can_handle(const TUser *user, uint16_t zones)
+ * @brief	Checks if a user is allowed to activate or deactivate some zones
+ * @param	user		pointer to the user
+ * @param	zones		bitmask of the zones
+ * @retval	TRUE if the user can handle all the zones, FALSE otherwise
+ */
+bool user_can_handle(const TUser *user, uint16_t zones) {
+	if (user->role == USER_ROLE_ADMIN) {
+		return TRUE;
+	}
+	return (user->zones & zones) == zones ? TRUE : FALSE;
+}
+
+/*
+ * @fn		bool user_can_handle_system(const TUser *user)
+ * @brief	Checks if a user is allowed to enable or disable the whole system
+ * @param	user		pointer to the user
+ * @retval	TRUE if the role of the user is at least USER_ROLE_USER, FALSE otherwise
+ */
+bool user_can_handle_system(const TUser *user) {
+	return user->role >= USER_ROLE_USER ? TRUE : FALSE;
+}
+
+/*
+ * @fn		static int user_directory_parse_role(const char *name)
+ * @brief	Converts the name of a role in the corresponding TUser_role value
+ * @param	name	the name of the role
+ * @retval	the role, or -1 if the name is not valid
+ */
+static int user_directory_parse_role(const char *name) {
+	for (uint8_t i = 0; i <= USER_ROLE_ADMIN; i++) {
+		if (strcmp(name, USER_ROLE_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * @fn		static int user_directory_add_from_args(TUser_directory *directory, char *args)
+ * @brief	Adds a user described by a string in the format "<pin> <role> <zones>",
+ * 			where zones is a hexadecimal bitmask. Commas can be used instead of spaces.
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	args		the description of the user
+ * @retval	USER_DIRECTORY_ERR_INVALID if the description is not valid, the result of user_directory_add() otherwise
+ */
+static int user_directory_add_from_args(TUser_directory *directory, char *args) {
+	char *pin = shell_next_token(&args);
+	char *role_name = shell_next_token(&args);
+	char *zones = shell_next_token(&args);
+
+	if (pin == NULL || role_name == NULL || zones == NULL
+			|| strlen(pin) != USER_DIRECTORY_PIN_LENGTH) {
+		return USER_DIRECTORY_ERR_INVALID;
+	}
+
+	int role = user_directory_parse_role(role_name);
+	if (role < 0) {
+		return USER_DIRECTORY_ERR_INVALID;
+	}
+
+	return user_directory_add(directory, (uint8_t*) pin, role, strtoul(zones, NULL, 16));
+}
+
+/*
+ * @fn		static const char* user_directory_error_string(int error)
+ * @brief	Returns a message describing the result of an operation on the directory
+ */
+static const char* user_directory_error_string(int error) {
+	switch (error) {
+	case USER_DIRECTORY_OK:
+		return "Done";
+	case USER_DIRECTORY_ERR_FULL:
+		return "Directory full";
+	case USER_DIRECTORY_ERR_DUPLICATE:
+		return "PIN already used";
+	case USER_DIRECTORY_ERR_NOT_FOUND:
+		return "User not found";
+	default:
+		return "Usage: <4-digits pin> <guest|user|admin> <hex zones>";
+	}
+}
+
+static void user_directory_command_add(TShell *shell, void *context, char *args) {
+	int result = user_directory_add_from_args(context, args);
+	shell_print(shell, "%s\r\n", user_directory_error_string(result));
+}
+
+static void user_directory_command_remove(TShell *shell, void *context, char *args) {
+	char *pin = shell_next_token(&args);
+	int result = USER_DIRECTORY_ERR_INVALID;
+
+	if (pin != NULL && strlen(pin) == USER_DIRECTORY_PIN_LENGTH) {
+		result = user_directory_remove(context, (uint8_t*) pin);
+	}
+	shell_print(shell, "%s\r\n", user_directory_error_string(result));
+}
+
+static void user_directory_command_count(TShell *shell, void *context, char *args) {
+	TUser_directory *directory = context;
+	shell_print(shell, "%u users, %u free\r\n", directory->count,
+			USER_DIRECTORY_MAX_USERS - directory->count);
+}
+
+/*
+ * @fn		static bool user_directory_import_line(TShell *shell, void *context, char *line)
+ * @brief	Adds the user described by a line, until a line with a single dot ends the import
+ */
+static bool user_directory_import_line(TShell *shell, void *context, char *line) {
+	if (strcmp(line, ".") == 0) {
+		shell_print(shell, "Imported %u users, rejected %u\r\n", imported_users, rejected_users);
+		return FALSE;
+	}
+
+	if (user_directory_add_from_args(context, line) == USER_DIRECTORY_OK) {
+		imported_users++;
+	} else {
+		rejected_users++;
+	}
+	return TRUE;
+}
+
+static void user_directory_command_import(TShell *shell, void *context, char *args) {
+	imported_users = 0;
+	rejected_users = 0;
+	shell_set_line_handler(shell, user_directory_import_line, context);
+	shell_print(shell, "Send one user per line, end with a single dot\r\n");
+}
+
+/*
+ * @fn		void user_directory_register_commands(TUser_directory *directory, TShell *shell)
+ * @brief	Adds to the shell the commands to handle the directory:
+ * 			useradd <pin> <role> <zones>, userdel <pin>, users and userimport.
+ * 			userimport receives one user per line, in the same format of useradd, until a line with a single dot
+ * @param	directory	pointer to the TUser_directory structure
+ * @param	shell		pointer to the TShell structure
+ */
+void user_directory_register_commands(TUser_directory *directory, TShell *shell) {
+	shell_register_command(shell, "useradd", "<pin> <guest|user|admin> <hex zones>",
+			user_directory_command_add, directory);
+	shell_register_command(shell, "userdel", "<pin>", user_directory_command_remove, directory);
+	shell_register_command(shell, "users", "shows the number of users", user_directory_command_count,
+			directory);
+	shell_register_command(shell, "userimport", "imports one user per line until a single dot",
+			user_directory_command_import, directory);
+}
@@ -0,0 +1,99 @@
+/*
+ * This module keeps the timing profile of every zone, in milliseconds:
+ * 		the entry delay, between a detection and the alarm, so the user can disarm the zone when coming in
+ * 		the exit delay, between the arming of the zone and the activation of its sensors, so the user can go out
+ * 		the duration of the alarm
+ * The sensor registry applies the profile of the zones of a sensor every time the sensor is armed,
+ * so the profiles changed from the shell hold from the next arming.
+ */
+
+#include "zone_profile.h"
+
+static TZone_profile profiles[ZONE_PROFILES_N];
+
+/*
+ * @fn		void zone_profile_init(const TZone_profile *profile)
+ * @brief	Gives the same profile to all the zones
+ * @param	profile	the default profile
+ */
+void zone_profile_init(const TZone_profile *profile) {
+	for (uint8_t zone = 0; zone < ZONE_PROFILES_N; zone++) {
+		profiles[zone] = *profile;
+	}
+}
+
+/*
+ * @fn		int zone_profile_set(uint16_t zones, const TZone_profile *profile)
+ * @brief	Sets the profile of some zones
+ * @param	zones	mask of the zones
+ * @param	profile	the profile, its times must not exceed ZONE_PROFILE_MAX_TIME
+ * @retval	ZONE_PROFILE_ERR_INVALID if the mask is empty or a time is too long, ZONE_PROFILE_OK otherwise
+ */
+int zone_profile_set(uint16_t zones, const TZone_profile *profile) {
+	if (zones == 0 || profile->entry_delay > ZONE_PROFILE_MAX_TIME || profile->exit_delay > ZONE_PROFILE_MAX_TIME
+			|| profile->duration > ZONE_PROFILE_MAX_TIME) {
+		return ZONE_PROFILE_ERR_INVALID;
+	}
+
+	// the profiles are read by the keypad interrupt when the zones are armed
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for (uint16_t bits = zones; bits != 0; bits &= bits - 1U) {
+		profiles[__builtin_ctz(bits)] = *profile;
+	}
+	__set_PRIMASK(primask);
+	return ZONE_PROFILE_OK;
+}
+
+/*
+ * @fn		const TZone_profile* zone_profile_get(uint16_t zones)
+ * @brief	Returns the profile of a sensor belonging to some zones: the profile of the lowest zone of the mask
+ * @param	zones	mask of the zones
+ * @retval	the profile, the one of the first zone if the mask is empty
+ */
+const TZone_profile* zone_profile_get(uint16_t zones) {
+	return &profiles[(zones == 0) ? 0 : __builtin_ctz(zones)];
+}
+
+static void zone_profile_command_show(TShell *shell, void *context, char *args) {
+	shell_print(shell, "%-6s %10s %10s %10s\r\n", "zone", "entry ms", "exit ms", "alarm ms");
+	for (uint8_t zone = 0; zone < ZONE_PROFILES_N; zone++) {
+		TZone_profile *profile = &profiles[zone];
+		shell_print(shell, "0x%04x %10lu %10lu %10lu\r\n", 1U << zone, profile->entry_delay, profile->exit_delay,
+				profile->duration);
+	}
+}
+
+static void zone_profile_command_set(TShell *shell, void *context, char *args) {
+	char *zones = shell_next_token(&args);
+	char *entry_delay = shell_next_token(&args);
+	char *exit_delay = shell_next_token(&args);
+	char *duration = shell_next_token(&args);
+	int result = ZONE_PROFILE_ERR_INVALID;
+
+	if (zones != NULL && entry_delay != NULL && exit_delay != NULL && duration != NULL) {
+		TZone_profile profile = { strtoul(entry_delay, NULL, 10), strtoul(exit_delay, NULL, 10),
+				strtoul(duration, NULL, 10) };
+		result = zone_profile_set(strtoul(zones, NULL, 16), &profile);
+	}
+
+	if (result == ZONE_PROFILE_OK) {
+		shell_print(shell, "Done, it holds from the next arming\r\n");
+	} else {
+		shell_print(shell, "Usage: profile <hex zones> <entry ms> <exit ms> <duration ms> [max %lu ms]\r\n",
+				ZONE_PROFILE_MAX_TIME);
+	}
+}
+
+/*
+ * @fn		void zone_profile_register_commands(TShell *shell)
+ * @brief	Adds to the shell the commands profiles, that shows the profile of every zone,
+ * 			and profile <hex zones> <entry ms> <exit ms> <duration ms>, that changes the profile of some zones
+ * @param	shell	pointer to the TShell structure
+ */
+void zone_profile_register_commands(TShell *shell) {
+	shell_register_command(shell, "profiles", "shows the entry delay, the exit delay and the alarm duration of the zones",
+			zone_profile_command_show, NULL);
+	shell_register_command(shell, "profile", "<hex zones> <entry ms> <exit ms> <duration ms> sets the timing of zones",
+			zone_profile_command_set, NULL);
+}
@@ -0,0 +1,359 @@
+/*
+ * This module is a virtual STM32F401 board, so the firmware and the HAL run unchanged on the host, see board.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "board.h"
+#include "stm32f4xx_it.h"
+
+/*
+ * @brief	This struct represents a region of the memory map of the microcontroller.
+ * @param	base		the address of the region
+ * @param	size		bytes of the region
+ * @param	fill		the value of the bytes at the start
+ */
+typedef struct {
+	uintptr_t base;
+	size_t size;
+	uint8_t fill;
+} TBoard_region;
+
+static const TBoard_region regions[] = {
+	{ FLASH_BASE, 0x80000U, 0xFFU },
+	{ 0x1FFF0000U, 0x8000U, 0xFFU },
+	{ PERIPH_BASE, 0x80000U, 0x00U },
+	{ AHB2PERIPH_BASE, 0x40000U, 0x00U },
+	{ 0xE0000000U, 0x100000U, 0x00U },
+};
+
+#define BOARD_REGIONS_N		(sizeof(regions) / sizeof(regions[0]))
+#define BOARD_PERIPHERALS	(2U)
+
+/* The unique ID and the factory calibrations of the ADC, of a typical part */
+#define BOARD_UID				(0x1FFF7A10U)
+#define BOARD_VREFINT_CAL		(0x1FFF7A2AU)
+#define BOARD_TS_CAL1			(0x1FFF7A2CU)
+#define BOARD_TS_CAL2			(0x1FFF7A2EU)
+
+uint32_t host_primask;
+uint32_t host_apsr_ge;
+
+/*
+ * @brief	The state of the virtual board.
+ * @param	now				milliseconds passed since board_init
+ * @param	in_interrupt	TRUE while an interrupt runs
+ * @param	pending_ticks	SysTick interrupts waiting for PRIMASK to be cleared
+ * @param	exti_pending	the pending lines of the EXTI
+ * @param	output			the hook of the outputs, and its context
+ * @param	sink			the sink of the UARTs, and its context
+ * @param	transmitting	the UART whose transfer completes at the next millisecond, NULL if none
+ * @param	receiving		the UART waiting for a byte, NULL if none
+ * @param	received		where the next byte goes
+ */
+static struct {
+	uint32_t now;
+	bool in_interrupt;
+	uint32_t pending_ticks;
+	uint32_t exti_pending;
+	TBoard_output_hook output;
+	void *output_context;
+	TBoard_uart_sink sink;
+	void *sink_context;
+	UART_HandleTypeDef *transmitting;
+	UART_HandleTypeDef *receiving;
+	uint8_t *received;
+} board;
+
+/*
+ * @fn		static void board_map(void)
+ * @brief	Maps the memory of the microcontroller at its addresses, before the tests start.
+ * 			The program is linked without PIE, so its own addresses stay away from these ones
+ */
+__attribute__((constructor)) static void board_map(void) {
+	for (uint8_t i = 0; i < BOARD_REGIONS_N; i++) {
+		void *region = mmap((void*) regions[i].base, regions[i].size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (region != (void*) regions[i].base) {
+			fprintf(stderr, "board: the memory at 0x%08lX can't be mapped\n", (unsigned long) regions[i].base);
+			exit(EXIT_FAILURE);
+		}
+		memset(region, regions[i].fill, regions[i].size);
+	}
+
+	for (uint8_t i = 0; i < 12U; i++) {
+		((uint8_t*) BOARD_UID)[i] = (uint8_t) (0x30U + i * 7U);
+	}
+	*(uint16_t*) BOARD_VREFINT_CAL = 1500U;
+	*(uint16_t*) BOARD_TS_CAL1 = 943U;
+	*(uint16_t*) BOARD_TS_CAL2 = 1191U;
+}
+
+/*
+ * @fn		static bool board_interrupt_begin(void)
+ * @brief	Marks the start of an interrupt
+ * @retval	TRUE if an interrupt was running already
+ */
+static bool board_interrupt_begin(void) {
+	bool nested = board.in_interrupt;
+	board.in_interrupt = TRUE;
+	return nested;
+}
+
+/*
+ * @fn		static void board_exti_sync(void)
+ * @brief	PR is write-one-to-clear, while the memory of the board keeps what is written:
+ * 			the bits the firmware wrote are the lines it cleared
+ */
+static void board_exti_sync(void) {
+	board.exti_pending &= ~EXTI->PR;
+	EXTI->PR = 0;
+}
+
+/*
+ * @fn		static void board_exti_deliver(void)
+ * @brief	Runs the interrupts of the pending EXTI lines enabled by IMR, unless they must wait
+ */
+static void board_exti_deliver(void) {
+	static void (*const handlers[])(void) = {
+		EXTI0_IRQHandler, EXTI1_IRQHandler, EXTI2_IRQHandler, EXTI3_IRQHandler, EXTI4_IRQHandler,
+		EXTI9_5_IRQHandler, EXTI15_10_IRQHandler
+	};
+	static const uint32_t groups[] = {
+		0x0001U, 0x0002U, 0x0004U, 0x0008U, 0x0010U, 0x03E0U, 0xFC00U
+	};
+
+	board_exti_sync();
+	if (board.in_interrupt || host_primask != 0U) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+		uint32_t lines = board.exti_pending & EXTI->IMR & groups[i];
+		if (lines == 0) {
+			continue;
+		}
+
+		board_interrupt_begin();
+		EXTI->PR = lines;
+		handlers[i]();
+		board.in_interrupt = FALSE;
+		// the lines left pending without a handler are dropped, instead of firing forever
+		board.exti_pending &= ~lines;
+		board_exti_sync();
+	}
+}
+
+/*
+ * @fn		static void board_uart_complete(void)
+ * @brief	Completes the transfer started in the last millisecond
+ */
+static void board_uart_complete(void) {
+	UART_HandleTypeDef *huart = board.transmitting;
+
+	if (huart == NULL || host_primask != 0U) {
+		return;
+	}
+
+	board.transmitting = NULL;
+	huart->gState = HAL_UART_STATE_READY;
+	bool nested = board_interrupt_begin();
+	HAL_UART_TxCpltCallback(huart);
+	board.in_interrupt = nested;
+}
+
+/*
+ * @fn		static void board_systick(void)
+ * @brief	Runs the SysTick interrupt, then the EXTI lines it raised
+ */
+static void board_systick(void) {
+	board_exti_sync();
+	board_interrupt_begin();
+	SysTick_Handler();
+	board.in_interrupt = FALSE;
+	board_exti_deliver();
+}
+
+/*
+ * @fn		static void board_tick(void)
+ * @brief	Lets a millisecond pass
+ */
+static void board_tick(void) {
+	board.now++;
+	DWT->CYCCNT += SystemCoreClock / 1000U;
+
+	if (host_primask != 0U) {
+		board.pending_ticks++;
+	} else {
+		board_systick();
+	}
+	board_uart_complete();
+}
+
+void board_init(void) {
+	memset((void*) regions[BOARD_PERIPHERALS].base, 0, regions[BOARD_PERIPHERALS].size);
+	memset((void*) regions[BOARD_PERIPHERALS + 1U].base, 0, regions[BOARD_PERIPHERALS + 1U].size);
+	memset((void*) regions[BOARD_PERIPHERALS + 2U].base, 0, regions[BOARD_PERIPHERALS + 2U].size);
+	memset(&board, 0, sizeof(board));
+	host_primask = 0;
+
+	SystemCoreClock = 84000000U;
+	HAL_Init();
+}
+
+void board_advance(uint32_t milliseconds) {
+	while (milliseconds-- > 0) {
+		board_tick();
+	}
+}
+
+uint32_t board_now(void) {
+	return board.now;
+}
+
+void board_set_output_hook(TBoard_output_hook hook, void *context) {
+	board.output = hook;
+	board.output_context = context;
+}
+
+void board_set_input(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+	uint32_t previous = port->IDR & pin;
+
+	if (state == GPIO_PIN_SET) {
+		port->IDR |= pin;
+	} else {
+		port->IDR &= ~(uint32_t) pin;
+	}
+	if ((port->IDR & pin) == previous) {
+		return;
+	}
+
+	// the edge reaches the EXTI only if the line is routed to this port by SYSCFG
+	uint8_t line = (uint8_t) __builtin_ctz(pin);
+	uint32_t source = (SYSCFG->EXTICR[line >> 2U] >> (4U * (line & 3U))) & 0x0FU;
+	if (source != GPIO_GET_INDEX(port)) {
+		return;
+	}
+
+	uint32_t trigger = (state == GPIO_PIN_SET) ? EXTI->RTSR : EXTI->FTSR;
+	if ((trigger & pin) != 0) {
+		board.exti_pending |= pin;
+		board_exti_deliver();
+	}
+}
+
+void board_set_uart_sink(TBoard_uart_sink sink, void *context) {
+	board.sink = sink;
+	board.sink_context = context;
+}
+
+uint16_t board_uart_receive(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size) {
+	uint16_t received = 0;
+
+	for (uint16_t i = 0; i < size; i++) {
+		if (board.receiving != huart) {
+			continue;
+		}
+
+		*board.received = data[i];
+		board.receiving = NULL;
+		huart->RxState = HAL_UART_STATE_READY;
+		received++;
+
+		bool nested = board_interrupt_begin();
+		HAL_UART_RxCpltCallback(huart);
+		board.in_interrupt = nested;
+	}
+	return received;
+}
+
+void host_enable_irq(void) {
+	host_primask = 0;
+	if (board.in_interrupt) {
+		return;
+	}
+
+	while (board.pending_ticks > 0 && host_primask == 0U) {
+		board.pending_ticks--;
+		board_systick();
+	}
+	board_exti_deliver();
+	board_uart_complete();
+}
+
+void host_wait_for_interrupt(void) {
+	board_tick();
+}
+
+/*
+ * @fn		void HAL_Delay(uint32_t Delay)
+ * @brief	Lets the virtual clock run, as the HAL would wait for it
+ */
+void HAL_Delay(uint32_t Delay) {
+	if (host_primask != 0U) {
+		fprintf(stderr, "board: HAL_Delay with the interrupts disabled never returns\n");
+		abort();
+	}
+
+	if (board.in_interrupt) {
+		// the tick can't run inside an interrupt: only the transfers the firmware waits for complete
+		board_uart_complete();
+		return;
+	}
+
+	board_advance((Delay < HAL_MAX_DELAY) ? Delay + 1U : Delay);
+}
+
+void __wrap_HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+	if (PinState == GPIO_PIN_SET) {
+		GPIOx->ODR |= GPIO_Pin;
+		GPIOx->IDR |= GPIO_Pin;
+	} else {
+		GPIOx->ODR &= ~(uint32_t) GPIO_Pin;
+		GPIOx->IDR &= ~(uint32_t) GPIO_Pin;
+	}
+
+	if (board.output != NULL) {
+		board.output(GPIOx, GPIO_Pin, PinState, board.output_context);
+	}
+}
+
+void __wrap_HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	__wrap_HAL_GPIO_WritePin(GPIOx, GPIO_Pin, ((GPIOx->ODR & GPIO_Pin) != 0) ? GPIO_PIN_RESET : GPIO_PIN_SET);
+}
+
+HAL_StatusTypeDef __wrap_HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+	if (huart->gState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+	if (pData == NULL || Size == 0) {
+		return HAL_ERROR;
+	}
+
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	board.transmitting = huart;
+	if (board.sink != NULL) {
+		board.sink(huart, pData, Size, board.sink_context);
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef __wrap_HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+	if (huart->RxState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+	if (pData == NULL || Size == 0) {
+		return HAL_ERROR;
+	}
+
+	// the firmware receives one character at a time
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	board.receiving = huart;
+	board.received = pData;
+	return HAL_OK;
+}
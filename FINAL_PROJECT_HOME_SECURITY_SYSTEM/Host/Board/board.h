@@ -0,0 +1,100 @@
+/*
+ * This module is a virtual STM32F401 board, so the firmware and the HAL run unchanged on the host, for the tests
+ * and the benchmarks. The memory map of the microcontroller is mapped at its own addresses: the flash (erased),
+ * the system memory (UID and factory calibrations), the peripherals and the registers of the core. The firmware
+ * reads and writes the registers as plain memory, so nothing happens by itself. The board adds:
+ * 		- a virtual clock: every millisecond it runs SysTick_Handler and advances DWT->CYCCNT. The clock only runs
+ * 		  when the test asks it or when the firmware waits, with HAL_Delay or __WFI;
+ * 		- the pins: HAL_GPIO_WritePin and HAL_GPIO_TogglePin update ODR and IDR and notify the test,
+ * 		  the test drives the inputs, and the edges raise the EXTI lines configured by the firmware;
+ * 		- the UART: the transfers of HAL_UART_Transmit_DMA are handed to the test and complete at the next
+ * 		  millisecond, the characters given by the test complete HAL_UART_Receive_IT;
+ * 		- the mask of the interrupts: while PRIMASK is set the interrupts stay pending, and they run when it is cleared.
+ * The interrupts run one at a time, with no priority: an interrupt raised by an interrupt runs after it.
+ * Waiting with HAL_Delay inside an interrupt can't let the clock run, so only the transfers complete then.
+ * HAL_Delay with the interrupts disabled never returns on the board: the virtual board stops the program instead.
+ * The firmware is linked with -Wl,--wrap for HAL_GPIO_WritePin, HAL_GPIO_TogglePin, HAL_UART_Transmit_DMA
+ * and HAL_UART_Receive_IT, see CMakeLists.txt.
+ */
+
+#ifndef BOARD_H_
+#define BOARD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stm32f4xx_hal.h"
+#include "bool.h"
+
+/*
+ * @brief	Called when the firmware drives an output
+ * @param	port		the port of the pin
+ * @param	pin			the pin, GPIO_PIN_x
+ * @param	state		the new level of the pin
+ * @param	context		the context given to board_set_output_hook
+ */
+typedef void (*TBoard_output_hook)(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state, void *context);
+
+/*
+ * @brief	Called with the bytes sent by the UART
+ * @param	huart		the UART sending the bytes
+ * @param	data		the bytes
+ * @param	size		number of bytes
+ * @param	context		the context given to board_set_uart_sink
+ */
+typedef void (*TBoard_uart_sink)(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, void *context);
+
+/*
+ * @fn		void board_init(void)
+ * @brief	Resets the peripherals and the clock of the board, and runs HAL_Init() at 84 MHz.
+ * 			The flash keeps its content, as on a real reset
+ */
+void board_init(void);
+
+/*
+ * @fn		void board_advance(uint32_t milliseconds)
+ * @brief	Lets the virtual clock run
+ * @param	milliseconds	the time to let pass
+ */
+void board_advance(uint32_t milliseconds);
+
+/*
+ * @fn		uint32_t board_now(void)
+ * @brief	Tells the time of the virtual clock
+ * @retval	the milliseconds passed since board_init
+ */
+uint32_t board_now(void);
+
+/*
+ * @fn		void board_set_output_hook(TBoard_output_hook hook, void *context)
+ * @brief	Sets the function notified of the writes of the outputs, NULL for none
+ */
+void board_set_output_hook(TBoard_output_hook hook, void *context);
+
+/*
+ * @fn		void board_set_input(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+ * @brief	Drives an input of the board. If the level changes and the line of the pin is configured for the edge,
+ * 			the EXTI line becomes pending, and its interrupt runs as soon as the interrupts are enabled
+ * @param	port		the port of the pin
+ * @param	pin			the pin, GPIO_PIN_x
+ * @param	state		the new level of the pin
+ */
+void board_set_input(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+
+/*
+ * @fn		void board_set_uart_sink(TBoard_uart_sink sink, void *context)
+ * @brief	Sets the function receiving the bytes sent by the UARTs, NULL to discard them
+ */
+void board_set_uart_sink(TBoard_uart_sink sink, void *context);
+
+/*
+ * @fn		uint16_t board_uart_receive(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size)
+ * @brief	Sends bytes to the UART, one at a time. A byte that comes while no reception is started is lost
+ * @param	huart		the UART receiving the bytes
+ * @param	data		the bytes
+ * @param	size		number of bytes
+ * @retval	number of bytes received by the firmware
+ */
+uint16_t board_uart_receive(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+
+#endif /* BOARD_H_ */
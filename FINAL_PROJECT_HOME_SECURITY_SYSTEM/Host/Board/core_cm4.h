@@ -0,0 +1,12 @@
+/*
+ * The CMSIS core header, as seen by the firmware built for the host: the intrinsics of the Cortex-M4
+ * are replaced by the ones of host_cmsis.h, then the real header is included for the registers of the core.
+ */
+
+#ifndef HOST_CORE_CM4_H_
+#define HOST_CORE_CM4_H_
+
+#include "host_cmsis.h"
+#include_next <core_cm4.h>
+
+#endif /* HOST_CORE_CM4_H_ */
@@ -0,0 +1,157 @@
+/*
+ * This header replaces cmsis_gcc.h when the firmware is built for the host. The instructions of the Cortex-M4
+ * are written in C: the mask of the interrupts is a variable of the virtual board, and waiting for an interrupt
+ * lets the virtual clock run, see board.h.
+ */
+
+#ifndef HOST_CMSIS_H_
+#define HOST_CMSIS_H_
+
+#include <stdint.h>
+
+/* The real header of the compiler is skipped */
+#define __CMSIS_GCC_H
+
+#define __ASM						__asm
+#define __INLINE					inline
+#define __STATIC_INLINE				static inline
+#define __STATIC_FORCEINLINE		static inline
+#define __NO_RETURN					__attribute__((__noreturn__))
+#define __USED						__attribute__((used))
+#define __WEAK						__attribute__((weak))
+#define __PACKED					__attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT				struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION				union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)				__attribute__((aligned(x)))
+#define __RESTRICT					__restrict
+#define __COMPILER_BARRIER()		__asm volatile("" ::: "memory")
+
+/* PRIMASK of the virtual board, 1 while the interrupts are disabled */
+extern uint32_t host_primask;
+
+/* GE flags of the APSR of the virtual board, one per byte, set by the SIMD instructions and read by __SEL */
+extern uint32_t host_apsr_ge;
+
+/*
+ * @fn		void host_enable_irq(void)
+ * @brief	Clears PRIMASK and runs the interrupts that became pending while it was set
+ */
+void host_enable_irq(void);
+
+/*
+ * @fn		void host_wait_for_interrupt(void)
+ * @brief	Lets a millisecond of the virtual clock pass, as the next SysTick interrupt would wake the core
+ */
+void host_wait_for_interrupt(void);
+
+static inline void __enable_irq(void) {
+	host_enable_irq();
+}
+
+static inline void __disable_irq(void) {
+	host_primask = 1U;
+}
+
+static inline uint32_t __get_PRIMASK(void) {
+	return host_primask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask) {
+	if (primask == 0U) {
+		host_enable_irq();
+	} else {
+		host_primask = primask;
+	}
+}
+
+static inline uint32_t __get_IPSR(void) {
+	return 0U;
+}
+
+static inline uint32_t __get_CONTROL(void) {
+	return 0U;
+}
+
+static inline void __set_CONTROL(uint32_t control) {
+	(void) control;
+}
+
+static inline uint32_t __get_MSP(void) {
+	return 0U;
+}
+
+static inline void __set_MSP(uint32_t stack) {
+	(void) stack;
+}
+
+static inline uint32_t __get_BASEPRI(void) {
+	return 0U;
+}
+
+static inline void __set_BASEPRI(uint32_t basepri) {
+	(void) basepri;
+}
+
+static inline uint32_t __get_FPSCR(void) {
+	return 0U;
+}
+
+static inline void __set_FPSCR(uint32_t fpscr) {
+	(void) fpscr;
+}
+
+#define __NOP()						do { } while (0)
+#define __SEV()						do { } while (0)
+#define __WFI()						host_wait_for_interrupt()
+#define __WFE()						host_wait_for_interrupt()
+#define __ISB()						__COMPILER_BARRIER()
+#define __DSB()						__COMPILER_BARRIER()
+#define __DMB()						__COMPILER_BARRIER()
+
+#define __CLZ(value)				((uint8_t) ((value) == 0U ? 32U : (uint8_t) __builtin_clz(value)))
+
+static inline uint32_t __REV(uint32_t value) {
+	return __builtin_bswap32(value);
+}
+
+static inline uint32_t __RBIT(uint32_t value) {
+	uint32_t result = 0;
+
+	for (uint8_t i = 0; i < 32U; i++) {
+		result = (result << 1) | (value & 1U);
+		value >>= 1;
+	}
+	return result;
+}
+
+/*
+ * The SIMD instructions of the DSP extension, used by the firmware when it is built with __ARM_FEATURE_DSP,
+ * as the firmware_dsp library is: the halves of a word are signed 16-bit values.
+ */
+
+static inline uint32_t __SSUB16(uint32_t a, uint32_t b) {
+	int32_t low = (int32_t) (int16_t) a - (int16_t) b;
+	int32_t high = (int32_t) (int16_t) (a >> 16) - (int16_t) (b >> 16);
+
+	host_apsr_ge = ((low >= 0) ? 0x3U : 0U) | ((high >= 0) ? 0xCU : 0U);
+	return ((uint32_t) low & 0xFFFFU) | ((uint32_t) high << 16);
+}
+
+static inline uint32_t __SEL(uint32_t a, uint32_t b) {
+	uint32_t result = 0;
+
+	for (uint8_t i = 0; i < 4U; i++) {
+		uint32_t byte = 0xFFUL << (8U * i);
+		result |= (((host_apsr_ge >> i) & 1U) != 0) ? (a & byte) : (b & byte);
+	}
+	return result;
+}
+
+static inline uint32_t __SMLAD(uint32_t a, uint32_t b, uint32_t accumulator) {
+	int32_t low = (int32_t) (int16_t) a * (int16_t) b;
+	int32_t high = (int32_t) (int16_t) (a >> 16) * (int16_t) (b >> 16);
+
+	return accumulator + (uint32_t) low + (uint32_t) high;
+}
+
+#endif /* HOST_CMSIS_H_ */
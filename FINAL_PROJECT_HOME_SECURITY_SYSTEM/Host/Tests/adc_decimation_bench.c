@@ -0,0 +1,141 @@
+/*
+ * Benchmark of the decimation of the ADC stream: the cost of handing a block to the consumers, with every channel
+ * of a scan of BENCH_CHANNELS oversampled by 1, 4 and 16. The decimation reads the same samples as the plain copy
+ * and writes fewer of them, adding them up on the way, so an oversampled block must cost a small multiple
+ * of a plain one, whatever the ratio.
+ * The DMA does not run on the virtual board: the buffer is filled once with random conversions and the half
+ * complete callback is called by hand before every block. The first block of every ratio is checked against
+ * the mean of each group of samples. Every ratio is run a few times and the fastest run is kept.
+ * Usage: adc_decimation_bench [blocks]
+ */
+
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "adc.h"
+#include "dma.h"
+#include "tim.h"
+#include "adc_stream.h"
+
+#define BENCH_DEFAULT_BLOCKS	(200000U)
+#define BENCH_RUNS				(5U)
+#define BENCH_CHANNELS			(4U)
+
+/* Largest ratio between the cost of an oversampled block and of a plain one */
+#define BENCH_MAX_SLOWDOWN		(4.0)
+
+static TAdc_stream stream;
+static uint32_t random_state = 0x2545F491U;
+
+/* The samples received by every channel, checked after the first block of a ratio */
+static uint16_t received[BENCH_CHANNELS][ADC_STREAM_BLOCK_SIZE];
+static uint16_t received_length[BENCH_CHANNELS];
+static uint32_t checksum;
+
+static uint32_t bench_random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+static void consume(void *context, const uint16_t *samples, uint16_t length) {
+	uint8_t index = (uint8_t) (uintptr_t) context;
+
+	memcpy(received[index], samples, length * sizeof(samples[0]));
+	received_length[index] = length;
+	checksum += samples[0];
+}
+
+static void setup(void) {
+	board_init();
+	MX_DMA_Init();
+	MX_ADC1_Init();
+	MX_TIM2_Init();
+	memset(&stream, 0, sizeof(stream));
+	CHECK(adc_stream_init(&stream, &hadc1, &htim2) == ADC_STREAM_OK);
+	for (uint8_t i = 0; i < BENCH_CHANNELS; i++) {
+		CHECK(adc_stream_add_channel(&stream, ADC_CHANNEL_0 + i, consume, (void*) (uintptr_t) i) == i);
+	}
+	for (uint32_t i = 0; i < ADC_STREAM_BLOCK_SIZE * BENCH_CHANNELS; i++) {
+		stream.buffer[i] = bench_random(1U << ADC_STREAM_RESOLUTION);
+	}
+}
+
+/*
+ * @fn		static void check_block(uint8_t oversampling)
+ * @brief	Compares the last samples received by every channel with the sum of each group of conversions
+ * 			of the buffer, shifted as the decimation does
+ */
+static void check_block(uint8_t oversampling) {
+	uint8_t shift = __builtin_ctz(oversampling) / 2U;
+
+	for (uint8_t index = 0; index < BENCH_CHANNELS; index++) {
+		CHECK(received_length[index] == ADC_STREAM_BLOCK_SIZE / oversampling);
+		for (uint16_t i = 0; i < ADC_STREAM_BLOCK_SIZE / oversampling; i++) {
+			uint32_t sum = 0;
+
+			for (uint16_t j = 0; j < oversampling; j++) {
+				sum += stream.buffer[(i * oversampling + j) * BENCH_CHANNELS + index];
+			}
+			CHECK(received[index][i] == sum >> shift);
+		}
+		CHECK(adc_stream_get_bits(&stream, index) == ADC_STREAM_RESOLUTION + shift);
+	}
+}
+
+/*
+ * @fn		static double best_of_runs(uint8_t oversampling, uint32_t blocks)
+ * @brief	Hands the same block to the consumers again and again, with every channel oversampled
+ * @retval	the nanoseconds taken by a block, in the fastest run
+ */
+static double best_of_runs(uint8_t oversampling, uint32_t blocks) {
+	double best = 0;
+
+	setup();
+	for (uint8_t i = 0; i < BENCH_CHANNELS; i++) {
+		CHECK(adc_stream_set_channel(&stream, i, ADC_STREAM_SAMPLING_TIME, oversampling) == ADC_STREAM_OK);
+		adc_stream_start(&stream, i);
+	}
+	adc_stream_half_complete(&stream, &hadc1);
+	adc_stream_process(&stream);
+	check_block(oversampling);
+
+	for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+		uint64_t elapsed = 0;
+
+		for (uint32_t b = 0; b < blocks; b++) {
+			stream.next = 0;
+			adc_stream_half_complete(&stream, &hadc1);
+
+			uint64_t start = host_test_nanoseconds();
+			adc_stream_process(&stream);
+			elapsed += host_test_nanoseconds() - start;
+		}
+		double cost = (double) elapsed / blocks;
+		if (run == 0 || cost < best) {
+			best = cost;
+		}
+	}
+	CHECK(stream.overruns == 0);
+	return best;
+}
+
+int main(int argc, char **argv) {
+	static const uint8_t ratios[] = { 1, 4, 16 };
+	uint32_t blocks = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_BLOCKS;
+	double costs[sizeof(ratios)];
+
+	printf("%u channels, %u samples per block and channel\n", BENCH_CHANNELS, ADC_STREAM_BLOCK_SIZE);
+	for (uint8_t r = 0; r < sizeof(ratios); r++) {
+		costs[r] = best_of_runs(ratios[r], blocks);
+		printf("oversampling %2u: %.1f ns/block, %.2f ns/input sample, %.2f ns/output sample\n", ratios[r],
+				costs[r], costs[r] / (ADC_STREAM_BLOCK_SIZE * BENCH_CHANNELS),
+				costs[r] / (ADC_STREAM_BLOCK_SIZE / ratios[r] * BENCH_CHANNELS));
+	}
+	printf("checksum %lu\n", (unsigned long) checksum);
+
+	CHECK(costs[1] < costs[0] * BENCH_MAX_SLOWDOWN && costs[2] < costs[0] * BENCH_MAX_SLOWDOWN);
+	return host_test_result("adc_decimation_bench");
+}
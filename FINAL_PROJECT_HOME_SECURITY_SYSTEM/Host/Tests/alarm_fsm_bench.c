@@ -0,0 +1,271 @@
+/*
+ * Benchmark of the alarm state machine: the cost of an event through the table interpreter, against a switch
+ * written by hand with the same transitions and the same actions, as the sensors had before the tables.
+ * Both run the transitions of the PIR on a random sequence of events, with actions that only count their calls,
+ * so the difference is the cost of the interpreter. The full path of an edge of a PIR, from its handler, is timed too.
+ * Every measure is run a few times and the fastest run is kept.
+ * Usage: alarm_fsm_bench [events]
+ */
+
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "alarm_fsm.h"
+#include "pir_sensor.h"
+#include "exti_dispatcher.h"
+#include "latency.h"
+#include "health.h"
+
+#define BENCH_DEFAULT_EVENTS	(2000000U)
+#define BENCH_RUNS				(5U)
+#define BENCH_PIR_PIN			(GPIO_PIN_10)
+
+/* Largest ratio between the cost of an event in the interpreter and in the switch */
+#define BENCH_MAX_SLOWDOWN		(4.0)
+
+/* The actions of the PIR, counting their calls */
+enum {
+	BENCH_STOP_TIMER = ALARM_ACTION_END + 1, BENCH_START_DELAY, BENCH_START_DURATION, BENCH_ENABLE_INPUT,
+	BENCH_DISABLE_INPUT, BENCH_SOUND, BENCH_SILENCE, BENCH_ACTIONS_N
+};
+
+static volatile uint32_t calls[BENCH_ACTIONS_N];
+
+#define BENCH_ACTION(name, index) \
+	__attribute__((noinline)) static void name(void *sensor) { (void) sensor; calls[index]++; }
+BENCH_ACTION(stop_timer, BENCH_STOP_TIMER)
+BENCH_ACTION(start_delay, BENCH_START_DELAY)
+BENCH_ACTION(start_duration, BENCH_START_DURATION)
+BENCH_ACTION(enable_input, BENCH_ENABLE_INPUT)
+BENCH_ACTION(disable_input, BENCH_DISABLE_INPUT)
+BENCH_ACTION(sound, BENCH_SOUND)
+BENCH_ACTION(silence, BENCH_SILENCE)
+
+static const TAlarm_action actions[BENCH_ACTIONS_N] = {
+	NULL, stop_timer, start_delay, start_duration, enable_input, disable_input, sound, silence
+};
+
+/* The table of the PIR, see pir_sensor.c */
+static const TAlarm_transition transitions[ALARM_STATES_N][ALARM_EVENTS_N] = {
+	[ALARM_STATE_INACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { BENCH_STOP_TIMER, BENCH_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { BENCH_STOP_TIMER, BENCH_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { BENCH_STOP_TIMER, BENCH_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { BENCH_STOP_TIMER, BENCH_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_STATE_DELAYED, { BENCH_START_DELAY } },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ALARMED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { BENCH_STOP_TIMER, BENCH_SILENCE, BENCH_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { BENCH_STOP_TIMER, BENCH_SILENCE, BENCH_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_STATE_ACTIVE, { BENCH_SILENCE, BENCH_ENABLE_INPUT } }
+	},
+	[ALARM_STATE_DELAYED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_STATE_ACTIVE, { BENCH_STOP_TIMER, BENCH_ENABLE_INPUT } },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_STATE_INACTIVE, { BENCH_STOP_TIMER, BENCH_DISABLE_INPUT } },
+		[ALARM_EVENT_TRIGGER] = { ALARM_STATE_DELAYED, { BENCH_START_DELAY } },
+		[ALARM_EVENT_CLEAR] = { ALARM_STATE_ACTIVE, { BENCH_STOP_TIMER, BENCH_ENABLE_INPUT } },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_STATE_ALARMED, { BENCH_START_DURATION, BENCH_SOUND } }
+	}
+};
+
+static const TAlarm_fsm fsm = { transitions, actions };
+
+/*
+ * @fn		static bool change_state(TAlarmState *state, TAlarmEvent event)
+ * @brief	The same transitions as the table, written as a switch
+ */
+__attribute__((noinline)) static bool change_state(TAlarmState *state, TAlarmEvent event) {
+	switch (event) {
+	case ALARM_EVENT_ACTIVATE:
+		stop_timer(NULL);
+		if (*state == ALARM_STATE_ALARMED) {
+			silence(NULL);
+		}
+		enable_input(NULL);
+		*state = ALARM_STATE_ACTIVE;
+		return TRUE;
+	case ALARM_EVENT_DEACTIVATE:
+		stop_timer(NULL);
+		if (*state == ALARM_STATE_ALARMED) {
+			silence(NULL);
+		}
+		disable_input(NULL);
+		*state = ALARM_STATE_INACTIVE;
+		return TRUE;
+	case ALARM_EVENT_TRIGGER:
+		if (*state != ALARM_STATE_ACTIVE && *state != ALARM_STATE_DELAYED) {
+			return FALSE;
+		}
+		start_delay(NULL);
+		*state = ALARM_STATE_DELAYED;
+		return TRUE;
+	case ALARM_EVENT_CLEAR:
+		if (*state != ALARM_STATE_DELAYED) {
+			return FALSE;
+		}
+		stop_timer(NULL);
+		enable_input(NULL);
+		*state = ALARM_STATE_ACTIVE;
+		return TRUE;
+	case ALARM_EVENT_TIMEOUT:
+		if (*state == ALARM_STATE_DELAYED) {
+			start_duration(NULL);
+			sound(NULL);
+			*state = ALARM_STATE_ALARMED;
+			return TRUE;
+		}
+		if (*state == ALARM_STATE_ALARMED) {
+			silence(NULL);
+			enable_input(NULL);
+			*state = ALARM_STATE_ACTIVE;
+			return TRUE;
+		}
+		return FALSE;
+	default:
+		return FALSE;
+	}
+}
+
+static uint8_t *events;
+static uint32_t events_n;
+
+/*
+ * @fn		static void make_events(uint32_t n)
+ * @brief	A random sequence of events, mostly edges and timeouts as a sensor sees them (xorshift32)
+ */
+static void make_events(uint32_t n) {
+	static const uint8_t weights[] = {
+		ALARM_EVENT_ACTIVATE, ALARM_EVENT_DEACTIVATE, ALARM_EVENT_TRIGGER, ALARM_EVENT_TRIGGER, ALARM_EVENT_TRIGGER,
+		ALARM_EVENT_CLEAR, ALARM_EVENT_CLEAR, ALARM_EVENT_CLEAR, ALARM_EVENT_TIMEOUT, ALARM_EVENT_TIMEOUT
+	};
+	uint32_t random_state = 0x2545F491U;
+
+	events = malloc(n);
+	events_n = n;
+	for (uint32_t i = 0; i < n; i++) {
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		events[i] = weights[random_state % sizeof(weights)];
+	}
+}
+
+/*
+ * @fn		static double run_table(uint32_t *done, uint32_t *state_sum)
+ * @brief	Sends the events to the interpreter
+ * @retval	the nanoseconds taken by an event
+ */
+static double run_table(uint32_t *done, uint32_t *state_sum) {
+	TAlarmState state = ALARM_STATE_INACTIVE;
+
+	*done = 0;
+	*state_sum = 0;
+	uint64_t start = host_test_nanoseconds();
+	for (uint32_t i = 0; i < events_n; i++) {
+		*done += alarm_fsm_dispatch(&fsm, &state, events[i], NULL);
+		*state_sum += state;
+	}
+	return (double) (host_test_nanoseconds() - start) / events_n;
+}
+
+static double run_switch(uint32_t *done, uint32_t *state_sum) {
+	TAlarmState state = ALARM_STATE_INACTIVE;
+
+	*done = 0;
+	*state_sum = 0;
+	uint64_t start = host_test_nanoseconds();
+	for (uint32_t i = 0; i < events_n; i++) {
+		*done += change_state(&state, events[i]);
+		*state_sum += state;
+	}
+	return (double) (host_test_nanoseconds() - start) / events_n;
+}
+
+/*
+ * @fn		static double run_pir(void)
+ * @brief	Sends edges to the handler of an active PIR, with a delay longer than the run: it goes between
+ * 			active and delayed, through the storm protection, the activity and the timer wheel
+ * @retval	the nanoseconds taken by an edge
+ */
+static double run_pir(void) {
+	static TPIR_sensor pir;
+	static TBuzzer buzzer;
+	uint32_t edges = events_n / 10U;
+
+	board_init();
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+	PIR_sensor_init(&pir, 60000U, 10000U, EXTI15_10_IRQn, GPIOC, BENCH_PIR_PIN, &buzzer);
+	PIR_sensor_activate(&pir);
+
+	uint64_t elapsed = 0;
+	for (uint32_t i = 0; i < edges; i++) {
+		if ((i & 1U) == 0) {
+			GPIOC->IDR |= BENCH_PIR_PIN;
+		} else {
+			GPIOC->IDR &= ~(uint32_t) BENCH_PIR_PIN;
+		}
+		uint64_t start = host_test_nanoseconds();
+		PIR_sensor_handler(&pir);
+		elapsed += host_test_nanoseconds() - start;
+		// far enough from each other to stay out of the storm protection
+		board_advance(10U);
+	}
+	CHECK(pir.state == ALARM_STATE_ACTIVE && pir.storms == 0);
+	return (double) elapsed / edges;
+}
+
+int main(int argc, char **argv) {
+	uint32_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_EVENTS;
+	double table = 0;
+	double hand = 0;
+	double pir = 0;
+
+	make_events(n);
+	for (uint8_t i = 0; i < BENCH_RUNS; i++) {
+		uint32_t table_done, table_sum, switch_done, switch_sum;
+		uint32_t table_calls[BENCH_ACTIONS_N], switch_calls[BENCH_ACTIONS_N];
+
+		for (uint8_t j = 0; j < BENCH_ACTIONS_N; j++) {
+			calls[j] = 0;
+		}
+		double cost = run_table(&table_done, &table_sum);
+		table = (i == 0 || cost < table) ? cost : table;
+		for (uint8_t j = 0; j < BENCH_ACTIONS_N; j++) {
+			table_calls[j] = calls[j];
+			calls[j] = 0;
+		}
+		cost = run_switch(&switch_done, &switch_sum);
+		hand = (i == 0 || cost < hand) ? cost : hand;
+		for (uint8_t j = 0; j < BENCH_ACTIONS_N; j++) {
+			switch_calls[j] = calls[j];
+		}
+
+		// both took the same transitions, through the same states, with the same actions
+		CHECK(table_done == switch_done && table_sum == switch_sum);
+		for (uint8_t j = 0; j < BENCH_ACTIONS_N; j++) {
+			CHECK(table_calls[j] == switch_calls[j]);
+		}
+
+		cost = run_pir();
+		pir = (i == 0 || cost < pir) ? cost : pir;
+	}
+
+	printf("%lu events: table %.1f ns/event, switch %.1f ns/event (%.2fx), PIR edge %.1f ns\n", (unsigned long) n,
+			table, hand, table / hand, pir);
+	CHECK(table < hand * BENCH_MAX_SLOWDOWN);
+	free(events);
+	return host_test_result("alarm_fsm_bench");
+}
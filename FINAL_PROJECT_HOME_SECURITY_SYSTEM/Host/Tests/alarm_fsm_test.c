@@ -0,0 +1,382 @@
+/*
+ * Exhaustive tests of the alarm state machine.
+ * The interpreter is checked on a table built by the test, on every state and event and out of their range:
+ * the next state, the order of the actions, the observer, and an action dispatching an event on the same sensor.
+ * Then every input of the PIR and of the photoresistor is sent in every state they can reach, through the same
+ * functions the firmware calls: the activation, the edges of the PIR, the ADC watchdog and the expiration of the timer.
+ * After each one the state, the observer, the timer, the buzzer and the sampling are compared with what is expected.
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "adc.h"
+#include "dma.h"
+#include "tim.h"
+#include "usart.h"
+#include "alarm_fsm.h"
+#include "pir_sensor.h"
+#include "photoresistor.h"
+#include "logger.h"
+
+#define TEST_DELAY			(1000U)
+#define TEST_DURATION		(5000U)
+#define TEST_PIR_PIN		(GPIO_PIN_10)
+
+extern TLogger logger;
+
+/* The transitions seen by the observer */
+static uint32_t transitions;
+static TAlarmState observed_previous;
+static TAlarmState observed_state;
+
+static void observer(void *sensor, TAlarmState previous, TAlarmState state) {
+	(void) sensor;
+	transitions++;
+	observed_previous = previous;
+	observed_state = state;
+}
+
+/*
+ * The table of the interpreter test: the cells where state + event is a multiple of 3 are ignored, the others
+ * go to (state + event) % ALARM_STATES_N with the actions 1 + event, then 1 + ALARM_EVENTS_N + state
+ */
+static TAlarm_transition test_transitions[ALARM_STATES_N][ALARM_EVENTS_N];
+
+#define TEST_ACTIONS_N		(1U + ALARM_EVENTS_N + ALARM_STATES_N + 1U)
+#define TEST_ACTION_NESTED	(TEST_ACTIONS_N - 1U)
+
+static uint8_t action_log[16];
+static uint8_t action_log_n;
+static TAlarmState test_state;
+static TAlarm_fsm test_fsm;
+
+/* Each action of the table logs its own index, so the order can be checked */
+#define TEST_ACTION(n) static void test_action_##n(void *sensor) { (void) sensor; action_log[action_log_n++] = n; }
+TEST_ACTION(1)
+TEST_ACTION(2)
+TEST_ACTION(3)
+TEST_ACTION(4)
+TEST_ACTION(5)
+TEST_ACTION(6)
+TEST_ACTION(7)
+TEST_ACTION(8)
+TEST_ACTION(9)
+
+/* Sends a DEACTIVATE from inside a transition: it must see the state already changed */
+static void test_action_nested(void *sensor) {
+	action_log[action_log_n++] = TEST_ACTION_NESTED;
+	action_log[action_log_n++] = (uint8_t) test_state;
+	alarm_fsm_dispatch(&test_fsm, &test_state, ALARM_EVENT_DEACTIVATE, sensor);
+}
+
+static const TAlarm_action test_actions[TEST_ACTIONS_N] = {
+	NULL, test_action_1, test_action_2, test_action_3, test_action_4, test_action_5, test_action_6, test_action_7,
+	test_action_8, test_action_9, test_action_nested
+};
+
+static void test_interpreter(void) {
+	for (uint8_t state = 0; state < ALARM_STATES_N; state++) {
+		for (uint8_t event = 0; event < ALARM_EVENTS_N; event++) {
+			TAlarm_transition *cell = &test_transitions[state][event];
+			memset(cell, ALARM_ACTION_END, sizeof(*cell));
+			if ((state + event) % 3U == 0) {
+				cell->next_state = ALARM_FSM_IGNORE;
+			} else {
+				cell->next_state = (state + event) % ALARM_STATES_N;
+				cell->actions[0] = 1U + event;
+				cell->actions[1] = 1U + ALARM_EVENTS_N + state;
+			}
+		}
+	}
+	test_fsm.transitions = test_transitions;
+	test_fsm.actions = test_actions;
+	alarm_fsm_set_observer(observer);
+
+	for (uint8_t state = 0; state < ALARM_STATES_N + 1U; state++) {
+		for (uint8_t event = 0; event < ALARM_EVENTS_N + 1U; event++) {
+			bool in_range = state < ALARM_STATES_N && event < ALARM_EVENTS_N;
+			bool ignored = !in_range || (state + event) % 3U == 0;
+
+			test_state = state;
+			transitions = 0;
+			action_log_n = 0;
+			bool done = alarm_fsm_dispatch(&test_fsm, &test_state, event, NULL);
+
+			CHECK(done == !ignored);
+			if (ignored) {
+				CHECK(test_state == state && transitions == 0 && action_log_n == 0);
+				continue;
+			}
+			CHECK(test_state == (state + event) % ALARM_STATES_N);
+			CHECK(transitions == 1 && observed_previous == state && observed_state == test_state);
+			CHECK(action_log_n == 2 && action_log[0] == 1U + event && action_log[1] == 1U + ALARM_EVENTS_N + state);
+		}
+	}
+
+	// a full list of actions, with no terminator
+	TAlarm_transition *cell = &test_transitions[ALARM_STATE_ACTIVE][ALARM_EVENT_TIMEOUT];
+	cell->next_state = ALARM_STATE_ALARMED;
+	for (uint8_t i = 0; i < ALARM_FSM_MAX_ACTIONS; i++) {
+		cell->actions[i] = 1U + i;
+	}
+	test_state = ALARM_STATE_ACTIVE;
+	action_log_n = 0;
+	CHECK(alarm_fsm_dispatch(&test_fsm, &test_state, ALARM_EVENT_TIMEOUT, NULL));
+	CHECK(action_log_n == ALARM_FSM_MAX_ACTIONS);
+	for (uint8_t i = 0; i < ALARM_FSM_MAX_ACTIONS; i++) {
+		CHECK(action_log[i] == 1U + i);
+	}
+
+	// an action dispatching an event: the state is already the new one, and the nested transition is kept
+	cell->actions[0] = TEST_ACTION_NESTED;
+	cell->actions[1] = ALARM_ACTION_END;
+	test_transitions[ALARM_STATE_ALARMED][ALARM_EVENT_DEACTIVATE].next_state = ALARM_STATE_INACTIVE;
+	test_state = ALARM_STATE_ACTIVE;
+	transitions = 0;
+	action_log_n = 0;
+	CHECK(alarm_fsm_dispatch(&test_fsm, &test_state, ALARM_EVENT_TIMEOUT, NULL));
+	CHECK(action_log[0] == TEST_ACTION_NESTED && action_log[1] == ALARM_STATE_ALARMED);
+	CHECK(test_state == ALARM_STATE_INACTIVE && transitions == 2);
+	CHECK(observed_previous == ALARM_STATE_ALARMED && observed_state == ALARM_STATE_INACTIVE);
+
+	alarm_fsm_set_observer(NULL);
+}
+
+/* The inputs of the sensors, as the firmware produces them */
+typedef enum {
+	INPUT_ACTIVATE, INPUT_DEACTIVATE, INPUT_RISING, INPUT_FALLING, INPUT_TIMEOUT, INPUTS_N
+} TInput;
+
+/*
+ * The expected state of the PIR after an input, indexed by state and input.
+ * The edges that are not a transition are ignored, and a timeout can only come from the timer of a transition.
+ */
+static const TAlarmState pir_expected[ALARM_STATES_N][INPUTS_N] = {
+	[ALARM_STATE_INACTIVE] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_INACTIVE,
+			ALARM_STATE_INACTIVE },
+	[ALARM_STATE_ACTIVE] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_DELAYED, ALARM_STATE_ACTIVE,
+			ALARM_STATE_ACTIVE },
+	[ALARM_STATE_ALARMED] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_ALARMED, ALARM_STATE_ALARMED,
+			ALARM_STATE_ACTIVE },
+	[ALARM_STATE_DELAYED] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_DELAYED, ALARM_STATE_ACTIVE,
+			ALARM_STATE_ALARMED }
+};
+
+/* TRUE where the PIR takes a transition, even to the same state */
+static const bool pir_transition[ALARM_STATES_N][INPUTS_N] = {
+	[ALARM_STATE_INACTIVE] = { TRUE, TRUE, FALSE, FALSE, FALSE },
+	[ALARM_STATE_ACTIVE] = { TRUE, TRUE, TRUE, FALSE, FALSE },
+	[ALARM_STATE_ALARMED] = { TRUE, TRUE, FALSE, FALSE, TRUE },
+	[ALARM_STATE_DELAYED] = { TRUE, TRUE, TRUE, TRUE, TRUE }
+};
+
+static TPIR_sensor pir;
+static TBuzzer buzzer;
+static TAdc_stream stream;
+static TPhotoresistor photoresistor;
+
+static void setup(void) {
+	board_init();
+	MX_GPIO_Init();
+	MX_DMA_Init();
+	MX_USART2_UART_Init();
+	MX_ADC1_Init();
+	MX_TIM2_Init();
+	MX_TIM3_Init();
+	console_init(&huart2);
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+	logger_init(&logger, &huart2);
+	// there is no RTC on the virtual board: once the configuration is done, the messages are printed without it
+	get_configuration()->done = TRUE;
+	buzzer_init(&buzzer, &htim3, TIM_CHANNEL_1);
+}
+
+/*
+ * @fn		static void expire(TTimer *timer, TAlarmState *state)
+ * @brief	Lets a running timer expire on the wheel, that is when the state of its sensor changes.
+ * 			A stopped one can't, so its callback is run as the wheel would
+ */
+static void expire(TTimer *timer, TAlarmState *state) {
+	TAlarmState previous = *state;
+
+	if (!timer_wheel_is_running(timer)) {
+		timer->callback(timer->context);
+		return;
+	}
+	while (*state == previous) {
+		board_advance(1);
+	}
+}
+
+/*
+ * @fn		static void pir_input(TInput input)
+ * @brief	Sends an input to the PIR: the edges are seen by its handler with the level of the pin
+ */
+static void pir_input(TInput input) {
+	switch (input) {
+	case INPUT_ACTIVATE:
+		PIR_sensor_activate(&pir);
+		break;
+	case INPUT_DEACTIVATE:
+		PIR_sensor_deactivate(&pir);
+		break;
+	case INPUT_RISING:
+	case INPUT_FALLING:
+		if (input == INPUT_RISING) {
+			GPIOC->IDR |= TEST_PIR_PIN;
+		} else {
+			GPIOC->IDR &= ~(uint32_t) TEST_PIR_PIN;
+		}
+		PIR_sensor_handler(&pir);
+		break;
+	default:
+		expire(&pir.timer, &pir.state);
+		break;
+	}
+}
+
+/*
+ * @fn		static void pir_reach(TAlarmState state)
+ * @brief	Starts a new PIR and brings it to a state, the way the firmware would
+ */
+static void pir_reach(TAlarmState state) {
+	setup();
+	PIR_sensor_init(&pir, TEST_DELAY, TEST_DURATION, EXTI15_10_IRQn, GPIOC, TEST_PIR_PIN, &buzzer);
+	if (state == ALARM_STATE_INACTIVE) {
+		return;
+	}
+	PIR_sensor_activate(&pir);
+	if (state == ALARM_STATE_ACTIVE) {
+		return;
+	}
+	pir_input(INPUT_RISING);
+	if (state == ALARM_STATE_ALARMED) {
+		board_advance(TEST_DELAY);
+	}
+}
+
+static void test_pir(void) {
+	unsigned failures = host_test_failures;
+
+	for (uint8_t state = 0; state < ALARM_STATES_N; state++) {
+		for (uint8_t input = 0; input < INPUTS_N; input++) {
+			pir_reach(state);
+			CHECK(pir.state == state);
+
+			transitions = 0;
+			alarm_fsm_set_observer(observer);
+			pir_input(input);
+			alarm_fsm_set_observer(NULL);
+
+			TAlarmState expected = pir_expected[state][input];
+			CHECK(pir.state == expected);
+			CHECK(transitions == (pir_transition[state][input] ? 1U : 0U));
+			// the timer counts the delay and the duration, the buzzer sounds only in the alarm
+			CHECK(timer_wheel_is_running(&pir.timer)
+					== (expected == ALARM_STATE_DELAYED || expected == ALARM_STATE_ALARMED));
+			CHECK((buzzer.pulse != 0) == (expected == ALARM_STATE_ALARMED));
+			if (host_test_failures != failures) {
+				fprintf(stderr, "PIR: state %u, input %u\n", state, input);
+				failures = host_test_failures;
+			}
+		}
+	}
+}
+
+/* The inputs of the photoresistor: the ADC watchdog takes the place of the edges */
+#define INPUT_WATCHDOG		(INPUT_RISING)
+
+static const TAlarmState photoresistor_expected[ALARM_STATES_N][INPUTS_N] = {
+	[ALARM_STATE_INACTIVE] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_INACTIVE, 0,
+			ALARM_STATE_INACTIVE },
+	[ALARM_STATE_ACTIVE] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_DELAYED, 0, ALARM_STATE_ACTIVE },
+	[ALARM_STATE_ALARMED] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_ALARMED, 0, ALARM_STATE_ACTIVE },
+	[ALARM_STATE_DELAYED] = { ALARM_STATE_ACTIVE, ALARM_STATE_INACTIVE, ALARM_STATE_ACTIVE, 0, ALARM_STATE_ALARMED }
+};
+
+static const bool photoresistor_transition[ALARM_STATES_N][INPUTS_N] = {
+	[ALARM_STATE_INACTIVE] = { TRUE, TRUE, FALSE, FALSE, FALSE },
+	[ALARM_STATE_ACTIVE] = { TRUE, TRUE, TRUE, FALSE, FALSE },
+	[ALARM_STATE_ALARMED] = { TRUE, TRUE, FALSE, FALSE, TRUE },
+	[ALARM_STATE_DELAYED] = { TRUE, TRUE, TRUE, FALSE, TRUE }
+};
+
+static void photoresistor_input(TInput input) {
+	switch (input) {
+	case INPUT_ACTIVATE:
+		photoresistor_activate(&photoresistor);
+		break;
+	case INPUT_DEACTIVATE:
+		photoresistor_deactivate(&photoresistor);
+		break;
+	case INPUT_WATCHDOG:
+		photoresistor_watchdog(&photoresistor);
+		break;
+	default:
+		expire(&photoresistor.alarm_timer, &photoresistor.state);
+		break;
+	}
+}
+
+static void photoresistor_reach(TAlarmState state) {
+	setup();
+	memset(&stream, 0, sizeof(stream));
+	adc_stream_init(&stream, &hadc1, &htim2);
+	photoresistor_init(&photoresistor, TEST_DELAY, TEST_DURATION, &stream, ADC_CHANNEL_0, &buzzer);
+	if (state == ALARM_STATE_INACTIVE) {
+		return;
+	}
+	photoresistor_activate(&photoresistor);
+	if (state == ALARM_STATE_ACTIVE) {
+		return;
+	}
+	photoresistor_watchdog(&photoresistor);
+	if (state == ALARM_STATE_ALARMED) {
+		board_advance(TEST_DELAY);
+	}
+}
+
+static void test_photoresistor(void) {
+	unsigned failures = host_test_failures;
+
+	for (uint8_t state = 0; state < ALARM_STATES_N; state++) {
+		for (uint8_t input = 0; input < INPUTS_N; input++) {
+			if (input == INPUT_FALLING) {
+				continue;
+			}
+			photoresistor_reach(state);
+			CHECK(photoresistor.state == state);
+
+			transitions = 0;
+			alarm_fsm_set_observer(observer);
+			photoresistor_input(input);
+			alarm_fsm_set_observer(NULL);
+
+			TAlarmState expected = photoresistor_expected[state][input];
+			CHECK(photoresistor.state == expected);
+			CHECK(transitions == (photoresistor_transition[state][input] ? 1U : 0U));
+			CHECK(timer_wheel_is_running(&photoresistor.alarm_timer)
+					== (expected == ALARM_STATE_DELAYED || expected == ALARM_STATE_ALARMED));
+			CHECK((buzzer.pulse != 0) == (expected == ALARM_STATE_ALARMED));
+			// the light is sampled while the photoresistor watches the barrier
+			CHECK(adc_stream_is_started(&stream, photoresistor.index)
+					== (expected == ALARM_STATE_ACTIVE || expected == ALARM_STATE_DELAYED));
+			if (host_test_failures != failures) {
+				fprintf(stderr, "photoresistor: state %u, input %u\n", state, input);
+				failures = host_test_failures;
+			}
+		}
+	}
+}
+
+int main(void) {
+	test_interpreter();
+	test_pir();
+	test_photoresistor();
+	return host_test_result("alarm_fsm_test");
+}
@@ -0,0 +1,202 @@
+/*
+ * Benchmark of the correlation of the detections, up to 100 rules, with the firmware built for 128 rules.
+ * The registry holds CORRELATION_ZONES_N sensors, one in each zone, whose detections come from a small table
+ * of the state machine: a TRIGGER enters the delayed state, a CLEAR leaves it. Only the TRIGGER is timed.
+ * The rules are indexed by zone, so a detection must cost the same with 2 rules of its zone and with 98 more rules
+ * of the other zones. Then 100 rules on random zones are run against detections of random sensors.
+ * Every measure is run a few times and the fastest run is kept.
+ * Usage: correlation_bench [detections]
+ */
+
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "usart.h"
+#include "console.h"
+#include "correlation.h"
+
+#define BENCH_DEFAULT_DETECTIONS	(100000U)
+#define BENCH_RUNS					(5U)
+#define BENCH_RULES					(100U)
+#define BENCH_WINDOW				(2000U)
+
+/* Largest ratio between the cost of a detection with all the rules and with the rules of its zone only */
+#define BENCH_MAX_SLOWDOWN			(2.0)
+
+extern TLogger logger;
+
+static TAlarmState states[CORRELATION_ZONES_N];
+static uint32_t random_state;
+
+static uint32_t bench_random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+static void sensor_activate(void *sensor) {
+	*(TAlarmState*) sensor = ALARM_STATE_ACTIVE;
+}
+
+static void sensor_deactivate(void *sensor) {
+	*(TAlarmState*) sensor = ALARM_STATE_INACTIVE;
+}
+
+static TAlarmState sensor_state(void *sensor) {
+	return *(TAlarmState*) sensor;
+}
+
+static void sensor_stats(void *sensor, TSensor_stats *stats) {
+	(void) sensor;
+	memset(stats, 0, sizeof(*stats));
+}
+
+static const TSensor_ops sensor_ops = {
+	.activate = sensor_activate,
+	.deactivate = sensor_deactivate,
+	.state = sensor_state,
+	.stats = sensor_stats
+};
+
+/* A detection and its end, with no action */
+static const TAlarm_transition transitions[ALARM_STATES_N][ALARM_EVENTS_N] = {
+	[ALARM_STATE_INACTIVE] = { { ALARM_FSM_IGNORE }, { ALARM_FSM_IGNORE }, { ALARM_FSM_IGNORE }, { ALARM_FSM_IGNORE },
+			{ ALARM_FSM_IGNORE } },
+	[ALARM_STATE_ACTIVE] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TRIGGER] = { ALARM_STATE_DELAYED },
+		[ALARM_EVENT_CLEAR] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	},
+	[ALARM_STATE_ALARMED] = { { ALARM_FSM_IGNORE }, { ALARM_FSM_IGNORE }, { ALARM_FSM_IGNORE }, { ALARM_FSM_IGNORE },
+			{ ALARM_FSM_IGNORE } },
+	[ALARM_STATE_DELAYED] = {
+		[ALARM_EVENT_ACTIVATE] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_DEACTIVATE] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_TRIGGER] = { ALARM_FSM_IGNORE },
+		[ALARM_EVENT_CLEAR] = { ALARM_STATE_ACTIVE },
+		[ALARM_EVENT_TIMEOUT] = { ALARM_FSM_IGNORE }
+	}
+};
+
+static const TAlarm_action no_actions[1] = { NULL };
+static const TAlarm_fsm fsm = { transitions, no_actions };
+
+static void setup(void) {
+	board_init();
+	MX_USART2_UART_Init();
+	console_init(&huart2);
+	timer_wheel_init();
+	health_init();
+	logger_init(&logger, &huart2);
+	// there is no RTC on the virtual board: once the configuration is done, the messages are printed without it
+	get_configuration()->done = TRUE;
+
+	sensor_registry_init();
+	for (uint8_t zone = 0; zone < CORRELATION_ZONES_N; zone++) {
+		states[zone] = ALARM_STATE_ACTIVE;
+		sensor_registry_add(&sensor_ops, &states[zone], "bench", 1U << zone);
+	}
+	correlation_init();
+}
+
+/*
+ * @fn		static void add_rule(uint16_t zones, uint16_t then)
+ * @brief	Adds a sequence rule from zones to then, or a count rule on zones,
+ * 			with a weight of 1, so the level rarely reaches the correlated alarm
+ */
+static void add_rule(uint16_t zones, uint16_t then) {
+	int index;
+
+	if (bench_random(2) == 0) {
+		index = correlation_add_sequence("bench sequence", zones, then, BENCH_WINDOW, 1);
+	} else {
+		index = correlation_add_count("bench count", zones, 2 + bench_random(CORRELATION_COUNT_MAX - 1U),
+				BENCH_WINDOW, 1);
+	}
+	CHECK(index >= 0);
+}
+
+/*
+ * @fn		static double run(uint32_t detections, bool one_sensor)
+ * @brief	Sends the detections, a millisecond apart, from the sensor of the zone 0 or from random sensors
+ * @retval	the nanoseconds taken by a detection
+ */
+static double run(uint32_t detections, bool one_sensor) {
+	uint64_t elapsed = 0;
+
+	for (uint32_t i = 0; i < detections; i++) {
+		uint8_t zone = one_sensor ? 0 : bench_random(CORRELATION_ZONES_N);
+
+		uint64_t start = host_test_nanoseconds();
+		alarm_fsm_dispatch(&fsm, &states[zone], ALARM_EVENT_TRIGGER, &states[zone]);
+		elapsed += host_test_nanoseconds() - start;
+
+		alarm_fsm_dispatch(&fsm, &states[zone], ALARM_EVENT_CLEAR, &states[zone]);
+		board_advance(1);
+	}
+	return (double) elapsed / detections;
+}
+
+/*
+ * @fn		static double best_of_runs(uint8_t others, uint32_t detections, bool one_sensor)
+ * @brief	Adds 2 rules of the zone 0 and others on the other zones, or all of them on random zones
+ * 			if the detections come from random sensors, and keeps the fastest run
+ */
+static double best_of_runs(uint8_t others, uint32_t detections, bool one_sensor) {
+	double best = 0;
+
+	for (uint8_t i = 0; i < BENCH_RUNS; i++) {
+		random_state = 0x2545F491U;
+		setup();
+		if (one_sensor) {
+			add_rule(1U, 1U);
+			add_rule(1U, 1U);
+			for (uint8_t j = 0; j < others; j++) {
+				add_rule((uint16_t) (2U << bench_random(CORRELATION_ZONES_N - 1U)),
+						(uint16_t) (2U << bench_random(CORRELATION_ZONES_N - 1U)));
+			}
+		} else {
+			for (uint8_t j = 0; j < BENCH_RULES; j++) {
+				uint16_t zones = (uint16_t) ((1U << bench_random(CORRELATION_ZONES_N))
+						| (1U << bench_random(CORRELATION_ZONES_N)));
+				add_rule(zones, (uint16_t) (1U << bench_random(CORRELATION_ZONES_N)));
+			}
+		}
+
+		double cost = run(detections, one_sensor);
+		if (i == 0 || cost < best) {
+			best = cost;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	uint32_t detections = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_DETECTIONS;
+
+	printf("%lu rules at most\n", (unsigned long) CORRELATION_RULES_N);
+	double own = best_of_runs(0, detections, TRUE);
+	double all = best_of_runs(BENCH_RULES - 2U, detections, TRUE);
+	printf("rules of the zone only (2): %.1f ns/detection\n", own);
+	printf("with %u rules of other zones (%u): %.1f ns/detection, %.2fx\n", BENCH_RULES - 2U, BENCH_RULES, all,
+			all / own);
+
+	double random = best_of_runs(0, detections, FALSE);
+	printf("%u rules on random zones, random sensors: %.1f ns/detection\n", BENCH_RULES, random);
+
+	// the table holds the rules of the benchmark, and no more than its cap
+	random_state = 0x2545F491U;
+	setup();
+	for (uint32_t i = 0; i < CORRELATION_RULES_N; i++) {
+		CHECK(correlation_add_count("bench count", 1U, 2, BENCH_WINDOW, 1) == (int) i);
+	}
+	CHECK(correlation_add_count("bench count", 1U, 2, BENCH_WINDOW, 1) == CORRELATION_ERR_FULL);
+
+	CHECK(CORRELATION_RULES_N >= BENCH_RULES);
+	CHECK(all < own * BENCH_MAX_SLOWDOWN);
+	return host_test_result("correlation_bench");
+}
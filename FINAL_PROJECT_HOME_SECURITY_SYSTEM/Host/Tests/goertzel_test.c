@@ -0,0 +1,161 @@
+/*
+ * Tests of the Goertzel bank with synthetic sines: a sine on a bin must be measured at its amplitude, and must not
+ * leak into the other bins, at the rates of the ADC stream with and without the averaging of the samples in groups.
+ * The samples are fed in blocks of random lengths, on a constant level, rounded as the ADC would. The averaging
+ * of a group attenuates a sine by sin(pi f d / rate) / (d sin(pi f / rate)), as expected by the test.
+ * The windows must last a whole number of periods of the bins at any rate multiple of GOERTZEL_RESOLUTION, also
+ * when the groups do not divide the rate evenly, as at 50 kHz.
+ * A constant level gives its mean and no amplitude, the bins not below half the rate stay at 0, and the resonators
+ * must not overflow with the full scale of the oversampled samples.
+ * Usage: goertzel_test [seed]
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_test.h"
+#include "goertzel.h"
+
+/* Windows fed before the one checked, the first one has no mean to subtract */
+#define TEST_WINDOWS			(3U)
+
+/* Error allowed on an amplitude, relative to the sine and absolute in steps of the samples */
+#define TEST_RELATIVE_ERROR		(0.01)
+#define TEST_ABSOLUTE_ERROR		(2.0)
+
+static const uint16_t bins[] = { 100U, 120U, 200U, 240U };
+#define TEST_BINS_N				(sizeof(bins) / sizeof(bins[0]))
+
+static uint32_t random_state;
+
+static uint32_t test_random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+static void setup(TGoertzel *goertzel, uint32_t rate) {
+	goertzel_init(goertzel);
+	for (uint8_t i = 0; i < TEST_BINS_N; i++) {
+		CHECK(goertzel_add_bin(goertzel, bins[i]) == GOERTZEL_OK);
+	}
+	goertzel_set_rate(goertzel, rate);
+}
+
+/*
+ * @fn		static void feed(TGoertzel *goertzel, uint32_t rate, double level, double amplitude, double frequency,
+ * 				uint16_t top)
+ * @brief	Feeds TEST_WINDOWS windows of a sine on a level, with a random phase, in blocks of random lengths
+ */
+static void feed(TGoertzel *goertzel, uint32_t rate, double level, double amplitude, double frequency, uint16_t top) {
+	uint32_t total = TEST_WINDOWS * rate / GOERTZEL_RESOLUTION;
+	double phase = 2.0 * M_PI * test_random(1000) / 1000.0;
+	uint32_t windows = goertzel->windows;
+	uint32_t n = 0;
+
+	while (n < total) {
+		uint16_t samples[100];
+		uint16_t length = 1U + test_random(sizeof(samples) / sizeof(samples[0]));
+
+		if (length > total - n) {
+			length = total - n;
+		}
+		for (uint16_t i = 0; i < length; i++, n++) {
+			double value = level + amplitude * sin(2.0 * M_PI * frequency * n / rate + phase);
+			samples[i] = (value < 0) ? 0 : (value > top) ? top : (uint16_t) lround(value);
+		}
+		goertzel_block(goertzel, samples, length);
+	}
+	CHECK(goertzel->windows == windows + TEST_WINDOWS);
+}
+
+/*
+ * @fn		static double group_gain(uint32_t rate, uint16_t decimation, double frequency)
+ * @brief	Returns the gain of the mean of decimation samples, for a sine of a frequency
+ */
+static double group_gain(uint32_t rate, uint16_t decimation, double frequency) {
+	double x = M_PI * frequency / rate;
+	return (decimation == 1) ? 1.0 : sin(x * decimation) / (decimation * sin(x));
+}
+
+static bool close_to(double measured, double expected) {
+	return fabs(measured - expected) <= expected * TEST_RELATIVE_ERROR + TEST_ABSOLUTE_ERROR;
+}
+
+static void test_sines(uint32_t rate, double amplitude, uint16_t top) {
+	TGoertzel goertzel;
+	double level = top / 2.0;
+
+	for (uint8_t target = 0; target < TEST_BINS_N; target++) {
+		setup(&goertzel, rate);
+		// a sine above half the rate of the resonators would alias on the other bins
+		if (2U * bins[target] * goertzel.decimation >= rate) {
+			continue;
+		}
+		feed(&goertzel, rate, level, amplitude, bins[target], top);
+
+		for (uint8_t bin = 0; bin < TEST_BINS_N; bin++) {
+			bool measured = 2U * bins[bin] * goertzel.decimation < rate;
+			double expected = (bin == target && measured) ? amplitude * group_gain(rate, goertzel.decimation, bins[bin])
+					: 0;
+
+			if (!close_to(goertzel.amplitudes[bin], expected)) {
+				fprintf(stderr, "rate %lu, sine of %.0f at %u Hz: bin %u Hz is %u, expected %.1f\n",
+						(unsigned long) rate, amplitude, bins[target], bins[bin], goertzel.amplitudes[bin], expected);
+				host_test_failures++;
+			}
+		}
+		// the means of the groups and of the window are truncated, each one by less than a step
+		CHECK(fabs(goertzel.mean - level) <= 2.0);
+	}
+}
+
+static void test_constant(uint32_t rate) {
+	TGoertzel goertzel;
+
+	setup(&goertzel, rate);
+	feed(&goertzel, rate, 1234.0, 0, 0, 4095U);
+	CHECK(goertzel.mean == 1234U);
+	CHECK(goertzel_get_peak(&goertzel) == 0);
+}
+
+static void test_bins(void) {
+	TGoertzel goertzel;
+
+	goertzel_init(&goertzel);
+	CHECK(goertzel_add_bin(&goertzel, 0) == GOERTZEL_ERR_INVALID);
+	CHECK(goertzel_add_bin(&goertzel, GOERTZEL_RESOLUTION + 1U) == GOERTZEL_ERR_INVALID);
+	for (uint8_t i = 0; i < GOERTZEL_MAX_BINS; i++) {
+		CHECK(goertzel_add_bin(&goertzel, bins[i % TEST_BINS_N]) == GOERTZEL_OK);
+	}
+	CHECK(goertzel_add_bin(&goertzel, bins[0]) == GOERTZEL_ERR_INVALID);
+
+	// no rate, no window
+	uint16_t samples[GOERTZEL_CHUNK] = { 0 };
+	CHECK(!goertzel_block(&goertzel, samples, GOERTZEL_CHUNK));
+	CHECK(goertzel.windows == 0);
+}
+
+int main(int argc, char **argv) {
+	// the rates of the stream: the default one, the highest without groups, with groups of 2 and 4, and with groups
+	// that must grow to divide the window, of 53 and 20 samples
+	static const uint32_t rates[] = { 640U, 1000U, GOERTZEL_MAX_RATE, 2U * GOERTZEL_MAX_RATE, 12800U, 31270U, 50000U };
+
+	random_state = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0x9E3779B9U;
+	if (random_state == 0) {
+		random_state = 1;
+	}
+
+	test_bins();
+	for (uint8_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+		test_constant(rates[r]);
+		// a flicker barely over the threshold of the photoresistor, a strong one, and the oversampled full scale
+		test_sines(rates[r], 30.0, 4095U);
+		test_sines(rates[r], 1500.0, 4095U);
+		test_sines(rates[r], 16000.0, 32767U);
+	}
+	// only the bins below half the rate are measured
+	test_sines(300U, 1000.0, 4095U);
+	return host_test_result("goertzel_test");
+}
@@ -0,0 +1,72 @@
+/*
+ * Tests of the fault events: the logger keeps a reference to every message queued, so the events of different
+ * sources and of the same fault, queued before the logger prints them, must keep their own text.
+ * Also the events dropped because the queue of the logger is full must not overwrite the ones queued.
+ * The configuration is left not done, so the logger only queues the messages and the test reads its queue.
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "usart.h"
+#include "logger.h"
+
+extern TLogger logger;
+
+static void setup(void) {
+	board_init();
+	MX_USART2_UART_Init();
+	console_init(&huart2);
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	logger_init(&logger, &huart2);
+	get_configuration()->done = FALSE;
+}
+
+/*
+ * @fn		static const char* queued(uint8_t i)
+ * @brief	Returns the i-th message in the queue of the logger, from the oldest
+ */
+static const char* queued(uint8_t i) {
+	return logger.messages[(logger.first + i) % LOGGER_QUEUE_SIZE];
+}
+
+static void test_sources(void) {
+	setup();
+	health_raise(HEALTH_FAULT_PIR_STUCK, 1);
+	health_raise(HEALTH_FAULT_PIR_STUCK, 2);
+	health_raise(HEALTH_FAULT_KEYPAD_ROW_STUCK, 3);
+	health_clear(HEALTH_FAULT_PIR_STUCK, 1);
+	// a fault already raised, or not raised, is not logged again
+	health_raise(HEALTH_FAULT_PIR_STUCK, 2);
+	health_clear(HEALTH_FAULT_PIR_STUCK, 1);
+
+	CHECK(logger.count == 4);
+	CHECK(strcmp(queued(0), "Fault: PIR line 1 stuck high") == 0);
+	CHECK(strcmp(queued(1), "Fault: PIR line 2 stuck high") == 0);
+	CHECK(strcmp(queued(2), "Fault: keypad row 3 stuck high") == 0);
+	CHECK(strcmp(queued(3), "Fault cleared: pir stuck 1") == 0);
+}
+
+static void test_full_queue(void) {
+	char expected[HEALTH_MESSAGE_LENGTH];
+
+	setup();
+	// the first events fill the queue, the others are dropped
+	for (uint8_t source = 0; source < 2U * LOGGER_QUEUE_SIZE; source++) {
+		health_raise(HEALTH_FAULT_PIR_STUCK, source);
+	}
+	CHECK(logger.count == LOGGER_QUEUE_SIZE && logger.dropped == LOGGER_QUEUE_SIZE);
+	for (uint8_t source = 0; source < LOGGER_QUEUE_SIZE; source++) {
+		snprintf(expected, sizeof(expected), "Fault: PIR line %u stuck high", source);
+		CHECK(strcmp(queued(source), expected) == 0);
+	}
+}
+
+int main(void) {
+	test_sources();
+	test_full_queue();
+	return host_test_result("health_test");
+}
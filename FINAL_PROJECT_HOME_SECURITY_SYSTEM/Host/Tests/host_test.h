@@ -0,0 +1,51 @@
+/*
+ * Checks and timings shared by the tests and the benchmarks of the host.
+ * A test counts the failed checks and returns host_test_result() from main, so ctest sees the failures.
+ */
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+static unsigned host_test_failures;
+
+/* Checks a condition, printing it with its line when it is false */
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			host_test_failures++; \
+		} \
+	} while (0)
+
+/*
+ * @fn		static inline int host_test_result(const char *name)
+ * @brief	Prints the outcome of a test
+ * @param	name	the name of the test
+ * @retval	the exit code of the test, 0 if no check failed
+ */
+static inline int host_test_result(const char *name) {
+	if (host_test_failures != 0) {
+		fprintf(stderr, "%s: %u checks failed\n", name, host_test_failures);
+		return 1;
+	}
+	printf("%s: passed\n", name);
+	return 0;
+}
+
+/*
+ * @fn		static inline uint64_t host_test_nanoseconds(void)
+ * @brief	Reads the monotonic clock of the host, for the benchmarks
+ * @retval	the time in nanoseconds
+ */
+static inline uint64_t host_test_nanoseconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+#endif /* HOST_TEST_H_ */
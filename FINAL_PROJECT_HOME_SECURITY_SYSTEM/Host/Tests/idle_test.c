@@ -0,0 +1,66 @@
+/*
+ * Tests of the tickless sleep: the timers of the wheel must expire at their time after the sleeps, and their callbacks
+ * must run with the interrupts enabled, since they may wait for the console with HAL_Delay.
+ * The timer of the sleeps does not count on the virtual board: the test raises its update flag before each sleep,
+ * as if it reached the deadline, and the sleep takes the millisecond of the board given by __WFI.
+ * The main loop is the one of main.c: the sleep is called with the interrupts disabled.
+ */
+
+#include "host_test.h"
+#include "board.h"
+#include "tim.h"
+#include "idle.h"
+
+#define TEST_TIMERS_N		(4U)
+
+static TTimer timers[TEST_TIMERS_N];
+static uint32_t start;
+static uint32_t expired_at[TEST_TIMERS_N];
+
+static void expired(void *context) {
+	uint32_t i = (uint32_t) (uintptr_t) context;
+
+	expired_at[i] = HAL_GetTick() - start;
+	CHECK(__get_PRIMASK() == 0);
+	// as free_console() does: with the interrupts disabled it would never return
+	HAL_Delay(1);
+}
+
+/*
+ * @fn		static void main_loop(uint32_t milliseconds)
+ * @brief	Sleeps, with nothing to poll, until the time has passed
+ */
+static void main_loop(uint32_t milliseconds) {
+	uint32_t sleeps = 0;
+
+	while (HAL_GetTick() - start < milliseconds) {
+		TIM11->SR |= TIM_SR_UIF;
+		__disable_irq();
+		idle_sleep(TRUE);
+		__enable_irq();
+		sleeps++;
+	}
+	printf("%lu ms in %lu sleeps\n", (unsigned long) milliseconds, (unsigned long) sleeps);
+}
+
+int main(void) {
+	static const uint32_t delays[TEST_TIMERS_N] = { 3U, 40U, 1000U, IDLE_MAX_SLEEP * 2U + 500U };
+
+	board_init();
+	MX_TIM11_Init();
+	timer_wheel_init();
+	idle_init(&htim11, TIM1_TRG_COM_TIM11_IRQn);
+
+	start = HAL_GetTick();
+	for (uint32_t i = 0; i < TEST_TIMERS_N; i++) {
+		timer_wheel_setup(&timers[i], expired, (void*) (uintptr_t) i);
+		timer_wheel_start(&timers[i], delays[i], 0);
+	}
+	main_loop(delays[TEST_TIMERS_N - 1U] + 10U);
+
+	// every timer expired at its time, as measured by the tick of the HAL
+	for (uint32_t i = 0; i < TEST_TIMERS_N; i++) {
+		CHECK(expired_at[i] == delays[i]);
+	}
+	return host_test_result("idle_test");
+}
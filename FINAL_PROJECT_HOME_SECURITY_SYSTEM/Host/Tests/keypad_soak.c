@@ -0,0 +1,281 @@
+/*
+ * Soak test of the keypad on the virtual board, faster than real time.
+ * The matrix of the keypad is modelled on the pins: a held key connects its column to its row, so a row reads
+ * high while one of its keys is held and its column is driven high. The firmware sees the edges of the rows
+ * on the EXTI, debounces them with the timer wheel and scans the columns as on the board.
+ * Random sequences are typed: valid commands, wrong and partial PINs, bouncing keys, garbage and the quick arm chord.
+ * After each sequence the keypad must have checked the expected number of commands and must not be left with
+ * a full buffer. The report gives the throughput, the rejected commands and the stuck states.
+ * Usage: keypad_soak [sequences] [seed]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "gpio.h"
+#include "tim.h"
+#include "usart.h"
+#include "keypad.h"
+
+#define SOAK_DEFAULT_SEQUENCES	(20000U)
+#define SOAK_PIN				("4321")
+
+/* Milliseconds a key is held, and between the release of a key and the press of the next one */
+#define SOAK_HOLD_TIME			(120U)
+#define SOAK_GAP_TIME			(60U)
+
+/* Edges of a bouncing key, and milliseconds between them */
+#define SOAK_BOUNCES			(3U)
+#define SOAK_BOUNCE_GAP			(2U)
+
+/* Milliseconds waited after a sequence, so the keypad checks its buffer and sees the releases */
+#define SOAK_SETTLE_TIME		(300U)
+
+/* Milliseconds the keys of the chord are held together */
+#define SOAK_CHORD_TIME			(KEYPAD_QUICK_ARM_HOLD_TIME + 100U)
+
+typedef enum {
+	SEQUENCE_VALID, SEQUENCE_WRONG_PIN, SEQUENCE_BOUNCING, SEQUENCE_PARTIAL, SEQUENCE_GARBAGE, SEQUENCE_CHORD,
+	SEQUENCE_KINDS_N
+} TSequence_kind;
+
+static const char COMMAND_LETTERS[] = { KEYPAD_Button_A, KEYPAD_Button_B, KEYPAD_Button_C, KEYPAD_Button_D };
+static const char COMMAND_ENDS[] = { KEYPAD_Button_HASH, KEYPAD_Button_STAR };
+
+extern TKeypad keypad;
+extern TBuzzer buzzer;
+extern TLogger logger;
+extern TUser_directory users;
+
+/* The keys held on the virtual keypad, as the bits of KEYPAD_KEY_BIT() */
+static uint16_t held_keys;
+static uint32_t random_state;
+
+/*
+ * @fn		static uint32_t soak_random(uint32_t n)
+ * @brief	Returns a pseudo-random number from 0 to n - 1 (xorshift32)
+ */
+static uint32_t soak_random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+/*
+ * @fn		static void matrix_update(void)
+ * @brief	Drives the rows from the held keys and from the levels of the columns
+ */
+static void matrix_update(void) {
+	for (uint8_t row = 0; row < ROWS_N; row++) {
+		GPIO_PinState level = GPIO_PIN_RESET;
+		for (uint8_t col = 0; col < COLUMNS_N; col++) {
+			if ((held_keys & KEYPAD_KEY_BIT(row, col)) != 0 && (COLUMN_1_PORT->ODR & keypad.cols_pins[col]) != 0) {
+				level = GPIO_PIN_SET;
+			}
+		}
+		board_set_input(ROW_1_PORT, keypad.rows_pins[row], level);
+	}
+}
+
+static void matrix_output(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state, void *context) {
+	(void) state;
+	(void) context;
+	if (port == COLUMN_1_PORT && (pin & (COLUMN_1_PIN | COLUMN_2_PIN | COLUMN_3_PIN | COLUMN_4_PIN)) != 0) {
+		matrix_update();
+	}
+}
+
+static uint16_t key_bit(char key) {
+	for (uint8_t row = 0; row < ROWS_N; row++) {
+		for (uint8_t col = 0; col < COLUMNS_N; col++) {
+			if (KEYS[row][col] == (TKEYPAD_Button) key) {
+				return KEYPAD_KEY_BIT(row, col);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * @fn		static void run(uint32_t milliseconds)
+ * @brief	Lets the time pass, running the main loop of the firmware every millisecond
+ */
+static void run(uint32_t milliseconds) {
+	while (milliseconds-- > 0) {
+		board_advance(1);
+		KEYPAD_poll(&keypad);
+	}
+}
+
+static void press(uint16_t keys) {
+	held_keys |= keys;
+	matrix_update();
+}
+
+static void release(uint16_t keys) {
+	held_keys &= ~keys;
+	matrix_update();
+}
+
+/*
+ * @fn		static void type_key(char key, bool bouncing)
+ * @brief	Presses and releases a key, with a few bounces before the contact is stable
+ */
+static void type_key(char key, bool bouncing) {
+	uint16_t bit = key_bit(key);
+
+	if (bouncing) {
+		for (uint8_t i = 0; i < SOAK_BOUNCES; i++) {
+			press(bit);
+			run(SOAK_BOUNCE_GAP);
+			release(bit);
+			run(SOAK_BOUNCE_GAP);
+		}
+	}
+	press(bit);
+	run(SOAK_HOLD_TIME);
+	release(bit);
+	run(SOAK_GAP_TIME);
+}
+
+/*
+ * @fn		static uint32_t type_sequence(TSequence_kind kind)
+ * @brief	Types a random sequence of a kind
+ * @retval	the number of commands the keypad must check
+ */
+static uint32_t type_sequence(TSequence_kind kind) {
+	char keys[KEYPAD_DEFAULT_BUFFER_SIZE];
+	uint8_t n = 0;
+
+	switch (kind) {
+	case SEQUENCE_VALID:
+	case SEQUENCE_BOUNCING:
+	case SEQUENCE_WRONG_PIN:
+		keys[n++] = KEYPAD_Button_HASH;
+		for (uint8_t i = 0; i < USER_PIN_LENGTH; i++) {
+			keys[n++] = (kind == SEQUENCE_WRONG_PIN) ? (char) ('0' + soak_random(10)) : SOAK_PIN[i];
+		}
+		keys[n++] = COMMAND_LETTERS[soak_random(sizeof(COMMAND_LETTERS))];
+		keys[n++] = COMMAND_ENDS[soak_random(sizeof(COMMAND_ENDS))];
+
+		uint8_t bouncing = (kind == SEQUENCE_BOUNCING) ? soak_random(n) : n;
+		for (uint8_t i = 0; i < n; i++) {
+			type_key(keys[i], i == bouncing);
+		}
+		return 1;
+	case SEQUENCE_PARTIAL:
+		type_key(KEYPAD_Button_HASH, FALSE);
+		for (uint8_t i = 0, digits = soak_random(USER_PIN_LENGTH + 1); i < digits; i++) {
+			type_key(SOAK_PIN[i], FALSE);
+		}
+		// the keys typed so far are discarded by the next key
+		run(MAX_DELAY_BETWEEN_PRESSIONS + SOAK_GAP_TIME);
+		return 0;
+	case SEQUENCE_CHORD:
+		// the keys of a gesture are not part of a command
+		press(key_bit(KEYPAD_Button_A));
+		run(SOAK_GAP_TIME);
+		press(key_bit(KEYPAD_Button_B));
+		run(SOAK_CHORD_TIME);
+		release(key_bit(KEYPAD_Button_A) | key_bit(KEYPAD_Button_B));
+		run(SOAK_GAP_TIME);
+		return 0;
+	default:
+		for (uint8_t i = 0; i < KEYPAD_DEFAULT_BUFFER_SIZE; i++) {
+			type_key(KEYS[soak_random(ROWS_N)][soak_random(COLUMNS_N)], FALSE);
+		}
+		return 1;
+	}
+}
+
+static void setup(void) {
+	board_init();
+	board_set_output_hook(matrix_output, NULL);
+
+	MX_GPIO_Init();
+	MX_USART2_UART_Init();
+	MX_TIM3_Init();
+	console_init(&huart2);
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+	sensor_registry_init();
+
+	user_directory_init(&users, HAL_GetUIDw0());
+	user_directory_add(&users, (const uint8_t*) SOAK_PIN, USER_ROLE_ADMIN, USER_ZONE_ALL);
+	KEYPAD_init_default(&keypad);
+	buzzer_init(&buzzer, &htim3, TIM_CHANNEL_1);
+	logger_init(&logger, &huart2);
+	// there is no RTC on the virtual board: once the configuration is done, the messages are printed without it
+	get_configuration()->done = TRUE;
+}
+
+int main(int argc, char **argv) {
+	uint32_t sequences = (argc > 1) ? strtoul(argv[1], NULL, 10) : SOAK_DEFAULT_SEQUENCES;
+	uint32_t kinds[SEQUENCE_KINDS_N] = { 0 };
+	uint32_t accepted = 0;
+	uint32_t rejected = 0;
+	uint32_t stuck = 0;
+	uint32_t unexpected = 0;
+
+	random_state = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0x2545F491U;
+	if (random_state == 0) {
+		random_state = 1;
+	}
+	setup();
+
+	uint32_t start_time = board_now();
+	uint64_t start = host_test_nanoseconds();
+
+	for (uint32_t i = 0; i < sequences; i++) {
+		uint32_t start_accepted = keypad.accepted_commands;
+		uint32_t start_rejected = keypad.rejected_commands;
+		TSequence_kind kind = soak_random(SEQUENCE_KINDS_N);
+
+		kinds[kind]++;
+		uint32_t expected = type_sequence(kind);
+		run(SOAK_SETTLE_TIME);
+
+		uint32_t sequence_accepted = keypad.accepted_commands - start_accepted;
+		uint32_t sequence_rejected = keypad.rejected_commands - start_rejected;
+		if (sequence_accepted + sequence_rejected != expected) {
+			unexpected++;
+			fprintf(stderr, "sequence %lu of kind %d: %lu commands checked, %lu expected\n", (unsigned long) i, kind,
+					(unsigned long) (sequence_accepted + sequence_rejected), (unsigned long) expected);
+		}
+		if (keypad.index >= KEYPAD_DEFAULT_BUFFER_SIZE || !KEYPAD_is_idle(&keypad)) {
+			stuck++;
+			fprintf(stderr, "sequence %lu of kind %d: stuck, index %u, keys 0x%04X\n", (unsigned long) i, kind,
+					keypad.index, keypad.pressed_keys);
+		}
+		accepted += sequence_accepted;
+		rejected += sequence_rejected;
+	}
+
+	double host_seconds = (double) (host_test_nanoseconds() - start) / 1e9;
+	double board_seconds = (double) (board_now() - start_time) / 1000.0;
+	uint32_t commands = accepted + rejected;
+
+	printf("%lu sequences (valid %lu, wrong PIN %lu, bouncing %lu, partial %lu, garbage %lu, chord %lu)\n",
+			(unsigned long) sequences, (unsigned long) kinds[SEQUENCE_VALID],
+			(unsigned long) kinds[SEQUENCE_WRONG_PIN], (unsigned long) kinds[SEQUENCE_BOUNCING],
+			(unsigned long) kinds[SEQUENCE_PARTIAL], (unsigned long) kinds[SEQUENCE_GARBAGE],
+			(unsigned long) kinds[SEQUENCE_CHORD]);
+	printf("%.0f s of keypad in %.2f s (%.0fx real time), %.1f commands/min, %.0f sequences/s on the host\n",
+			board_seconds, host_seconds, board_seconds / host_seconds, commands * 60.0 / board_seconds,
+			sequences / host_seconds);
+	printf("accepted %lu, rejected %lu (%.1f%%), stuck %lu, unexpected %lu\n", (unsigned long) accepted,
+			(unsigned long) rejected, (commands == 0) ? 0.0 : rejected * 100.0 / commands, (unsigned long) stuck,
+			(unsigned long) unexpected);
+
+	CHECK(stuck == 0);
+	CHECK(unexpected == 0);
+	// the valid commands can still be rejected while the system is disabled, but not all of them
+	CHECK(kinds[SEQUENCE_VALID] == 0 || accepted > 0);
+
+	return host_test_result("keypad_soak");
+}
@@ -0,0 +1,337 @@
+/*
+ * Tests of the keypad on the virtual board, with the matrix modelled on the pins as in keypad_soak.
+ * The latency of the commands must be measured also when the release of a key bounces: the bounce of the last key
+ * comes while the full buffer waits to be checked, and must not restart the measure, so every command gives
+ * a sample to every stage and no debounce lasts longer than the debounce of a key.
+ * The gesture engine is fed by hand: a long press and a chord are recognized once their keys are held long enough,
+ * and only once. On the keypad, the panic alarm must not change the state of the system, must not be silenced
+ * by the beep of the commands, and must be stopped only by D*. The quick arm activates its zones, through
+ * a sensor of the test, only while the system is enabled.
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "gpio.h"
+#include "tim.h"
+#include "usart.h"
+#include "keypad.h"
+
+#define TEST_PIN				("4321")
+#define TEST_GUEST_PIN			("1111")
+
+/* Milliseconds a key is held, and between the release of a key and the press of the next one */
+#define TEST_HOLD_TIME			(100U)
+#define TEST_GAP_TIME			(100U)
+
+/* Milliseconds waited after a command, so it is checked, logged and printed */
+#define TEST_SETTLE_TIME		(300U)
+
+extern TKeypad keypad;
+extern TBuzzer buzzer;
+extern TLogger logger;
+extern TUser_directory users;
+extern uint8_t system_state;
+
+/* The keys held on the virtual keypad, as the bits of KEYPAD_KEY_BIT() */
+static uint16_t held_keys;
+
+/* The sensor of the area, counting its activations */
+static uint32_t activations;
+static TAlarmState sensor_state;
+
+/* The actions of the gestures of test_gestures, counting the recognitions */
+static uint32_t actions[2];
+
+/*
+ * @fn		static void matrix_update(void)
+ * @brief	Drives the rows from the held keys and from the levels of the columns
+ */
+static void matrix_update(void) {
+	for (uint8_t row = 0; row < ROWS_N; row++) {
+		GPIO_PinState level = GPIO_PIN_RESET;
+		for (uint8_t col = 0; col < COLUMNS_N; col++) {
+			if ((held_keys & KEYPAD_KEY_BIT(row, col)) != 0 && (COLUMN_1_PORT->ODR & keypad.cols_pins[col]) != 0) {
+				level = GPIO_PIN_SET;
+			}
+		}
+		board_set_input(ROW_1_PORT, keypad.rows_pins[row], level);
+	}
+}
+
+static void matrix_output(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state, void *context) {
+	(void) state;
+	(void) context;
+	if (port == COLUMN_1_PORT && (pin & (COLUMN_1_PIN | COLUMN_2_PIN | COLUMN_3_PIN | COLUMN_4_PIN)) != 0) {
+		matrix_update();
+	}
+}
+
+static uint16_t key_bit(char key) {
+	for (uint8_t row = 0; row < ROWS_N; row++) {
+		for (uint8_t col = 0; col < COLUMNS_N; col++) {
+			if (KEYS[row][col] == (TKEYPAD_Button) key) {
+				return KEYPAD_KEY_BIT(row, col);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * @fn		static void run(uint32_t milliseconds)
+ * @brief	Lets the time pass, running the main loop of the firmware every millisecond
+ */
+static void run(uint32_t milliseconds) {
+	while (milliseconds-- > 0) {
+		board_advance(1);
+		KEYPAD_poll(&keypad);
+	}
+}
+
+static void press(uint16_t keys) {
+	held_keys |= keys;
+	matrix_update();
+}
+
+static void release(uint16_t keys) {
+	held_keys &= ~keys;
+	matrix_update();
+}
+
+/*
+ * @fn		static void type_key(char key, bool bouncing)
+ * @brief	Presses and releases a key, the release bouncing once if asked
+ */
+static void type_key(char key, bool bouncing) {
+	uint16_t bit = key_bit(key);
+
+	press(bit);
+	run(TEST_HOLD_TIME);
+	release(bit);
+	if (bouncing) {
+		run(1);
+		press(bit);
+		run(1);
+		release(bit);
+	}
+	run(TEST_GAP_TIME);
+}
+
+/*
+ * @fn		static void type_command(const char *pin, const char *command, bool bouncing)
+ * @brief	Types a PIN and a command, the release of its last key bouncing if asked
+ */
+static void type_command(const char *pin, const char *command, bool bouncing) {
+	type_key(KEYPAD_Button_HASH, FALSE);
+	for (uint8_t i = 0; i < USER_PIN_LENGTH; i++) {
+		type_key(pin[i], FALSE);
+	}
+	type_key(command[0], FALSE);
+	type_key(command[1], bouncing);
+	run(TEST_SETTLE_TIME);
+}
+
+/*
+ * @fn		static void hold(uint16_t keys, uint32_t milliseconds)
+ * @brief	Holds some keys together, pressed one after the other, then releases them
+ */
+static void hold(uint16_t keys, uint32_t milliseconds) {
+	for (uint16_t left = keys; left != 0; left &= left - 1U) {
+		press(left & -left);
+		run(TEST_GAP_TIME);
+	}
+	run(milliseconds);
+	release(keys);
+	run(TEST_GAP_TIME);
+}
+
+static void sensor_activate(void *sensor) {
+	(void) sensor;
+	activations++;
+	sensor_state = ALARM_STATE_ACTIVE;
+}
+
+static void sensor_deactivate(void *sensor) {
+	(void) sensor;
+	sensor_state = ALARM_STATE_INACTIVE;
+}
+
+static TAlarmState sensor_get_state(void *sensor) {
+	(void) sensor;
+	return sensor_state;
+}
+
+static void sensor_stats(void *sensor, TSensor_stats *stats) {
+	(void) sensor;
+	memset(stats, 0, sizeof(*stats));
+}
+
+static const TSensor_ops sensor_ops = {
+	.activate = sensor_activate,
+	.deactivate = sensor_deactivate,
+	.state = sensor_get_state,
+	.stats = sensor_stats
+};
+
+static void setup(void) {
+	board_init();
+	board_set_output_hook(matrix_output, NULL);
+	held_keys = 0;
+	system_state = SYSTEM_STATE_DISABLED;
+
+	MX_GPIO_Init();
+	MX_USART2_UART_Init();
+	MX_TIM3_Init();
+	console_init(&huart2);
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+	sensor_registry_init();
+
+	user_directory_init(&users, HAL_GetUIDw0());
+	user_directory_add(&users, (const uint8_t*) TEST_PIN, USER_ROLE_ADMIN, USER_ZONE_ALL);
+	user_directory_add(&users, (const uint8_t*) TEST_GUEST_PIN, USER_ROLE_GUEST, USER_ZONE_AREA);
+	activations = 0;
+	sensor_state = ALARM_STATE_INACTIVE;
+	CHECK(sensor_registry_add(&sensor_ops, &sensor_state, "test", USER_ZONE_AREA) == SENSOR_REGISTRY_OK);
+	KEYPAD_init_default(&keypad);
+	buzzer_init(&buzzer, &htim3, TIM_CHANNEL_1);
+	logger_init(&logger, &huart2);
+	// there is no RTC on the virtual board: the messages are printed at once
+	get_configuration()->done = TRUE;
+	health_raise(HEALTH_FAULT_RTC_TIMEOUT, 0);
+}
+
+/*
+ * @fn		static void test_latency(bool bouncing)
+ * @brief	Types a few commands and checks that every one of them is measured in every stage
+ */
+static void test_latency(bool bouncing) {
+	static const char *commands[] = { "D#", "A#", "A*" };
+	const uint32_t n = sizeof(commands) / sizeof(commands[0]);
+	TLatency_stats stats;
+
+	setup();
+	for (uint8_t i = 0; i < n; i++) {
+		type_command(TEST_PIN, commands[i], bouncing);
+	}
+	CHECK(keypad.accepted_commands == n && keypad.rejected_commands == 0);
+
+	for (uint8_t stage = 0; stage < LATENCY_STAGES_N; stage++) {
+		uint32_t expected = (stage == LATENCY_STAGE_DEBOUNCE || stage == LATENCY_STAGE_DECODE)
+				? n * KEYPAD_DEFAULT_BUFFER_SIZE : n;
+
+		latency_get_stats(stage, &stats);
+		if (stats.count != expected) {
+			fprintf(stderr, "%s release: stage %u has %lu samples, expected %lu\n", bouncing ? "bouncing" : "clean",
+					stage, (unsigned long) stats.count, (unsigned long) expected);
+			host_test_failures++;
+		}
+	}
+	// a stale edge would make a debounce as long as the typing of a command
+	latency_get_stats(LATENCY_STAGE_DEBOUNCE, &stats);
+	CHECK(stats.max / (SystemCoreClock / 1000U) <= KEYPAD_DEBOUNCE_TIME + 1U);
+}
+
+static void count_action(void *context) {
+	actions[(uintptr_t) context]++;
+}
+
+static void test_gestures(void) {
+	const uint16_t star = KEYPAD_KEY_BIT(3, 0);
+	const uint16_t a = KEYPAD_KEY_BIT(0, 3);
+	const uint16_t b = KEYPAD_KEY_BIT(1, 3);
+	TKeypad_gestures engine;
+
+	memset(actions, 0, sizeof(actions));
+	KEYPAD_gesture_init(&engine);
+	CHECK(KEYPAD_gesture_add(&engine, star, 3000U, count_action, (void*) 0) == KEYPAD_GESTURE_OK);
+	CHECK(KEYPAD_gesture_add(&engine, a | b, 300U, count_action, (void*) 1) == KEYPAD_GESTURE_OK);
+	CHECK(KEYPAD_gesture_next_deadline(&engine) == KEYPAD_GESTURE_NO_DEADLINE);
+
+	// a long press released too early, then one held long enough, recognized once while it is held
+	KEYPAD_gesture_key_down(&engine, star, 1000U);
+	CHECK(KEYPAD_gesture_next_deadline(&engine) == 4000U);
+	CHECK(!KEYPAD_gesture_tick(&engine, 3999U));
+	KEYPAD_gesture_key_up(&engine, star, 3999U);
+	CHECK(!KEYPAD_gesture_tick(&engine, 4000U) && actions[0] == 0);
+	KEYPAD_gesture_key_down(&engine, star, 5000U);
+	CHECK(KEYPAD_gesture_tick(&engine, 8000U) && actions[0] == 1);
+	CHECK(!KEYPAD_gesture_tick(&engine, 9000U) && actions[0] == 1);
+	KEYPAD_gesture_key_up(&engine, star, 9000U);
+
+	// a chord must be pressed within the window, a key of it alone is nothing
+	KEYPAD_gesture_key_down(&engine, a, 10000U);
+	CHECK(!KEYPAD_gesture_tick(&engine, 11000U));
+	KEYPAD_gesture_key_down(&engine, b, 10000U + KEYPAD_GESTURE_CHORD_WINDOW + 1U);
+	CHECK(KEYPAD_gesture_next_deadline(&engine) == KEYPAD_GESTURE_NO_DEADLINE);
+	KEYPAD_gesture_key_up(&engine, a | b, 12000U);
+	KEYPAD_gesture_key_down(&engine, a, 13000U);
+	KEYPAD_gesture_key_down(&engine, b, 13100U);
+	CHECK(!KEYPAD_gesture_tick(&engine, 13399U));
+	CHECK(KEYPAD_gesture_tick(&engine, 13400U) && actions[1] == 1);
+	KEYPAD_gesture_key_up(&engine, a | b, 14000U);
+	CHECK(engine.recognized == 2 && actions[0] == 1);
+
+	// the deadlines are compared across the overflow of the milliseconds
+	KEYPAD_gesture_key_down(&engine, star, UINT32_MAX - 1000U);
+	CHECK(!KEYPAD_gesture_tick(&engine, 1000U));
+	CHECK(KEYPAD_gesture_tick(&engine, 2000U) && actions[0] == 2);
+
+	for (uint8_t i = engine.gestures_n; i < KEYPAD_GESTURE_MAX_RECOGNIZERS; i++) {
+		CHECK(KEYPAD_gesture_add(&engine, a, 100U, count_action, (void*) 1) == KEYPAD_GESTURE_OK);
+	}
+	CHECK(KEYPAD_gesture_add(&engine, a, 100U, count_action, (void*) 1) == KEYPAD_GESTURE_ERR_FULL);
+}
+
+static void test_panic(void) {
+	setup();
+	hold(key_bit(KEYPAD_Button_STAR), KEYPAD_PANIC_HOLD_TIME);
+	CHECK(KEYPAD_is_panic_alarm() && system_state == SYSTEM_STATE_DISABLED);
+	CHECK(buzzer.pulse == buzzer_long_pulse() && !buzzer.single_pulse_mode);
+	CHECK(keypad.index == 0);
+
+	// the system is still disabled: only the commands of the system are checked
+	type_command(TEST_GUEST_PIN, "A#", FALSE);
+	CHECK(keypad.rejected_commands == 1 && activations == 0);
+
+	// the commands are executed without the beep, so the alarm goes on
+	type_command(TEST_PIN, "D#", FALSE);
+	type_command(TEST_GUEST_PIN, "A#", FALSE);
+	run(zone_profile_get(USER_ZONE_AREA)->exit_delay);
+	CHECK(keypad.accepted_commands == 2 && system_state == SYSTEM_STATE_ENABLED && activations == 1);
+	CHECK(KEYPAD_is_panic_alarm() && buzzer.pulse == buzzer_long_pulse() && !buzzer.single_pulse_mode);
+
+	type_command(TEST_PIN, "D*", FALSE);
+	CHECK(!KEYPAD_is_panic_alarm() && system_state == SYSTEM_STATE_DISABLED);
+	CHECK(sensor_state == ALARM_STATE_INACTIVE);
+}
+
+static void test_quick_arm(void) {
+	uint16_t chord = key_bit(KEYPAD_Button_A) | key_bit(KEYPAD_Button_B);
+	uint32_t exit_delay = zone_profile_get(USER_ZONE_AREA)->exit_delay;
+
+	setup();
+	hold(chord, KEYPAD_QUICK_ARM_HOLD_TIME);
+	run(exit_delay);
+	CHECK(activations == 0 && keypad.gestures.recognized == 1);
+
+	type_command(TEST_PIN, "D#", FALSE);
+	hold(chord, KEYPAD_QUICK_ARM_HOLD_TIME);
+	run(exit_delay);
+	CHECK(activations == 1 && sensor_state == ALARM_STATE_ACTIVE && keypad.gestures.recognized == 2);
+	// the keys of the chord are not the start of a command
+	CHECK(keypad.index == 0 && keypad.accepted_commands == 1 && keypad.rejected_commands == 0);
+}
+
+int main(void) {
+	test_latency(FALSE);
+	test_latency(TRUE);
+	test_gestures();
+	test_panic();
+	test_quick_arm();
+	return host_test_result("keypad_test");
+}
@@ -0,0 +1,75 @@
+/*
+ * Tests of the turns of the flash sectors of the light history: the other sector must be erased only by
+ * light_history_erase_ahead(), which the main loop calls while every zone is disarmed, and never when a chunk
+ * is programmed. While the sector being filled is full and the other one is not erased, the chunks are dropped;
+ * once it is erased, the next chunk starts the next turn in it.
+ * The erase of the virtual board leaves the memory as it is: the other sector is never programmed by the test,
+ * so it reads erased anyway. The intervals are closed by hand, with a steady level.
+ */
+
+#include "host_test.h"
+#include "board.h"
+#include "light_history.h"
+
+#define TEST_LEVEL		(2000U)
+
+static TLight_history history;
+static TDatetime datetime;
+
+/*
+ * @fn		static void spill_until(uint16_t flash_n)
+ * @brief	Closes the intervals until the sector being filled holds flash_n chunks
+ */
+static void spill_until(uint16_t flash_n) {
+	while (history.flash_n < flash_n) {
+		light_history_add(&history, TEST_LEVEL, LIGHT_HISTORY_LEVEL);
+		history.due = TRUE;
+		light_history_process(&history);
+	}
+}
+
+/*
+ * @fn		static void spill_next(void)
+ * @brief	Closes the intervals until the oldest chunk in RAM leaves the ring, programmed or dropped
+ */
+static void spill_next(void) {
+	uint32_t left = history.flash_n + history.dropped;
+
+	while (history.flash_n + history.dropped == left) {
+		light_history_add(&history, TEST_LEVEL, LIGHT_HISTORY_LEVEL);
+		history.due = TRUE;
+		light_history_process(&history);
+	}
+}
+
+int main(void) {
+	board_init();
+	timer_wheel_init();
+	light_history_init(&history, &datetime);
+	CHECK(history.sector == 0 && history.flash_n == 0 && history.flash_ok);
+
+	// too early: the older chunks are kept
+	spill_until(LIGHT_HISTORY_FLASH_CHUNKS - LIGHT_HISTORY_ERASE_AHEAD - 1U);
+	light_history_erase_ahead(&history);
+	CHECK(!history.next_erased);
+
+	// the zones stay armed until the sector is full: the next chunks are dropped, the sector does not change
+	spill_until(LIGHT_HISTORY_FLASH_CHUNKS);
+	CHECK(history.flash_full && !history.next_erased);
+	spill_next();
+	spill_next();
+	CHECK(history.sector == 0 && history.dropped == 2 && history.flash_ok);
+
+	// once disarmed, the other sector is erased and the next chunk starts its turn
+	light_history_erase_ahead(&history);
+	CHECK(history.next_erased && history.older_n == 0 && history.flash_ok);
+	spill_next();
+	CHECK(history.sector == 1 && history.turn == 1 && history.flash_n == 1 && !history.next_erased);
+	CHECK(history.older_n == LIGHT_HISTORY_FLASH_CHUNKS && history.dropped == 2);
+
+	// the history is found again at the start, in the sector filled last
+	light_history_init(&history, &datetime);
+	CHECK(history.sector == 1 && history.turn == 1 && history.flash_n == 1);
+	CHECK(history.older_n == LIGHT_HISTORY_FLASH_CHUNKS && !history.flash_full);
+	return host_test_result("light_history_test");
+}
@@ -0,0 +1,120 @@
+/*
+ * Benchmark of the PIR zones: the cost of an edge, from the EXTI interrupt to the state machine of its zone,
+ * with 1 to PIR_ARRAY_ZONES_N zones. The zone of a line is found through a table, so the cost must not grow
+ * with the number of zones.
+ * The zones sit on the 16 lines of GPIOC, all active. The edges go round the zones, a pulse at a time, 10 ms
+ * apart so no zone reaches its storm protection nor the end of its delay. Only the edges are timed, not the ticks
+ * between them. Every number of zones is run a few times and the fastest run is kept.
+ * Usage: pir_array_bench [edges]
+ */
+
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "pir_array.h"
+#include "exti_dispatcher.h"
+#include "latency.h"
+#include "health.h"
+
+#define BENCH_DEFAULT_EDGES		(20000U)
+#define BENCH_RUNS				(5U)
+#define BENCH_EDGE_GAP			(10U)
+#define BENCH_DELAY				(60000U)
+#define BENCH_DURATION			(10000U)
+
+/* Largest ratio between the cost of an edge with all the zones and with one zone */
+#define BENCH_MAX_SLOWDOWN		(2.0)
+
+static TPIR_array array;
+
+static IRQn_Type irq_of_line(uint8_t line) {
+	static const IRQn_Type irqs[] = { EXTI0_IRQn, EXTI1_IRQn, EXTI2_IRQn, EXTI3_IRQn, EXTI4_IRQn };
+	if (line < 5U) {
+		return irqs[line];
+	}
+	return (line < 10U) ? EXTI9_5_IRQn : EXTI15_10_IRQn;
+}
+
+/*
+ * @fn		static void setup(uint8_t zones)
+ * @brief	Starts the board with the given number of active zones, on the first lines of GPIOC
+ */
+static void setup(uint8_t zones) {
+	GPIO_InitTypeDef GPIO_InitStruct = { 0 };
+
+	board_init();
+	__HAL_RCC_GPIOC_CLK_ENABLE();
+	GPIO_InitStruct.Pin = GPIO_PIN_All;
+	GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+
+	PIR_array_init(&array);
+	for (uint8_t line = 0; line < zones; line++) {
+		PIR_array_add(&array, BENCH_DELAY, BENCH_DURATION, irq_of_line(line), GPIOC, 1U << line, NULL);
+		PIR_sensor_activate(&array.zones[line]);
+	}
+}
+
+/*
+ * @fn		static double run(uint8_t zones, uint32_t edges)
+ * @brief	Sends edges round the zones
+ * @retval	the nanoseconds taken by an edge
+ */
+static double run(uint8_t zones, uint32_t edges) {
+	uint64_t elapsed = 0;
+
+	setup(zones);
+	for (uint32_t i = 0; i < edges; i++) {
+		uint8_t line = (i / 2U) % zones;
+		uint64_t start = host_test_nanoseconds();
+		board_set_input(GPIOC, 1U << line, ((i & 1U) == 0) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+		elapsed += host_test_nanoseconds() - start;
+		board_advance(BENCH_EDGE_GAP);
+	}
+
+	// every edge reached its zone, and the zones went back to their active state
+	uint32_t handled = 0;
+	for (uint8_t zone = 0; zone < zones; zone++) {
+		handled += array.zones[zone].edges;
+		CHECK(array.zones[zone].state == ALARM_STATE_ACTIVE);
+		CHECK(array.zones[zone].storms == 0);
+	}
+	CHECK(handled == edges);
+	return (double) elapsed / edges;
+}
+
+int main(int argc, char **argv) {
+	uint32_t edges = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_EDGES;
+	double one_zone = 0;
+	double all_zones = 0;
+
+	// an even number of edges leaves every output low
+	edges &= ~1U;
+	printf("%5s %12s\n", "zones", "ns/edge");
+	for (uint8_t zones = 1; zones <= PIR_ARRAY_ZONES_N; zones++) {
+		double best = 0;
+		for (uint8_t i = 0; i < BENCH_RUNS; i++) {
+			double cost = run(zones, edges);
+			if (i == 0 || cost < best) {
+				best = cost;
+			}
+		}
+		printf("%5u %12.1f\n", zones, best);
+
+		if (zones == 1) {
+			one_zone = best;
+		}
+		all_zones = best;
+	}
+
+	printf("%u zones cost %.2fx one zone\n", PIR_ARRAY_ZONES_N, all_zones / one_zone);
+	CHECK(all_zones < one_zone * BENCH_MAX_SLOWDOWN);
+	return host_test_result("pir_array_bench");
+}
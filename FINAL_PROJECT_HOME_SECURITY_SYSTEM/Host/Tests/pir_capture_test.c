@@ -0,0 +1,253 @@
+/*
+ * Tests of the capture of the PIR edges: the merge of the two rings in time order, the pulse statistics,
+ * and the edges overwritten in the rings before they are read, which must be skipped and counted.
+ * An active sensor on the capture must keep the main loop awake only while the rings hold edges not read yet,
+ * since every capture raises the interrupt of the timer that wakes the sleep. Its activity must account the edges
+ * at the time they were captured, however late they are read.
+ * The test plays the DMA: it writes the timestamps in the rings, decrements the counters of the streams and runs
+ * their interrupts at every half of a ring, as the streams configured by MX_TIM5_Init do.
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "dma.h"
+#include "tim.h"
+#include "stm32f4xx_it.h"
+#include "pir_capture.h"
+#include "pir_array.h"
+#include "exti_dispatcher.h"
+#include "latency.h"
+#include "health.h"
+#include "user_directory.h"
+
+extern DMA_HandleTypeDef hdma_tim5_ch1;
+extern DMA_HandleTypeDef hdma_tim5_ch2;
+
+static TPIR_capture capture;
+static TPIR_array array;
+static uint32_t now;
+
+/*
+ * @fn		static void dma_interrupt(bool rising, uint32_t flags)
+ * @brief	Raises the flags of the stream of a ring and runs its interrupt. ISR is read only and IFCR is
+ * 			write-one-to-clear, while the memory of the board keeps what is written: the test clears the flags
+ */
+static void dma_interrupt(bool rising, uint32_t flags) {
+	if (rising) {
+		DMA1->LISR |= flags << 16U;
+		DMA1_Stream2_IRQHandler();
+		DMA1->LISR &= ~DMA1->LIFCR;
+		DMA1->LIFCR = 0;
+	} else {
+		DMA1->HISR |= flags;
+		DMA1_Stream4_IRQHandler();
+		DMA1->HISR &= ~DMA1->HIFCR;
+		DMA1->HIFCR = 0;
+	}
+}
+
+/*
+ * @fn		static void edge(bool rising, uint32_t width)
+ * @brief	Captures an edge width microseconds after the previous one, as the DMA of its direction would
+ */
+static void edge(bool rising, uint32_t width) {
+	DMA_Stream_TypeDef *stream = rising ? DMA1_Stream2 : DMA1_Stream4;
+	volatile uint32_t *ring = rising ? capture.rising : capture.falling;
+
+	now += width;
+	ring[PIR_CAPTURE_RING_SIZE - stream->NDTR] = now;
+	stream->NDTR--;
+	if (stream->NDTR == PIR_CAPTURE_RING_SIZE / 2U) {
+		// half transfer, the flags of the streams 2 and 4 sit at the same bits of their halves of the registers
+		dma_interrupt(rising, DMA_LISR_HTIF0);
+	} else if (stream->NDTR == 0) {
+		stream->NDTR = PIR_CAPTURE_RING_SIZE;
+		dma_interrupt(rising, DMA_LISR_TCIF0);
+	}
+}
+
+static void setup(void) {
+	// the handles live in the RAM, that a reset would clear, while board_init only resets the peripherals
+	memset(&htim5, 0, sizeof(htim5));
+	memset(&hdma_tim5_ch1, 0, sizeof(hdma_tim5_ch1));
+	memset(&hdma_tim5_ch2, 0, sizeof(hdma_tim5_ch2));
+	board_init();
+	MX_DMA_Init();
+	MX_TIM5_Init();
+	PIR_capture_init(&capture, &htim5);
+	PIR_capture_start(&capture);
+	now = 0;
+}
+
+static void test_merge(void) {
+	bool rising;
+	uint32_t time;
+	uint32_t previous = 0;
+
+	setup();
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+
+	// the pulses get longer, the gaps shorter, and the counter of the timer overflows in the middle
+	now = UINT32_MAX - 5000U;
+	for (uint32_t i = 0; i < 10; i++) {
+		edge(TRUE, 100U);
+		edge(FALSE, 200U + i);
+	}
+	for (uint32_t i = 0; i < 20; i++) {
+		CHECK(PIR_capture_next_edge(&capture, &rising, &time));
+		CHECK(rising == ((i & 1U) == 0));
+		CHECK(i == 0 || (int32_t) (time - previous) > 0);
+		previous = time;
+	}
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+	CHECK(capture.edges == 20 && capture.lost == 0);
+	CHECK(capture.min_pulse_width == 200U && capture.max_pulse_width == 209U);
+	CHECK(capture.pulse_width == 209U && capture.gap == 100U);
+}
+
+static void test_full_ring(void) {
+	bool rising;
+	uint32_t time;
+
+	setup();
+	// a whole ring of each direction, read after the interrupts of both halves
+	for (uint32_t i = 0; i < PIR_CAPTURE_RING_SIZE; i++) {
+		edge(TRUE, 10U);
+		edge(FALSE, 10U);
+	}
+	for (uint32_t i = 0; i < 2U * PIR_CAPTURE_RING_SIZE; i++) {
+		CHECK(PIR_capture_next_edge(&capture, &rising, &time));
+		CHECK(time == 10U * (i + 1U));
+	}
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+	CHECK(capture.lost == 0);
+}
+
+static void test_overrun(void) {
+	bool rising;
+	uint32_t time;
+	uint32_t burst = 3U * PIR_CAPTURE_RING_SIZE + 5U;
+
+	setup();
+	// a burst of rising edges laps the ring three times before it is read: only the last ring of them is left
+	for (uint32_t i = 0; i < burst; i++) {
+		edge(TRUE, 1U);
+	}
+	edge(FALSE, 1U);
+
+	for (uint32_t i = 0; i < PIR_CAPTURE_RING_SIZE; i++) {
+		CHECK(PIR_capture_next_edge(&capture, &rising, &time));
+		CHECK(rising && time == burst - PIR_CAPTURE_RING_SIZE + i + 1U);
+	}
+	CHECK(PIR_capture_next_edge(&capture, &rising, &time));
+	CHECK(!rising && time == burst + 1U);
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+	CHECK(capture.lost == burst - PIR_CAPTURE_RING_SIZE);
+
+	// once read, the ring goes on without new losses
+	for (uint32_t i = 0; i < PIR_CAPTURE_RING_SIZE / 2U; i++) {
+		edge(TRUE, 1U);
+	}
+	for (uint32_t i = 0; i < PIR_CAPTURE_RING_SIZE / 2U; i++) {
+		CHECK(PIR_capture_next_edge(&capture, &rising, &time));
+	}
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+	CHECK(capture.lost == burst - PIR_CAPTURE_RING_SIZE);
+}
+
+static void test_late_interrupt(void) {
+	bool rising;
+	uint32_t time;
+
+	setup();
+	// the stream reached the half of the ring, but its interrupt has not run yet
+	for (uint32_t i = 0; i < PIR_CAPTURE_RING_SIZE / 2U + 3U; i++) {
+		capture.rising[i] = i + 1U;
+	}
+	DMA1_Stream2->NDTR = PIR_CAPTURE_RING_SIZE / 2U - 3U;
+	for (uint32_t i = 0; i < PIR_CAPTURE_RING_SIZE / 2U + 3U; i++) {
+		CHECK(PIR_capture_next_edge(&capture, &rising, &time));
+		CHECK(rising && time == i + 1U);
+	}
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+
+	// then it runs, and nothing is read twice
+	dma_interrupt(TRUE, DMA_LISR_HTIF0);
+	CHECK(!PIR_capture_next_edge(&capture, &rising, &time));
+	CHECK(capture.lost == 0);
+}
+
+/*
+ * @fn		static TPIR_sensor* setup_sensor(void)
+ * @brief	Starts the board with a PIR sensor on the capture, registered and inactive
+ */
+static TPIR_sensor* setup_sensor(void) {
+	TPIR_sensor *pir;
+
+	setup();
+	timer_wheel_init();
+	health_init();
+	latency_init();
+	exti_dispatcher_init();
+	sensor_registry_init();
+	PIR_array_init(&array);
+	PIR_array_add(&array, 60000U, 10000U, EXTI1_IRQn, GPIOA, GPIO_PIN_1, NULL);
+	pir = PIR_array_get_zone(&array, GPIO_PIN_1);
+	PIR_sensor_attach_capture(pir, &capture);
+	sensor_registry_add(&PIR_sensor_ops, pir, "pir", USER_ZONE_AREA);
+	return pir;
+}
+
+static void test_idle(void) {
+	TPIR_sensor *pir = setup_sensor();
+
+	CHECK((htim5.Instance->DIER & (TIM_DIER_CC1IE | TIM_DIER_CC2IE)) == (TIM_DIER_CC1IE | TIM_DIER_CC2IE));
+	// the sensor watches, but with nothing captured the main loop can sleep
+	PIR_sensor_activate(pir);
+	CHECK(pir->state == ALARM_STATE_ACTIVE);
+	CHECK(!PIR_capture_has_edges(&capture) && sensor_registry_is_idle());
+
+	edge(TRUE, 100U);
+	CHECK(PIR_capture_has_edges(&capture) && !sensor_registry_is_idle());
+	PIR_sensor_process(pir);
+	CHECK(pir->state == ALARM_STATE_DELAYED);
+	CHECK(!PIR_capture_has_edges(&capture) && sensor_registry_is_idle());
+
+	// the edges captured while the sensor is inactive keep it busy until they are dropped
+	PIR_sensor_deactivate(pir);
+	edge(FALSE, 100U);
+	CHECK(!sensor_registry_is_idle());
+	PIR_sensor_process(pir);
+	CHECK(sensor_registry_is_idle() && capture.edges == 2);
+}
+
+static void test_activity_time(void) {
+	TPIR_sensor *pir = setup_sensor();
+	uint32_t start;
+
+	board_advance(10U);
+	PIR_sensor_activate(pir);
+	start = HAL_GetTick();
+	now = start * PIR_CAPTURE_TICKS_PER_MS;
+
+	// a pulse of 20 ms, read 45 ms after its start
+	edge(TRUE, 5U * PIR_CAPTURE_TICKS_PER_MS);
+	edge(FALSE, 20U * PIR_CAPTURE_TICKS_PER_MS);
+	board_advance(50U);
+	htim5.Instance->CNT = HAL_GetTick() * PIR_CAPTURE_TICKS_PER_MS;
+	CHECK(PIR_capture_to_tick(&capture, now) == start + 25U);
+	PIR_sensor_process(pir);
+	CHECK(pir->high_time == 20U && pir->high_since == start + 5U);
+}
+
+int main(void) {
+	test_merge();
+	test_full_ring();
+	test_overrun();
+	test_late_interrupt();
+	test_idle();
+	test_activity_time();
+	return host_test_result("pir_capture_test");
+}
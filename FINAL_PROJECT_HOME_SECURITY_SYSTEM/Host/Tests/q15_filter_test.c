@@ -0,0 +1,223 @@
+/*
+ * Tests of the Q15 filter: every output must be equal bit by bit to the one of a plain filter, written sample by
+ * sample with a sorted median, a summed average and the same rounding of the IIR.
+ * The program is built twice: with the firmware of the target, that works one half of a pair at a time, and as
+ * q15_filter_dsp_test with firmware_dsp, where the median and the average run on the SIMD instructions of the
+ * Cortex-M4 written in Board/host_cmsis.h. Both must match the plain filter on every stage, every length of the
+ * stages and of the blocks, the full scale of the ADC, single spikes and every resolution of the oversampling.
+ * Usage: q15_filter_test [blocks] [seed]
+ */
+
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "q15_filter.h"
+
+#define TEST_DEFAULT_BLOCKS		(20000U)
+
+/* Longest block of the test, more than one pass of the filter */
+#define TEST_MAX_BLOCK			(3U * Q15_FILTER_MAX_BLOCK + 5U)
+
+/*
+ * @brief	The plain filter: the whole history of the inputs and of the medians, in Q15.
+ * @param	median_length	samples of the median
+ * @param	average_length	samples of the moving average
+ * @param	iir_alpha		coefficient of the IIR in Q15
+ * @param	inputs			the inputs in Q15, the oldest first
+ * @param	medians			the outputs of the median, the oldest first
+ * @param	count			number of inputs so far
+ * @param	iir_state		last output of the IIR
+ */
+typedef struct {
+	uint8_t median_length;
+	uint8_t average_length;
+	int16_t iir_alpha;
+	int16_t *inputs;
+	int16_t *medians;
+	uint32_t count;
+	int16_t iir_state;
+} TPlain_filter;
+
+static uint32_t random_state;
+
+static uint32_t test_random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+/*
+ * @fn		static int16_t plain_at(const int16_t *values, int32_t index)
+ * @brief	Returns a value of the history, the first one before the first sample, as the filter is primed
+ */
+static int16_t plain_at(const int16_t *values, int32_t index) {
+	return values[(index < 0) ? 0 : index];
+}
+
+static void plain_sample(TPlain_filter *plain, int16_t input, int16_t *output) {
+	int16_t window[Q15_FILTER_MAX_MEDIAN];
+	int32_t n = (int32_t) plain->count;
+	int32_t sum = 0;
+
+	plain->inputs[n] = input;
+	if (n == 0) {
+		plain->iir_state = input;
+	}
+
+	// insertion sort of the last inputs
+	for (int32_t i = 0; i < plain->median_length; i++) {
+		int16_t value = plain_at(plain->inputs, n - i);
+		int32_t j = i;
+
+		for (; j > 0 && window[j - 1] > value; j--) {
+			window[j] = window[j - 1];
+		}
+		window[j] = value;
+	}
+	plain->medians[n] = window[plain->median_length / 2U];
+
+	for (int32_t i = 0; i < plain->average_length; i++) {
+		sum += plain_at(plain->medians, n - i);
+	}
+	*output = (int16_t) (sum / plain->average_length);
+
+	if (plain->iir_alpha != 0) {
+		plain->iir_state += (int16_t) (((int32_t) (*output - plain->iir_state) * plain->iir_alpha + (1L << 14)) >> 15);
+		*output = plain->iir_state;
+	}
+	plain->count++;
+}
+
+/*
+ * @fn		static uint16_t random_sample(uint8_t bits, uint16_t previous)
+ * @brief	Mostly a slow walk around the previous sample, with spikes and both ends of the scale
+ */
+static uint16_t random_sample(uint8_t bits, uint16_t previous) {
+	uint16_t top = (1U << bits) - 1U;
+	int32_t sample;
+
+	switch (test_random(16)) {
+	case 0:
+		return 0;
+	case 1:
+		return top;
+	case 2:
+		return test_random(top + 1U);
+	default:
+		sample = (int32_t) previous + (int32_t) test_random(33) - 16;
+		return (sample < 0) ? 0 : (sample > top) ? top : (uint16_t) sample;
+	}
+}
+
+/*
+ * @fn		static void test_configuration(uint8_t median_length, uint8_t average_length, int16_t iir_alpha,
+ * 				uint32_t blocks)
+ * @brief	Filters random blocks of random lengths with the filter and with the plain one, changing the resolution
+ * 			now and then as the oversampling of the channel does
+ */
+static void test_configuration(uint8_t median_length, uint8_t average_length, int16_t iir_alpha, uint32_t blocks) {
+	static int16_t inputs[TEST_DEFAULT_BLOCKS * TEST_MAX_BLOCK];
+	static int16_t medians[TEST_DEFAULT_BLOCKS * TEST_MAX_BLOCK];
+	TQ15_filter filter;
+	TPlain_filter plain = { median_length, average_length, iir_alpha, inputs, medians, 0, 0 };
+	uint8_t bits = Q15_FILTER_ADC_BITS;
+	uint16_t previous = 1U << (bits - 1U);
+	uint32_t mismatches = 0;
+
+	CHECK(q15_filter_init(&filter, median_length, average_length, iir_alpha) == Q15_FILTER_OK);
+	for (uint32_t b = 0; b < blocks && plain.count + TEST_MAX_BLOCK <= TEST_DEFAULT_BLOCKS * TEST_MAX_BLOCK; b++) {
+		uint16_t samples[TEST_MAX_BLOCK];
+		int16_t output[TEST_MAX_BLOCK];
+		uint16_t length = 1U + test_random(TEST_MAX_BLOCK);
+
+		if (test_random(8) == 0) {
+			uint8_t next = Q15_FILTER_ADC_BITS + test_random(16U - Q15_FILTER_ADC_BITS);
+
+			CHECK(q15_filter_set_resolution(&filter, next) == Q15_FILTER_OK);
+			previous = (next >= bits) ? previous << (next - bits) : previous >> (bits - next);
+			bits = next;
+		}
+		for (uint16_t i = 0; i < length; i++) {
+			samples[i] = previous = random_sample(bits, previous);
+		}
+
+		q15_filter_block(&filter, samples, output, length);
+		for (uint16_t i = 0; i < length; i++) {
+			int16_t expected;
+
+			plain_sample(&plain, (int16_t) (samples[i] << (15U - bits)), &expected);
+			if (output[i] != expected) {
+				if (mismatches++ < 5U) {
+					fprintf(stderr, "median %u, average %u, alpha %d: sample %lu is %d, expected %d\n",
+							median_length, average_length, iir_alpha, (unsigned long) (plain.count - 1U), output[i],
+							expected);
+				}
+			}
+		}
+	}
+	CHECK(mismatches == 0);
+}
+
+static void test_find_outside(uint32_t rounds) {
+	int16_t values[2U * Q15_FILTER_MAX_BLOCK + 1U];
+
+	for (uint32_t r = 0; r < rounds; r++) {
+		uint16_t length = test_random(sizeof(values) / sizeof(values[0]) + 1U);
+		int16_t low = test_random(INT16_MAX);
+		int16_t high = low + test_random(INT16_MAX - low + 1U);
+		int32_t expected = -1;
+
+		for (uint16_t i = 0; i < length; i++) {
+			// mostly inside, with the limits themselves and the values right outside them
+			switch (test_random(8)) {
+			case 0:
+				values[i] = low;
+				break;
+			case 1:
+				values[i] = high;
+				break;
+			case 2:
+				values[i] = (low > 0) ? low - 1 : low;
+				break;
+			case 3:
+				values[i] = (high < INT16_MAX) ? high + 1 : high;
+				break;
+			case 4:
+				values[i] = test_random(INT16_MAX + 1U);
+				break;
+			default:
+				values[i] = low + test_random(high - low + 1U);
+				break;
+			}
+			if (expected < 0 && (values[i] < low || values[i] > high)) {
+				expected = i;
+			}
+		}
+		CHECK(q15_filter_find_outside(values, length, low, high) == expected);
+	}
+}
+
+int main(int argc, char **argv) {
+	static const uint8_t medians[] = { 1, 3, 5 };
+	static const int16_t alphas[] = { 0, 1, 4096, 16384, INT16_MAX };
+	uint32_t blocks = (argc > 1) ? strtoul(argv[1], NULL, 10) : TEST_DEFAULT_BLOCKS / 10U;
+
+	random_state = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0x2545F491U;
+	if (random_state == 0) {
+		random_state = 1;
+	}
+	if (blocks > TEST_DEFAULT_BLOCKS) {
+		blocks = TEST_DEFAULT_BLOCKS;
+	}
+
+	for (uint8_t m = 0; m < sizeof(medians); m++) {
+		for (uint8_t average = 1; average <= Q15_FILTER_MAX_AVERAGE; average <<= 1) {
+			for (uint8_t a = 0; a < sizeof(alphas) / sizeof(alphas[0]); a++) {
+				test_configuration(medians[m], average, alphas[a], blocks);
+			}
+		}
+	}
+	test_find_outside(blocks * 10U);
+	return host_test_result("q15_filter_test");
+}
@@ -0,0 +1,284 @@
+/*
+ * Tests of the raw stream decoded as the receiver of Tools/ does: the bytes sent by the firmware on the UART
+ * of the virtual board go to the decoder, and every packet must come out as the firmware made it.
+ * The DMA of the ADC does not run: the test fills a half of the buffer and runs its callback, and the edges
+ * of the PIR are handed to the tap of the capture. A transfer of the UART completes at the next millisecond,
+ * or as soon as the interrupts are enabled again: a burst of blocks sent with the interrupts disabled finds the DMA
+ * busy, and must be dropped by the firmware and seen by the decoder as a gap in the sequence.
+ * A byte corrupted on the line must fail the CRC and be counted as lost.
+ * The packets are written to a capture file, mapped back in memory and compared with the ones decoded.
+ * raw_stream_stop waits for the UART in a loop, the virtual clock would not run: the stream is never stopped.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "adc.h"
+#include "dma.h"
+#include "tim.h"
+#include "usart.h"
+#include "console.h"
+#include "timer_wheel.h"
+#include "raw_stream.h"
+#include "raw_stream_decoder.h"
+
+#define TEST_CHANNELS			(2U)
+#define TEST_BLOCK_SAMPLES		(ADC_STREAM_BLOCK_SIZE * TEST_CHANNELS)
+#define TEST_MAX_PACKETS		(256U)
+
+/* A sample of a block, whose bytes the sink corrupts on the line when asked */
+#define TEST_MARKER				(0x0ABCU)
+
+static TAdc_stream adc;
+static TPIR_capture capture;
+static TRaw_stream raw;
+static TRaw_decoder decoder;
+static TRaw_capture capture_file;
+
+/* The packets decoded, as the records of the capture */
+static TRaw_capture_record received[TEST_MAX_PACKETS];
+static uint32_t received_n;
+static bool corrupt;
+
+static void consume(void *context, const uint16_t *samples, uint16_t length) {
+	(void) context;
+	(void) samples;
+	(void) length;
+}
+
+static void handle(const TRaw_packet *packet, void *context) {
+	TRaw_capture_record *record = &received[received_n];
+
+	(void) context;
+	if (received_n == TEST_MAX_PACKETS) {
+		host_test_failures++;
+		return;
+	}
+	memset(record, 0, sizeof(*record));
+	record->type = packet->type;
+	record->info = packet->info;
+	record->sequence = packet->sequence;
+	record->tick = packet->tick;
+	record->length = packet->length;
+	record->lost = packet->lost;
+	memcpy(record->payload, packet->payload, packet->length);
+	received_n++;
+	CHECK(raw_capture_append(&capture_file, packet) == 0);
+}
+
+/*
+ * @fn		static void sink(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, void *context)
+ * @brief	Hands the bytes of the console to the decoder, flipping a bit of TEST_MARKER once if corrupt is set
+ */
+static void sink(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, void *context) {
+	uint8_t line[RAW_STREAM_BUFFER_SIZE];
+
+	(void) context;
+	CHECK(huart == &huart2 && size <= sizeof(line));
+	memcpy(line, data, size);
+	for (uint16_t i = 0; corrupt && i + 1U < size; i++) {
+		if (line[i] == (uint8_t) TEST_MARKER && line[i + 1U] == (uint8_t) (TEST_MARKER >> 8)) {
+			line[i] ^= 0x01U;
+			corrupt = FALSE;
+		}
+	}
+	raw_decoder_feed(&decoder, line, size);
+}
+
+static void setup(const char *path) {
+	board_init();
+	MX_DMA_Init();
+	MX_ADC1_Init();
+	MX_TIM2_Init();
+	MX_TIM5_Init();
+	MX_USART2_UART_Init();
+	console_init(&huart2);
+	timer_wheel_init();
+	// the registers of the board do not move: the line is idle
+	USART2->SR |= USART_SR_TC;
+
+	memset(&adc, 0, sizeof(adc));
+	CHECK(adc_stream_init(&adc, &hadc1, &htim2) == ADC_STREAM_OK);
+	for (uint8_t i = 0; i < TEST_CHANNELS; i++) {
+		CHECK(adc_stream_add_channel(&adc, ADC_CHANNEL_0 + i, consume, NULL) == i);
+	}
+	PIR_capture_init(&capture, &htim5);
+	raw_stream_init(&raw, &huart2, &adc, &capture);
+
+	raw_decoder_init(&decoder, handle, NULL);
+	CHECK(raw_capture_open(&capture_file, path, RAW_STREAM_DEFAULT_BAUD) == 0);
+	board_set_uart_sink(sink, NULL);
+	CHECK(raw_stream_start(&raw, RAW_STREAM_DEFAULT_BAUD) == RAW_STREAM_OK);
+}
+
+/*
+ * @fn		static const uint16_t* block(uint16_t first)
+ * @brief	Fills the next half of the buffer of the ADC with samples counting from first, and hands it to the tap
+ * @retval	the samples of the block
+ */
+static const uint16_t* block(uint16_t first) {
+	uint8_t half = adc.next;
+	uint16_t *samples = &adc.buffer[half * TEST_BLOCK_SAMPLES];
+
+	for (uint16_t i = 0; i < TEST_BLOCK_SAMPLES; i++) {
+		samples[i] = (uint16_t) (first + i) & 0x0FFFU;
+	}
+	if (half == 0) {
+		adc_stream_half_complete(&adc, &hadc1);
+	} else {
+		adc_stream_complete(&adc, &hadc1);
+	}
+	adc_stream_process(&adc);
+	return samples;
+}
+
+static uint32_t get32(const uint8_t *data) {
+	return (uint32_t) data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static void test_decoder(void) {
+	static const uint8_t zero[] = { 0x01, 0x01 };
+	static const uint8_t bad[] = { 0x05, 0x11 };
+	uint8_t decoded[4];
+
+	CHECK(raw_decoder_crc((const uint8_t*) "123456789", 9) == 0x29B1U);
+	CHECK(raw_decoder_cobs(zero, sizeof(zero), decoded) == 1 && decoded[0] == 0);
+	CHECK(raw_decoder_cobs(bad, sizeof(bad), decoded) == SIZE_MAX);
+
+	// the receiver does not depend on the firmware, its sizes must follow it
+	CHECK(RAW_DECODER_HEADER_SIZE == RAW_STREAM_HEADER_SIZE && RAW_DECODER_CRC_SIZE == RAW_STREAM_CRC_SIZE);
+	CHECK(RAW_DECODER_MAX_PAYLOAD == RAW_STREAM_MAX_PAYLOAD);
+	CHECK(RAW_DECODER_MAX_FRAME + 1U >= RAW_STREAM_ENCODED_SIZE(RAW_STREAM_MAX_PACKET));
+	CHECK(RAW_DECODER_STATS_SIZE == RAW_STREAM_STATS_SIZE);
+	CHECK((int) RAW_DECODER_PACKET_ADC == (int) RAW_STREAM_PACKET_ADC);
+	CHECK((int) RAW_DECODER_PACKET_PIR == (int) RAW_STREAM_PACKET_PIR);
+	CHECK((int) RAW_DECODER_PACKET_STATS == (int) RAW_STREAM_PACKET_STATS);
+}
+
+static void test_blocks(void) {
+	for (uint16_t b = 0; b < 10U; b++) {
+		uint32_t before = received_n;
+		uint16_t samples[TEST_BLOCK_SAMPLES];
+
+		memcpy(samples, block(b * 100U), sizeof(samples));
+		board_advance(1);
+		CHECK(received_n == before + 1U);
+		TRaw_capture_record *packet = &received[before];
+		CHECK(packet->type == RAW_DECODER_PACKET_ADC && packet->info == TEST_CHANNELS);
+		CHECK(packet->tick == board_now() - 1U && packet->lost == 0);
+		CHECK(packet->length == sizeof(samples) && memcmp(packet->payload, samples, sizeof(samples)) == 0);
+	}
+	CHECK(decoder.lost == 0 && decoder.crc_errors == 0 && decoder.framing_errors == 0);
+}
+
+static void test_edges(void) {
+	uint32_t before = received_n;
+
+	for (uint32_t i = 0; i < 3U; i++) {
+		capture.tap(capture.tap_context, (i & 1U) == 0, 1000000U + 250U * i);
+	}
+	raw_stream_process(&raw);
+	board_advance(1);
+	CHECK(received_n == before + 1U);
+	TRaw_capture_record *packet = &received[before];
+	CHECK(packet->type == RAW_DECODER_PACKET_PIR && packet->length == 3U * RAW_STREAM_EDGE_SIZE);
+	for (uint32_t i = 0; i < 3U; i++) {
+		CHECK(get32(&packet->payload[i * RAW_STREAM_EDGE_SIZE]) == 1000000U + 250U * i);
+		CHECK(packet->payload[i * RAW_STREAM_EDGE_SIZE + 4U] == ((i & 1U) == 0));
+	}
+}
+
+static void test_stats(void) {
+	uint32_t before = received_n;
+
+	board_advance(RAW_STREAM_STATS_PERIOD);
+	raw_stream_process(&raw);
+	board_advance(1);
+	CHECK(received_n == before + 1U);
+	TRaw_capture_record *packet = &received[before];
+	CHECK(packet->type == RAW_DECODER_PACKET_STATS && packet->length == RAW_STREAM_STATS_SIZE);
+	// the packets made before the statistics, and none dropped
+	CHECK(get32(&packet->payload[0]) == packet->sequence && get32(&packet->payload[4]) == 0);
+	CHECK(get32(&packet->payload[8]) == raw.bytes - raw.sending);
+}
+
+static void test_burst(void) {
+	// the DMA sends one buffer while the blocks fill the other one, the rest is dropped
+	__disable_irq();
+	for (uint16_t b = 0; b < 20U; b++) {
+		block(b);
+	}
+	__enable_irq();
+	board_advance(3);
+	CHECK(raw.dropped > 0 && decoder.lost == 0);
+	// the gap shows with the next packet
+	block(0);
+	board_advance(1);
+	CHECK(decoder.lost == raw.dropped && received[received_n - 1U].lost == raw.dropped);
+	CHECK(decoder.crc_errors == 0 && decoder.framing_errors == 0);
+}
+
+static void test_corruption(void) {
+	uint64_t lost = decoder.lost;
+	uint64_t packets = decoder.packets;
+
+	corrupt = TRUE;
+	block(TEST_MARKER);
+	board_advance(1);
+	CHECK(!corrupt && decoder.crc_errors == 1 && decoder.packets == packets);
+	block(0);
+	board_advance(1);
+	CHECK(decoder.packets == packets + 1U && decoder.lost == lost + 1U);
+	CHECK(decoder.framing_errors == 0);
+}
+
+/*
+ * @fn		static void test_capture(const char *path)
+ * @brief	Maps the capture file and compares it with the packets decoded
+ */
+static void test_capture(const char *path) {
+	CHECK(raw_capture_close(&capture_file, &decoder) == 0);
+
+	int file = open(path, O_RDONLY);
+	off_t size = lseek(file, 0, SEEK_END);
+	CHECK(file >= 0 && size == (off_t) (RAW_CAPTURE_HEADER_SIZE + received_n * RAW_CAPTURE_RECORD_SIZE));
+	const uint8_t *map = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	CHECK(map != MAP_FAILED);
+	if (map == MAP_FAILED) {
+		return;
+	}
+
+	const TRaw_capture_header *header = (const TRaw_capture_header*) map;
+	CHECK(memcmp(header->magic, RAW_CAPTURE_MAGIC, sizeof(RAW_CAPTURE_MAGIC)) == 0);
+	CHECK(header->version == RAW_CAPTURE_VERSION && header->baud == RAW_STREAM_DEFAULT_BAUD);
+	CHECK(header->header_size == RAW_CAPTURE_HEADER_SIZE && header->record_size == RAW_CAPTURE_RECORD_SIZE);
+	CHECK(header->records == received_n && header->lost == decoder.lost && header->crc_errors == 1);
+	CHECK(header->bytes == decoder.bytes && header->framing_errors == 0);
+	CHECK(memcmp(&map[header->header_size], received, received_n * RAW_CAPTURE_RECORD_SIZE) == 0);
+	munmap((void*) map, (size_t) size);
+}
+
+int main(void) {
+	char path[] = "/tmp/raw_stream_test_XXXXXX";
+	int file = mkstemp(path);
+
+	CHECK(file >= 0);
+	close(file);
+
+	test_decoder();
+	setup(path);
+	test_blocks();
+	test_edges();
+	test_stats();
+	test_burst();
+	test_corruption();
+	test_capture(path);
+	unlink(path);
+	return host_test_result("raw_stream_test");
+}
@@ -0,0 +1,233 @@
+/*
+ * Tests of the timing wheel: every timer must expire at its exact tick, whatever level of the wheel it starts in.
+ * The delays around the boundaries of the levels and beyond the span of the wheel are checked one by one, then
+ * random starts, restarts and cancels, from the test and from the callbacks, are checked against a plain model
+ * of the timers. The earliest deadline is compared with the model at every tick.
+ * The wheel is ticked directly: the test does not need the SysTick of the board.
+ * Usage: timer_wheel_test [ticks] [seed]
+ */
+
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "timer_wheel.h"
+
+#define TEST_DEFAULT_TICKS		(2000000U)
+#define TEST_TIMERS_N			(64U)
+
+/* One random operation every TEST_OPERATION_ODDS ticks, on average */
+#define TEST_OPERATION_ODDS		(4U)
+
+/*
+ * @brief	The model of a timer, next to the timer of the wheel.
+ * @param	timer		the timer of the wheel
+ * @param	running		TRUE if the timer must be running
+ * @param	due			the tick of its next expiration
+ * @param	period		milliseconds between the expirations, 0 if it expires once
+ * @param	expirations	number of times the callback ran
+ */
+typedef struct {
+	TTimer timer;
+	bool running;
+	uint32_t due;
+	uint32_t period;
+	uint32_t expirations;
+} TTest_timer;
+
+static TTest_timer timers[TEST_TIMERS_N];
+static uint32_t now;
+static uint32_t random_state;
+
+/* The callbacks touch other timers too, in the random test */
+static bool meddling;
+
+static uint32_t test_random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+/*
+ * @fn		static uint32_t random_delay(void)
+ * @brief	Mostly short delays, as the sensors use, and a few ones for every level of the wheel and beyond it
+ */
+static uint32_t random_delay(void) {
+	switch (test_random(8)) {
+	case 0:
+		return test_random(TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS * 4U);
+	case 1:
+		return test_random(TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS);
+	case 2:
+	case 3:
+		return test_random(TIMER_WHEEL_SLOTS * 4U);
+	default:
+		return test_random(TIMER_WHEEL_SLOTS);
+	}
+}
+
+static void start(TTest_timer *t, uint32_t delay, uint32_t period) {
+	timer_wheel_start(&t->timer, delay, period);
+	t->running = TRUE;
+	t->due = now + ((delay == 0) ? 1U : delay);
+	t->period = period;
+}
+
+static void cancel(TTest_timer *t) {
+	timer_wheel_cancel(&t->timer);
+	t->running = FALSE;
+}
+
+static void random_operation(void) {
+	TTest_timer *t = &timers[test_random(TEST_TIMERS_N)];
+
+	if (test_random(4) == 0) {
+		cancel(t);
+	} else {
+		start(t, random_delay(), (test_random(4) == 0) ? 1U + random_delay() : 0);
+	}
+}
+
+static void expired(void *context) {
+	TTest_timer *t = context;
+
+	CHECK(t->running && t->due == now);
+	t->expirations++;
+	if (t->period != 0) {
+		t->due += t->period;
+	} else {
+		t->running = FALSE;
+	}
+
+	if (meddling && test_random(8) == 0) {
+		random_operation();
+	}
+}
+
+/*
+ * @fn		static uint32_t model_deadline(void)
+ * @brief	The milliseconds before the earliest expiration of the model
+ */
+static uint32_t model_deadline(void) {
+	uint32_t deadline = TIMER_WHEEL_SPAN;
+	bool none = TRUE;
+
+	for (uint32_t i = 0; i < TEST_TIMERS_N; i++) {
+		if (timers[i].running && (none || timers[i].due - now < deadline)) {
+			deadline = timers[i].due - now;
+			none = FALSE;
+		}
+	}
+	return deadline;
+}
+
+static void tick(void) {
+	now++;
+	timer_wheel_tick();
+}
+
+static void setup(void) {
+	timer_wheel_init();
+	now = 0;
+	for (uint32_t i = 0; i < TEST_TIMERS_N; i++) {
+		timer_wheel_setup(&timers[i].timer, expired, &timers[i]);
+		timers[i].running = FALSE;
+		timers[i].expirations = 0;
+	}
+	meddling = FALSE;
+}
+
+static void test_boundaries(void) {
+	static const uint32_t delays[] = {
+		0, 1, 2, TIMER_WHEEL_SLOTS - 1U, TIMER_WHEEL_SLOTS, TIMER_WHEEL_SLOTS + 1U,
+		TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS - 1U, TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS,
+		TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS + 1U, TIMER_WHEEL_SPAN / TIMER_WHEEL_SLOTS - 1U,
+		TIMER_WHEEL_SPAN / TIMER_WHEEL_SLOTS, TIMER_WHEEL_SPAN / TIMER_WHEEL_SLOTS + 1U,
+		TIMER_WHEEL_SPAN - 1U, TIMER_WHEEL_SPAN, TIMER_WHEEL_SPAN + 1U, 2U * TIMER_WHEEL_SPAN + 5U
+	};
+	const uint32_t n = sizeof(delays) / sizeof(delays[0]);
+
+	// all at once from tick 0, then all again from an offset that is not aligned to any level
+	for (uint32_t offset = 0; offset < 2U; offset++) {
+		setup();
+		for (uint32_t i = 0; i < offset * 12345U; i++) {
+			tick();
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			start(&timers[i], delays[i], 0);
+		}
+		CHECK(timer_wheel_next_deadline() == 1U);
+
+		uint32_t end = now + delays[n - 1U];
+		while (now != end) {
+			tick();
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			CHECK(timers[i].expirations == 1U && !timer_wheel_is_running(&timers[i].timer));
+		}
+		CHECK(timer_wheel_next_deadline() == TIMER_WHEEL_SPAN);
+	}
+}
+
+static void test_periodic(void) {
+	setup();
+	start(&timers[0], 10U, 10U);
+	start(&timers[1], 1U, TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS + 7U);
+	for (uint32_t i = 0; i < 100000U; i++) {
+		tick();
+		CHECK(timer_wheel_next_deadline() == model_deadline());
+	}
+	CHECK(timers[0].expirations == 10000U);
+	CHECK(timers[1].expirations == 1U + (100000U - 1U) / (TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS + 7U));
+
+	// a cancelled timer gives the deadline back to the next one
+	cancel(&timers[0]);
+	CHECK(timer_wheel_next_deadline() == timers[1].due - now);
+	cancel(&timers[1]);
+	CHECK(timer_wheel_next_deadline() == TIMER_WHEEL_SPAN);
+}
+
+static void test_random_operations(uint32_t ticks) {
+	uint32_t started = 0;
+	uint32_t expirations = 0;
+
+	setup();
+	meddling = TRUE;
+	for (uint32_t i = 0; i < ticks; i++) {
+		if (test_random(TEST_OPERATION_ODDS) == 0) {
+			random_operation();
+			started++;
+		}
+		tick();
+
+		for (uint32_t j = 0; j < TEST_TIMERS_N; j++) {
+			CHECK(timer_wheel_is_running(&timers[j].timer) == timers[j].running);
+		}
+		CHECK(timer_wheel_next_deadline() == model_deadline());
+		if (host_test_failures > 10U) {
+			fprintf(stderr, "stopped at tick %lu\n", (unsigned long) now);
+			return;
+		}
+	}
+
+	for (uint32_t j = 0; j < TEST_TIMERS_N; j++) {
+		expirations += timers[j].expirations;
+	}
+	printf("%lu ticks, %lu operations, %lu expirations\n", (unsigned long) ticks, (unsigned long) started,
+			(unsigned long) expirations);
+	CHECK(expirations > 0);
+}
+
+int main(int argc, char **argv) {
+	uint32_t ticks = (argc > 1) ? strtoul(argv[1], NULL, 10) : TEST_DEFAULT_TICKS;
+
+	random_state = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0x9E3779B9U;
+	if (random_state == 0) {
+		random_state = 1;
+	}
+
+	test_boundaries();
+	test_periodic();
+	test_random_operations(ticks);
+	return host_test_result("timer_wheel_test");
+}
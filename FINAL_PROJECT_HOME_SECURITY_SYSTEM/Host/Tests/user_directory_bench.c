@@ -0,0 +1,82 @@
+/*
+ * Benchmark of the lookups of the user directory, with a table of 2048 slots so that a thousand users fit.
+ * The cost of a lookup must not depend on the number of users: the times with 10, 100 and 1000 users are
+ * printed, and the test fails if a thousand users make a lookup more than a few times slower.
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "user_directory.h"
+
+#define BENCH_LOOKUPS		(2000000U)
+#define BENCH_RUNS			(5U)
+#define BENCH_MAX_SLOWDOWN	(4.0)
+
+static TUser_directory directory;
+
+static void pin_of(uint16_t n, uint8_t *pin) {
+	char digits[USER_DIRECTORY_PIN_LENGTH + 1];
+
+	snprintf(digits, sizeof(digits), "%04u", (unsigned) ((n * 7919U) % 10000U));
+	memcpy(pin, digits, USER_DIRECTORY_PIN_LENGTH);
+}
+
+/*
+ * @fn		static double lookup_time(uint16_t users, bool hits)
+ * @brief	Measures a lookup in a directory of some users, the best of some runs
+ * @param	users	the number of users in the directory
+ * @param	hits	TRUE to look for the PINs of the users, FALSE for PINs of no user
+ * @retval	the time of a lookup in nanoseconds
+ */
+static double lookup_time(uint16_t users, bool hits) {
+	static uint8_t pins[1024][USER_DIRECTORY_PIN_LENGTH];
+	double best = 1e30;
+
+	user_directory_init(&directory, 0x5EEDU);
+	for (uint16_t i = 0; i < users; i++) {
+		pin_of(i, pins[i]);
+		CHECK(user_directory_add(&directory, pins[i], USER_ROLE_USER, USER_ZONE_ALL) == USER_DIRECTORY_OK);
+	}
+	if (!hits) {
+		for (uint16_t i = 0; i < 1024U; i++) {
+			pin_of(5000U + i, pins[i]);
+		}
+	}
+
+	for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+		uint32_t found = 0;
+		uint64_t start = host_test_nanoseconds();
+		for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+			found += user_directory_find(&directory, pins[i % (hits ? users : 1024U)]) != NULL;
+		}
+		double time = (double) (host_test_nanoseconds() - start) / BENCH_LOOKUPS;
+
+		CHECK(found == (hits ? BENCH_LOOKUPS : 0));
+		if (time < best) {
+			best = time;
+		}
+	}
+	return best;
+}
+
+int main(void) {
+	static const uint16_t sizes[] = { 10, 100, 1000 };
+	double hit[3];
+	double miss[3];
+
+	board_init();
+
+	printf("users   hit ns   miss ns\n");
+	for (uint8_t i = 0; i < 3; i++) {
+		hit[i] = lookup_time(sizes[i], TRUE);
+		miss[i] = lookup_time(sizes[i], FALSE);
+		printf("%5u   %6.1f   %7.1f\n", sizes[i], hit[i], miss[i]);
+	}
+
+	CHECK(hit[2] < hit[0] * BENCH_MAX_SLOWDOWN);
+	CHECK(miss[2] < miss[0] * BENCH_MAX_SLOWDOWN);
+
+	return host_test_result("user_directory_bench");
+}
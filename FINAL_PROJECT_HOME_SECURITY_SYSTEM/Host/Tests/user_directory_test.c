@@ -0,0 +1,154 @@
+/*
+ * Tests of the user directory: lookups, removals in the middle of the clusters, the limits of the table,
+ * the rights of the roles, and the bulk import through the UART of the console.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "host_test.h"
+#include "board.h"
+#include "usart.h"
+#include "console.h"
+#include "user_directory.h"
+
+static TUser_directory directory;
+static TShell shell;
+static char output[4096];
+static size_t output_length;
+
+/*
+ * @fn		static void pin_of(uint16_t n, uint8_t *pin)
+ * @brief	Writes the PIN of the n-th user of a test
+ */
+static void pin_of(uint16_t n, uint8_t *pin) {
+	char digits[USER_DIRECTORY_PIN_LENGTH + 1];
+
+	snprintf(digits, sizeof(digits), "%04u", (unsigned) ((n * 7919U) % 10000U));
+	memcpy(pin, digits, USER_DIRECTORY_PIN_LENGTH);
+}
+
+static void collect(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, void *context) {
+	(void) huart;
+	(void) context;
+	if (output_length + size < sizeof(output)) {
+		memcpy(&output[output_length], data, size);
+		output_length += size;
+		output[output_length] = '\0';
+	}
+}
+
+/*
+ * @fn		static void type_line(const char *line)
+ * @brief	Sends a line to the shell and runs it
+ */
+static void type_line(const char *line) {
+	board_uart_receive(&huart2, (const uint8_t*) line, strlen(line));
+	board_uart_receive(&huart2, (const uint8_t*) "\r", 1);
+	shell_process(&shell);
+	board_advance(1);
+}
+
+static void test_lookup(void) {
+	user_directory_init(&directory, 0x1234U);
+
+	CHECK(user_directory_add(&directory, (const uint8_t*) "1234", USER_ROLE_USER, USER_ZONE_AREA) == USER_DIRECTORY_OK);
+	CHECK(user_directory_add(&directory, (const uint8_t*) "1234", USER_ROLE_ADMIN, USER_ZONE_ALL)
+			== USER_DIRECTORY_ERR_DUPLICATE);
+	CHECK(user_directory_add(&directory, (const uint8_t*) "12a4", USER_ROLE_USER, USER_ZONE_AREA)
+			== USER_DIRECTORY_ERR_INVALID);
+	CHECK(directory.count == 1);
+
+	TUser *user = user_directory_find(&directory, (const uint8_t*) "1234");
+	CHECK(user != NULL && user->role == USER_ROLE_USER && user->zones == USER_ZONE_AREA);
+	CHECK(user_directory_find(&directory, (const uint8_t*) "1235") == NULL);
+
+	// the PIN is not kept in clear
+	CHECK(memmem(&directory, sizeof(directory), "1234", 4) == NULL);
+
+	CHECK(user_directory_remove(&directory, (const uint8_t*) "1234") == USER_DIRECTORY_OK);
+	CHECK(user_directory_remove(&directory, (const uint8_t*) "1234") == USER_DIRECTORY_ERR_NOT_FOUND);
+	CHECK(user_directory_find(&directory, (const uint8_t*) "1234") == NULL);
+	CHECK(directory.count == 0);
+}
+
+static void test_full_directory(void) {
+	uint8_t pin[USER_DIRECTORY_PIN_LENGTH];
+
+	user_directory_init(&directory, 0xCAFEU);
+	for (uint16_t i = 0; i < USER_DIRECTORY_MAX_USERS; i++) {
+		pin_of(i, pin);
+		CHECK(user_directory_add(&directory, pin, USER_ROLE_GUEST, i) == USER_DIRECTORY_OK);
+	}
+	pin_of(USER_DIRECTORY_MAX_USERS, pin);
+	CHECK(user_directory_add(&directory, pin, USER_ROLE_GUEST, 0) == USER_DIRECTORY_ERR_FULL);
+
+	// every other user is removed: the ones left must still be found, whatever cluster they were in
+	for (uint16_t i = 0; i < USER_DIRECTORY_MAX_USERS; i += 2) {
+		pin_of(i, pin);
+		CHECK(user_directory_remove(&directory, pin) == USER_DIRECTORY_OK);
+	}
+	for (uint16_t i = 0; i < USER_DIRECTORY_MAX_USERS; i++) {
+		pin_of(i, pin);
+		TUser *user = user_directory_find(&directory, pin);
+		if (i % 2 == 0) {
+			CHECK(user == NULL);
+		} else {
+			CHECK(user != NULL && user->zones == i);
+		}
+	}
+	CHECK(directory.count == USER_DIRECTORY_MAX_USERS / 2);
+}
+
+static void test_rights(void) {
+	TUser guest = { .digest = 1, .zones = USER_ZONE_BARRIER, .role = USER_ROLE_GUEST };
+	TUser user = { .digest = 2, .zones = USER_ZONE_AREA | USER_ZONE_BARRIER, .role = USER_ROLE_USER };
+	TUser admin = { .digest = 3, .zones = 0, .role = USER_ROLE_ADMIN };
+
+	CHECK(user_can_handle(&guest, USER_ZONE_BARRIER));
+	CHECK(!user_can_handle(&guest, USER_ZONE_AREA | USER_ZONE_BARRIER));
+	CHECK(!user_can_handle_system(&guest));
+	CHECK(user_can_handle(&user, USER_ZONE_AREA | USER_ZONE_BARRIER));
+	CHECK(user_can_handle_system(&user));
+	CHECK(user_can_handle(&admin, USER_ZONE_ALL));
+	CHECK(user_can_handle_system(&admin));
+}
+
+static void test_import(void) {
+	user_directory_init(&directory, 0xBEEFU);
+	MX_USART2_UART_Init();
+	console_init(&huart2);
+	shell_init(&shell, &huart2);
+	user_directory_register_commands(&directory, &shell);
+	shell_start(&shell);
+	board_set_uart_sink(collect, NULL);
+
+	type_line("userimport");
+	type_line("1111 admin ffff");
+	type_line("2222,user,1");
+	type_line("3333 root 1");
+	type_line("1111 guest 2");
+	type_line(".");
+	CHECK(strstr(output, "Imported 2 users, rejected 2") != NULL);
+
+	TUser *user = user_directory_find(&directory, (const uint8_t*) "2222");
+	CHECK(user != NULL && user->role == USER_ROLE_USER && user->zones == USER_ZONE_AREA);
+
+	// the lines go back to the commands after the dot
+	output_length = 0;
+	type_line("userdel 1111");
+	CHECK(strstr(output, "Done") != NULL);
+	CHECK(user_directory_find(&directory, (const uint8_t*) "1111") == NULL);
+}
+
+int main(void) {
+	board_init();
+
+	test_lookup();
+	test_full_directory();
+	test_rights();
+	test_import();
+
+	return host_test_result("user_directory_test");
+}
@@ -0,0 +1,180 @@
+/*
+ * This module decodes on the host the packets of the raw stream of the firmware, see raw_stream_decoder.h.
+ */
+
+#include <string.h>
+
+#include "raw_stream_decoder.h"
+
+/*
+ * @fn		static uint16_t raw_decoder_get16(const uint8_t *data)
+ * @brief	Reads a value little endian
+ */
+static uint16_t raw_decoder_get16(const uint8_t *data) {
+	return (uint16_t) (data[0] | (data[1] << 8));
+}
+
+/*
+ * @fn		static uint32_t raw_decoder_get32(const uint8_t *data)
+ * @brief	Reads a value little endian
+ */
+static uint32_t raw_decoder_get32(const uint8_t *data) {
+	return raw_decoder_get16(data) | ((uint32_t) raw_decoder_get16(&data[2]) << 16);
+}
+
+uint16_t raw_decoder_crc(const uint8_t *data, size_t length) {
+	uint16_t crc = 0xFFFFU;
+
+	for (size_t i = 0; i < length; i++) {
+		crc ^= (uint16_t) (data[i] << 8);
+		for (uint8_t bit = 0; bit < 8U; bit++) {
+			crc = (crc & 0x8000U) ? (uint16_t) ((crc << 1) ^ 0x1021U) : (uint16_t) (crc << 1);
+		}
+	}
+	return crc;
+}
+
+size_t raw_decoder_cobs(const uint8_t *frame, size_t length, uint8_t *decoded) {
+	size_t in = 0;
+	size_t out = 0;
+
+	while (in < length) {
+		uint8_t code = frame[in++];
+
+		// a code counts itself and the bytes up to the next zero, it is never zero inside a frame
+		if (code == 0 || in + code - 1U > length) {
+			return SIZE_MAX;
+		}
+		for (uint8_t i = 1; i < code; i++) {
+			decoded[out++] = frame[in++];
+		}
+		// the zero replaced by the code, unless it is the last code or the one after 254 bytes without zeros
+		if (code != 0xFFU && in < length) {
+			decoded[out++] = 0;
+		}
+	}
+	return out;
+}
+
+void raw_decoder_init(TRaw_decoder *decoder, TRaw_packet_handler handler, void *context) {
+	memset(decoder, 0, sizeof(TRaw_decoder));
+	decoder->handler = handler;
+	decoder->context = context;
+}
+
+/*
+ * @fn		static void raw_decoder_frame(TRaw_decoder *decoder)
+ * @brief	Decodes the frame completed by a zero, checks its CRC and its sequence number, and hands it to the handler
+ */
+static void raw_decoder_frame(TRaw_decoder *decoder) {
+	uint8_t packet[RAW_DECODER_MAX_FRAME];
+	size_t length;
+	TRaw_packet decoded;
+
+	if (decoder->frame_n > RAW_DECODER_MAX_FRAME) {
+		decoder->framing_errors++;
+		return;
+	}
+	length = raw_decoder_cobs(decoder->frame, decoder->frame_n, packet);
+	if (length == SIZE_MAX || length < RAW_DECODER_HEADER_SIZE + RAW_DECODER_CRC_SIZE
+			|| length > RAW_DECODER_MAX_PACKET) {
+		decoder->framing_errors++;
+		return;
+	}
+	length -= RAW_DECODER_CRC_SIZE;
+	if (raw_decoder_crc(packet, length) != raw_decoder_get16(&packet[length])) {
+		decoder->crc_errors++;
+		return;
+	}
+
+	decoded.type = packet[0];
+	decoded.info = packet[1];
+	decoded.sequence = raw_decoder_get16(&packet[2]);
+	decoded.tick = raw_decoder_get32(&packet[4]);
+	decoded.length = (uint16_t) (length - RAW_DECODER_HEADER_SIZE);
+	decoded.payload = &packet[RAW_DECODER_HEADER_SIZE];
+	// the packets dropped by the firmware and the ones with a wrong CRC are the gap in the sequence
+	decoded.lost = decoder->sequenced ? (uint16_t) (decoded.sequence - decoder->next_sequence) : 0;
+	decoder->lost += decoded.lost;
+	decoder->next_sequence = decoded.sequence + 1U;
+	decoder->sequenced = 1;
+	decoder->packets++;
+	if (decoder->handler != NULL) {
+		decoder->handler(&decoded, decoder->context);
+	}
+}
+
+void raw_decoder_feed(TRaw_decoder *decoder, const uint8_t *data, size_t size) {
+	decoder->bytes += size;
+	for (size_t i = 0; i < size; i++) {
+		if (data[i] == 0) {
+			// the bytes before the first zero are the end of something else
+			if (decoder->synced && decoder->frame_n != 0) {
+				raw_decoder_frame(decoder);
+			}
+			decoder->synced = 1;
+			decoder->frame_n = 0;
+		} else if (decoder->frame_n < RAW_DECODER_MAX_FRAME) {
+			decoder->frame[decoder->frame_n++] = data[i];
+		} else {
+			decoder->frame_n = RAW_DECODER_MAX_FRAME + 1U;
+		}
+	}
+}
+
+int raw_capture_open(TRaw_capture *capture, const char *path, uint32_t baud) {
+	TRaw_capture_header *header = &capture->header;
+
+	memset(header, 0, sizeof(TRaw_capture_header));
+	memcpy(header->magic, RAW_CAPTURE_MAGIC, sizeof(RAW_CAPTURE_MAGIC));
+	header->version = RAW_CAPTURE_VERSION;
+	header->header_size = RAW_CAPTURE_HEADER_SIZE;
+	header->record_size = RAW_CAPTURE_RECORD_SIZE;
+	header->baud = baud;
+	capture->file = fopen(path, "wb");
+	if (capture->file == NULL) {
+		return -1;
+	}
+	if (fwrite(header, sizeof(TRaw_capture_header), 1, capture->file) != 1) {
+		fclose(capture->file);
+		capture->file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int raw_capture_append(TRaw_capture *capture, const TRaw_packet *packet) {
+	TRaw_capture_record record;
+
+	memset(&record, 0, sizeof(record));
+	record.type = packet->type;
+	record.info = packet->info;
+	record.sequence = packet->sequence;
+	record.tick = packet->tick;
+	record.length = packet->length;
+	record.lost = packet->lost;
+	memcpy(record.payload, packet->payload, packet->length);
+	if (fwrite(&record, sizeof(record), 1, capture->file) != 1) {
+		return -1;
+	}
+	capture->header.records++;
+	return 0;
+}
+
+int raw_capture_close(TRaw_capture *capture, const TRaw_decoder *decoder) {
+	TRaw_capture_header *header = &capture->header;
+	int result = 0;
+
+	header->lost = decoder->lost;
+	header->crc_errors = decoder->crc_errors;
+	header->framing_errors = decoder->framing_errors;
+	header->bytes = decoder->bytes;
+	if (fseek(capture->file, 0, SEEK_SET) != 0 || fwrite(header, sizeof(TRaw_capture_header), 1, capture->file) != 1) {
+		result = -1;
+	}
+	if (fclose(capture->file) != 0) {
+		result = -1;
+	}
+	capture->file = NULL;
+	return result;
+}
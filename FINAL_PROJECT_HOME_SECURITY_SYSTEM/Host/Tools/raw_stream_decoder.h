@@ -0,0 +1,224 @@
+/*
+ * This module decodes on the host the packets of the raw stream of the firmware, see Core/Inc/raw_stream.h,
+ * and writes them to a capture file. It does not depend on the firmware, so the receiver runs without it.
+ * The bytes received are cut at every zero: each frame is COBS decoded, and its CRC-16/CCITT-FALSE is checked
+ * against the last two bytes. The bytes before the first zero are dropped, the firmware starts the stream with one.
+ * The packets lost on the way, dropped by the firmware for a full buffer or by the decoder for a wrong CRC,
+ * are counted from the gaps of the sequence numbers: more than 65535 packets lost in a row would go unseen.
+ * The capture file is made to be mapped in memory: a header of RAW_CAPTURE_HEADER_SIZE bytes, then the packets
+ * as records of RAW_CAPTURE_RECORD_SIZE bytes, both in the byte order of the host. The header is written again
+ * when the file is closed; if the receiver is killed, the records are the size of the file after the header
+ * divided by the size of a record.
+ */
+
+#ifndef RAW_STREAM_DECODER_H_
+#define RAW_STREAM_DECODER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Sizes of a packet before the encoding, as RAW_STREAM_HEADER_SIZE, RAW_STREAM_CRC_SIZE and RAW_STREAM_MAX_PAYLOAD */
+#define RAW_DECODER_HEADER_SIZE		(8U)
+#define RAW_DECODER_CRC_SIZE		(2U)
+#define RAW_DECODER_MAX_PAYLOAD		(512U)
+#define RAW_DECODER_MAX_PACKET		(RAW_DECODER_HEADER_SIZE + RAW_DECODER_MAX_PAYLOAD + RAW_DECODER_CRC_SIZE)
+
+/* Longest frame between two zeros: the largest packet with a code every 254 bytes */
+#define RAW_DECODER_MAX_FRAME		(RAW_DECODER_MAX_PACKET + RAW_DECODER_MAX_PACKET / 254U + 1U)
+
+/* Types of the packets, as RAW_STREAM_PACKET_ADC, RAW_STREAM_PACKET_PIR and RAW_STREAM_PACKET_STATS */
+enum {
+	RAW_DECODER_PACKET_ADC = 1,
+	RAW_DECODER_PACKET_PIR,
+	RAW_DECODER_PACKET_STATS
+};
+
+/* Bytes of the payload of the statistics, as RAW_STREAM_STATS_SIZE */
+#define RAW_DECODER_STATS_SIZE		(18U)
+
+/*
+ * @brief	A packet received.
+ * @param	type		one of RAW_DECODER_PACKET_ADC, RAW_DECODER_PACKET_PIR, RAW_DECODER_PACKET_STATS
+ * @param	info		the channels interleaved in the samples of an ADC packet, 0 otherwise
+ * @param	sequence	the sequence number given by the firmware
+ * @param	tick		the millisecond of the firmware when the packet has been made
+ * @param	length		bytes of the payload
+ * @param	lost		packets missing from the sequence right before this one
+ * @param	payload		the payload, little endian
+ */
+typedef struct {
+	uint8_t type;
+	uint8_t info;
+	uint16_t sequence;
+	uint32_t tick;
+	uint16_t length;
+	uint16_t lost;
+	const uint8_t *payload;
+} TRaw_packet;
+
+/*
+ * @brief	Called for every packet received with a good CRC
+ * @param	packet		the packet, valid only during the call
+ * @param	context		the context given to raw_decoder_init
+ */
+typedef void (*TRaw_packet_handler)(const TRaw_packet *packet, void *context);
+
+/*
+ * @brief	This struct represents the decoder of a stream.
+ * @param	handler			the function receiving the packets, and its context
+ * @param	frame			the bytes of the frame being received
+ * @param	frame_n			number of bytes of the frame, RAW_DECODER_MAX_FRAME + 1 once it is too long
+ * @param	synced			nonzero once the first zero has been received
+ * @param	sequenced		nonzero once a packet has been received, next_sequence is valid then
+ * @param	next_sequence	the sequence number expected for the next packet
+ * @param	packets			number of packets received with a good CRC
+ * @param	lost			number of packets missing from the sequence
+ * @param	crc_errors		number of frames with a wrong CRC
+ * @param	framing_errors	number of frames that are not a packet: too short, too long or badly encoded
+ * @param	bytes			number of bytes received
+ */
+typedef struct {
+	TRaw_packet_handler handler;
+	void *context;
+	uint8_t frame[RAW_DECODER_MAX_FRAME];
+	size_t frame_n;
+	int synced;
+	int sequenced;
+	uint16_t next_sequence;
+	uint64_t packets;
+	uint64_t lost;
+	uint64_t crc_errors;
+	uint64_t framing_errors;
+	uint64_t bytes;
+} TRaw_decoder;
+
+/* The start of a capture file, RAW_CAPTURE_MAGIC with its terminating zero, and its version */
+#define RAW_CAPTURE_MAGIC			"RAWSTRM"
+#define RAW_CAPTURE_VERSION			(1U)
+
+/*
+ * @brief	The header of a capture file.
+ * @param	magic			RAW_CAPTURE_MAGIC
+ * @param	version			RAW_CAPTURE_VERSION
+ * @param	header_size		bytes of the header, where the records start
+ * @param	record_size		bytes of a record
+ * @param	baud			the rate of the stream
+ * @param	records			number of records
+ * @param	lost			packets missing from the sequence
+ * @param	crc_errors		frames with a wrong CRC
+ * @param	framing_errors	frames that are not a packet
+ * @param	bytes			bytes received
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t baud;
+	uint64_t records;
+	uint64_t lost;
+	uint64_t crc_errors;
+	uint64_t framing_errors;
+	uint64_t bytes;
+} TRaw_capture_header;
+
+/*
+ * @brief	A record of a capture file, a packet with its payload padded to the largest one.
+ * @param	type		the type of the packet
+ * @param	info		the info of the packet
+ * @param	sequence	the sequence number of the packet
+ * @param	tick		the millisecond of the firmware when the packet has been made
+ * @param	length		bytes of the payload
+ * @param	lost		packets missing from the sequence right before this one
+ * @param	payload		the payload, little endian, followed by zeros
+ */
+typedef struct {
+	uint8_t type;
+	uint8_t info;
+	uint16_t sequence;
+	uint32_t tick;
+	uint16_t length;
+	uint16_t lost;
+	uint32_t reserved;
+	uint8_t payload[RAW_DECODER_MAX_PAYLOAD];
+} TRaw_capture_record;
+
+#define RAW_CAPTURE_HEADER_SIZE		(sizeof(TRaw_capture_header))
+#define RAW_CAPTURE_RECORD_SIZE		(sizeof(TRaw_capture_record))
+
+/*
+ * @brief	This struct represents a capture file being written.
+ * @param	file		the file
+ * @param	header		the header, written again when the file is closed
+ */
+typedef struct {
+	FILE *file;
+	TRaw_capture_header header;
+} TRaw_capture;
+
+/*
+ * @fn		uint16_t raw_decoder_crc(const uint8_t *data, size_t length)
+ * @brief	Computes the CRC-16/CCITT-FALSE of the data, a bit at a time: polynomial 0x1021, initial value 0xFFFF,
+ * 			no reflection and no final xor. The check value, of "123456789", is 0x29B1
+ * @retval	the CRC
+ */
+uint16_t raw_decoder_crc(const uint8_t *data, size_t length);
+
+/*
+ * @fn		size_t raw_decoder_cobs(const uint8_t *frame, size_t length, uint8_t *decoded)
+ * @brief	Decodes a COBS frame, without its terminating zero
+ * @param	frame		the frame
+ * @param	length		bytes of the frame
+ * @param	decoded		where the decoded bytes go, at least length bytes
+ * @retval	the number of bytes decoded, or SIZE_MAX if the frame is badly encoded
+ */
+size_t raw_decoder_cobs(const uint8_t *frame, size_t length, uint8_t *decoded);
+
+/*
+ * @fn		void raw_decoder_init(TRaw_decoder *decoder, TRaw_packet_handler handler, void *context)
+ * @brief	Initializes a decoder, waiting for the first zero
+ * @param	decoder		pointer to the TRaw_decoder structure to initialize
+ * @param	handler		the function receiving the packets
+ * @param	context		the context given to the handler
+ */
+void raw_decoder_init(TRaw_decoder *decoder, TRaw_packet_handler handler, void *context);
+
+/*
+ * @fn		void raw_decoder_feed(TRaw_decoder *decoder, const uint8_t *data, size_t size)
+ * @brief	Decodes the bytes received, calling the handler for every packet completed
+ * @param	decoder		pointer to the TRaw_decoder structure
+ * @param	data		the bytes
+ * @param	size		number of bytes
+ */
+void raw_decoder_feed(TRaw_decoder *decoder, const uint8_t *data, size_t size);
+
+/*
+ * @fn		int raw_capture_open(TRaw_capture *capture, const char *path, uint32_t baud)
+ * @brief	Creates a capture file, with an empty header
+ * @param	capture		pointer to the TRaw_capture structure to initialize
+ * @param	path		the path of the file, replaced if it exists
+ * @param	baud		the rate of the stream, written in the header
+ * @retval	0, or -1 if the file could not be written
+ */
+int raw_capture_open(TRaw_capture *capture, const char *path, uint32_t baud);
+
+/*
+ * @fn		int raw_capture_append(TRaw_capture *capture, const TRaw_packet *packet)
+ * @brief	Appends a packet to a capture file
+ * @param	capture		pointer to the TRaw_capture structure
+ * @param	packet		the packet
+ * @retval	0, or -1 if the file could not be written
+ */
+int raw_capture_append(TRaw_capture *capture, const TRaw_packet *packet);
+
+/*
+ * @fn		int raw_capture_close(TRaw_capture *capture, const TRaw_decoder *decoder)
+ * @brief	Writes the header again, with the records and the counters of the decoder, and closes the file
+ * @param	capture		pointer to the TRaw_capture structure
+ * @param	decoder		the decoder of the stream
+ * @retval	0, or -1 if the file could not be written
+ */
+int raw_capture_close(TRaw_capture *capture, const TRaw_decoder *decoder);
+
+#endif /* RAW_STREAM_DECODER_H_ */
@@ -0,0 +1,229 @@
+/*
+ * Receiver of the raw stream of the firmware, for the commissioning: it reads the packets from a serial port,
+ * checks them and writes them to a capture file, see raw_stream_decoder.h for its format.
+ * The stream is started from the console with "stream on [baud]"; the receiver opens the port at the rate of the
+ * stream, raw, and counts the packets, the losses and the errors, printing them with the statistics sent by the
+ * firmware. At the end, after the given seconds or at Ctrl-C, it sends "stream off" at the rate of the stream,
+ * so the firmware restores the console, and writes the totals in the header of the capture.
+ * Usage: raw_stream_receiver <device> <capture> [baud] [seconds]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "raw_stream_decoder.h"
+
+#define RECEIVER_DEFAULT_BAUD		(2000000UL)
+
+/* The rates of the termios of the host, the ones above 230400 are not everywhere */
+static const struct {
+	unsigned long baud;
+	speed_t speed;
+} speeds[] = {
+	{ 9600UL, B9600 }, { 19200UL, B19200 }, { 38400UL, B38400 }, { 57600UL, B57600 }, { 115200UL, B115200 },
+	{ 230400UL, B230400 },
+#ifdef B460800
+	{ 460800UL, B460800 },
+#endif
+#ifdef B921600
+	{ 921600UL, B921600 },
+#endif
+#ifdef B1000000
+	{ 1000000UL, B1000000 },
+#endif
+#ifdef B1500000
+	{ 1500000UL, B1500000 },
+#endif
+#ifdef B2000000
+	{ 2000000UL, B2000000 },
+#endif
+#ifdef B2500000
+	{ 2500000UL, B2500000 },
+#endif
+};
+
+#define RECEIVER_SPEEDS_N			(sizeof(speeds) / sizeof(speeds[0]))
+
+static volatile sig_atomic_t stopping;
+
+/*
+ * @brief	The state of the receiver.
+ * @param	capture		the capture file
+ * @param	failed		nonzero once the capture could not be written
+ */
+typedef struct {
+	TRaw_capture capture;
+	int failed;
+} TReceiver;
+
+static void receiver_interrupt(int signal) {
+	(void) signal;
+	stopping = 1;
+}
+
+/*
+ * @fn		static int receiver_open(const char *device, unsigned long baud)
+ * @brief	Opens the serial port raw, 8N1 without flow control, at the rate of the stream.
+ * 			A read returns what came in the last tenth of a second, nothing included
+ * @retval	the descriptor of the port, or -1
+ */
+static int receiver_open(const char *device, unsigned long baud) {
+	struct termios options;
+	speed_t speed = 0;
+	int port;
+
+	for (size_t i = 0; i < RECEIVER_SPEEDS_N; i++) {
+		if (speeds[i].baud == baud) {
+			speed = speeds[i].speed;
+		}
+	}
+	if (speed == 0) {
+		fprintf(stderr, "%lu baud is not supported by the termios of the host\n", baud);
+		return -1;
+	}
+
+	port = open(device, O_RDWR | O_NOCTTY);
+	if (port < 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(errno));
+		return -1;
+	}
+	if (tcgetattr(port, &options) != 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(errno));
+		close(port);
+		return -1;
+	}
+	cfmakeraw(&options);
+	options.c_cflag |= CLOCAL | CREAD;
+	options.c_cflag &= ~(CSTOPB | CRTSCTS);
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 1;
+	cfsetispeed(&options, speed);
+	cfsetospeed(&options, speed);
+	if (tcsetattr(port, TCSANOW, &options) != 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(errno));
+		close(port);
+		return -1;
+	}
+	tcflush(port, TCIOFLUSH);
+	return port;
+}
+
+/*
+ * @fn		static unsigned long receiver_get(const uint8_t *data, uint8_t size)
+ * @brief	Reads a value of some bytes, little endian
+ */
+static unsigned long receiver_get(const uint8_t *data, uint8_t size) {
+	unsigned long value = 0;
+
+	while (size-- > 0) {
+		value = (value << 8) | data[size];
+	}
+	return value;
+}
+
+/*
+ * @fn		static void receiver_print_stats(const TRaw_packet *packet, const TRaw_decoder *decoder)
+ * @brief	Prints the statistics sent by the firmware, see RAW_STREAM_PACKET_STATS, with the ones of the decoder
+ */
+static void receiver_print_stats(const TRaw_packet *packet, const TRaw_decoder *decoder) {
+	const uint8_t *stats = packet->payload;
+	unsigned long usage;
+
+	if (packet->length < RAW_DECODER_STATS_SIZE) {
+		return;
+	}
+	usage = receiver_get(&stats[12], 2);
+	fprintf(stderr, "[%lu ms] board: %lu packets, %lu dropped, %lu bytes, UART %lu.%lu%%, %lu ADC overruns;"
+			" received: %llu packets, %llu lost, %llu CRC errors, %llu framing errors\n", (unsigned long) packet->tick,
+			receiver_get(&stats[0], 4), receiver_get(&stats[4], 4), receiver_get(&stats[8], 4), usage / 10U,
+			usage % 10U, receiver_get(&stats[14], 4),
+			(unsigned long long) decoder->packets, (unsigned long long) decoder->lost,
+			(unsigned long long) decoder->crc_errors, (unsigned long long) decoder->framing_errors);
+}
+
+static TRaw_decoder decoder;
+
+static void receiver_packet(const TRaw_packet *packet, void *context) {
+	TReceiver *receiver = context;
+
+	if (!receiver->failed && raw_capture_append(&receiver->capture, packet) != 0) {
+		fprintf(stderr, "the capture could not be written: %s\n", strerror(errno));
+		receiver->failed = 1;
+	}
+	if (packet->type == RAW_DECODER_PACKET_STATS) {
+		receiver_print_stats(packet, &decoder);
+	}
+}
+
+int main(int argc, char **argv) {
+	static const char stop_command[] = "stream off\r";
+	TReceiver receiver = { 0 };
+	unsigned long baud = (argc > 3) ? strtoul(argv[3], NULL, 10) : RECEIVER_DEFAULT_BAUD;
+	unsigned long seconds = (argc > 4) ? strtoul(argv[4], NULL, 10) : 0;
+	time_t start = time(NULL);
+	uint8_t data[4096];
+	int port;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: raw_stream_receiver <device> <capture> [baud] [seconds]\n");
+		return 2;
+	}
+	port = receiver_open(argv[1], baud);
+	if (port < 0) {
+		return 1;
+	}
+	if (raw_capture_open(&receiver.capture, argv[2], (uint32_t) baud) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		close(port);
+		return 1;
+	}
+	raw_decoder_init(&decoder, receiver_packet, &receiver);
+	signal(SIGINT, receiver_interrupt);
+	signal(SIGTERM, receiver_interrupt);
+
+	while (!stopping && !receiver.failed && (seconds == 0 || (unsigned long) (time(NULL) - start) < seconds)) {
+		ssize_t n = read(port, data, sizeof(data));
+
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+			break;
+		}
+		if (n > 0) {
+			raw_decoder_feed(&decoder, data, (size_t) n);
+		}
+	}
+
+	// the firmware sends its last packets before the console comes back: they end the capture
+	if (write(port, stop_command, sizeof(stop_command) - 1U) < 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+	}
+	tcdrain(port);
+	for (int i = 0; i < 5; i++) {
+		ssize_t n = read(port, data, sizeof(data));
+
+		if (n > 0) {
+			raw_decoder_feed(&decoder, data, (size_t) n);
+		}
+	}
+	close(port);
+
+	if (raw_capture_close(&receiver.capture, &decoder) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		receiver.failed = 1;
+	}
+	printf("%llu bytes, %llu packets, %llu lost, %llu CRC errors, %llu framing errors, %llu records in %s\n",
+			(unsigned long long) decoder.bytes, (unsigned long long) decoder.packets,
+			(unsigned long long) decoder.lost, (unsigned long long) decoder.crc_errors,
+			(unsigned long long) decoder.framing_errors, (unsigned long long) receiver.capture.header.records,
+			argv[2]);
+	return receiver.failed ? 1 : 0;
+}